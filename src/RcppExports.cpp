@@ -147,6 +147,15 @@ BEGIN_RCPP
     return R_NilValue;
 END_RCPP
 }
+// gdal_cleanup
+void gdal_cleanup();
+RcppExport SEXP _terra_gdal_cleanup() {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    gdal_cleanup();
+    return R_NilValue;
+END_RCPP
+}
 // percRank
 std::vector<double> percRank(std::vector<double> x, std::vector<double> y, double minc, double maxc, int tail);
 RcppExport SEXP _terra_percRank(SEXP xSEXP, SEXP ySEXP, SEXP mincSEXP, SEXP maxcSEXP, SEXP tailSEXP) {
@@ -162,6 +171,33 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// simd_bench
+Rcpp::DataFrame simd_bench(double n, int reps);
+RcppExport SEXP _terra_simd_bench(SEXP nSEXP, SEXP repsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< double >::type n(nSEXP);
+    Rcpp::traits::input_parameter< int >::type reps(repsSEXP);
+    rcpp_result_gen = Rcpp::wrap(simd_bench(n, reps));
+    return rcpp_result_gen;
+END_RCPP
+}
+// chunkcache_test
+Rcpp::List chunkcache_test(std::vector<double> size, std::vector<double> chunk, double maxbytes, std::vector<double> start, std::vector<double> count);
+RcppExport SEXP _terra_chunkcache_test(SEXP sizeSEXP, SEXP chunkSEXP, SEXP maxbytesSEXP, SEXP startSEXP, SEXP countSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::vector<double> >::type size(sizeSEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type chunk(chunkSEXP);
+    Rcpp::traits::input_parameter< double >::type maxbytes(maxbytesSEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type start(startSEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type count(countSEXP);
+    rcpp_result_gen = Rcpp::wrap(chunkcache_test(size, chunk, maxbytes, start, count));
+    return rcpp_result_gen;
+END_RCPP
+}
 
 RcppExport SEXP _rcpp_module_boot_spat();
 
@@ -179,7 +215,10 @@ static const R_CallMethodDef CallEntries[] = {
     {"_terra_gdal_drivers", (DL_FUNC) &_terra_gdal_drivers, 0},
     {"_terra_set_gdal_warnings", (DL_FUNC) &_terra_set_gdal_warnings, 1},
     {"_terra_gdal_init", (DL_FUNC) &_terra_gdal_init, 1},
+    {"_terra_gdal_cleanup", (DL_FUNC) &_terra_gdal_cleanup, 0},
     {"_terra_percRank", (DL_FUNC) &_terra_percRank, 5},
+    {"_terra_simd_bench", (DL_FUNC) &_terra_simd_bench, 2},
+    {"_terra_chunkcache_test", (DL_FUNC) &_terra_chunkcache_test, 5},
     {"_rcpp_module_boot_spat", (DL_FUNC) &_rcpp_module_boot_spat, 0},
     {NULL, NULL, 0}
 };
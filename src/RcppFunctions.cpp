@@ -1,10 +1,13 @@
 #include <Rcpp.h>
 //#include "spatRaster.h"
 #include "spatRasterMultiple.h"
+#include "spatSIMD.h"
+#include "spatChunkCache.h"
 
 //#include <memory> //std::addressof
 #include "gdal_priv.h"
 #include "gdalio.h"
+#include "crs.h"
 #include "ogr_spatialref.h"
 
 
@@ -270,6 +273,11 @@ void gdal_init(std::string path) {
 #endif
 }
 
+// [[Rcpp::export(name = ".gdalcleanup")]]
+void gdal_cleanup() {
+	ct_clear();
+}
+
 // [[Rcpp::export(name = ".precRank")]]
 std::vector<double> percRank(std::vector<double> x, std::vector<double> y, double minc, double maxc, int tail) {
 					
@@ -321,3 +329,64 @@ std::vector<double> percRank(std::vector<double> x, std::vector<double> y, doubl
 }
 
 
+// cells per second of the SIMD kernels, and of their scalar versions
+// [[Rcpp::export(name = ".simd_benchmark")]]
+Rcpp::DataFrame simd_bench(double n = 1000000, int reps = 10) {
+	std::vector<std::string> kernel;
+	std::vector<double> scalar, simd;
+	simd_benchmark(n, reps, kernel, scalar, simd);
+	std::vector<std::string> level(kernel.size(), simd_level());
+	return Rcpp::DataFrame::create(
+		Rcpp::Named("kernel") = kernel, 
+		Rcpp::Named("scalar") = scalar, 
+		Rcpp::Named("simd") = simd, 
+		Rcpp::Named("level") = level, 
+		Rcpp::Named("stringsAsFactors") = false);
+}
+
+
+// reads hyperslabs (nd values of "start" and "count" for each) through a
+// SpatChunkCache of an array with the row-major cell numbers as values. 
+// Returns the values of each request, and the number of chunks read after it
+// [[Rcpp::export(name = ".chunkcache_test")]]
+Rcpp::List chunkcache_test(std::vector<double> size, std::vector<double> chunk, double maxbytes, std::vector<double> start, std::vector<double> count) {
+	size_t nd = size.size();
+	std::vector<size_t> dsize(size.begin(), size.end());
+	SpatSlabReader reader = [dsize, nd](const std::vector<size_t> &st, const std::vector<size_t> &cn, std::vector<double> &buf) {
+		std::vector<size_t> idx = st;
+		for (size_t k=0; k<buf.size(); k++) {
+			double cell = 0;
+			for (size_t i=0; i<nd; i++) {
+				cell = cell * dsize[i] + idx[i];
+			}
+			buf[k] = cell;
+			for (size_t i=nd; i>0; i--) {
+				idx[i-1]++;
+				if (idx[i-1] < (st[i-1] + cn[i-1])) break;
+				idx[i-1] = st[i-1];
+			}
+		}
+		return true;
+	};
+	SpatChunkCache cache(dsize, std::vector<size_t>(chunk.begin(), chunk.end()), maxbytes, reader);
+	size_t nreq = nd == 0 ? 0 : start.size() / nd;
+	Rcpp::List values(nreq);
+	std::vector<double> nread(nreq);
+	for (size_t r=0; r<nreq; r++) {
+		std::vector<size_t> st(start.begin() + r*nd, start.begin() + (r+1)*nd);
+		std::vector<size_t> cn(count.begin() + r*nd, count.begin() + (r+1)*nd);
+		std::vector<size_t> stride(nd, 1);
+		size_t n = 1;
+		for (size_t i=nd; i>0; i--) {
+			stride[i-1] = n;
+			n *= cn[i-1];
+		}
+		std::vector<double> out(n, NAN);
+		if (!cache.read(st, cn, stride, out.data())) {
+			Rcpp::stop("invalid request");
+		}
+		values[r] = out;
+		nread[r] = cache.nread;
+	}
+	return Rcpp::List::create(Rcpp::Named("values") = values, Rcpp::Named("nread") = nread);
+}
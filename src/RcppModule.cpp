@@ -2,6 +2,7 @@
 //#include "spatRaster.h"
 #include "spatRasterMultiple.h"
 #include <memory> //std::addressof
+#include "NA.h"
 
 
 //void SpatRaster_finalizer( SpatRaster* ptr ){
@@ -36,9 +37,11 @@ Rcpp::List getDataFrame(SpatDataFrame* v) {
 		if (itype[i] == 0) {
 			out[i] = v->getD(i);
 		} else if (itype[i] == 1) {
-			Rcpp::NumericVector iv = Rcpp::wrap(v->getI(i));
+			std::vector<long> lv = v->getI(i);
+			Rcpp::NumericVector iv = Rcpp::wrap(lv);
+			long longNA = NA<long>::value;
 			for (R_xlen_t j=0; j<iv.size(); j++) {
-				if (iv[j] == -2147483648) {
+				if ((lv[j] == longNA) || (lv[j] == -2147483648)) {
 					iv[j] = NA_REAL;
 				}
 			}
@@ -163,6 +166,7 @@ RCPP_MODULE(spat){
 		.method("deepcopy", &SpatOptions::deepCopy, "deepCopy")
 		.property("tempdir", &SpatOptions::get_tempdir, &SpatOptions::set_tempdir )
 		.property("memfrac", &SpatOptions::get_memfrac, &SpatOptions::set_memfrac )
+		.property("memmax", &SpatOptions::get_memmax, &SpatOptions::set_memmax )
 		.property("filenames", &SpatOptions::get_filenames, &SpatOptions::set_filenames )
 		.property("filetype", &SpatOptions::get_filetype, &SpatOptions::set_filetype )
 		.property("datatype", &SpatOptions::get_datatype, &SpatOptions::set_datatype )
@@ -174,6 +178,7 @@ RCPP_MODULE(spat){
 		.field("datatype_set", &SpatOptions::datatype_set)
 		.property("progress", &SpatOptions::get_progress, &SpatOptions::set_progress)
 		.property("ncopies", &SpatOptions::get_ncopies, &SpatOptions::set_ncopies, "ncopies")
+		.property("threads", &SpatOptions::get_threads, &SpatOptions::set_threads, "threads")
 
 		.property("def_filetype", &SpatOptions::get_def_filetype, &SpatOptions::set_def_filetype )
 		.property("def_datatype", &SpatOptions::get_def_datatype, &SpatOptions::set_def_datatype )
@@ -318,7 +323,7 @@ RCPP_MODULE(spat){
 		.property("names", &SpatVector::get_names, &SpatVector::set_names)
 		.method("nrow", &SpatVector::nrow, "nrow")
 		.method("ncol", &SpatVector::ncol, "ncol")
-		.method("project", &SpatVector::project, "project")
+		.method("project", (SpatVector (SpatVector::*)(std::string, SpatOptions&))( &SpatVector::project), "project")
 		.method("read", &SpatVector::read, "read")
 		.method("setGeometry", &SpatVector::setGeometry, "setGeometry")
 		.method("size", &SpatVector::size, "size")
@@ -363,7 +368,9 @@ RCPP_MODULE(spat){
 		.method("clearance", &SpatVector::clearance)
 
 		.method("relate_first", &SpatVector::relateFirst)
+		.method("relate_pairs", &SpatVector::relatePairs)
 		.method("relate_between", ( std::vector<int> (SpatVector::*)(SpatVector, std::string))( &SpatVector::relate ))
+		.method("geos_cache", &SpatVector::geos_cache)
 		.method("relate_within", ( std::vector<int> (SpatVector::*)(std::string, bool))( &SpatVector::relate ))
 		.method("crop_ext", ( SpatVector (SpatVector::*)(SpatExtent))( &SpatVector::crop ))
 		.method("crop_vct", ( SpatVector (SpatVector::*)(SpatVector))( &SpatVector::crop ))
@@ -547,12 +554,12 @@ RCPP_MODULE(spat){
 		.method("setValues", &SpatRaster::setValues)
 		//.method("replaceValues", &SpatRaster::replace)
 		.method("setRange", &SpatRaster::setRange, "setRange")
-		.method("writeStart", &SpatRaster::writeStart, "writeStart") 
+		.method("writeStart", (bool (SpatRaster::*)(SpatOptions&))( &SpatRaster::writeStart), "writeStart") 
 		.method("writeStop", &SpatRaster::writeStop, "writeStop") 
 		.method("writeValues", &SpatRaster::writeValues, "writeValues") 
 		.method("writeRaster", &SpatRaster::writeRaster, "writeRaster")
 		.method("canProcessInMemory", &SpatRaster::canProcessInMemory, "canProcessInMemory")
-		.method("chunkSize", &SpatRaster::chunkSize, "chunkSize")
+		.method("chunkSize", (size_t (SpatRaster::*)(SpatOptions&))( &SpatRaster::chunkSize), "chunkSize")
 		.method("to_memory", &SpatRaster::to_memory, "to_memory")
 
 		.method("adjacentMat", &SpatRaster::adjacentMat, "adjacent with matrix")
@@ -563,6 +570,7 @@ RCPP_MODULE(spat){
 		.method("rapply", &SpatRaster::rapply, "rapply")
 		.method("rappvals", &SpatRaster::rappvals, "rappvals")
 		.method("arith_rast", ( SpatRaster (SpatRaster::*)(SpatRaster, std::string, SpatOptions&) )( &SpatRaster::arith ))
+		.method("expression", &SpatRaster::expression, "expression")
 		.method("arith_numb", ( SpatRaster (SpatRaster::*)(std::vector<double>, std::string, bool, SpatOptions&) )( &SpatRaster::arith ))
 		.method("rst_area", &SpatRaster::rst_area, "rst_area")
 		.method("sum_area", &SpatRaster::sum_area, "sum_area")
@@ -578,6 +586,7 @@ RCPP_MODULE(spat){
 		.method("bilinearValues", &SpatRaster::bilinearValues, "bilin")
 
 		.method("patches", &SpatRaster::clumps, "patches")
+		.method("patch_stats", &SpatRaster::patchStats, "patch_stats")
 		.method("boundaries", &SpatRaster::edges, "edges")
 		.method("buffer", &SpatRaster::buffer, "buffer")
 		.method("gridDistance", &SpatRaster::gridDistance, "gridDistance")
@@ -649,6 +658,7 @@ RCPP_MODULE(spat){
 		.method("trig", &SpatRaster::trig, "trig")
 		.method("trim", &SpatRaster::trim, "trim")
 		.method("unique", &SpatRaster::unique, "unique")
+		.method("crosstab", &SpatRaster::crosstab, "crosstab")
 		.method("sieve", &SpatRaster::sievefilter, "sievefilter")
 
 		.method("rectify", &SpatRaster::rectify, "rectify")
@@ -20,6 +20,7 @@
 #include "recycle.h"
 #include "math_utils.h"
 #include "vecmath.h"
+#include "spatSIMD.h"
 //#include "modal.h"
 
 /*
@@ -65,74 +66,38 @@ void operator%(std::vector<double>& a, const std::vector<double>& b) {
 //template <typename T>
 void operator==(std::vector<double>& a, const std::vector<double>& b) {
 //    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::equal_to<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = a[i] == b[i];
-		}
-	}
+	simd_compare(a.data(), b.data(), a.size(), SIMD_EQ);
 }
 
 //template <typename T>
 void operator!=(std::vector<double>& a, const std::vector<double>& b) {
 //    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::not_equal_to<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = a[i] != b[i];
-		}
-	}
+	simd_compare(a.data(), b.data(), a.size(), SIMD_NE);
 }
 
 //template <typename T>
 void operator>=(std::vector<double>& a, const std::vector<double>& b) {
 //    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::greater_equal<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = a[i] >= b[i];
-		}
-	}
+	simd_compare(a.data(), b.data(), a.size(), SIMD_GE);
 }
 
 //template <typename T>
 void operator<=(std::vector<double>& a, const std::vector<double>& b) {
 //    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::less_equal<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = a[i] <= b[i];
-		}
-	}
+	simd_compare(a.data(), b.data(), a.size(), SIMD_LE);
  }
 
 
 //template <typename T>
 void operator>(std::vector<double>& a, const std::vector<double>& b) {
 //    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::greater<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = a[i] > b[i];
-		}
-	}
+	simd_compare(a.data(), b.data(), a.size(), SIMD_GT);
 }
 
 //template <typename T>
 void operator<(std::vector<double>& a, const std::vector<double>& b) {
 //    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::less<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = a[i] < b[i];
-		}
-	}
+	simd_compare(a.data(), b.data(), a.size(), SIMD_LT);
 }
 
 
@@ -182,15 +147,32 @@ SpatRaster SpatRaster::arith(SpatRaster x, std::string oper, SpatOptions &opt) {
 		out.setError(x.getError());
 		return(out);
 	}
- 	if (!out.writeStart(opt)) {
+	BlockLayout layout;
+	layout.threaded = true;
+	layout.tiles = true;
+ 	if (!out.writeStart(opt, layout)) {
 		readStop();
 		x.readStop();
 		return out;
 	}
 
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a = readBlock(out.bs, i);
-		std::vector<double> b = x.readBlock(out.bs, i);
+	BlockReader reader = [&](size_t i, std::vector<std::vector<double>> &d) {
+		d.resize(2);
+		d[0] = readBlock(out.bs, i);
+		d[1] = x.readBlock(out.bs, i);
+		if (hasError()) {
+			out.setError(getError());
+			return false;
+		}
+		if (x.hasError()) {
+			out.setError(x.getError());
+			return false;
+		}
+		return true;
+	};
+	BlockWorker worker = [oper](size_t i, std::vector<std::vector<double>> &d) {
+		std::vector<double> &a = d[0];
+		std::vector<double> &b = d[1];
 		recycle(a,b);
 		if (oper == "+") {
 			std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::plus<double>());
@@ -217,8 +199,11 @@ SpatRaster SpatRaster::arith(SpatRaster x, std::string oper, SpatOptions &opt) {
 		} else if (oper == "<") {
 			a < b;
 		}
-		if (!out.writeValues(a, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;
-
+	};
+	if (!out.writeBlocks(reader, worker, opt)) {
+		readStop();
+		x.readStop();
+		return out;
 	}
 	out.writeStop();
 	readStop();
@@ -245,13 +230,25 @@ SpatRaster SpatRaster::arith(double x, std::string oper, bool reverse, SpatOptio
 		return(out);
 	}
 
-  	if (!out.writeStart(opt)) {
+	BlockLayout layout;
+	layout.threaded = true;
+	layout.tiles = true;
+  	if (!out.writeStart(opt, layout)) {
 		readStop();
 		return out;
 	}
 
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a = readBlock(out.bs, i);
+	BlockReader reader = [&](size_t i, std::vector<std::vector<double>> &d) {
+		d.resize(1);
+		d[0] = readBlock(out.bs, i);
+		if (hasError()) {
+			out.setError(getError());
+			return false;
+		}
+		return true;
+	};
+	BlockWorker worker = [x, oper, reverse](size_t i, std::vector<std::vector<double>> &d) {
+		std::vector<double> &a = d[0];
 		if (std::isnan(x)) {
 			for(double& d : a)  d = NAN;
 		} else if (oper == "+") {
@@ -279,46 +276,23 @@ SpatRaster SpatRaster::arith(double x, std::string oper, bool reverse, SpatOptio
 			}
 		} else if (oper == "%") {
 			if (reverse) {
-				for (size_t i=0; i<a.size(); i++) {
-					a[i] = std::fmod(x, a[i]);
+				for (size_t j=0; j<a.size(); j++) {
+					a[j] = std::fmod(x, a[j]);
 				}
 			} else {
-				for (size_t i=0; i<a.size(); i++) {
-					a[i] = std::fmod(a[i], x);
+				for (size_t j=0; j<a.size(); j++) {
+					a[j] = std::fmod(a[j], x);
 				}
 			}
-		} else if (oper == "==") {
-			for(double& d : a) if (!std::isnan(d)) d = d == x;
-		} else if (oper == "!=") {
-			for(double& d : a) if (!std::isnan(d)) d = d != x;
-		} else if (oper == ">=") {
-			if (reverse) {
-				for(double& d : a) if (!std::isnan(d)) d = x >= d;
-			} else {
-				for(double& d : a) if (!std::isnan(d)) d = d >= x;
-			}
-		} else if (oper == "<=") {
-			if (reverse) {
-				for(double& d : a) if (!std::isnan(d)) d = x <= d;			
-			} else {
-				for(double& d : a) if (!std::isnan(d)) d = d <= x;
-			}
-		} else if (oper == ">") {
-			if (reverse) {
-				for(double& d : a) if (!std::isnan(d)) d = x > d;			
-			} else {
-				for(double& d : a) if (!std::isnan(d)) d = d > x;
-			}
-		} else if (oper == "<") {
-			if (reverse) {
-				for(double& d : a) if (!std::isnan(d)) d = x < d;			
-			} else {
-				for(double& d : a) if (!std::isnan(d)) d = d < x;
-			}
+		} else if (simd_cmp_code(oper) >= 0) {
+			simd_compare_scalar(a.data(), x, a.size(), simd_cmp_code(oper), reverse);
 		} else {
 			// stop
 		}
-		if (!out.writeValues(a, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;
+	};
+	if (!out.writeBlocks(reader, worker, opt)) {
+		readStop();
+		return out;
 	}
 	out.writeStop();
 	readStop();
@@ -355,19 +329,31 @@ SpatRaster SpatRaster::arith(std::vector<double> x, std::string oper, bool rever
 	}
 
 	
-  	if (!out.writeStart(opt)) {
+	BlockLayout layout;
+	layout.threaded = true;
+	layout.tiles = true;
+  	if (!out.writeStart(opt, layout)) {
 		readStop();
 		return out;
 	}
 
 	unsigned nl = nlyr();
-	unsigned nc = ncol();
 	recycle(x, nlyr());
 
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> v = readBlock(out.bs, i);
+	BlockReader reader = [&](size_t i, std::vector<std::vector<double>> &d) {
+		d.resize(1);
+		d[0] = readBlock(out.bs, i);
+		if (hasError()) {
+			out.setError(getError());
+			return false;
+		}
+		return true;
+	};
+	BlockWorker worker = [&x, &oper, reverse, nl](size_t i, std::vector<std::vector<double>> &d) {
+		std::vector<double> &v = d[0];
 		std::vector<double> vv;
-		unsigned off = out.bs.nrows[i] * nc;
+		vv.reserve(v.size());
+		unsigned off = v.size() / nl;
 		for (size_t j=0; j<nl; j++) {
 			unsigned s = j * off;
 			std::vector<double> a(v.begin()+s, v.begin()+s+off);
@@ -405,40 +391,18 @@ SpatRaster SpatRaster::arith(std::vector<double> x, std::string oper, bool rever
 						a[k] = std::fmod(a[k], x[j]);
 					}
 				}
-			} else if (oper == "==") {
-				for(double& d : a) if (!std::isnan(d)) d = d == x[j];
-			} else if (oper == "!=") {
-				for(double& d : a) if (!std::isnan(d)) d = d != x[j];
-			} else if (oper == ">=") {
-				if (reverse) {
-					for(double& d : a) if (!std::isnan(d)) d = x[j] >= d;			
-				} else {
-					for(double& d : a) if (!std::isnan(d)) d = d >= x[j];
-				}
-			} else if (oper == "<=") {
-				if (reverse) {
-					for(double& d : a) if (!std::isnan(d)) d = x[j] <= d;			
-				} else {
-					for(double& d : a) if (!std::isnan(d)) d = d <= x[j];
-				}
-			} else if (oper == ">") {
-				if (reverse) {
-					for(double& d : a) if (!std::isnan(d)) d = x[j] > d;			
-				} else {
-					for(double& d : a) if (!std::isnan(d)) d = d > x[j];
-				}
-			} else if (oper == "<") {
-				if (reverse) {
-					for(double& d : a) if (!std::isnan(d)) d = x[j] < d;			
-				} else {
-					for(double& d : a) if (!std::isnan(d)) d = d < x[j];
-				}
+			} else if (simd_cmp_code(oper) >= 0) {
+				simd_compare_scalar(a.data(), x[j], a.size(), simd_cmp_code(oper), reverse);
 			} else {
 				// stop
 			}
 			vv.insert(vv.end(), a.begin(), a.end());
 		}
-		if (!out.writeValues(vv, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;
+		v.swap(vv);
+	};
+	if (!out.writeBlocks(reader, worker, opt)) {
+		readStop();
+		return out;
 	}
 	out.writeStop();
 	readStop();
@@ -502,14 +466,28 @@ SpatRaster SpatRaster::math(std::string fun, SpatOptions &opt) {
 	}
 
 	
-  	if (!out.writeStart(opt)) {
+	BlockLayout layout;
+	layout.threaded = true;
+	layout.tiles = true;
+  	if (!out.writeStart(opt, layout)) {
 		readStop();
 		return out;
 	}
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a = readBlock(out.bs, i);
-		for(double& d : a) if (!std::isnan(d)) d = mathFun(d);
-		if (!out.writeValues(a, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;	
+	BlockReader reader = [&](size_t i, std::vector<std::vector<double>> &d) {
+		d.resize(1);
+		d[0] = readBlock(out.bs, i);
+		if (hasError()) {
+			out.setError(getError());
+			return false;
+		}
+		return true;
+	};
+	BlockWorker worker = [mathFun](size_t i, std::vector<std::vector<double>> &d) {
+		for(double& v : d[0]) if (!std::isnan(v)) v = mathFun(v);
+	};
+	if (!out.writeBlocks(reader, worker, opt)) {
+		readStop();
+		return out;
 	}
 	out.writeStop();
 	readStop();
@@ -903,17 +881,28 @@ SpatRaster SpatRaster::summary_numb(std::string fun, std::vector<double> add, bo
 	}
 
 
-	if (!out.writeStart(opt)) {
+	BlockLayout layout;
+	layout.threaded = true;
+	layout.tiles = true;
+	if (!out.writeStart(opt, layout)) {
 		readStop();
 		return out;
 	}
 	unsigned nl = nlyr();
-	std::vector<double> v(nl);
-	if (add.size() > 0) v.insert( v.end(), add.begin(), add.end() );
-
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a = readBlock(out.bs, i);
-		unsigned nc = out.bs.nrows[i] * out.ncol();
+	BlockReader reader = [&](size_t i, std::vector<std::vector<double>> &d) {
+		d.resize(1);
+		d[0] = readBlock(out.bs, i);
+		if (hasError()) {
+			out.setError(getError());
+			return false;
+		}
+		return true;
+	};
+	BlockWorker worker = [&add, sumFun, narm, nl](size_t i, std::vector<std::vector<double>> &d) {
+		std::vector<double> &a = d[0];
+		std::vector<double> v(nl);
+		if (add.size() > 0) v.insert( v.end(), add.begin(), add.end() );
+		unsigned nc = a.size() / nl;
 		std::vector<double> b(nc);
 		for (size_t j=0; j<nc; j++) {
 			for (size_t k=0; k<nl; k++) {
@@ -921,8 +910,11 @@ SpatRaster SpatRaster::summary_numb(std::string fun, std::vector<double> add, bo
 			}
 			b[j] = sumFun(v, narm);
 		}
-		if (!out.writeValues(b, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;
-
+		a.swap(b);
+	};
+	if (!out.writeBlocks(reader, worker, opt)) {
+		readStop();
+		return out;
 	}
 	out.writeStop();
 	readStop();
@@ -0,0 +1,245 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include "spatAsync.h"
+#include <system_error>
+
+#ifdef useGDAL
+#include "cpl_error.h"
+
+void __err_collect(CPLErr eErrClass, int err_no, const char *msg) {
+	SpatMessages *m = (SpatMessages *) CPLGetErrorHandlerUserData();
+	if ((m == NULL) || (eErrClass < CE_Warning)) return;
+	if (eErrClass == CE_Warning) {
+		m->addWarning(std::string(msg) + " (GDAL " + std::to_string(err_no) + ")");
+	} else if (!m->has_error) {
+		m->setError(std::string(msg) + " (GDAL error " + std::to_string(err_no) + ")");
+	}
+}
+
+
+static SpatMessages write_task(GDALDataset *ds, const std::vector<double> &v, const std::string &datatype, size_t startrow, size_t nrows, size_t startcol, size_t ncols, size_t nl) {
+	SpatMessages m;
+	CPLPushErrorHandlerEx((CPLErrorHandler)__err_collect, &m);
+	SpatMessages w = writeBlockGDAL(ds, v, datatype, startrow, nrows, startcol, ncols, nl);
+	CPLPopErrorHandler();
+	for (size_t i=0; i<m.warnings.size(); i++) {
+		w.addWarning(m.warnings[i]);
+	}
+	if (m.has_error && !w.has_error) {
+		w.setError(m.getError());
+	}
+	return w;
+}
+#endif
+
+
+SpatAsyncWrite::~SpatAsyncWrite() {
+	if (worker.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stop = true;
+		}
+		cv.notify_all();
+		worker.join();
+	}
+}
+
+
+void SpatAsyncWrite::run() {
+	while (true) {
+		std::function<SpatMessages()> t;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [&]{ return stop || has_task; });
+			if (!has_task) return;
+			t.swap(task);
+		}
+		SpatMessages m = t();
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			result = m;
+			has_task = false;
+		}
+		cv.notify_all();
+	}
+}
+
+
+void SpatAsyncWrite::submit(std::function<SpatMessages()> t) {
+	if (!worker.joinable()) {
+		worker = std::thread(&SpatAsyncWrite::run, this);
+	}
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [&]{ return !has_task; });
+		task.swap(t);
+		has_task = true;
+	}
+	pending = true;
+	cv.notify_all();
+}
+
+
+SpatMessages SpatAsyncWrite::wait() {
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [&]{ return !has_task; });
+	pending = false;
+	SpatMessages m = result;
+	result = SpatMessages();
+	return m;
+}
+
+
+// only file based sources are read ahead; reading from memory is fast
+bool SpatRaster::prefetchable() {
+#ifdef useGDAL
+	if (!hasValues()) return false;
+	for (size_t i=0; i<nsrc(); i++) {
+		if (source[i].memory || source[i].multidim || source[i].scratch || source[i].rotated) {
+			return false;
+		}
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+void SpatRaster::prefetchStart(size_t row, size_t nrows, size_t col, size_t ncols) {
+	if (!prefetch) return;
+	prefetchStop();
+#ifdef useGDAL
+	// the background thread only gets the datasets and the windows to read
+	std::vector<SpatAsyncWindow> w(nsrc());
+	for (size_t i=0; i<nsrc(); i++) {
+		if (!source[i].open_read) return;
+		w[i] = gdalWindow(i, row, col);
+	}
+	try {
+		prefetch->chunk = std::async(std::launch::async, [w, nrows, ncols]() -> SpatAsyncChunk {
+			SpatAsyncChunk out;
+			out.values.resize(w.size());
+			CPLPushErrorHandlerEx((CPLErrorHandler)__err_collect, &out.msg);
+			for (size_t i=0; i<w.size(); i++) {
+				if (read_window_gdal(w[i], nrows, ncols, out.values[i]) != CE_None) {
+					if (!out.msg.has_error) out.msg.setError("cannot read values");
+					break;
+				}
+			}
+			CPLPopErrorHandler();
+			return out;
+		});
+	} catch (std::system_error &e) {
+		// no thread available; read when asked
+		return;
+	}
+	prefetch->row = row;
+	prefetch->nrows = nrows;
+	prefetch->col = col;
+	prefetch->ncols = ncols;
+	prefetch->pending = true;
+#endif
+}
+
+
+// wait for the pending read; use it if it has the requested values
+bool SpatRaster::prefetchGet(std::vector<double> &out, size_t row, size_t nrows, size_t col, size_t ncols) {
+	if ((!prefetch) || (!prefetch->pending)) return false;
+	prefetch->pending = false;
+	SpatAsyncChunk chunk = prefetch->chunk.get();
+	if ((row != prefetch->row) || (nrows != prefetch->nrows) || (col != prefetch->col) || (ncols != prefetch->ncols)) {
+		return false;
+	}
+	for (size_t i=0; i<chunk.msg.warnings.size(); i++) {
+		addWarning(chunk.msg.warnings[i]);
+	}
+	out.resize(0);
+	if (chunk.msg.has_error) {
+		setError(chunk.msg.getError());
+		return true;
+	}
+#ifdef useGDAL
+	out.reserve(nrows * ncols * nlyr());
+	for (size_t i=0; i<chunk.values.size(); i++) {
+		readChunkGDALFinish(chunk.values[i], i, nrows, ncols);
+		out.insert(out.end(), chunk.values[i].begin(), chunk.values[i].end());
+	}
+#endif
+	return true;
+}
+
+
+void SpatRaster::prefetchStop() {
+	if (prefetch && prefetch->pending) {
+		prefetch->pending = false;
+		prefetch->chunk.wait();
+		prefetch->chunk = std::future<SpatAsyncChunk>();
+	}
+}
+
+
+bool SpatRaster::writeQueue(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols) {
+#ifdef useGDAL
+	if (!writeWait()) return false;
+	GDALDataset *ds = source[0].gdalconnection;
+	std::string datatype = source[0].datatype;
+	size_t nl = nlyr();
+	if (writeq) {
+		// the values are copied because the caller may re-use them
+		std::shared_ptr<std::vector<double>> v = std::make_shared<std::vector<double>>(vals);
+		try {
+			writeq->submit([ds, v, datatype, startrow, nrows, startcol, ncols, nl]() -> SpatMessages {
+				return write_task(ds, *v, datatype, startrow, nrows, startcol, ncols, nl);
+			});
+			return true;
+		} catch (std::system_error &e) {
+			// no thread available; write now
+		}
+	}
+	SpatMessages m = writeBlockGDAL(ds, vals, datatype, startrow, nrows, startcol, ncols, nl);
+	if (m.has_error) {
+		setError(m.getError());
+		GDALClose( source[0].gdalconnection );
+		return false;
+	}
+	return true;
+#else
+	setError("GDAL is not available");
+	return false;
+#endif
+}
+
+
+// wait for the pending write and report its messages
+bool SpatRaster::writeWait() {
+	if ((!writeq) || (!writeq->pending)) return true;
+	SpatMessages m = writeq->wait();
+	for (size_t i=0; i<m.warnings.size(); i++) {
+		addWarning(m.warnings[i]);
+	}
+	if (m.has_error) {
+		setError(m.getError());
+#ifdef useGDAL
+		GDALClose( source[0].gdalconnection );
+#endif
+		return false;
+	}
+	return true;
+}
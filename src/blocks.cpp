@@ -0,0 +1,151 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <stdexcept>
+
+
+// Process the blocks in "bs" (set by writeStart) and write the results.
+// Reading and writing is done on the calling thread, in order, because
+// GDAL datasets, the progress bar and the R error handlers are not thread-safe.
+// The computations are done by a pool of worker threads. At most 2 blocks
+// per thread are in memory at any time; getBlockSize takes that into account
+// if the layout is "threaded". The pipeline stops if the reader returns false.
+
+bool SpatRaster::writeBlocks(BlockReader reader, BlockWorker worker, SpatOptions &opt) {
+
+	size_t n = bs.n;
+	size_t nt = std::min((size_t)opt.get_threads(), n);
+
+	if (nt < 2) {
+		std::vector<std::vector<double>> d;
+		for (size_t i = 0; i < n; i++) {
+			if (!reader(i, d)) {
+				if (!hasError()) setError("cannot read values");
+				return false;
+			}
+			worker(i, d);
+			if (!writeValues(d[0], bs.row[i], bs.nrows[i], bs.col[i], bs.ncols[i])) return false;
+		}
+		return true;
+	}
+
+	std::vector<std::vector<std::vector<double>>> slots(n);
+	std::vector<bool> finished(n, false);
+	std::deque<size_t> todo;
+	std::mutex mtx;
+	std::condition_variable has_work, has_done;
+	bool stop = false;
+	std::string failed = "";
+
+	auto work = [&]() {
+		while (true) {
+			size_t i;
+			std::vector<std::vector<double>> d;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				has_work.wait(lock, [&]{ return stop || !todo.empty(); });
+				if (stop) return;
+				i = todo.front();
+				todo.pop_front();
+				d.swap(slots[i]);
+			}
+			std::string err = "";
+			try {
+				worker(i, d);
+			} catch (std::exception &e) {
+				err = e.what();
+				if (err == "") err = "error in worker thread";
+			}
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				if (err != "") {
+					failed = err;
+				} else {
+					slots[i].swap(d);
+					finished[i] = true;
+				}
+			}
+			has_done.notify_one();
+		}
+	};
+
+	std::vector<std::thread> pool;
+	pool.reserve(nt);
+	for (size_t i = 0; i < nt; i++) {
+		pool.push_back(std::thread(work));
+	}
+
+	size_t maxq = 2 * nt;
+	size_t nread = 0;
+	size_t nwritten = 0;
+	bool ok = true;
+	std::vector<std::vector<double>> d;
+	while (nwritten < n) {
+		bool ready;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (failed != "") {
+				setError(failed);
+				ok = false;
+				break;
+			}
+			ready = finished[nwritten];
+		}
+		if (ready) {
+			// no worker touches a finished slot
+			d.swap(slots[nwritten]);
+			slots[nwritten].resize(0);
+			ok = writeValues(d[0], bs.row[nwritten], bs.nrows[nwritten], bs.col[nwritten], bs.ncols[nwritten]);
+			d.resize(0);
+			if (!ok) break;
+			nwritten++;
+		} else if ((nread < n) && ((nread - nwritten) < maxq)) {
+			if (!reader(nread, d)) {
+				if (!hasError()) setError("cannot read values");
+				ok = false;
+				break;
+			}
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				slots[nread].swap(d);
+				todo.push_back(nread);
+			}
+			d.resize(0);
+			has_work.notify_one();
+			nread++;
+		} else {
+			std::unique_lock<std::mutex> lock(mtx);
+			has_done.wait(lock, [&]{ return finished[nwritten] || (failed != ""); });
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stop = true;
+	}
+	has_work.notify_all();
+	for (size_t i = 0; i < pool.size(); i++) {
+		pool[i].join();
+	}
+	return ok;
+}
+
@@ -0,0 +1,149 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include "spatChunkCache.h"
+
+
+SpatChunkCache::SpatChunkCache(std::vector<size_t> dimsize, std::vector<size_t> chunksize, size_t max_bytes, SpatSlabReader slabreader) {
+	size = dimsize;
+	chunk = chunksize;
+	for (size_t i=0; i<size.size(); i++) {
+		if ((chunk[i] == 0) || (chunk[i] > size[i])) chunk[i] = std::max(size[i], (size_t)1);
+	}
+	maxbytes = max_bytes;
+	reader = slabreader;
+}
+
+
+// the values of a chunk, read if not in the cache
+std::vector<double>* SpatChunkCache::get(const std::vector<size_t> &cindex) {
+	size_t nd = size.size();
+	size_t key = 0;
+	for (size_t i=0; i<nd; i++) {
+		size_t nchunks = (size[i] + chunk[i] - 1) / chunk[i];
+		key = key * nchunks + cindex[i];
+	}
+	auto it = cache.find(key);
+	if (it != cache.end()) {
+		lru.splice(lru.begin(), lru, it->second.first);
+		return &(it->second.second);
+	}
+
+	std::vector<size_t> start(nd), count(nd);
+	size_t n = 1;
+	for (size_t i=0; i<nd; i++) {
+		start[i] = cindex[i] * chunk[i];
+		count[i] = std::min(chunk[i], size[i] - start[i]);
+		n *= count[i];
+	}
+	std::vector<double> v(n);
+	if (!reader(start, count, v)) {
+		return NULL;
+	}
+	nread++;
+	size_t nbytes = n * sizeof(double);
+	while ((bytes + nbytes > maxbytes) && (!lru.empty())) {
+		size_t old = lru.back();
+		lru.pop_back();
+		auto oit = cache.find(old);
+		bytes -= oit->second.second.size() * sizeof(double);
+		cache.erase(oit);
+	}
+	lru.push_front(key);
+	bytes += nbytes;
+	auto ins = cache.emplace(key, std::make_pair(lru.begin(), std::move(v)));
+	return &(ins.first->second.second);
+}
+
+
+bool SpatChunkCache::read(const std::vector<size_t> &start, const std::vector<size_t> &count, const std::vector<size_t> &stride, double *out) {
+	size_t nd = size.size();
+	if ((start.size() != nd) || (count.size() != nd) || (stride.size() != nd) || (nd == 0)) {
+		return false;
+	}
+	std::vector<size_t> cfirst(nd), clast(nd);
+	for (size_t i=0; i<nd; i++) {
+		if ((count[i] == 0) || ((start[i] + count[i]) > size[i])) return false;
+		cfirst[i] = start[i] / chunk[i];
+		clast[i] = (start[i] + count[i] - 1) / chunk[i];
+	}
+
+	// all chunks that intersect with the request
+	std::vector<size_t> ci = cfirst;
+	while (true) {
+		std::vector<double> *v = get(ci);
+		if (v == NULL) return false;
+
+		// the part of this chunk that is requested
+		std::vector<size_t> from(nd), to(nd), cstart(nd), ccount(nd);
+		for (size_t i=0; i<nd; i++) {
+			cstart[i] = ci[i] * chunk[i];
+			ccount[i] = std::min(chunk[i], size[i] - cstart[i]);
+			from[i] = std::max(start[i], cstart[i]);
+			to[i] = std::min(start[i] + count[i], cstart[i] + ccount[i]);
+		}
+		// position in the chunk and in the output, last dimension fastest
+		std::vector<size_t> idx = from;
+		size_t last = nd - 1;
+		while (true) {
+			size_t cpos = 0, opos = 0;
+			for (size_t i=0; i<nd; i++) {
+				cpos = cpos * ccount[i] + (idx[i] - cstart[i]);
+				opos += (idx[i] - start[i]) * stride[i];
+			}
+			const double *src = v->data() + cpos;
+			size_t n = to[last] - from[last];
+			size_t s = stride[last];
+			if (s == 1) {
+				std::copy(src, src + n, out + opos);
+			} else {
+				for (size_t j=0; j<n; j++) {
+					out[opos + j * s] = src[j];
+				}
+			}
+			// next run
+			size_t d = last;
+			bool done = true;
+			while (d > 0) {
+				d--;
+				idx[d]++;
+				if (idx[d] < to[d]) {
+					done = false;
+					break;
+				}
+				idx[d] = from[d];
+			}
+			if (done) break;
+		}
+
+		// next chunk
+		size_t d = nd;
+		bool done = true;
+		while (d > 0) {
+			d--;
+			ci[d]++;
+			if (ci[d] <= clast[d]) {
+				done = false;
+				break;
+			}
+			ci[d] = cfirst[d];
+		}
+		if (done) break;
+	}
+	return true;
+}
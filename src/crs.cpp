@@ -16,9 +16,14 @@
 // along with spat. If not, see <http://www.gnu.org/licenses/>.
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <thread>
 //#include "spatMessages.h"
 #include "spatRaster.h"
 #include "string_utils.h"
+#include "spatAsync.h"
 
 
 #ifndef useGDAL
@@ -295,41 +300,161 @@ bool wkt_from_string(std::string input, std::string& wkt, std::string& msg) {
 
 
 
-SpatMessages transform_coordinates(std::vector<double> &x, std::vector<double> &y, std::string fromCRS, std::string toCRS) {
+// Coordinate transformations are kept for later use, because setting up
+// the PROJ pipeline can take much more time than transforming the coordinates.
+// A transformation object is used by one thread at a time; ct_get hands out
+// one that is not in use (for the same source and target crs) or makes a new one.
+// Only the transformations for the last used source and target crs are kept
+// (at most ct_maxidle of them), and ct_clear frees them (when terra is unloaded).
 
-	SpatMessages m;
+static std::mutex ct_mutex;
+static std::pair<std::string, std::string> ct_key;
+static std::vector<OGRCoordinateTransformation*> ct_idle;
+static const size_t ct_maxidle = 32;
+
+
+void ct_clear() {
+	std::vector<OGRCoordinateTransformation*> ct;
+	{
+		std::lock_guard<std::mutex> lock(ct_mutex);
+		ct.swap(ct_idle);
+	}
+	for (size_t i=0; i<ct.size(); i++) {
+		OCTDestroyCoordinateTransformation(ct[i]);
+	}
+}
+
+
+OGRCoordinateTransformation* ct_get(const std::string &from, const std::string &to, std::string &msg) {
+	{
+		std::lock_guard<std::mutex> lock(ct_mutex);
+		if ((ct_key == std::make_pair(from, to)) && (!ct_idle.empty())) {
+			OGRCoordinateTransformation *ct = ct_idle.back();
+			ct_idle.pop_back();
+			return ct;
+		}
+	}
 	OGRSpatialReference source, target;
-	const char *pszDefFrom = fromCRS.c_str();
-	OGRErr erro = source.SetFromUserInput(pszDefFrom);
-	if (erro != OGRERR_NONE) {
-		m.setError("input crs is not valid");
-		return m;
+	if (source.SetFromUserInput(from.c_str()) != OGRERR_NONE) {
+		msg = "input crs is not valid";
+		return NULL;
 	}
-	const char *pszDefTo = toCRS.c_str();
-	erro = target.SetFromUserInput(pszDefTo);
-	if (erro != OGRERR_NONE) {
-		m.setError("output crs is not valid");
-		return m;
+	if (target.SetFromUserInput(to.c_str()) != OGRERR_NONE) {
+		msg = "output crs is not valid";
+		return NULL;
+	}
+	CPLSetConfigOption("OGR_CT_FORCE_TRADITIONAL_GIS_ORDER", "YES");
+	OGRCoordinateTransformation *ct = OGRCreateCoordinateTransformation(&source, &target);
+	if (ct == NULL) {
+		msg = "Cannot do this transformation";
+	}
+	return ct;
+}
+
+
+void ct_release(const std::string &from, const std::string &to, OGRCoordinateTransformation *ct) {
+	if (ct == NULL) return;
+	std::vector<OGRCoordinateTransformation*> old;
+	{
+		std::lock_guard<std::mutex> lock(ct_mutex);
+		std::pair<std::string, std::string> key = std::make_pair(from, to);
+		if (ct_key != key) {
+			// the transformations for another crs are not used anymore
+			old.swap(ct_idle);
+			ct_key = key;
+		}
+		if (ct_idle.size() < ct_maxidle) {
+			ct_idle.push_back(ct);
+			ct = NULL;
+		}
 	}
+	for (size_t i=0; i<old.size(); i++) {
+		OCTDestroyCoordinateTransformation(old[i]);
+	}
+	if (ct != NULL) OCTDestroyCoordinateTransformation(ct);
+}
 
-	OGRCoordinateTransformation *poCT;
-	poCT = OGRCreateCoordinateTransformation(&source, &target);
 
-	if( poCT == NULL )	{
-		m.setError( "Cannot do this coordinate transformation" );
-		return (m);
+bool transform_xy(std::vector<double> &x, std::vector<double> &y, std::vector<int> &ok, const std::string &from, const std::string &to, unsigned threads, SpatMessages &msg) {
+
+	size_t n = x.size();
+	ok.assign(n, TRUE);
+	// a thread is only worth it for a large number of points
+	size_t minbatch = 65536;
+	size_t nt = std::max((size_t)1, std::min((size_t)threads, n / minbatch));
+
+	std::vector<OGRCoordinateTransformation*> ct(nt, NULL);
+	for (size_t i=0; i<nt; i++) {
+		std::string errmsg;
+		ct[i] = ct_get(from, to, errmsg);
+		if (ct[i] == NULL) {
+			for (size_t j=0; j<i; j++) ct_release(from, to, ct[j]);
+			msg.setError(errmsg);
+			return false;
+		}
+	}
+	if (n == 0) {
+		ct_release(from, to, ct[0]);
+		return true;
 	}
 
+	size_t chunk = (n + nt - 1) / nt;
+	// the messages of each thread are collected (the error handler of
+	// the main thread calls R) and reported after the threads are done
+	std::vector<SpatMessages> tmsg(nt);
+	auto work = [&](size_t i) {
+		size_t start = i * chunk;
+		if (start >= n) return;
+		size_t m = std::min(chunk, n - start);
+		CPLPushErrorHandlerEx((CPLErrorHandler)__err_collect, &tmsg[i]);
+		ct[i]->Transform(m, &x[start], &y[start], NULL, &ok[start]);
+		CPLPopErrorHandler();
+	};
+	if (nt == 1) {
+		work(0);
+	} else {
+		std::vector<std::thread> pool;
+		pool.reserve(nt);
+		for (size_t i=0; i<nt; i++) {
+			pool.push_back(std::thread(work, i));
+		}
+		for (size_t i=0; i<nt; i++) {
+			pool[i].join();
+		}
+	}
+	for (size_t i=0; i<nt; i++) {
+		ct_release(from, to, ct[i]);
+	}
+	// points that failed are flagged in "ok"; the messages are warnings (once each)
+	std::vector<std::string> w;
+	for (size_t i=0; i<nt; i++) {
+		w.insert(w.end(), tmsg[i].warnings.begin(), tmsg[i].warnings.end());
+		if (tmsg[i].has_error) w.push_back(tmsg[i].getError());
+	}
+	std::sort(w.begin(), w.end());
+	w.erase(std::unique(w.begin(), w.end()), w.end());
+	for (size_t i=0; i<w.size(); i++) {
+		msg.addWarning(w[i]);
+	}
+	return true;
+}
+
+
+SpatMessages transform_coordinates(std::vector<double> &x, std::vector<double> &y, std::string fromCRS, std::string toCRS) {
+
+	SpatMessages m;
+	std::vector<int> ok;
+	if (!transform_xy(x, y, ok, fromCRS, toCRS, 1, m)) {
+		return m;
+	}
 	unsigned failcount = 0;
 	for (size_t i=0; i < x.size(); i++) {
-		if( !poCT->Transform( 1, &x[i], &y[i] ) ) {
+		if (!ok[i]) {
 			x[i] = NAN;
 			y[i] = NAN;
 			failcount++;
 		}
 	}
-	
-	OCTDestroyCoordinateTransformation(poCT); 	
 	if (failcount > 0) {
 		m.addWarning(std::to_string(failcount) + " failed transformations");
 	}
@@ -338,6 +463,12 @@ SpatMessages transform_coordinates(std::vector<double> &x, std::vector<double> &
 
 
 SpatVector SpatVector::project(std::string crs) {
+	SpatOptions opt;
+	return project(crs, opt);
+}
+
+
+SpatVector SpatVector::project(std::string crs, SpatOptions &opt) {
 
 	SpatVector s;
 
@@ -346,58 +477,101 @@ SpatVector SpatVector::project(std::string crs) {
 		return(s);
 	#else
 
-	OGRSpatialReference source, target;
 	std::string vsrs = getSRS("wkt");
-	const char *pszDefFrom = vsrs.c_str();
-	OGRErr erro = source.SetFromUserInput(pszDefFrom);
-	if (erro != OGRERR_NONE) {
-		s.setError("input crs is not valid");
-		return s;
-	}
-	const char *pszDefTo = crs.c_str();
-	erro = target.SetFromUserInput(pszDefTo);
-	if (erro != OGRERR_NONE) {
-		s.setError("output crs is not valid");
-		return s;
-	}
 
-	CPLSetConfigOption("OGR_CT_FORCE_TRADITIONAL_GIS_ORDER", "YES");
-	OGRCoordinateTransformation *poCT;
-	poCT = OGRCreateCoordinateTransformation(&source, &target);
+	// all coordinates are transformed at once (in batches, with "threads"
+	// threads); a part is removed if its (outer) ring cannot be transformed
 
-	if( poCT == NULL )	{
-		s.setError( "Cannot do this transformation" );
-		return(s);
+	if (geoms.packed()) {
+		SpatGeomColumns c = geoms.columns();
+		std::vector<int> ok;
+		if (!transform_xy(c.x, c.y, ok, vsrs, crs, opt.get_threads(), s.msg)) {
+			return s;
+		}
+		bool allok = std::find(ok.begin(), ok.end(), FALSE) == ok.end();
+		if (!allok) {
+			c.set_offsets();
+			SpatGeomColumns cc;
+			cc.gtype = c.gtype;
+			cc.n = c.n;
+			cc.ring.push_back(0);
+			cc.part.push_back(0);
+			cc.geom.push_back(0);
+			for (size_t i=0; i<c.size(); i++) {
+				for (size_t j=c.geom[i]; j<c.geom[i+1]; j++) {
+					size_t r = c.part[j];
+					if (std::find(ok.begin()+c.ring[r], ok.begin()+c.ring[r+1], FALSE) != (ok.begin()+c.ring[r+1])) continue;
+					for (; r<c.part[j+1]; r++) {
+						cc.x.insert(cc.x.end(), c.x.begin()+c.ring[r], c.x.begin()+c.ring[r+1]);
+						cc.y.insert(cc.y.end(), c.y.begin()+c.ring[r], c.y.begin()+c.ring[r+1]);
+						cc.ring.push_back(cc.x.size());
+					}
+					cc.part.push_back(cc.ring.size()-1);
+				}
+				cc.geom.push_back(cc.part.size()-1);
+			}
+			c = cc;
+		}
+		s.geoms.setColumns(c);
+		s.computeExtent();
+		s.setSRS(crs);
+		s.df = df;
+		return s;
 	}
 
-	s.setSRS(crs);
-	s.df = df;
-	std::vector<unsigned> keeprows;
-
+	// gather
+	std::vector<double> x, y;
+	size_t n = nxy();
+	x.reserve(n);
+	y.reserve(n);
+	for (size_t i=0; i < size(); i++) {
+		const SpatGeom g = geoms.get(i);
+		for (size_t j=0; j < g.parts.size(); j++) {
+			const SpatPart &p = g.parts[j];
+			x.insert(x.end(), p.x.begin(), p.x.end());
+			y.insert(y.end(), p.y.begin(), p.y.end());
+			for (size_t k=0; k < p.holes.size(); k++) {
+				x.insert(x.end(), p.holes[k].x.begin(), p.holes[k].x.end());
+				y.insert(y.end(), p.holes[k].y.begin(), p.holes[k].y.end());
+			}
+		}
+	}
+	std::vector<int> ok;
+	if (!transform_xy(x, y, ok, vsrs, crs, opt.get_threads(), s.msg)) {
+		return s;
+	}
 
+	// scatter
+	size_t k = 0;
 	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom g = geoms.get(i);
 		SpatGeom gg;
 		gg.gtype = g.gtype;
-		for (size_t j=0; j < g.size(); j++) {
-			SpatPart p = g.getPart(j);
-			if (poCT->Transform(p.x.size(), &p.x[0], &p.y[0]) ) {
-				SpatPart pp(p.x, p.y);
-				if (p.hasHoles()) {
-					for (size_t k=0; k < p.nHoles(); k++) {
-						SpatHole h = p.getHole(k);
-						poCT->Transform(h.x.size(), &h.x[0], &h.y[0]);
-						pp.addHole(h.x, h.y);
-					}
+		for (size_t j=0; j < g.parts.size(); j++) {
+			const SpatPart &p = g.parts[j];
+			size_t np = p.x.size();
+			if (np == 0) {
+				gg.addPart(p);
+				continue;
+			}
+			bool pok = std::find(ok.begin()+k, ok.begin()+k+np, FALSE) == (ok.begin()+k+np);
+			SpatPart pp(std::vector<double>(x.begin()+k, x.begin()+k+np), std::vector<double>(y.begin()+k, y.begin()+k+np));
+			k += np;
+			for (size_t h=0; h < p.holes.size(); h++) {
+				size_t nh = p.holes[h].x.size();
+				if (nh > 0) {
+					pp.addHole(std::vector<double>(x.begin()+k, x.begin()+k+nh), std::vector<double>(y.begin()+k, y.begin()+k+nh));
 				}
+				k += nh;
+			}
+			if (pok) {
 				gg.addPart(pp);
 			}
 		}
-		keeprows.push_back(i);
 		s.addGeom(gg);
 	}
-	s.df = df.subset_rows(keeprows);
-	OCTDestroyCoordinateTransformation(poCT);
+	s.setSRS(crs);
+	s.df = df;
 
 	#endif
 	return s;
@@ -2,6 +2,11 @@
 #include "ogr_spatialref.h"
 
 SpatMessages transform_coordinates(std::vector<double> &x, std::vector<double> &y, std::string fromCRS, std::string toCRS);
+// transform x and y in place, with up to "threads" threads; ok[i] is FALSE for points that failed
+// the GDAL/PROJ messages are returned as warnings in "msg"
+bool transform_xy(std::vector<double> &x, std::vector<double> &y, std::vector<int> &ok, const std::string &from, const std::string &to, unsigned threads, SpatMessages &msg);
+// free the coordinate transformations that are kept for later use
+void ct_clear();
 bool wkt_from_spatial_reference(const OGRSpatialReference *srs, std::string &wkt, std::string &msg);
 bool prj_from_spatial_reference(const OGRSpatialReference *srs, std::string &prj, std::string &msg);
 //std::vector<std::string> srefs_from_string(std::string input);
@@ -25,16 +25,6 @@
 #include "vecmath.h"
 
 
-void shortDistPoints(std::vector<double> &d, const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &px, const std::vector<double> &py, const bool& lonlat, const double &lindist) {
-	if (lonlat) {
-		distanceToNearest_lonlat(d, x, y, px, py);
-	} else {
-		distanceToNearest_plane(d, x, y, px, py, lindist);
-	}
-}
-
-
-
 SpatRaster SpatRaster::distance(SpatVector p, SpatOptions &opt) {
 
 	SpatRaster out = geometry();
@@ -77,6 +67,13 @@ SpatRaster SpatRaster::distance(SpatVector p, SpatOptions &opt) {
 		return out;
 	}
 	std::vector<std::vector<double>> pxy = p.coordinates();
+	SpatKDTree<2> ptree;
+	SpatKDTree<3> stree;
+	if (lonlat) {
+		stree = sphere_tree(pxy[0], pxy[1]);
+	} else {
+		ptree = plane_tree(pxy[0], pxy[1]);
+	}
 	std::vector<double> v, cells;
 	
 	for (size_t i = 0; i < out.bs.n; i++) {
@@ -96,7 +93,11 @@ SpatRaster SpatRaster::distance(SpatVector p, SpatOptions &opt) {
 		}
 		std::vector<std::vector<double>> xy = xyFromCell(cells);
 		std::vector<double> d(cells.size(), 0); 
-		shortDistPoints(d, xy[0], xy[1], pxy[0], pxy[1], lonlat, m);
+		if (lonlat) {
+			distanceToNearest_lonlat(d, xy[0], xy[1], stree, pxy[0], pxy[1]);
+		} else {
+			distanceToNearest_plane(d, xy[0], xy[1], ptree, m);
+		}
 		if (!out.writeValues(d, out.bs.row[i], out.bs.nrows[i], 0, nc)) return out;
 	}
 	out.writeStop();
@@ -25,6 +25,7 @@
 #include <cmath>
 #include "ggeodesic.h"
 #include "recycle.h"
+#include "distance.h"
 
 
 double distance_lonlat(const double &lon1, const double &lat1, const double &lon2, const double &lat2) {
@@ -341,48 +342,106 @@ std::vector<std::vector<double> > destpoint_plane(std::vector<double>  x, std::v
 }
 
 
-void distanceToNearest_lonlat(std::vector<double> &d, const std::vector<double> &lon1, const std::vector<double> &lat1, const std::vector<double> &lon2, const std::vector<double> &lat2) {
-	int n = lon1.size();
-	int m = lon2.size();
+// points on the unit sphere
+void lonlat_xyz(const double &lon, const double &lat, double *xyz) {
+	double phi = lat * M_PI / 180;
+	double lambda = lon * M_PI / 180;
+	xyz[0] = cos(phi) * cos(lambda);
+	xyz[1] = cos(phi) * sin(lambda);
+	xyz[2] = sin(phi);
+}
+
+
+SpatKDTree<3> sphere_tree(const std::vector<double> &lon, const std::vector<double> &lat) {
+	size_t n = lon.size();
+	std::vector<double> xyz(n * 3);
+	for (size_t i=0; i<n; i++) {
+		lonlat_xyz(lon[i], lat[i], &xyz[i*3]);
+	}
+	return SpatKDTree<3>(xyz);
+}
+
+
+SpatKDTree<2> plane_tree(const std::vector<double> &x, const std::vector<double> &y) {
+	size_t n = x.size();
+	std::vector<double> xy(n * 2);
+	for (size_t i=0; i<n; i++) {
+		xy[i*2] = x[i];
+		xy[i*2+1] = y[i];
+	}
+	return SpatKDTree<2>(xy);
+}
+
+
+// The nearest point on the sphere is found with the tree; and then the geodesic 
+// distance to all points that may be nearer on the ellipsoid. The great circle 
+// distance on the mean sphere is within 1% of the geodesic distance (2% is used).
+void distanceToNearest_lonlat(std::vector<double> &d, const std::vector<double> &lon1, const std::vector<double> &lat1, const SpatKDTree<3> &tree, const std::vector<double> &lon2, const std::vector<double> &lat2) {
+	size_t n = lon1.size();
 	double a = 6378137.0;
 	double f = 1/298.257223563;
+	double r = 6371008.8;
 	double azi1, azi2, s12;
 	struct geod_geodesic g;
 	geod_init(&g, a, f);
-
- 	for (int i=0; i < n; i++) {
-		if (std::isnan(lat1[i])) {
+	double q[3];
+	std::vector<size_t> near;
+ 	for (size_t i=0; i < n; i++) {
+		if (std::isnan(lat1[i]) || std::isnan(lon1[i])) {
 			continue;
 		}
-		geod_inverse(&g, lat1[i], lon1[i], lat2[0], lon2[0], &d[i], &azi1, &azi2);
-		for (int j=1; j<m; j++) {
-			geod_inverse(&g, lat1[i], lon1[i], lat2[j], lon2[j], &s12, &azi1, &azi2);
+		lonlat_xyz(lon1[i], lat1[i], q);
+		size_t j;
+		double c2;
+		if (!tree.nearest(q, j, c2)) {
+			d[i] = NAN;
+			continue;
+		}
+		geod_inverse(&g, lat1[i], lon1[i], lat2[j], lon2[j], &d[i], &azi1, &azi2);
+		double angle = std::min(M_PI, d[i] / (0.98 * r));
+		double chord = 2 * sin(angle / 2);
+		tree.within(q, chord * chord, near);
+		for (size_t k=0; k<near.size(); k++) {
+			if (near[k] == j) continue;
+			geod_inverse(&g, lat1[i], lon1[i], lat2[near[k]], lon2[near[k]], &s12, &azi1, &azi2);
 			if (s12 < d[i]) {
 				d[i] = s12;
 			}
-		}		
+		}
 	}
 }
 
 
+void distanceToNearest_lonlat(std::vector<double> &d, const std::vector<double> &lon1, const std::vector<double> &lat1, const std::vector<double> &lon2, const std::vector<double> &lat2) {
+	SpatKDTree<3> tree = sphere_tree(lon2, lat2);
+	distanceToNearest_lonlat(d, lon1, lat1, tree, lon2, lat2);
+}
 
 
-void distanceToNearest_plane(std::vector<double> &d, const std::vector<double> &x1, const  std::vector<double> &y1, const std::vector<double> &x2, const std::vector<double> &y2, const double& lindist) {
-	int n = x1.size();
-	int m = x2.size();
-  	for (int i=0; i < n; i++) {
-		if (std::isnan(x1[i])) continue;
-		d[i] = sqrt(pow((x2[0]-x1[i]),2) + pow((y2[0]-y1[i]), 2)) * lindist;
-		for (int j=1; j < m; j++) {
-			double r = sqrt(pow((x2[j]-x1[i]),2) + pow((y2[j]-y1[i]), 2));
-			if (r < d[i]) {
-				d[i] = r * lindist;
-			}
+void distanceToNearest_plane(std::vector<double> &d, const std::vector<double> &x1, const std::vector<double> &y1, const SpatKDTree<2> &tree, const double& lindist) {
+	size_t n = x1.size();
+	double q[2];
+  	for (size_t i=0; i < n; i++) {
+		if (std::isnan(x1[i]) || std::isnan(y1[i])) continue;
+		q[0] = x1[i];
+		q[1] = y1[i];
+		size_t j;
+		double d2;
+		if (tree.nearest(q, j, d2)) {
+			d[i] = sqrt(d2) * lindist;
+		} else {
+			d[i] = NAN;
 		}
 	}
 }
 
 
+void distanceToNearest_plane(std::vector<double> &d, const std::vector<double> &x1, const  std::vector<double> &y1, const std::vector<double> &x2, const std::vector<double> &y2, const double& lindist) {
+	SpatKDTree<2> tree = plane_tree(x2, y2);
+	distanceToNearest_plane(d, x1, y1, tree, lindist);
+}
+
+
 
 void nearest_lonlat(std::vector<long> &id, std::vector<double> &d, std::vector<double> &nlon, std::vector<double> &nlat, const std::vector<double> &lon1, const std::vector<double> &lat1, const std::vector<double> &lon2, const std::vector<double> &lat2) {
 	size_t n = lon1.size();
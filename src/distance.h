@@ -15,6 +15,9 @@
 // You should have received a copy of the GNU General Public License
 // along with spat. If not, see <http://www.gnu.org/licenses/>.
 
+#include <vector>
+#include "spatIndex.h"
+
 // distance
 double distance_plane(const double &x1, const double &y1, const double &x2, const double &y2);
 std::vector<double> distance_plane(std::vector<double> &x1, std::vector<double> &y1, std::vector<double> &x2, std::vector<double> &y2);
@@ -51,6 +54,12 @@ double toRad(double &deg);
 void distanceToNearest_plane(std::vector<double> &d, const std::vector<double> &x1, const  std::vector<double> &y1, const std::vector<double> &x2, const std::vector<double> &y2, const double& lindist);
 void distanceToNearest_lonlat(std::vector<double> &d, const std::vector<double> &lon1, const std::vector<double> &lat1, const std::vector<double> &lon2, const std::vector<double> &lat2);
 
+// with a spatial index of the points (lon2, lat2) or (x2, y2)
+SpatKDTree<2> plane_tree(const std::vector<double> &x, const std::vector<double> &y);
+SpatKDTree<3> sphere_tree(const std::vector<double> &lon, const std::vector<double> &lat);
+void distanceToNearest_plane(std::vector<double> &d, const std::vector<double> &x1, const std::vector<double> &y1, const SpatKDTree<2> &tree, const double& lindist);
+void distanceToNearest_lonlat(std::vector<double> &d, const std::vector<double> &lon1, const std::vector<double> &lat1, const SpatKDTree<3> &tree, const std::vector<double> &lon2, const std::vector<double> &lat2);
+
 
 void nearest_lonlat(std::vector<long> &id, std::vector<double> &d, std::vector<double> &nlon, std::vector<double> &nlat, const std::vector<double> &lon1, const std::vector<double> &lat1, const std::vector<double> &lon2, const std::vector<double> &lat2);
 void nearest_lonlat_self(std::vector<long> &id, std::vector<double> &d, std::vector<double> &nlon, std::vector<double> &nlat, const std::vector<double> &lon, const std::vector<double> &lat);
@@ -0,0 +1,314 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include "spatExpr.h"
+#include <map>
+
+// operators with the same results as in R, including for NA (NAN)
+
+struct ExprAdd { double operator()(double a, double b) const { return a + b; } };
+struct ExprSub { double operator()(double a, double b) const { return a - b; } };
+struct ExprMul { double operator()(double a, double b) const { return a * b; } };
+struct ExprDiv { double operator()(double a, double b) const { return a / b; } };
+// NA^0 and 1^NA are 1
+struct ExprPow { double operator()(double a, double b) const { return std::pow(a, b); } };
+// the sign of the result is that of b
+struct ExprMod { double operator()(double a, double b) const {
+	if (std::isnan(a) || std::isnan(b)) return NAN;
+	double r = std::fmod(a, b);
+	return ((r != 0) && ((r < 0) != (b < 0))) ? r + b : r; } };
+struct ExprIntDiv { double operator()(double a, double b) const { return std::floor(a / b); } };
+struct ExprEQ { double operator()(double a, double b) const {
+	return (std::isnan(a) || std::isnan(b)) ? NAN : a == b; } };
+struct ExprNE { double operator()(double a, double b) const {
+	return (std::isnan(a) || std::isnan(b)) ? NAN : a != b; } };
+struct ExprGT { double operator()(double a, double b) const {
+	return (std::isnan(a) || std::isnan(b)) ? NAN : a > b; } };
+struct ExprLT { double operator()(double a, double b) const {
+	return (std::isnan(a) || std::isnan(b)) ? NAN : a < b; } };
+struct ExprGE { double operator()(double a, double b) const {
+	return (std::isnan(a) || std::isnan(b)) ? NAN : a >= b; } };
+struct ExprLE { double operator()(double a, double b) const {
+	return (std::isnan(a) || std::isnan(b)) ? NAN : a <= b; } };
+// NA & FALSE is FALSE; NA | TRUE is TRUE
+struct ExprAnd { double operator()(double a, double b) const {
+	if ((a == 0) || (b == 0)) return 0;
+	return (std::isnan(a) || std::isnan(b)) ? NAN : 1; } };
+struct ExprOr { double operator()(double a, double b) const {
+	if ((!std::isnan(a) && (a != 0)) || (!std::isnan(b) && (b != 0))) return 1;
+	return (std::isnan(a) || std::isnan(b)) ? NAN : 0; } };
+struct ExprMin { double operator()(double a, double b) const {
+	return (std::isnan(a) || std::isnan(b)) ? NAN : std::min(a, b); } };
+struct ExprMax { double operator()(double a, double b) const {
+	return (std::isnan(a) || std::isnan(b)) ? NAN : std::max(a, b); } };
+struct ExprAtan2 { double operator()(double a, double b) const {
+	return (std::isnan(a) || std::isnan(b)) ? NAN : std::atan2(a, b); } };
+
+struct ExprNeg { double operator()(double a) const { return -a; } };
+struct ExprNot { double operator()(double a) const { return std::isnan(a) ? NAN : a == 0; } };
+struct ExprIsNA { double operator()(double a) const { return std::isnan(a); } };
+struct ExprAbs { double operator()(double a) const { return std::fabs(a); } };
+struct ExprSqrt { double operator()(double a) const { return std::sqrt(a); } };
+struct ExprExp { double operator()(double a) const { return std::exp(a); } };
+struct ExprExpm1 { double operator()(double a) const { return std::expm1(a); } };
+struct ExprLog { double operator()(double a) const { return std::log(a); } };
+struct ExprLog10 { double operator()(double a) const { return std::log10(a); } };
+struct ExprLog2 { double operator()(double a) const { return std::log2(a); } };
+struct ExprLog1p { double operator()(double a) const { return std::log1p(a); } };
+struct ExprFloor { double operator()(double a) const { return std::floor(a); } };
+struct ExprCeil { double operator()(double a) const { return std::ceil(a); } };
+struct ExprTrunc { double operator()(double a) const { return std::trunc(a); } };
+// like R, half-way cases are rounded to the even number
+struct ExprRound { double operator()(double a) const { return std::nearbyint(a); } };
+struct ExprSign { double operator()(double a) const { return std::isnan(a) ? NAN : (a > 0) - (a < 0); } };
+struct ExprSin { double operator()(double a) const { return std::sin(a); } };
+struct ExprCos { double operator()(double a) const { return std::cos(a); } };
+struct ExprTan { double operator()(double a) const { return std::tan(a); } };
+struct ExprAsin { double operator()(double a) const { return std::asin(a); } };
+struct ExprAcos { double operator()(double a) const { return std::acos(a); } };
+struct ExprAtan { double operator()(double a) const { return std::atan(a); } };
+struct ExprSinh { double operator()(double a) const { return std::sinh(a); } };
+struct ExprCosh { double operator()(double a) const { return std::cosh(a); } };
+struct ExprTanh { double operator()(double a) const { return std::tanh(a); } };
+
+
+template <typename F>
+void expr_unary(std::vector<SpatExprValue> &stack, size_t n) {
+	F f;
+	SpatExprValue &a = stack.back();
+	if (a.scalar) {
+		a.s = f(a.s);
+		return;
+	}
+	double *x = a.v.data();
+	for (size_t i=0; i<n; i++) {
+		x[i] = f(x[i]);
+	}
+}
+
+
+// the result replaces the first argument
+template <typename F>
+void expr_binary(std::vector<SpatExprValue> &stack, size_t n) {
+	F f;
+	SpatExprValue &b = stack.back();
+	SpatExprValue &a = stack[stack.size()-2];
+	if (a.scalar && b.scalar) {
+		a.s = f(a.s, b.s);
+	} else if (a.scalar) {
+		const double s = a.s;
+		double *y = b.v.data();
+		for (size_t i=0; i<n; i++) {
+			y[i] = f(s, y[i]);
+		}
+		a.v.swap(b.v);
+		a.scalar = false;
+	} else if (b.scalar) {
+		const double s = b.s;
+		double *x = a.v.data();
+		for (size_t i=0; i<n; i++) {
+			x[i] = f(x[i], s);
+		}
+	} else {
+		double *x = a.v.data();
+		const double *y = b.v.data();
+		for (size_t i=0; i<n; i++) {
+			x[i] = f(x[i], y[i]);
+		}
+	}
+	stack.pop_back();
+}
+
+
+double expr_at(const SpatExprValue &x, size_t i) {
+	return x.scalar ? x.s : x.v[i];
+}
+
+
+// ifelse(test, yes, no)
+void expr_ifelse(std::vector<SpatExprValue> &stack, size_t n) {
+	size_t k = stack.size();
+	SpatExprValue &test = stack[k-3];
+	const SpatExprValue &yes = stack[k-2];
+	const SpatExprValue &no = stack[k-1];
+	if (test.scalar && yes.scalar && no.scalar) {
+		test.s = std::isnan(test.s) ? NAN : (test.s != 0 ? yes.s : no.s);
+	} else {
+		std::vector<double> r(n);
+		for (size_t i=0; i<n; i++) {
+			double t = expr_at(test, i);
+			r[i] = std::isnan(t) ? NAN : (t != 0 ? expr_at(yes, i) : expr_at(no, i));
+		}
+		test.v.swap(r);
+		test.scalar = false;
+	}
+	stack.resize(k-2);
+}
+
+
+bool SpatExpr::compile(const std::vector<std::string> &ops, const std::vector<double> &args, size_t nlyr, std::string &msg) {
+
+	static const std::map<std::string, SpatExprKernel> binary = {
+		{"+", expr_binary<ExprAdd>}, {"-", expr_binary<ExprSub>},
+		{"*", expr_binary<ExprMul>}, {"/", expr_binary<ExprDiv>},
+		{"^", expr_binary<ExprPow>}, {"%%", expr_binary<ExprMod>}, {"%", expr_binary<ExprMod>}, {"%/%", expr_binary<ExprIntDiv>},
+		{"==", expr_binary<ExprEQ>}, {"!=", expr_binary<ExprNE>},
+		{">", expr_binary<ExprGT>}, {"<", expr_binary<ExprLT>},
+		{">=", expr_binary<ExprGE>}, {"<=", expr_binary<ExprLE>},
+		{"&", expr_binary<ExprAnd>}, {"|", expr_binary<ExprOr>},
+		{"pmin", expr_binary<ExprMin>}, {"pmax", expr_binary<ExprMax>}, {"atan2", expr_binary<ExprAtan2>}
+	};
+	static const std::map<std::string, SpatExprKernel> unary = {
+		{"neg", expr_unary<ExprNeg>}, {"!", expr_unary<ExprNot>}, {"is.na", expr_unary<ExprIsNA>},
+		{"abs", expr_unary<ExprAbs>}, {"sqrt", expr_unary<ExprSqrt>},
+		{"exp", expr_unary<ExprExp>}, {"expm1", expr_unary<ExprExpm1>},
+		{"log", expr_unary<ExprLog>}, {"log10", expr_unary<ExprLog10>},
+		{"log2", expr_unary<ExprLog2>}, {"log1p", expr_unary<ExprLog1p>},
+		{"floor", expr_unary<ExprFloor>}, {"ceiling", expr_unary<ExprCeil>},
+		{"trunc", expr_unary<ExprTrunc>}, {"round", expr_unary<ExprRound>}, {"sign", expr_unary<ExprSign>},
+		{"sin", expr_unary<ExprSin>}, {"cos", expr_unary<ExprCos>}, {"tan", expr_unary<ExprTan>},
+		{"asin", expr_unary<ExprAsin>}, {"acos", expr_unary<ExprAcos>}, {"atan", expr_unary<ExprAtan>},
+		{"sinh", expr_unary<ExprSinh>}, {"cosh", expr_unary<ExprCosh>}, {"tanh", expr_unary<ExprTanh>}
+	};
+
+	code.resize(0);
+	depth = 0;
+	if ((ops.size() != args.size()) || (ops.size() == 0)) {
+		msg = "invalid expression";
+		return false;
+	}
+	size_t size = 0;
+	for (size_t i=0; i<ops.size(); i++) {
+		SpatExprInstr ins;
+		size_t nargs = 0;
+		if (ops[i] == "layer") {
+			if ((args[i] < 0) || (args[i] >= nlyr)) {
+				msg = "invalid layer in expression";
+				return false;
+			}
+			ins.type = 0;
+			ins.layer = args[i];
+		} else if (ops[i] == "const") {
+			ins.type = 1;
+			ins.value = args[i];
+		} else {
+			ins.type = 2;
+			std::map<std::string, SpatExprKernel>::const_iterator it;
+			if ((it = binary.find(ops[i])) != binary.end()) {
+				nargs = 2;
+			} else if ((it = unary.find(ops[i])) != unary.end()) {
+				nargs = 1;
+			} else if (ops[i] == "ifelse") {
+				nargs = 3;
+			} else {
+				msg = "unknown function in expression: " + ops[i];
+				return false;
+			}
+			ins.kernel = (nargs == 3) ? expr_ifelse : it->second;
+		}
+		if (nargs > size) {
+			msg = "invalid expression";
+			return false;
+		}
+		size = (nargs == 0) ? size + 1 : size - nargs + 1;
+		depth = std::max(depth, size);
+		code.push_back(ins);
+	}
+	if (size != 1) {
+		msg = "invalid expression";
+		return false;
+	}
+	return true;
+}
+
+
+void SpatExpr::eval(const std::vector<double> &v, size_t ncell, std::vector<double> &out) const {
+	std::vector<SpatExprValue> stack;
+	stack.reserve(depth);
+	for (size_t i=0; i<code.size(); i++) {
+		const SpatExprInstr &ins = code[i];
+		if (ins.type == 0) {
+			stack.push_back(SpatExprValue());
+			SpatExprValue &x = stack.back();
+			size_t off = ins.layer * ncell;
+			x.v.assign(v.begin() + off, v.begin() + off + ncell);
+			x.scalar = false;
+		} else if (ins.type == 1) {
+			stack.push_back(SpatExprValue());
+			stack.back().s = ins.value;
+		} else {
+			ins.kernel(stack, ncell);
+		}
+	}
+	if (stack[0].scalar) {
+		out.assign(ncell, stack[0].s);
+	} else {
+		out.swap(stack[0].v);
+	}
+}
+
+
+
+SpatRaster SpatRaster::expression(std::vector<std::string> ops, std::vector<double> args, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	SpatExpr expr;
+	std::string msg;
+	if (!expr.compile(ops, args, nlyr(), msg)) {
+		out.setError(msg);
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("raster has no values");
+		return out;
+	}
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	BlockLayout layout;
+	layout.threaded = true;
+	layout.tiles = true;
+  	if (!out.writeStart(opt, layout)) {
+		readStop();
+		return out;
+	}
+
+	size_t nl = nlyr();
+	BlockReader reader = [&](size_t i, std::vector<std::vector<double>> &d) {
+		d.resize(1);
+		d[0] = readBlock(out.bs, i);
+		if (hasError()) {
+			out.setError(getError());
+			return false;
+		}
+		return true;
+	};
+	BlockWorker worker = [expr, nl](size_t i, std::vector<std::vector<double>> &d) {
+		std::vector<double> v;
+		expr.eval(d[0], d[0].size() / nl, v);
+		d[0].swap(v);
+	};
+	if (!out.writeBlocks(reader, worker, opt)) {
+		readStop();
+		return out;
+	}
+	out.writeStop();
+	readStop();
+	return(out);
+}
@@ -20,6 +20,7 @@
 #include "spatRasterMultiple.h"
 #include "distance.h"
 #include "vecmath.h"
+#include "spatScanline.h"
 
 
 
@@ -379,68 +380,10 @@ std::vector<double> SpatRaster::line_cells(SpatGeom& g) {
 
 
 std::vector<double> SpatRaster::polygon_cells(SpatGeom& g) {
-
-// does not deal with holes yet.
-
-	unsigned nrows = nrow();
-	unsigned ncols = ncol();
-	SpatExtent extent = getExtent();
-
-	double xmin = extent.xmin;
-	double ymax = extent.ymax;
-	double rx = xres();
-	double ry = yres();
+	SpatExtent e = getExtent();
+	SpatScanGrid grid(e.xmin, e.ymax, xres(), yres(), nrow(), ncol());
 	std::vector<double> out;
-
-	unsigned np = g.size();
-	for (size_t prt=0; prt<np; prt++) {
-
-        SpatPart p = g.getPart(prt);
-        double miny = vmin(p.y, true);
-        double maxy = vmax(p.y, true);
-        double minrow = rowFromY(miny);
-        double maxrow = rowFromY(maxy);
-        if (minrow > nrows || maxrow < 0) {
-            return(out);
-        }
-        size_t startrow = minrow < 0 ? 0 : minrow;
-        size_t endrow = maxrow >= nrows ? (nrows-1) : maxrow;
-        unsigned n = p.x.size();
-        out.reserve(5*(startrow-endrow+1));
-
-        std::vector<unsigned> nCol(n);
-        for (size_t row=0; row<nrows; row++) {
-            double y = ymax - (row+0.5) * ry;
-            // find nodes.
-            unsigned nodes = 0;
-            size_t j = n-1;
-            for (size_t i=0; i<n; i++) {
-                if (((p.y[i] < y) && (p.y[j] >= y)) || ((p.y[j] < y) && (p.y[i] >= y))) {
-                //	nCol[nodes++]=(int)  (((pX[i] - xmin + (y-pY[i])/(pY[j]-pY[i]) * (pX[j]-pX[i])) + 0.5 * rx ) / rx);
-                    double nds = ((p.x[i] - xmin + (y-p.y[i])/(p.y[j]-p.y[i]) * (p.x[j]-p.x[i])) + 0.5 * rx ) / rx;
-                    nds = nds < 0 ? 0 : nds;
-                    nds = nds > ncols ? ncols : nds;
-                    nCol[nodes] = (unsigned) nds;
-                    nodes++;
-                }
-                j = i;
-            }
-
-            // now remove the holes?
-
-            std::sort(nCol.begin(), nCol.begin()+nodes);
-            unsigned rowcell = ncols * row;
-
-            // fill  cells between node pairs.
-            for (size_t i=0; i < nodes; i+=2) {
-                if (nCol[i+1] > 0 && nCol[i] < ncols) { // surely should be >= 0?
-                    for (size_t col = nCol[i]; col < nCol[i+1]; col++) {
-                        out.push_back(col + rowcell);
-                    }
-                }
-            }
-        }
-	}
+	scan_polygon(g, grid, false, out);
 	return(out);
 }
 
@@ -820,6 +763,18 @@ std::vector<std::vector<double>> SpatRaster::extractCell(std::vector<double> &ce
 				}
 				lyr++;
 			}
+		} else if (source[src].scratch) {
+			std::vector<double> g;
+			if (win) {
+				readRowColScratch(src, wrc[0], wrc[1], g);
+			} else {
+				readRowColScratch(src, rc[0], rc[1], g);
+			}
+			if (hasError()) return out;
+			for (size_t i=0; i<slyrs; i++) {
+				out[lyr] = std::vector<double>(g.begin() + i*n, g.begin() + (i+1)*n);
+				lyr++;
+			}
 		} else {
 			std::vector<std::vector<double>> srcout;
 			//if (source[0].driver == "raster") {
@@ -899,6 +854,17 @@ std::vector<double> SpatRaster::extractCellFlat(std::vector<double> &cell) {
 				}
 				lyr++;
 			}
+		} else if (source[src].scratch) {
+			std::vector<double> g;
+			if (win) {
+				readRowColScratch(src, wrc[0], wrc[1], g);
+			} else {
+				readRowColScratch(src, rc[0], rc[1], g);
+			}
+			if (hasError()) {
+				return out;
+			}
+			std::copy(g.begin(), g.end(), out.begin() + off);
 		} else {
 			//if (source[0].driver == "raster") {
 			//	srcout = readCellsBinary(src, cell);
@@ -922,7 +888,7 @@ std::vector<double> SpatRaster::extractCellFlat(std::vector<double> &cell) {
 				return out;
 			}
 		}
-		off += source[src].nlyr;
+		off += slyrs * n;
 	}
 	return out;
 }
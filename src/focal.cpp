@@ -633,6 +633,225 @@ void focal_win_mean(const std::vector<double> &d, std::vector<double> &out, int
 
 
 
+// The rows of a block that are needed for "nr" output rows, with "wnc/2" columns
+// added on both sides, such that each focal window is a rectangle in the output.
+// The added columns have "fill", or the values of the outer columns if "expand"
+std::vector<double> focal_pad(const std::vector<double> &d, int nc, int srow, int nr, int wnr, int wnc, double fill, bool expand) {
+	int hwc = wnc / 2;
+	int hwr = wnr / 2;
+	size_t pnr = nr + wnr - 1;
+	size_t pnc = nc + wnc - 1;
+	std::vector<double> p(pnr * pnc);
+	for (size_t i=0; i<pnr; i++) {
+		const double *row = &d[(srow - hwr + i) * nc];
+		double *prow = &p[i * pnc];
+		std::fill(prow, prow + hwc, expand ? row[0] : fill);
+		std::copy(row, row + nc, prow + hwc);
+		std::fill(prow + hwc + nc, prow + pnc, expand ? row[nc-1] : fill);
+	}
+	return p;
+}
+
+
+// running sums of the finite values, and the number of NAN, Inf and -Inf values
+class FocalSums {
+	public:
+		std::vector<double> sum, nan, pinf, ninf;
+
+		FocalSums(size_t n) : sum(n, 0), nan(n, 0), pinf(n, 0), ninf(n, 0) {}
+
+		void clear() {
+			std::fill(sum.begin(), sum.end(), 0);
+			std::fill(nan.begin(), nan.end(), 0);
+			std::fill(pinf.begin(), pinf.end(), 0);
+			std::fill(ninf.begin(), ninf.end(), 0);
+		}
+
+		// add (sign=1) or remove (sign=-1) the values of a row
+		void add(const double *x, double sign) {
+			for (size_t j=0; j<sum.size(); j++) {
+				if (std::isnan(x[j])) {
+					nan[j] += sign;
+				} else if (std::isinf(x[j])) {
+					if (x[j] > 0) pinf[j] += sign; else ninf[j] += sign;
+				} else {
+					sum[j] += sign * x[j];
+				}
+			}
+		}
+};
+
+
+// the sum (times "weight") or mean of the values in each window, with running sums:
+// per column of the rows in the window, and then of "wnc" columns of these sums.
+// Instead of updating a running sum, it is computed anew every "wnr" (or "wnc") steps
+// such that rounding errors do not accumulate. "nnan" gets the number of NANs.
+// If "padvalues" is false, a window with only NANs and added columns is NAN (with narm)
+void focal_win_sums(const std::vector<double> &p, std::vector<double> &out, std::vector<double> &nnan, 
+		int nc, int nr, int wnr, int wnc, double weight, bool mean, bool narm, bool padvalues) {
+
+	size_t pnc = nc + wnc - 1;
+	size_t ww = wnr * wnc;
+	int hwc = wnc / 2;
+	out.resize(nc * nr);
+	nnan.resize(nc * nr);
+	FocalSums cs(pnc);
+	for (int r=0; r < nr; r++) {
+		if ((r % wnr) == 0) {
+			cs.clear();
+			for (int i=0; i<wnr; i++) {
+				cs.add(&p[(r+i) * pnc], 1);
+			}
+		} else {
+			cs.add(&p[(r+wnr-1) * pnc], 1);
+			cs.add(&p[(r-1) * pnc], -1);
+		}
+		double s=0, n=0, pi=0, ni=0;
+		for (int c=0; c < nc; c++) {
+			if ((c % wnc) == 0) {
+				s = 0; n = 0; pi = 0; ni = 0;
+				for (int j=c; j<(c+wnc); j++) {
+					s += cs.sum[j]; n += cs.nan[j]; pi += cs.pinf[j]; ni += cs.ninf[j];
+				}
+			} else {
+				int j = c + wnc - 1;
+				s += cs.sum[j] - cs.sum[c-1];
+				n += cs.nan[j] - cs.nan[c-1];
+				pi += cs.pinf[j] - cs.pinf[c-1];
+				ni += cs.ninf[j] - cs.ninf[c-1];
+			}
+			size_t k = nc * r + c;
+			nnan[k] = n;
+			double nval = ww - n;
+			double nfound = nval;
+			if (!padvalues) {
+				int npad = std::max(0, hwc - c) + std::max(0, c + hwc - (nc - 1));
+				nfound -= npad * wnr;
+			}
+			if ((narm && (nfound == 0)) || ((!narm) && (n > 0))) {
+				out[k] = NAN;
+				continue;
+			}
+			double v = s;
+			if (pi > 0) {
+				v = (ni > 0) ? NAN : INFINITY;
+			} else if (ni > 0) {
+				v = -INFINITY;
+			}
+			out[k] = mean ? v / nval : v * weight;
+		}
+	}
+}
+
+
+// van Herk / Gil-Werman: the minimum (or maximum) of each window of "w" values 
+// with three comparisons per value. "g" has the running minimum from the start
+// of each segment of w values, "h" from the end of each segment.
+template <typename Compare>
+void vhgw_row(const double *x, size_t n, size_t w, double *out, std::vector<double> &g, std::vector<double> &h, Compare better) {
+	g.resize(n);
+	h.resize(n);
+	for (size_t i=0; i<n; i++) {
+		g[i] = ((i % w) == 0) ? x[i] : (better(x[i], g[i-1]) ? x[i] : g[i-1]);
+	}
+	for (size_t i=n; i>0; i--) {
+		size_t j = i-1;
+		h[j] = (((j % w) == (w-1)) || (j == (n-1))) ? x[j] : (better(x[j], h[j+1]) ? x[j] : h[j+1]);
+	}
+	for (size_t i=0; i<(n-w+1); i++) {
+		double a = h[i];
+		double b = g[i+w-1];
+		out[i] = better(b, a) ? b : a;
+	}
+}
+
+
+// the minimum or maximum of each window (of the values times "weight" > 0); first per
+// column (with vhgw on the rows) and then of these (with vhgw on the columns)
+template <typename Compare>
+void focal_win_minmax(std::vector<double> &p, std::vector<double> &out, const std::vector<double> &nnan,
+		int nc, int nr, int wnr, int wnc, double weight, bool narm, double worst, Compare better) {
+
+	size_t pnr = nr + wnr - 1;
+	size_t pnc = nc + wnc - 1;
+	out.resize(nc * nr);
+	for (double &d : p) {
+		if (std::isnan(d)) d = worst;
+	}
+	// the running minimum from the start of each segment of wnr rows
+	std::vector<double> g(p.size());
+	for (size_t i=0; i<pnr; i++) {
+		double *gi = &g[i*pnc];
+		const double *pi = &p[i*pnc];
+		if ((i % wnr) == 0) {
+			std::copy(pi, pi+pnc, gi);
+		} else {
+			const double *gp = gi - pnc;
+			for (size_t j=0; j<pnc; j++) {
+				gi[j] = better(pi[j], gp[j]) ? pi[j] : gp[j];
+			}
+		}
+	}
+	// the running minimum from the end of each segment, in place
+	for (size_t i=pnr; i>0; i--) {
+		size_t k = i-1;
+		if ((((k % wnr) == (size_t)(wnr-1))) || (k == (pnr-1))) continue;
+		double *hi = &p[k*pnc];
+		const double *hn = hi + pnc;
+		for (size_t j=0; j<pnc; j++) {
+			if (better(hn[j], hi[j])) hi[j] = hn[j];
+		}
+	}
+	// the minimum of the rows of the windows, in g (row r of g is not needed anymore)
+	for (int r=0; r<nr; r++) {
+		double *vr = &g[r*pnc];
+		const double *gr = &g[(r+wnr-1)*pnc];
+		const double *hr = &p[r*pnc];
+		for (size_t j=0; j<pnc; j++) {
+			vr[j] = better(gr[j], hr[j]) ? gr[j] : hr[j];
+		}
+	}
+	std::vector<double> rg, rh;
+	double ww = wnr * wnc;
+	for (int r=0; r<nr; r++) {
+		double *o = &out[r*nc];
+		vhgw_row(&g[r*pnc], pnc, wnc, o, rg, rh, better);
+		for (int c=0; c<nc; c++) {
+			double n = nnan[r*nc+c];
+			if ((narm && (n == ww)) || ((!narm) && (n > 0))) {
+				o[c] = NAN;
+			} else {
+				o[c] *= weight;
+			}
+		}
+	}
+}
+
+
+// focal sum, mean, min or max if all weights are the same.
+// O(1) per cell instead of O(wnr * wnc) for focal_win_sum etc.
+void focal_win_fast(const std::vector<double> &d, std::vector<double> &out, int nc, int srow, int nr,
+                    int wnr, int wnc, double weight, double fill, bool narm, bool expand, const std::string &fun) {
+
+	std::vector<double> p = focal_pad(d, nc, srow, nr, wnr, wnc, fill, expand);
+	std::vector<double> nnan;
+	if ((fun == "sum") || (fun == "mean")) {
+		// as in focal_win_sum, the fill value of the added columns is not a value that was found
+		bool padvalues = expand || std::isnan(fill) || (fun == "mean");
+		focal_win_sums(p, out, nnan, nc, nr, wnr, wnc, weight, fun == "mean", narm, padvalues);
+	} else {
+		std::vector<double> sums;
+		focal_win_sums(p, sums, nnan, nc, nr, wnr, wnc, weight, false, narm, true);
+		sums.resize(0);
+		if (fun == "min") {
+			focal_win_minmax(p, out, nnan, nc, nr, wnr, wnc, weight, narm, INFINITY, std::less<double>());
+		} else {
+			focal_win_minmax(p, out, nnan, nc, nr, wnr, wnc, weight, narm, -INFINITY, std::greater<double>());
+		}
+	}
+}
+
+
 SpatRaster SpatRaster::focal3(std::vector<unsigned> w, std::vector<double> m, double fillvalue, bool narm, bool naonly, std::string fun, bool expand, SpatOptions &opt) {
 
 	SpatRaster out = geometry(1);
@@ -681,11 +900,24 @@ SpatRaster SpatRaster::focal3(std::vector<unsigned> w, std::vector<double> m, do
 	}
 
 
+	// with the same weight for all cells, sum, mean, min and max are computed with 
+	// running sums or van Herk/Gil-Werman, instead of by visiting each cell of each window
+	double weight = m[0];
+	bool sameweight = std::isfinite(weight);
+	for (size_t i=1; i<m.size(); i++) {
+		if (m[i] != weight) {
+			sameweight = false;
+			break;
+		}
+	}
+	bool fast = sameweight && ((fun == "sum") || ((fun == "mean") && (weight == 1)) || 
+		(((fun == "min") || (fun == "max")) && (weight > 0)));
+
 	if (!readStart()) {
 		out.setError(getError());
 		return(out);
 	}
-	opt.ncopies += 2;
+	opt.ncopies += fast ? 4 : 2;
 	opt.minrows = w[0] > nr ? nr : w[0];
 	
  	if (!out.writeStart(opt)) {
@@ -730,9 +962,11 @@ SpatRaster SpatRaster::focal3(std::vector<unsigned> w, std::vector<double> m, do
 		std::vector<double> vin = readValues(rstart, rnrows, 0, nc);		
 		if (i==0) {
 			if (expand) {
-				fill = {vin.begin(), vin.begin()+nc};
-				for (size_t i=1; i<dhw0; i++) {
-					fill.insert(fill.end(), fill.begin(), fill.end());
+				std::vector<double> row(vin.begin(), vin.begin()+nc);
+				fill.resize(0);
+				fill.reserve(fsz2);
+				for (size_t j=0; j<dhw0; j++) {
+					fill.insert(fill.end(), row.begin(), row.end());
 				}
 			} else {
 				fill.resize(fsz2, fillvalue);
@@ -742,9 +976,10 @@ SpatRaster SpatRaster::focal3(std::vector<unsigned> w, std::vector<double> m, do
 		
 		if (i == (out.bs.n-1)) {
 			if (expand) {
-				fill = {vin.end()-nc, vin.end()};
-				for (size_t i=1; i<dhw0; i++) {
-					fill.insert(fill.end(), fill.begin(), fill.end());
+				std::vector<double> row(vin.end()-nc, vin.end());
+				fill.resize(0);
+				for (size_t j=0; j<dhw0; j++) {
+					fill.insert(fill.end(), row.begin(), row.end());
 				}
 			} else {
 				std::fill(fill.begin(), fill.end(), fillvalue);
@@ -752,7 +987,9 @@ SpatRaster SpatRaster::focal3(std::vector<unsigned> w, std::vector<double> m, do
 			vin.insert(vin.end(), fill.begin(), fill.end());
 		}
 
-		if (dofun) {
+		if (fast) {
+			focal_win_fast(vin, vout, nc, roff, out.bs.nrows[i], w[0], w[1], weight, fillvalue, narm, expand, fun);
+		} else if (dofun) {
 			focal_win_fun(vin, vout, nc, roff, out.bs.nrows[i], m, w[0], w[1], fillvalue, narm, expand, fFun);			
 		} else if (fun == "mean") {
 			focal_win_mean(vin, vout, nc, roff, out.bs.nrows[i], m, w[0], w[1], fillvalue, narm, expand);
@@ -765,8 +1002,9 @@ SpatRaster SpatRaster::focal3(std::vector<unsigned> w, std::vector<double> m, do
 		}
 	
 		if (naonly) {
+			// the first output row is row "roff" of vin
 			for (size_t j=0; j<vout.size(); j++) {
-				size_t k = fsz2 + j;
+				size_t k = roff * nc + j;
 				if (!std::isnan(vin[k])) {
 					vout[j] = vin[k];	
 				}
@@ -28,6 +28,7 @@
 #include "crs.h"
 #include "gdalio.h"
 #include "recycle.h"
+#include "spatSIMD.h"
 
 
 //#include <vector>
@@ -231,36 +232,48 @@ GDALResampleAlg getAlgo(std::string m) {
 }
 
 
-bool gdal_warper(GDALDatasetH &hSrcDS, GDALDatasetH &hDstDS, std::vector<unsigned> srcbands, std::vector<unsigned> dstbands, std::string method, std::string srccrs, std::string msg, bool verbose) {
+// the warp options for (a subset of) the bands of a source, into a buffer
+// of a raster with geotransform "dstGT". Only the source window that is
+// needed for each part of the output is read, and the operation can be
+// used for all blocks (see GDALWarpOperation::WarpRegionToBuffer)
+GDALWarpOperation* warp_operation(GDALDatasetH &hSrcDS, std::vector<unsigned> srcbands, std::vector<double> &naflags, std::string method, std::string srccrs, std::string dstcrs, double *dstGT, unsigned threads, std::string &msg, bool verbose) {
 
-	if (srcbands.size() != dstbands.size()) {
-		msg = "number of source bands must match number of dest bands";
-		return false;
-	}
 	int nbands = srcbands.size();
-
 	GDALResampleAlg a = getAlgo(method);
 
-    // Setup warp options.
-    GDALWarpOptions *psWarpOptions = GDALCreateWarpOptions();
-    psWarpOptions->hSrcDS = hSrcDS;
-    psWarpOptions->hDstDS = hDstDS;
+	double srcGT[6];
+	if (GDALGetGeoTransform(hSrcDS, srcGT) != CE_None) {
+		msg = "cannot get the geotransform of the source";
+		return NULL;
+	}
+
+	void *hTransformArg = GDALCreateGenImgProjTransformer3(srccrs.c_str(), srcGT, dstcrs.c_str(), dstGT);
+	if (hTransformArg == NULL) {
+		msg = "cannot create a transformer for these coordinate reference systems";
+		return NULL;
+	}
+
+	GDALWarpOptions *psWarpOptions = GDALCreateWarpOptions();
+	psWarpOptions->hSrcDS = hSrcDS;
+	// no destination dataset; the output goes to the buffer of a block
+	psWarpOptions->hDstDS = NULL;
 	psWarpOptions->eResampleAlg = a;
-    psWarpOptions->nBandCount = nbands;
-    psWarpOptions->panSrcBands = (int *) CPLMalloc(sizeof(int) * nbands );
-    psWarpOptions->panDstBands = (int *) CPLMalloc(sizeof(int) * nbands );
+	psWarpOptions->eWorkingDataType = GDT_Float64;
+	psWarpOptions->nBandCount = nbands;
+	psWarpOptions->panSrcBands = (int *) CPLMalloc(sizeof(int) * nbands );
+	psWarpOptions->panDstBands = (int *) CPLMalloc(sizeof(int) * nbands );
 	psWarpOptions->padfSrcNoDataReal = (double *) CPLMalloc(sizeof(double) * nbands );
 	psWarpOptions->padfDstNoDataReal = (double *) CPLMalloc(sizeof(double) * nbands );
 	psWarpOptions->padfSrcNoDataImag = (double *) CPLMalloc(sizeof(double) * nbands );
 	psWarpOptions->padfDstNoDataImag = (double *) CPLMalloc(sizeof(double) * nbands );
 
-	GDALRasterBandH hBand;
+	naflags.resize(nbands);
 	int hasNA;
 	for (int i=0; i<nbands; i++) {
 		psWarpOptions->panSrcBands[i] = (int) srcbands[i]+1;
-		psWarpOptions->panDstBands[i] = (int) dstbands[i]+1;
+		psWarpOptions->panDstBands[i] = i+1;
 
-		hBand = GDALGetRasterBand(hSrcDS, srcbands[i]+1);
+		GDALRasterBandH hBand = GDALGetRasterBand(hSrcDS, srcbands[i]+1);
 		double naflag = GDALGetRasterNoDataValue(hBand, &hasNA);
 		if (verbose && i == 0) {
 #ifdef useRcpp
@@ -269,41 +282,51 @@ bool gdal_warper(GDALDatasetH &hSrcDS, GDALDatasetH &hDstDS, std::vector<unsigne
 			Rcpp::Rcout << "NA flag       : " << naflag << std::endl;
 #endif
 		}
-		if (hasNA) {
-			psWarpOptions->padfSrcNoDataReal[i] = naflag;
-			psWarpOptions->padfDstNoDataReal[i] = naflag;
-			hBand = GDALGetRasterBand(hDstDS, dstbands[i]+1);
-			GDALSetRasterNoDataValue(hBand, naflag);
-		} else {
-			psWarpOptions->padfSrcNoDataReal[i] = NAN;
-			psWarpOptions->padfDstNoDataReal[i] = NAN;
-		}
+		if (!hasNA) naflag = NAN;
+		naflags[i] = naflag;
+		psWarpOptions->padfSrcNoDataReal[i] = naflag;
+		psWarpOptions->padfDstNoDataReal[i] = naflag;
 		psWarpOptions->padfSrcNoDataImag[i] = 0;
 		psWarpOptions->padfDstNoDataImag[i] = 0;
-    }
-
-	//psWarpOptions->pfnProgress = GDALTermProgress;
+	}
 
 	psWarpOptions->papszWarpOptions =
-     CSLSetNameValue( psWarpOptions->papszWarpOptions, "INIT_DEST", "NO_DATA");
+		CSLSetNameValue( psWarpOptions->papszWarpOptions, "INIT_DEST", "NO_DATA");
+	std::string nt = std::to_string(threads);
 	psWarpOptions->papszWarpOptions =
-      CSLSetNameValue( psWarpOptions->papszWarpOptions, "WRITE_FLUSH", "YES");
-
+		CSLSetNameValue( psWarpOptions->papszWarpOptions, "NUM_THREADS", nt.c_str());
+
+	psWarpOptions->pTransformerArg = hTransformArg;
+	psWarpOptions->pfnTransformer = GDALGenImgProjTransform;
+
+	GDALWarpOperation *oOperation = new GDALWarpOperation;
+	bool ok = oOperation->Initialize( psWarpOptions ) == CE_None;
+	// the operation has its own copy of the options, but not of the transformer
+	psWarpOptions->pTransformerArg = NULL;
+	GDALDestroyWarpOptions( psWarpOptions );
+	if (!ok) {
+		delete oOperation;
+		GDALDestroyGenImgProjTransformer( hTransformArg );
+		msg = "cannot initialize the warp operation";
+		return NULL;
+	}
+	return oOperation;
+}
 
-    psWarpOptions->pTransformerArg =
-        GDALCreateGenImgProjTransformer( hSrcDS, srccrs.c_str(),
-                                        hDstDS, GDALGetProjectionRef(hDstDS),
-                                        FALSE, 0.0, 1 );
-    psWarpOptions->pfnTransformer = GDALGenImgProjTransform;
 
-    GDALWarpOperation oOperation;
-    if (oOperation.Initialize( psWarpOptions ) != CE_None) {
-		return false;
+void warp_cleanup(std::vector<GDALWarpOperation*> &ops, std::vector<GDALDatasetH> &hSrcDS) {
+	for (size_t i=0; i<ops.size(); i++) {
+		if (ops[i] != NULL) {
+			void *hTransformArg = ops[i]->GetOptions()->pTransformerArg;
+			delete ops[i];
+			if (hTransformArg != NULL) GDALDestroyGenImgProjTransformer( hTransformArg );
+			ops[i] = NULL;
+		}
+	}
+	for (size_t i=0; i<hSrcDS.size(); i++) {
+		if (hSrcDS[i] != NULL) GDALClose( hSrcDS[i] );
+		hSrcDS[i] = NULL;
 	}
-    oOperation.ChunkAndWarpImage( 0, 0, GDALGetRasterXSize( hDstDS ), GDALGetRasterYSize( hDstDS ) );
-    GDALDestroyGenImgProjTransformer( psWarpOptions->pTransformerArg );
-    GDALDestroyWarpOptions( psWarpOptions );
-	return true;
 }
 
 
@@ -520,70 +543,75 @@ SpatRaster SpatRaster::warper(SpatRaster x, std::string crs, std::string method,
 		opt = SpatOptions(opt);
 	}
 
-	opt.ncopies += 4;
+	opt.ncopies += 2;
 	if (!out.writeStart(opt)) {
 		return out;		
 	}
 
 	std::string errmsg;
 	size_t ns = nsrc();
+	std::string dstcrs = out.getSRS("wkt");
 	SpatExtent eout = out.getExtent();
-
-
-	std::vector<bool> has_so = source[0].has_scale_offset;
-	std::vector<double> scale = source[0].scale;
-	std::vector<double> offset = source[0].offset;
-	for (size_t i=1; i<ns; i++) {
-		has_so.insert(has_so.end(), source[0].has_scale_offset.begin(), source[0].has_scale_offset.end());
-		scale.insert(scale.end(), source[0].scale.begin(), source[0].scale.end());
-		offset.insert(offset.end(), source[0].offset.begin(), source[0].offset.end());
+	std::vector<double> rs = out.resolution();
+	double dstGT[6] = { eout.xmin, rs[0], 0, eout.ymax, 0, -1 * rs[1] };
+	
+	// open the sources (or wrap the values of in memory sources) and set up 
+	// the warp operations once, and use them for all blocks
+	std::vector<GDALDatasetH> hSrcDS(ns, NULL);
+	std::vector<GDALWarpOperation*> ops(ns, NULL);
+	std::vector<std::vector<double>> naflags(ns);
+	unsigned threads = opt.get_threads();
+	for (size_t i=0; i<ns; i++) {
+		// values in memory are not copied (see open_gdal)
+		if (!open_gdal(hSrcDS[i], i, sopt)) {
+			warp_cleanup(ops, hSrcDS);
+			out.setError("cannot create dataset from source");
+			return out;
+		}
+		ops[i] = warp_operation(hSrcDS[i], source[i].layers, naflags[i], method, srccrs, dstcrs, dstGT, threads, errmsg, opt.get_verbose());
+		if (ops[i] == NULL) {
+			warp_cleanup(ops, hSrcDS);
+			out.setError(errmsg);
+			return out;
+		}
 	}
 
+	size_t nc = out.ncol();
 	for (size_t i = 0; i < out.bs.n; i++) {
-		int bandstart = 0;
-		eout.ymax = out.yFromRow(out.bs.row[i]);
-		eout.ymin = out.yFromRow(out.bs.row[i] + out.bs.nrows[i]-1);
-		SpatRaster crop_out = out.crop(eout, "out", sopt);
-		GDALDatasetH hDstDS;
-
-		if (!crop_out.create_gdalDS(hDstDS, "", "MEM", false, NAN, has_so, scale, offset, sopt)) {
-			return crop_out;
-		}
-	
-		for (size_t i=0; i<ns; i++) {
-
-			GDALDatasetH hSrcDS;
-
-			if (!open_gdal(hSrcDS, i, sopt)) {
-				out.setError("cannot create dataset from source");
-				if( hDstDS != NULL ) GDALClose( (GDALDatasetH) hDstDS );
+		size_t ncl = out.bs.nrows[i] * nc;
+		std::vector<double> v(ncl * out.nlyr());
+		size_t bandstart = 0;
+		for (size_t j=0; j<ns; j++) {
+			// the layers of a source are consecutive in "v"
+			double *b = &v[bandstart * ncl];
+			// cells that are not covered by the source are not written to
+			std::fill(b, b + naflags[j].size() * ncl, NAN);
+			CPLErr err = ops[j]->WarpRegionToBuffer(0, out.bs.row[i], nc, out.bs.nrows[i], b, GDT_Float64);
+			if (err != CE_None) {
+				warp_cleanup(ops, hSrcDS);
+				out.setError("cannot do this transformation (warp)");
 				return out;
 			}
-			std::vector<unsigned> srcbands = source[i].layers;
-			std::vector<unsigned> dstbands(srcbands.size()); 
-			std::iota (dstbands.begin(), dstbands.end(), bandstart); 
-			bandstart += dstbands.size();
-
-
-			bool success = gdal_warper(hSrcDS, hDstDS, srcbands, dstbands, method, srccrs, errmsg, opt.get_verbose());
-			if( hSrcDS != NULL ) GDALClose( (GDALDatasetH) hSrcDS );
-			if (!success) {
-				if( hDstDS != NULL ) GDALClose( (GDALDatasetH) hDstDS );
-				out.setError(errmsg);
-				return out;
+			for (size_t k=0; k<naflags[j].size(); k++) {
+				double *lyr = b + k * ncl;
+				double naflag = naflags[j][k];
+				if (!std::isnan(naflag)) {
+					bool below = naflag < -3.4e+37;
+					simd_set_na(lyr, ncl, below ? -3.4e+37 : naflag, below);
+				}
+				size_t lyrk = source[j].layers[k];
+				if ((lyrk < source[j].has_scale_offset.size()) && source[j].has_scale_offset[lyrk]) {
+					simd_scale_offset(lyr, ncl, source[j].scale[lyrk], source[j].offset[lyrk]);
+				}
 			}
+			bandstart += naflags[j].size();
 		}
-
-		bool ok = crop_out.from_gdalMEM(hDstDS, false, true); 
-	
-		if( hDstDS != NULL ) GDALClose( (GDALDatasetH) hDstDS );
-		if (!ok) {
-			out.setError("cannot do this transformation (warp)");
+		if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, nc)) {
+			warp_cleanup(ops, hSrcDS);
 			return out;
 		}
-		std::vector<double> v = crop_out.getValues(-1);
-		if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, out.ncol())) return out;
 	}
+	warp_cleanup(ops, hSrcDS);
 	out.writeStop();
 
 	if (mask) {
@@ -875,8 +903,8 @@ SpatRaster SpatRaster::rgb2col(size_t r,  size_t g, size_t b, SpatOptions &opt)
 		return out;
 	}
 	GDALRasterBandH R = GDALGetRasterBand(hSrcDS,1);
-	GDALRasterBandH G = GDALGetRasterBand(hSrcDS,1);
-	GDALRasterBandH B = GDALGetRasterBand(hSrcDS,1);
+	GDALRasterBandH G = GDALGetRasterBand(hSrcDS,2);
+	GDALRasterBandH B = GDALGetRasterBand(hSrcDS,3);
 
 	GDALColorTableH hColorTable= GDALCreateColorTable(GPI_RGB);
 
@@ -886,7 +914,8 @@ SpatRaster SpatRaster::rgb2col(size_t r,  size_t g, size_t b, SpatOptions &opt)
 		return out;
 	}	
 	
-	if (!out.create_gdalDS(hDstDS, filename, driver, true, 0, {false}, {0.0}, {1.0}, opt)) {
+	bool inplace = driver == "MEM";
+	if (!out.create_gdalDS(hDstDS, filename, driver, true, 0, {false}, {0.0}, {1.0}, opt, inplace)) {
 		out.setError("cannot create new dataset");
 		GDALClose(hSrcDS);
 		return out;
@@ -903,7 +932,7 @@ SpatRaster SpatRaster::rgb2col(size_t r,  size_t g, size_t b, SpatOptions &opt)
 	GDALClose(hSrcDS);
 
 	if (driver == "MEM") {
-		if (!out.from_gdalMEM(hDstDS, false, true)) {
+		if (!out.from_gdalMEM(hDstDS, false, true, inplace)) {
 			out.setError("conversion failed (mem)");
 			GDALClose(hDstDS);
 			return out;
@@ -943,7 +972,7 @@ SpatRaster SpatRaster::rgb2col(size_t r,  size_t g, size_t b, SpatOptions &opt)
 
 	
 SpatRaster SpatRaster::sievefilter(int threshold, int connections, SpatOptions &opt) {	
-	SpatRaster out;
+	SpatRaster out = geometry(1);
 	std::string filename = opt.get_filename();
 	std::string driver;
 	if (filename == "") {
@@ -980,7 +1009,8 @@ SpatRaster SpatRaster::sievefilter(int threshold, int connections, SpatOptions &
 		out.setError("empty driver");
 		return out;
 	}
-	if (!out.create_gdalDS(hDstDS, filename, driver, true, 0, source[0].has_scale_offset, source[0].scale, source[0].offset, opt)) {
+	bool inplace = driver == "MEM";
+	if (!out.create_gdalDS(hDstDS, filename, driver, true, 0, source[0].has_scale_offset, source[0].scale, source[0].offset, opt, inplace)) {
 		out.setError("cannot create new dataset");
 		GDALClose(hSrcDS);
 		return out;
@@ -989,7 +1019,7 @@ SpatRaster SpatRaster::sievefilter(int threshold, int connections, SpatOptions &
 	GDALRasterBandH hSrcBand = GDALGetRasterBand(hSrcDS, 1);
 	GDALRasterBandH hTargetBand = GDALGetRasterBand(hDstDS, 1);
 
-	if (!GDALSieveFilter(hSrcBand, NULL, hTargetBand, threshold, connections, NULL, NULL, NULL)) {
+	if (GDALSieveFilter(hSrcBand, NULL, hTargetBand, threshold, connections, NULL, NULL, NULL) != CE_None) {
 		out.setError("sieve failed");
 		GDALClose(hSrcDS);
 		GDALClose(hDstDS);
@@ -998,7 +1028,7 @@ SpatRaster SpatRaster::sievefilter(int threshold, int connections, SpatOptions &
 	
 	GDALClose(hSrcDS);
 	if (driver == "MEM") {
-		if (!out.from_gdalMEM(hDstDS, false, true)) {
+		if (!out.from_gdalMEM(hDstDS, false, true, inplace)) {
 			out.setError("conversion failed (mem)");
 			GDALClose(hDstDS);
 			return out;
@@ -1,54 +1,145 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
 
 #include "spatRaster.h"
 
-/*
-#if GDAL_VERSION_MAJOR >= 3 && GDAL_VERSION_MINOR >= 1
-
-#include "proj.h"
-
-#include "ogr_spatialref.h"
+#if (GDAL_VERSION_MAJOR > 3) || (GDAL_VERSION_MAJOR == 3 && GDAL_VERSION_MINOR >= 1)
 
+#include <numeric>
+#include <algorithm>
+#include <cmath>
 #include "gdal_priv.h"
 #include "gdal.h"
-#include "crs.h"
 #include "string_utils.h"
+#include "spatChunkCache.h"
+#include "ram.h"
+
+// read_gdal.cpp
+std::vector<int_64> ncdf_time(const std::vector<std::string> &metadata, std::vector<std::string> vals, std::string &step, std::string &msg);
+void NAso(std::vector<double> &d, size_t n, const std::vector<double> &flags, const std::vector<double> &scale, const std::vector<double>  &offset, const std::vector<bool> &haveso, const bool haveUserNAflag, const double userNAflag);
+
+
+// a hyperslab of an array. With stride, element (i, j, ...) goes to
+// sum(index * stride) of out; otherwise out is in row-major order
+bool md_read(GDALMDArrayH h, const std::vector<size_t> &start, const std::vector<size_t> &count, const std::vector<size_t> &stride, double *out) {
+	size_t nd = start.size();
+	std::vector<GUInt64> gstart(start.begin(), start.end());
+	std::vector<GPtrDiff_t> gstride(stride.begin(), stride.end());
+	GDALExtendedDataTypeH hDT = GDALExtendedDataTypeCreate(GDT_Float64);
+	int ok = GDALMDArrayRead(h, gstart.data(), count.data(),
+			NULL, // step: 1 for all dimensions
+			(gstride.size() == nd) ? gstride.data() : NULL,
+			hDT, out,
+			NULL, 0 // the extent of out is not checked
+		);
+	GDALExtendedDataTypeRelease(hDT);
+	return ok != 0;
+}
+
+
+// the coordinates of a dimension (if it has an indexing variable)
+bool md_dim_values(const std::shared_ptr<GDALDimension> &dim, std::vector<double> &vals, std::string &units, std::string &calendar) {
+	auto indvar = dim->GetIndexingVariable();
+	if (!indvar) return false;
+	size_t n = static_cast<size_t>(dim->GetSize());
+	vals.resize(n);
+	std::vector<GUInt64> start = {0};
+	std::vector<size_t> count = {n};
+	if (!indvar->Read(start.data(), count.data(), nullptr, nullptr, GDALExtendedDataType::Create(GDT_Float64), &vals[0])) {
+		return false;
+	}
+	auto att = indvar->GetAttribute("units");
+	if (att) {
+		const char *s = att->ReadAsString();
+		if (s != NULL) units = s;
+	}
+	att = indvar->GetAttribute("calendar");
+	if (att) {
+		const char *s = att->ReadAsString();
+		if (s != NULL) calendar = s;
+	}
+	return true;
+}
+
+
+// first and last cell center, and the resolution; false if the
+// coordinates are not equally spaced
+bool md_spacing(const std::vector<double> &v, double &first, double &last, double &res) {
+	size_t n = v.size();
+	first = v[0];
+	last = v[n-1];
+	if (n == 1) {
+		res = 1;
+		return true;
+	}
+	res = (last - first) / (n-1);
+	double tol = std::fabs(res) * 0.001;
+	for (size_t i=1; i<n; i++) {
+		if (std::fabs((v[i] - v[i-1]) - res) > tol) {
+			return false;
+		}
+	}
+	return true;
+}
 
 
 bool SpatRaster::constructFromFileMulti(std::string fname, std::string sub, std::vector<size_t> xyz) {
 
-	if (xyz.size() != 3) {
-		setError("you must supply three dimension indices");
-        return false;
+	auto poDataset = std::unique_ptr<GDALDataset>(
+		GDALDataset::Open(fname.c_str(), GDAL_OF_MULTIDIM_RASTER ));
+	if( !poDataset ) {
+		setError("cannot open file: " + fname);
+		return false;
 	}
-	
-    auto poDataset = std::unique_ptr<GDALDataset>(
-        GDALDataset::Open(fname.c_str(), GDAL_OF_MULTIDIM_RASTER ));
-    if( !poDataset ) {
-		setError("not a good dataset");
-        return false;
-    }
 
 	auto poRootGroup = poDataset->GetRootGroup();
-    if( !poRootGroup ) {
-		setError("no roots");
+	if( !poRootGroup ) {
+		setError("cannot open the root group of: " + fname);
 		return false;
-    }
+	}
 
-	bool warngroup = false;
-	std::vector<std::string> gnames;
+	std::vector<std::string> gnames = poRootGroup->GetMDArrayNames();
+	std::vector<std::string> candidates;
+	for (size_t i=0; i<gnames.size(); i++) {
+		auto a = poRootGroup->OpenMDArray(gnames[i]);
+		if (a && (a->GetDimensionCount() >= 2)) {
+			candidates.push_back(gnames[i]);
+		}
+	}
 	if (sub == "") {
-		char** papszOptions = NULL;
-		gnames = poRootGroup->GetMDArrayNames(papszOptions);
-		CSLDestroy(papszOptions);
-		sub = gnames[0];
-		if (gnames.size() > 1) warngroup = true;
+		if (candidates.size() == 0) {
+			setError("no arrays with two or more dimensions in: " + fname);
+			return false;
+		}
+		sub = candidates[0];
+		if (candidates.size() > 1) {
+			std::string gn = "";
+			for (size_t i=1; i<candidates.size(); i++) {
+				gn += (i > 1 ? ", " : "") + candidates[i];
+			}
+			addWarning("using: " + sub + ". Other arrays are: " + gn);
+		}
 	}
 
-    auto poVar = poRootGroup->OpenMDArray(sub.c_str());
-    if( !poVar )   {
+	auto poVar = poRootGroup->OpenMDArray(sub);
+	if( !poVar )   {
 		setError("cannot find: " + sub);
 		return false;
-    }
+	}
 
 	SpatRasterSource s;
 
@@ -60,7 +151,7 @@ bool SpatRaster::constructFromFileMulti(std::string fname, std::string sub, std:
 		OGRErr err = srs->exportToWkt(&cp, options);
 		if (err == OGRERR_NONE) {
 			wkt = std::string(cp);
-		} 
+		}
 		CPLFree(cp);
 	}
 	std::string msg;
@@ -68,118 +159,160 @@ bool SpatRaster::constructFromFileMulti(std::string fname, std::string sub, std:
 		addWarning(msg);
 	}
 
-
 	std::vector<size_t> dimcount;
 	std::vector<std::string> dimnames;
-	std::vector<double> dim_start, dim_end;
+	auto dims = poVar->GetDimensions();
+	for ( const auto &poDim: dims ) {
+		dimcount.push_back(static_cast<size_t>(poDim->GetSize()));
+		dimnames.push_back(poDim->GetName());
+	}
+	size_t nd = dimcount.size();
 
-	GDALExtendedDataTypeH hDT = GDALExtendedDataTypeCreate(GDT_Float64);
-    for ( const auto &poDim: poVar->GetDimensions() ) {
-        dimcount.push_back(static_cast<size_t>(poDim->GetSize()));
-        dimnames.push_back(static_cast<std::string>(poDim->GetName()));
-
-		std::vector<size_t> count = {dimcount[dimcount.size()-1]};
-		std::vector<double> vals(count[0]);
-
-		const auto indvar = poDim->GetIndexingVariable();
-		indvar->Read(
-			std::vector<GUInt64>{0}.data(),
-            count.data(), nullptr, nullptr, 
-            GDALExtendedDataType::Create(GDT_Float64),
-            &vals[0]);
-
-		// to do: check for equal spacing if x or y dim
-		dim_start.push_back(vals[0]);
-        dim_end.push_back(vals[vals.size()-1]);
-		Rcpp::Rcout << vals[0] << " - " << vals[vals.size()-1] << std::endl;
-
-    }
-    GDALExtendedDataTypeRelease(hDT); 	
-
-	s.m_ndims = dimcount.size();
-
-	if (warngroup) {
-		std::string gn = "";
-		for (size_t i=0; i<gnames.size(); i++) {
-			if (!is_in_vector(gnames[i], dimnames) &&  (gnames[i] != sub)) { 
-				gn += gnames[i] + ", ";
+	// by default, the CF order (..., z, y, x)
+	if (xyz.size() == 0) {
+		xyz = {nd-1, nd-2};
+		if (nd > 2) xyz.push_back(nd-3);
+	}
+	if ((xyz.size() != 3) && !((xyz.size() == 2) && (nd == 2))) {
+		setError("you must supply three dimension indices (x, y, z)");
+		return false;
+	}
+	std::vector<std::string> xyzname = {"x", "y", "z"};
+	for (size_t i=0; i<xyz.size(); i++) {
+		if (xyz[i] >= nd) {
+			setError("the " + xyzname[i] + " dimension is not valid");
+			return false;
+		}
+		for (size_t j=0; j<i; j++) {
+			if (xyz[i] == xyz[j]) {
+				setError("the x, y and z dimensions must be different");
+				return false;
 			}
 		}
-		addWarning("using: " + sub + ". Other groups are: \n" + gn);
 	}
+	if (nd == 2) xyz.resize(2);
+
+	s.m_ndims = nd;
+	s.m_counts = dimcount;
+	s.m_dims = xyz;
+	for (size_t i=0; i<xyz.size(); i++) {
+		s.m_dimnames.push_back(dimnames[xyz[i]]);
+	}
+	// other dimensions are read at their first index
+	for (size_t i=0; i<nd; i++) {
+		if (std::find(xyz.begin(), xyz.end(), i) == xyz.end()) {
+			s.m_dims.push_back(i);
+			s.m_dimnames.push_back(dimnames[i]);
+		}
+	}
+	if (nd > 3) {
+		std::string dn = s.m_dimnames[3];
+		for (size_t i=4; i<nd; i++) dn += ", " + s.m_dimnames[i];
+		addWarning("using the first index of: " + dn);
+	}
+
+	s.ncol = dimcount[xyz[0]];
+	s.nrow = dimcount[xyz[1]];
+	s.nlyr = nd > 2 ? dimcount[xyz[2]] : 1;
+
+	// the native chunks; zero if the array is not chunked
+	std::vector<GUInt64> bs = poVar->GetBlockSize();
+	s.m_chunks = std::vector<size_t>(nd, 0);
+	if (bs.size() == nd) {
+		for (size_t i=0; i<nd; i++) s.m_chunks[i] = bs[i];
+		s.blockcols = s.m_chunks[xyz[0]];
+		s.blockrows = s.m_chunks[xyz[1]];
+	}
+
+	SpatExtent e(0, s.ncol, 0, s.nrow);
+	std::vector<double> xv, yv;
+	std::string units, calendar;
+	bool hasx = md_dim_values(dims[xyz[0]], xv, units, calendar);
+	bool hasy = md_dim_values(dims[xyz[1]], yv, units, calendar);
+	if (hasx && hasy) {
+		double x1, x2, xres, y1, y2, yres;
+		bool eqx = md_spacing(xv, x1, x2, xres);
+		bool eqy = md_spacing(yv, y1, y2, yres);
+		if (!(eqx && eqy)) {
+			addWarning("cells are not equally spaced; the extent is approximate");
+		}
+		if (xres < 0) {
+			std::swap(x1, x2);
+			xres = -xres;
+		}
+		if (yres > 0) {
+			// south-up: the first row in the file is the southernmost
+			s.flipped = true;
+			std::swap(y1, y2);
+		} else {
+			yres = -yres;
+		}
+		e = SpatExtent(x1 - 0.5 * xres, x2 + 0.5 * xres, y2 - 0.5 * yres, y1 + 0.5 * yres);
+	} else {
+		addWarning("no coordinates for the x and y dimensions");
+	}
+	s.extent = e;
+
 	s.source_name = sub;
-	s.source_name_long = poVar->GetAttribute("long_name")->ReadAsString();
+	auto lname = poVar->GetAttribute("long_name");
+	if (lname) {
+		const char *ln = lname->ReadAsString();
+		if (ln != NULL) s.source_name_long = ln;
+	}
 
 	s.m_hasNA = false;
 	double NAval = poVar->GetNoDataValueAsDouble(&s.m_hasNA);
 	if (s.m_hasNA) {
 		s.m_missing_value = NAval;
 	}
-
-	SpatExtent e;
-	if (xyz[0] < s.m_ndims) {
-		s.nrow = dimcount[xyz[0]];
-		s.m_dimnames.push_back(dimnames[xyz[0]]);
-		double res = (dim_start[xyz[0]] - dim_end[xyz[0]]) / (s.nrow-1);
-		e.ymax = dim_start[xyz[0]] + 0.5 * res;
-		e.ymin = dim_end[xyz[0]] - 0.5 * res;
-	} else {
-		setError("the second dimension is not valid");
-		return false;		
-	}
-	if (xyz[1] < s.m_ndims) {
-		s.ncol = dimcount[xyz[1]];
-		s.m_dimnames.push_back(dimnames[xyz[1]]);
-		double res = (dim_end[xyz[1]] - dim_start[xyz[1]]) / (s.ncol-1);
-		e.xmin = dim_start[xyz[1]] - 0.5 * res;
-		e.xmax = dim_end[xyz[1]] + 0.5 * res;
-	} else {
-		setError("the first dimension is not valid");
-		return false;		
+	bool hasScale = false, hasOffset = false;
+	double scale = poVar->GetScale(&hasScale);
+	double offset = poVar->GetOffset(&hasOffset);
+	if (!hasScale) scale = 1;
+	if (!hasOffset) offset = 0;
+	s.has_scale_offset = std::vector<bool>(s.nlyr, hasScale || hasOffset);
+	s.scale = std::vector<double>(s.nlyr, scale);
+	s.offset = std::vector<double>(s.nlyr, offset);
+
+	s.names.resize(s.nlyr);
+	for (size_t i=0; i<s.nlyr; i++) {
+		s.names[i] = sub + "_" + std::to_string(i+1);
 	}
-	if (s.m_ndims > 2) {
-		if (xyz[2] < s.m_ndims) {
-			s.nlyr = dimcount[xyz[2]];
-			s.m_dimnames.push_back(dimnames[xyz[2]]);
-		} else {
-			setError("the third dimension is not valid");
-			return false;		
-		}
-	}
-	s.m_dims = xyz;
-	s.extent = e;	
-	if (s.m_ndims > 3) {
-		for (size_t i=0; i<s.m_ndims; i++) {
-			bool found = false;
-			for (size_t j=0; j<3; j++) {
-				if (i == xyz[j]) found = true;
-			}
-			if (!found) {
-				s.m_dims.push_back(i);
-				s.m_dimnames.push_back(dimnames[i]);				
+	if (nd > 2) {
+		std::vector<double> zv;
+		units = "";
+		calendar = "standard";
+		if (md_dim_values(dims[xyz[2]], zv, units, calendar)) {
+			if (units.find(" since ") != std::string::npos) {
+				std::vector<std::string> meta = {"time#units=" + units, "time#calendar=" + calendar};
+				std::vector<std::string> vals;
+				for (size_t i=0; i<zv.size(); i++) vals.push_back(double_to_string(zv[i]));
+				std::string step;
+				std::vector<int_64> tm = ncdf_time(meta, vals, step, msg);
+				if (msg != "") addWarning(msg);
+				if (tm.size() == s.nlyr) {
+					s.time = tm;
+					s.timestep = step;
+					s.hasTime = true;
+				}
+			} else if (s.m_dimnames[2] == "depth") {
+				s.depth = zv;
 			}
 		}
 	}
-	
+
 	s.nlyrfile = s.nlyr;
 	s.layers.resize(s.nlyr);
-    std::iota(s.layers.begin(), s.layers.end(), 0);
-	s.flipped = false;
+	std::iota(s.layers.begin(), s.layers.end(), 0);
 	s.rotated = false;
 	s.memory = false;
 	s.filename = fname;
+	s.driver = "gdal";
 	s.hasValues = true;
 	s.unit = std::vector<std::string>(s.nlyr, poVar->GetUnit());
 	s.multidim = true;
 
-// layer names
-// time 
-// extent
-	s.m_counts = dimcount;
 	setSource(s);
-	for (size_t i=0; i<s.m_ndims; i++){
-		Rcpp::Rcout << s.m_dims[i] << " " << s.m_dimnames[i] << " " << s.m_counts[s.m_dims[i]] << std::endl;
-	}
 	return true;
 }
 
@@ -187,96 +320,201 @@ bool SpatRaster::constructFromFileMulti(std::string fname, std::string sub, std:
 
 bool SpatRaster::readStartMulti(unsigned src) {
 
-    GDALDatasetH hDS = GDALOpenEx( source[src].filename.c_str(), GDAL_OF_MULTIDIM_RASTER, NULL, NULL, NULL);
-    if (!hDS) {
-		setError("not a good dataset");
-        return false;
-    }
-    GDALGroupH hGroup = GDALDatasetGetRootGroup(hDS);
-    GDALReleaseDataset(hDS);
-    if (!hGroup) {
-		setError("not a good root group");
+	GDALDatasetH hDS = GDALOpenEx( source[src].filename.c_str(), GDAL_OF_MULTIDIM_RASTER, NULL, NULL, NULL);
+	if (!hDS) {
+		setError("cannot open file: " + source[src].filename);
 		return false;
-    }
-    
-	GDALMDArrayH hVar = GDALGroupOpenMDArray(hGroup, source[src].source_name.c_str(), NULL);
-    GDALGroupRelease(hGroup);
-    if (!hVar) {
-		setError("not a good array");
+	}
+	GDALGroupH hGroup = GDALDatasetGetRootGroup(hDS);
+	GDALReleaseDataset(hDS);
+	if (!hGroup) {
+		setError("cannot open the root group of: " + source[src].filename);
 		return false;
-    }
+	}
 
+	GDALMDArrayH hVar = GDALGroupOpenMDArray(hGroup, source[src].source_name.c_str(), NULL);
+	GDALGroupRelease(hGroup);
+	if (!hVar) {
+		setError("cannot open: " + source[src].source_name);
+		return false;
+	}
 	source[src].gdalmdarray = hVar;
+
+	// chunked arrays are read one whole chunk at a time (that is how they
+	// are compressed), and the chunks are kept for the next request.
+	// Contiguous arrays are read directly
+	bool chunked = source[src].m_chunks.size() == source[src].m_ndims;
+	for (size_t i=0; i<source[src].m_chunks.size(); i++) {
+		chunked = chunked && (source[src].m_chunks[i] > 0);
+	}
+	if (chunked) {
+		size_t maxbytes = std::min(availableRAM() / 10, 1073741824.0);
+		SpatSlabReader reader = [hVar](const std::vector<size_t> &start, const std::vector<size_t> &count, std::vector<double> &buf) {
+			return md_read(hVar, start, count, std::vector<size_t>(), buf.data());
+		};
+		source[src].m_cache = std::make_shared<SpatChunkCache>(source[src].m_counts, source[src].m_chunks, maxbytes, reader);
+	}
+	source[src].open_read = true;
 	return true;
 }
 
 
 bool SpatRaster::readStopMulti(unsigned src) {
+	source[src].m_cache.reset();
 	GDALMDArrayRelease(source[src].gdalmdarray);
 	source[src].open_read = false;
 	return true;
 }
 
 
-bool SpatRaster::readValuesMulti(std::vector<double> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols) {
-	
-
-	std::vector<GUInt64> offset(source[src].m_ndims, 0);
-	std::vector<size_t> dims = source[src].m_dims;
+bool SpatRaster::readMulti(std::vector<double> &out, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols, const std::vector<unsigned> &lyrs) {
 
-	offset[source[src].m_dims[0]] = row;
-	offset[source[src].m_dims[1]] = col;
-	offset[source[src].m_dims[2]] = 0;
+	bool isopen = source[src].open_read;
+	if (!isopen) {
+		if (!readStartMulti(src)) return false;
+	}
+	SpatRasterSource &s = source[src];
 
-//	std::vector<size_t> count = source[src].m_counts;
-	std::vector<size_t> count(source[src].m_ndims, 1);
-	count[source[src].m_dims[0]] = nrows;
-	count[source[src].m_dims[1]] = ncols;
-	count[source[src].m_dims[2]] = nlyr();
+	if (s.hasWindow) {
+		row = row + s.window.off_row;
+		col = col + s.window.off_col;
+	}
+	size_t nd = s.m_ndims;
+	size_t xd = s.m_dims[0];
+	size_t yd = s.m_dims[1];
+	if (s.flipped) {
+		row = s.m_counts[yd] - row - nrows;
+	}
 
-	size_t n=1;
-	for (size_t i=0; i<count.size(); i++) {
-		n *= count[i];
+	size_t ncell = nrows * ncols;
+	size_t nl = lyrs.size();
+	std::vector<double> v(ncell * nl);
+	bool ok = true;
+	// one hyperslab for each run of consecutive layers, written in place
+	size_t i = 0;
+	while (ok && (i < nl)) {
+		size_t j = i + 1;
+		while ((j < nl) && (lyrs[j] == (lyrs[j-1] + 1))) j++;
+		std::vector<size_t> start(nd, 0), count(nd, 1), stride(nd, 0);
+		start[xd] = col;
+		count[xd] = ncols;
+		stride[xd] = 1;
+		start[yd] = row;
+		count[yd] = nrows;
+		stride[yd] = ncols;
+		if (nd > 2) {
+			size_t zd = s.m_dims[2];
+			start[zd] = lyrs[i];
+			count[zd] = j - i;
+			stride[zd] = ncell;
+		}
+		double *dst = v.data() + i * ncell;
+		if (s.m_cache) {
+			ok = s.m_cache->read(start, count, stride, dst);
+		} else {
+			ok = md_read(s.gdalmdarray, start, count, stride, dst);
+		}
+		i = j;
+	}
+	if (!isopen) {
+		readStopMulti(src);
+	}
+	if (!ok) {
+		setError("cannot read values");
+		return false;
 	}
-	
-	//count = {3600, 1, 1, 7200, 1};
 
-	GDALExtendedDataTypeH hDT = GDALExtendedDataTypeCreate(GDT_Float64);
-	
-	std::vector<double> temp;
-	temp.resize(n);
-	GDALMDArrayRead(source[src].gdalmdarray,
-						&offset[0],
-						&count[0],
-						NULL, // step: defaults to 1,1,1
-						NULL, // stride: default to row-major convention
-						hDT,
-						&temp[0],
-						NULL, // array start. Omitted 
-						0 // array size in bytes. Omitted 
-						);
-    GDALExtendedDataTypeRelease(hDT); 	
-	
-	size_t nc = ncell();
-	size_t nl = nlyr();
-	out.resize(0);
-	out.reserve(n);
-	for (size_t i=0; i<nl; i++) {
-		for (size_t j=0; j<nc; j++) {
-			out.push_back( temp[nl*j + i] );
+	std::vector<double> naflags(nl, s.m_hasNA ? s.m_missing_value : NAN);
+	std::vector<bool> haveso(nl, s.has_scale_offset[0]);
+	std::vector<double> scale(nl, s.scale[0]), offset(nl, s.offset[0]);
+	NAso(v, ncell, naflags, scale, offset, haveso, s.hasNAflag, s.NAflag);
+
+	if (s.flipped) {
+		for (size_t k=0; k<nl; k++) {
+			double *d = v.data() + k * ncell;
+			for (size_t r=0; r<(nrows/2); r++) {
+				std::swap_ranges(d + r * ncols, d + (r+1) * ncols, d + (nrows-r-1) * ncols);
+			}
 		}
 	}
+	out.insert(out.end(), v.begin(), v.end());
+	return true;
+}
+
+
+bool SpatRaster::readValuesMulti(std::vector<double> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols) {
+	return readMulti(out, src, row, nrows, col, ncols, source[src].layers);
+}
 
-	if (source[src].m_hasNA) {
-		std::replace (out.begin(), out.end(), source[src].m_missing_value, (double)NAN);
+
+// values for cells, layer by layer. For a chunked array, each cell only
+// touches the chunks that it is in (a time series is one column of chunks)
+bool SpatRaster::readRowColMulti(unsigned src, const std::vector<int_64> &rows, const std::vector<int_64> &cols, std::vector<double> &out) {
+
+	bool isopen = source[src].open_read;
+	if (!isopen) {
+		if (!readStartMulti(src)) return false;
+	}
+	SpatRasterSource &s = source[src];
+
+	size_t nd = s.m_ndims;
+	size_t xd = s.m_dims[0];
+	size_t yd = s.m_dims[1];
+	int_64 nr = s.m_counts[yd];
+	int_64 nc = s.m_counts[xd];
+	std::vector<unsigned> lyrs = s.layers;
+	size_t nl = lyrs.size();
+	size_t n = rows.size();
+	out = std::vector<double>(n * nl, NAN);
+
+	bool ok = true;
+	for (size_t k=0; k<n; k++) {
+		int_64 r = rows[k];
+		int_64 c = cols[k];
+		if ((r < 0) || (r >= nr) || (c < 0) || (c >= nc)) continue;
+		if (s.flipped) r = nr - 1 - r;
+		size_t i = 0;
+		while (ok && (i < nl)) {
+			size_t j = i + 1;
+			while ((j < nl) && (lyrs[j] == (lyrs[j-1] + 1))) j++;
+			std::vector<size_t> start(nd, 0), count(nd, 1), stride(nd, 0);
+			start[xd] = c;
+			start[yd] = r;
+			if (nd > 2) {
+				size_t zd = s.m_dims[2];
+				start[zd] = lyrs[i];
+				count[zd] = j - i;
+				stride[zd] = n;
+			}
+			double *dst = out.data() + i * n + k;
+			if (s.m_cache) {
+				ok = s.m_cache->read(start, count, stride, dst);
+			} else {
+				ok = md_read(s.gdalmdarray, start, count, stride, dst);
+			}
+			i = j;
+		}
+		if (!ok) break;
+	}
+	if (!isopen) {
+		readStopMulti(src);
 	}
+	if (!ok) {
+		setError("cannot read values");
+		return false;
+	}
+
+	std::vector<double> naflags(nl, s.m_hasNA ? s.m_missing_value : NAN);
+	std::vector<bool> haveso(nl, s.has_scale_offset[0]);
+	std::vector<double> scale(nl, s.scale[0]), offset(nl, s.offset[0]);
+	NAso(out, n, naflags, scale, offset, haveso, s.hasNAflag, s.NAflag);
 	return true;
 }
 
-  
-#else  
 
-*/
+#else
+
+
 bool SpatRaster::constructFromFileMulti(std::string fname, std::string sub, std::vector<size_t> xyz) {
 	setError("multidim is not supported by GDAL < 3.1");
 	return false;
@@ -286,18 +524,25 @@ bool SpatRaster::readStartMulti(unsigned src) {
 	setError("multidim is not supported by GDAL < 3.1");
 	return false;
 }
+
 bool SpatRaster::readStopMulti(unsigned src) {
 	setError("multidim is not supported by GDAL < 3.1");
 	return false;
 }
 
+bool SpatRaster::readMulti(std::vector<double> &out, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols, const std::vector<unsigned> &lyrs) {
+	setError("multidim is not supported by GDAL < 3.1");
+	return false;
+}
 
 bool SpatRaster::readValuesMulti(std::vector<double> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols) {
 	setError("multidim is not supported by GDAL < 3.1");
 	return false;
 }
 
-/*
-#endif
+bool SpatRaster::readRowColMulti(unsigned src, const std::vector<int_64> &rows, const std::vector<int_64> &cols, std::vector<double> &out) {
+	setError("multidim is not supported by GDAL < 3.1");
+	return false;
+}
 
-*/
\ No newline at end of file
+#endif
@@ -6,6 +6,7 @@
 #include "string_utils.h"
 #include "file_utils.h"
 #include "crs.h"
+#include "spatSIMD.h"
 //#include <vector>
 //#include <string>
 
@@ -411,6 +412,30 @@ bool getGDALDataType(std::string datatype, GDALDataType &gdt) {
 
 
 
+bool getTerraDataType(GDALDataType gdt, std::string &datatype) {
+	if (gdt == GDT_Float32) {
+		datatype = "FLT4S";
+	} else if (gdt == GDT_Int32) {
+		datatype = "INT4S";
+	} else if (gdt == GDT_Float64) {
+		datatype = "FLT8S";
+	} else if (gdt == GDT_Int16) {
+		datatype = "INT2S";
+	} else if (gdt == GDT_UInt32) {
+		datatype = "INT4U";
+	} else if (gdt == GDT_UInt16) {
+		datatype = "INT2U";
+	} else if (gdt == GDT_Byte) {
+		datatype = "INT1U";
+	} else {
+		datatype = "";
+		return false;
+	}
+	return true;
+}
+
+
+
 bool GDALsetSRS(GDALDatasetH &hDS, const std::string &crs) {
 	OGRSpatialReferenceH hSRS = OSRNewSpatialReference( NULL );
 	OGRErr erro = OSRSetFromUserInput(hSRS, crs.c_str());
@@ -465,6 +490,23 @@ bool SpatRaster::as_gdalvrt(GDALDatasetH &hVRT, SpatOptions &opt) {
 
 
 
+// add "nl" bands to a MEM dataset that point to "values" (nl layers of "ncl" cells)
+// with the DATAPOINTER option, such that GDAL reads and writes them in place.
+// The values must not be moved or freed before the dataset is closed
+bool mem_pointer_bands(GDALDatasetH hDS, double *values, size_t nl, size_t ncl) {
+	for (size_t i=0; i<nl; i++) {
+		char szPtrValue[128] = { '\0' };
+		int nRet = CPLPrintPointer(szPtrValue, reinterpret_cast<void*>(values + i * ncl), sizeof(szPtrValue));
+		szPtrValue[nRet] = 0;
+		char **papszOptions = CSLSetNameValue(NULL, "DATAPOINTER", szPtrValue);
+		CPLErr err = GDALAddBand(hDS, GDT_Float64, papszOptions);
+		CSLDestroy(papszOptions);
+		if (err != CE_None) return false;
+	}
+	return true;
+}
+
+
 bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, SpatOptions &opt) {
 
 	size_t isrc = src < 0 ? 0 : src;
@@ -502,7 +544,6 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, SpatOptions &opt) {
 	
 	} else { // in memory
 
-			
 		size_t nl;
 		if (src < 0) {
 			nl = nlyr();
@@ -512,27 +553,24 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, SpatOptions &opt) {
 		size_t ncls = nrow() * ncol();
 		GDALDriverH hDrv = GDALGetDriverByName("MEM");
 
-
-/*https://gis.stackexchange.com/questions/196048/how-to-reuse-memory-pointer-of-gdal-memory-driver
-		char **papszOptions = NULL;
-		hDS = GDALCreate(hDrv, "", ncol(), nrow(), 0, GDT_Float64, papszOptions);
-		if (hDS == NULL) return false;
-		std::vector<double> vals;
-		for(size_t i=0; i<nl; i++)	{
-			size_t off = ncls * i;
-			vals = std::vector<double>(source[0].values.begin() +off, source[0].values.begin() +off+ncls);
-			char szPtrValue[128] = { '\0' };
-			int nRet = CPLPrintPointer( szPtrValue, reinterpret_cast<void*>(&vals[0]), sizeof(szPtrValue) );
-			szPtrValue[nRet] = 0;
-			papszOptions = CSLSetNameValue(papszOptions, "DATAPOINTER", szPtrValue);
-			GDALAddBand(hDS, GDT_Float64, papszOptions);
+		// if all values are in memory, the bands point to them (no copy)
+		std::vector<size_t> srcs;
+		if (src < 0) {
+			for (size_t i=0; i<nsrc(); i++) srcs.push_back(i);
+		} else {
+			srcs.push_back(src);
+		}
+		bool view = hasval;
+		for (size_t i=0; i<srcs.size(); i++) {
+			SpatRasterSource &s = source[srcs[i]];
+			if ((!s.memory) || s.hasWindow || (s.layers.size() != s.nlyr) || (s.values.size() != (s.nlyr * ncls))) {
+				view = false;
+			}
 		}
-		CSLDestroy(papszOptions);
-*/
 
 		size_t nr = nrow();
 		size_t nc = ncol();
-		hDS = GDALCreate(hDrv, "", nc, nr, nl, GDT_Float64, NULL);
+		hDS = GDALCreate(hDrv, "", nc, nr, view ? 0 : nl, GDT_Float64, NULL);
 		if (hDS == NULL) return false;
 
 		std::vector<double> rs = resolution();
@@ -542,41 +580,59 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, SpatOptions &opt) {
 		GDALSetGeoTransform(hDS, adfGeoTransform);
 
 		if (!GDALsetSRS(hDS, source[0].srs.wkt)) {
+			GDALClose(hDS);
+			hDS = NULL;
 			setError("cannot set SRS");
 			return false;
 		}
 
-		CPLErr err = CE_None;
-	
-		if (hasval) {
-			std::vector<std::string> nms;
-			if (src < 0) {
-				nms = getNames();
-			} else {
-				nms = source[src].names;		
-			}
+		if (!hasval) return true;
 
-			std::vector<double> vv, vals;	
-			if (src < 0) {
-				vv = getValues();
-			} else {
-				if (!getValuesSource(src, vv)) {
-					setError("cannot read from source");
+		std::vector<std::string> nms;
+		if (src < 0) {
+			nms = getNames();
+		} else {
+			nms = source[src].names;		
+		}
+
+		if (view) {
+			for (size_t i=0; i<srcs.size(); i++) {
+				SpatRasterSource &s = source[srcs[i]];
+				if (!mem_pointer_bands(hDS, &s.values[0], s.nlyr, ncls)) {
+					GDALClose(hDS);
+					hDS = NULL;
+					setError("cannot create dataset from values in memory");
 					return false;
 				}
 			}
-	
 			for (size_t i=0; i < nl; i++) {
 				GDALRasterBandH hBand = GDALGetRasterBand(hDS, i+1);
 				GDALSetRasterNoDataValue(hBand, NAN);
 				GDALSetDescription(hBand, nms[i].c_str());
+			}
+			return true;
+		}
 
-				size_t offset = ncls * i;
-				vals = std::vector<double>(vv.begin() + offset, vv.begin() + offset+ncls);
-				err = GDALRasterIO(hBand, GF_Write, 0, 0, nc, nr, &vals[0], nc, nr, GDT_Float64, 0, 0);
-				if (err != CE_None) {
-					return false;
-				}
+		std::vector<double> vv;	
+		if (src < 0) {
+			vv = getValues();
+		} else {
+			if (!getValuesSource(src, vv)) {
+				GDALClose(hDS);
+				hDS = NULL;
+				setError("cannot read from source");
+				return false;
+			}
+		}
+		for (size_t i=0; i < nl; i++) {
+			GDALRasterBandH hBand = GDALGetRasterBand(hDS, i+1);
+			GDALSetRasterNoDataValue(hBand, NAN);
+			GDALSetDescription(hBand, nms[i].c_str());
+			CPLErr err = GDALRasterIO(hBand, GF_Write, 0, 0, nc, nr, &vv[ncls * i], nc, nr, GDT_Float64, 0, 0);
+			if (err != CE_None) {
+				GDALClose(hDS);
+				hDS = NULL;
+				return false;
 			}
 		}
 	}
@@ -585,7 +641,12 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, SpatOptions &opt) {
 }
 
 
-bool SpatRaster::from_gdalMEM(GDALDatasetH hDS, bool set_geometry, bool get_values) {
+bool SpatRaster::from_gdalMEM(GDALDatasetH hDS, bool set_geometry, bool get_values, bool inplace) {
+
+	if (inplace && set_geometry) {
+		setError("cannot set the geometry of a dataset with values in place");
+		return false;
+	}
 
 	if (set_geometry) {
 		SpatRasterSource s;
@@ -647,31 +708,32 @@ bool SpatRaster::from_gdalMEM(GDALDatasetH hDS, bool set_geometry, bool get_valu
 	}
 
 	if (get_values) {
-		source[0].values.resize(0);
-		source[0].values.reserve(ncell() * nlyr());
+		size_t ncl = ncell();
+		size_t nl = nlyr();
+		// with inplace, GDAL has already written the values to source[0].values
+		if (!inplace) {
+			source[0].values.resize(0);
+			source[0].values.resize(ncl * nl);
+		}
 		CPLErr err = CE_None;
 		int hasNA;
-		size_t nl = nlyr();
 		for (size_t i=0; i < nl; i++) {
 			GDALRasterBandH hBand = GDALGetRasterBand(hDS, i+1);
-			std::vector<double> lyrout( ncell() );
-			err = GDALRasterIO(hBand, GF_Read, 0, 0, ncol(), nrow(), &lyrout[0], ncol(), nrow(), GDT_Float64, 0, 0);
-			if (err != CE_None ) {
-				setError("CE_None");
-				return false;
+			double *lyrout = &source[0].values[i * ncl];
+			if (!inplace) {
+				err = GDALRasterIO(hBand, GF_Read, 0, 0, ncol(), nrow(), lyrout, ncol(), nrow(), GDT_Float64, 0, 0);
+				if (err != CE_None ) {
+					setError("CE_None");
+					return false;
+				}
 			}
 			//double naflag = -3.4e+38;
 			double naflag = GDALGetRasterNoDataValue(hBand, &hasNA);
 			if (hasNA && (!std::isnan(naflag))) {			
 				if (naflag < -3.4e+37) {
-					naflag = -3.4e+37;
-					for (size_t i=0; i<lyrout.size(); i++) {
-						if (lyrout[i] < naflag) {
-							lyrout[i] = NAN;
-						} 
-					}
+					simd_set_na(lyrout, ncl, -3.4e+37, true);
 				} else {
-					std::replace(lyrout.begin(), lyrout.end(), naflag, (double) NAN);
+					simd_set_na(lyrout, ncl, naflag, false);
 				}
 			} 
 
@@ -696,9 +758,8 @@ bool SpatRaster::from_gdalMEM(GDALDatasetH hDS, bool set_geometry, bool get_valu
 				mscale = 1;
 			}
 			if (has_so) {
-				for (double &d : lyrout) { d = d * mscale + moffset;}
+				simd_scale_offset(lyrout, ncl, mscale, moffset);
 			}
-			source[0].values.insert(source[0].values.end(), lyrout.begin(), lyrout.end());
 		}
 
 		source[0].hasValues = true;
@@ -760,7 +821,7 @@ char ** set_GDAL_options(std::string driver, double diskNeeded, bool writeRGB, s
 
 
 
-bool SpatRaster::create_gdalDS(GDALDatasetH &hDS, std::string filename, std::string driver, bool fill, double fillvalue, std::vector<bool> has_so, std::vector<double> scale, std::vector<double> offset, SpatOptions& opt) {
+bool SpatRaster::create_gdalDS(GDALDatasetH &hDS, std::string filename, std::string driver, bool fill, double fillvalue, std::vector<bool> has_so, std::vector<double> scale, std::vector<double> offset, SpatOptions& opt, bool inplace) {
 
 	has_so.resize(nlyr(), false);
 	
@@ -798,12 +859,31 @@ bool SpatRaster::create_gdalDS(GDALDatasetH &hDS, std::string filename, std::str
 		} else if (datatype == "INT1U") {
 			naflag = 255; // ?; 
 		} 
-	} else {
+	} else if (!inplace) {
 		getGDALDataType(opt.get_datatype(), gdt);
 	}
 	const char *pszFilename = filename.c_str();
-	hDS = GDALCreate(hDrv, pszFilename, ncol(), nrow(), nlyr(), gdt, papszOptions );
+	if ((driver == "MEM") && inplace) {
+		// the bands point to the values of this raster, such that GDAL
+		// writes them in place (see from_gdalMEM). This is only possible
+		// for doubles; the datatype in "opt" is not used 
+		size_t ncl = ncell();
+		source[0].values.resize(0);
+		source[0].values.resize(ncl * nlyr(), NAN);
+		source[0].hasValues = false;
+		hDS = GDALCreate(hDrv, pszFilename, ncol(), nrow(), 0, GDT_Float64, NULL);
+		if ((hDS != NULL) && (!mem_pointer_bands(hDS, &source[0].values[0], nlyr(), ncl))) {
+			GDALClose(hDS);
+			hDS = NULL;
+		}
+	} else {
+		hDS = GDALCreate(hDrv, pszFilename, ncol(), nrow(), nlyr(), gdt, papszOptions );
+	}
 	CSLDestroy( papszOptions );
+	if (hDS == NULL) {
+		setError("cannot create dataset");
+		return false;
+	}
 
 	std::vector<std::string> nms = getNames();
 	std::vector<bool> hasCats = hasCategories();
@@ -991,7 +1071,7 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS) {
 	if (!source[0].hasValues) {
 		return false;
 
-	} else if (source[0].driver == "gdal") {
+	} else if ((source[0].driver == "gdal") || (source[0].driver == "scratch")) {
 		std::string f = source[0].filename;
 		hDS = GDALOpen(f.c_str(), GA_ReadOnly);
 		return(hDS != NULL);
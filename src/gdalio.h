@@ -1,4 +1,5 @@
 bool getGDALDataType(std::string datatype, GDALDataType &gdt);
+bool getTerraDataType(GDALDataType gdt, std::string &datatype);
 std::string gdalinfo(std::string filename, std::vector<std::string> options, std::vector<std::string> openopts);
 std::vector<std::vector<std::string>> sdinfo(std::string fname);
 std::vector<std::string> get_metadata(std::string filename);
@@ -9,3 +10,4 @@ bool getNAvalue(GDALDataType gdt, double & naval);
 GDALDataset* openGDAL(std::string filename, unsigned OpenFlag);
 char ** set_GDAL_options(std::string driver, double diskNeeded, bool writeRGB, std::vector<std::string> gdal_options);
 
+bool mem_pointer_bands(GDALDatasetH hDS, double *values, size_t nl, size_t ncl);
@@ -811,47 +811,43 @@ SpatVector SpatVector::intersect(SpatVector v) {
 	SpatVector out;
 	out.srs = srs;
 
-	GEOSContextHandle_t hGEOSCtxt = geos_init();
-	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
-	//v = v.aggregate(false);
-	std::vector<GeomPtr> y = geos_geoms(&v, hGEOSCtxt);
+	std::shared_ptr<SpatGeosCache> gx = geos_cached(*this);
+	std::shared_ptr<SpatGeosCache> gy = geos_cached(v);
+	GEOSContextHandle_t hGEOSCtxt = gx->ctxt;
 	std::vector<GeomPtr> result;
 	size_t nx = size();
 	size_t ny = v.size();
 	std::vector<unsigned> idx, idy;
 	idx.reserve(nx);
 	idy.reserve(ny);
+	std::vector<size_t> cand;
 
 	if (type() == "points") {
-		//std::vector<bool> ixj(nx, false);
-		//size_t count = 0;
 		for (size_t j = 0; j < ny; j++) {
-			PrepGeomPtr pr = geos_ptr(GEOSPrepare_r(hGEOSCtxt, y[j].get()), hGEOSCtxt);
-			for (size_t i = 0; i < nx; i++) {
-				if (GEOSPreparedIntersects_r(hGEOSCtxt, pr.get(), x[i].get())) {
-					//if (!ixj[i]
-					//ixj[i] = true;
+			gx->candidates(v.geoms[j], cand);
+			if (cand.empty()) continue;
+			const GEOSPreparedGeometry *pr = gy->prepared(j);
+			for (size_t i : cand) {
+				if (GEOSPreparedIntersects_r(hGEOSCtxt, pr, gx->geoms[i].get())) {
 					idx.push_back(i);
 					idy.push_back(j);
-					//count++;
 				}
 			}
 		}
-		//std::vector<int> sx;
-		//sx.reserve(count);
-		//for (size_t i=0; i<ixj.size(); i++) {
-		//	if (ixj[i]) sx.push_back(i);	
-		//}
 		out = subset_rows(idx);
 		
 	} else {
 		
 		for (size_t i = 0; i < nx; i++) {
-			for (size_t j = 0; j < ny; j++) {
-				GEOSGeometry* geom = GEOSIntersection_r(hGEOSCtxt, x[i].get(), y[j].get());
+			gy->candidates(geoms[i], cand);
+			if (cand.empty()) continue;
+			const GEOSPreparedGeometry *pr = gx->prepared(i);
+			for (size_t j : cand) {
+				// much faster than computing an empty intersection
+				if (!GEOSPreparedIntersects_r(hGEOSCtxt, pr, gy->geoms[j].get())) continue;
+				GEOSGeometry* geom = GEOSIntersection_r(hGEOSCtxt, gx->geoms[i].get(), gy->geoms[j].get());
 				if (geom == NULL) {
 					out.setError("GEOS exception");
-					geos_finish(hGEOSCtxt);
 					return(out);
 				} 
 				if (!GEOSisEmpty_r(hGEOSCtxt, geom)) {
@@ -863,14 +859,12 @@ SpatVector SpatVector::intersect(SpatVector v) {
 				}
 			}
 		}
-	//SpatVectorCollection coll = coll_from_geos(result, hGEOSCtxt);
 		if (result.size() > 0) {
 			SpatVectorCollection coll = coll_from_geos(result, hGEOSCtxt);
 			out = coll.get(0);
 			out.srs = srs;
 		}
 	}
-	geos_finish(hGEOSCtxt);
 
 	if (!srs.is_same(v.srs, true)) {
 		out.addWarning("different crs"); 
@@ -977,6 +971,34 @@ int getRel(std::string &relation) {
 	return pattern;
 }
 
+// the relation of y to x that is true when "rel" of x to y is true
+std::string converseRel(const std::string &rel) {
+	if (rel == "within") return "contains";
+	if (rel == "contains") return "within";
+	if (rel == "covers") return "coveredby";
+	if (rel == "coveredby") return "covers";
+	if (rel == "containsproperly") return "";
+	return rel;
+}
+
+// can the relation only be true for geometries that intersect? In that
+// case, only the pairs of geometries with intersecting extents are evaluated
+bool needsIntersect(const std::string &relation, int pattern) {
+	if (pattern == 0) {
+		return relation != "disjoint";
+	}
+	// the interior or boundary of x must intersect the interior or boundary of y
+	std::vector<size_t> ib = {0, 1, 3, 4};
+	for (size_t i : ib) {
+		char c = relation.at(i);
+		if ((c == 'T') || (c == '0') || (c == '1') || (c == '2')) return true;
+	}
+	return false;
+}
+
+
+// all pairs (row-major); for relations that are true for most pairs (e.g. "disjoint"), 
+// for which a matrix uses less memory than the related pairs (see relatePairs)
 std::vector<int> SpatVector::relate(SpatVector v, std::string relation) {
 
 	std::vector<int> out;
@@ -986,33 +1008,141 @@ std::vector<int> SpatVector::relate(SpatVector v, std::string relation) {
 		return out;
 	}
 
-	GEOSContextHandle_t hGEOSCtxt = geos_init();
-	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
-	std::vector<GeomPtr> y = geos_geoms(&v, hGEOSCtxt);
+	std::shared_ptr<SpatGeosCache> gx = geos_cached(*this);
+	std::shared_ptr<SpatGeosCache> gy = geos_cached(v);
+	GEOSContextHandle_t hGEOSCtxt = gx->ctxt;
 	size_t nx = size();
 	size_t ny = v.size();
-	out.reserve(nx*ny);
-	if (pattern == 1) {
+	out.resize(nx * ny, 0);
+	bool filter = needsIntersect(relation, pattern);
+	std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun;
+	if (pattern == 0) relFun = getPrepRelateFun(relation);
+	std::vector<size_t> cand(ny);
+	std::iota(cand.begin(), cand.end(), 0);
+	for (size_t i = 0; i < nx; i++) {
+		if (filter) {
+			gy->candidates(geoms[i], cand);
+			if (cand.empty()) continue;
+		}
+		int *oi = &out[i * ny];
+		if (pattern == 1) {
+			for (size_t j : cand) {
+				oi[j] = GEOSRelatePattern_r(hGEOSCtxt, gx->geoms[i].get(), gy->geoms[j].get(), relation.c_str());
+			}
+		} else {
+			const GEOSPreparedGeometry *pr = gx->prepared(i);
+			for (size_t j : cand) {
+				oi[j] = relFun(hGEOSCtxt, pr, gy->geoms[j].get());
+			}
+		}
+	}
+	return out;
+}
+
+
+std::vector<std::vector<int>> SpatVector::relatePairs(SpatVector v, std::string relation) {
+
+	// the index of x and y, and the value of the relation (1, or 2 for NA)
+	std::vector<std::vector<int>> out(3);
+	int pattern = getRel(relation);
+	if (pattern == 2) {
+		setError("'" + relation + "'" + " is not a valid relate name or pattern");
+		return out;
+	}
+
+	std::shared_ptr<SpatGeosCache> gx = geos_cached(*this);
+	std::shared_ptr<SpatGeosCache> gy = geos_cached(v);
+	GEOSContextHandle_t hGEOSCtxt = gx->ctxt;
+	size_t nx = size();
+	size_t ny = v.size();
+
+	auto add = [&out](size_t i, size_t j, char r) {
+		if (r == 0) return;
+		out[0].push_back(i);
+		out[1].push_back(j);
+		out[2].push_back(r);
+	};
+
+	if (!needsIntersect(relation, pattern)) {
+		// all pairs are tested (e.g. "disjoint"), but only the related pairs are kept
+		std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun;
+		if (pattern == 0) relFun = getPrepRelateFun(relation);
 		for (size_t i = 0; i < nx; i++) {
+			const GEOSPreparedGeometry *pr = (pattern == 0) ? gx->prepared(i) : NULL;
 			for (size_t j = 0; j < ny; j++) {
-				out.push_back( GEOSRelatePattern_r(hGEOSCtxt, x[i].get(), y[j].get(), relation.c_str()));
+				if (pattern == 1) {
+					add(i, j, GEOSRelatePattern_r(hGEOSCtxt, gx->geoms[i].get(), gy->geoms[j].get(), relation.c_str()));
+				} else {
+					add(i, j, relFun(hGEOSCtxt, pr, gy->geoms[j].get()));
+				}
 			}
 		}
-	} else {
-		std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun = getPrepRelateFun(relation);
+		return out;
+	}
+
+	std::vector<size_t> cand;
+	if (pattern == 1) {
 		for (size_t i = 0; i < nx; i++) {
-			PrepGeomPtr pr = geos_ptr(GEOSPrepare_r(hGEOSCtxt, x[i].get()), hGEOSCtxt);
-			for (size_t j = 0; j < ny; j++) {
-				out.push_back( relFun(hGEOSCtxt, pr.get(), y[j].get()));
+			gy->candidates(geoms[i], cand);
+			for (size_t j : cand) {
+				add(i, j, GEOSRelatePattern_r(hGEOSCtxt, gx->geoms[i].get(), gy->geoms[j].get(), relation.c_str()));
 			}
-		} 
+		}
+		return out;
+	}
+
+	// prepare the geometries of y instead of those of x if x has points and 
+	// y has not; points benefit little from being prepared
+	std::string conv = converseRel(relation);
+	if ((type() == "points") && (v.type() != "points") && (conv != "")) {
+		std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun = getPrepRelateFun(conv);
+		std::vector<std::vector<int>> tmp(3);
+		for (size_t j = 0; j < ny; j++) {
+			gx->candidates(v.geoms[j], cand);
+			if (cand.empty()) continue;
+			const GEOSPreparedGeometry *pr = gy->prepared(j);
+			for (size_t i : cand) {
+				char r = relFun(hGEOSCtxt, pr, gx->geoms[i].get());
+				if (r == 0) continue;
+				tmp[0].push_back(i);
+				tmp[1].push_back(j);
+				tmp[2].push_back(r);
+			}
+		}
+		// in the order of x
+		std::vector<size_t> ord(tmp[0].size());
+		std::iota(ord.begin(), ord.end(), 0);
+		std::stable_sort(ord.begin(), ord.end(), [&tmp](size_t a, size_t b) { return tmp[0][a] < tmp[0][b]; });
+		for (size_t k : ord) {
+			add(tmp[0][k], tmp[1][k], tmp[2][k]);
+		}
+		return out;
 	}
-	geos_finish(hGEOSCtxt);
 
+	std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun = getPrepRelateFun(relation);
+	for (size_t i = 0; i < nx; i++) {
+		gy->candidates(geoms[i], cand);
+		if (cand.empty()) continue;
+		const GEOSPreparedGeometry *pr = gx->prepared(i);
+		for (size_t j : cand) {
+			add(i, j, relFun(hGEOSCtxt, pr, gy->geoms[j].get()));
+		}
+	}
 	return out;
 }
 
 
+void SpatVector::geos_cache(bool keep) {
+	if (keep) {
+		if (!geoscache) {
+			geoscache = std::make_shared<SpatGeosCache>(*this);
+		}
+	} else {
+		geoscache.reset();
+	}
+}
+
+
 std::vector<int> SpatVector::relateFirst(SpatVector v, std::string relation) {
 
 	int pattern = getRel(relation);
@@ -1021,36 +1151,39 @@ std::vector<int> SpatVector::relateFirst(SpatVector v, std::string relation) {
 		std::vector<int> out;
 		return out;
 	}
-	GEOSContextHandle_t hGEOSCtxt = geos_init();
-	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
-	std::vector<GeomPtr> y = geos_geoms(&v, hGEOSCtxt);
 	size_t nx = size();
 	size_t ny = v.size();
 	std::vector<int> out(nx, -1);
-	if (pattern == 1) {
-		for (size_t i = 0; i < nx; i++) {
-			for (size_t j = 0; j < ny; j++) {
-				if (GEOSRelatePattern_r(hGEOSCtxt, x[i].get(), y[j].get(), relation.c_str())) {
-					out[i] = j;
-					continue;
-				}
-			}
-		}
-	} else {
-		//std::function<char(GEOSContextHandle_t, const GEOSGeometry *, const GEOSGeometry *)> relFun = getRelateFun(relation);
-		std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun = getPrepRelateFun(relation);
 
-		for (size_t i = 0; i < nx; i++) {
-			PrepGeomPtr pr = geos_ptr(GEOSPrepare_r(hGEOSCtxt, x[i].get()), hGEOSCtxt);
-			for (size_t j = 0; j < ny; j++) {
-				if (relFun(hGEOSCtxt, pr.get(), y[j].get())) {
-					out[i] = j;
-					continue;
-				}
+	std::shared_ptr<SpatGeosCache> gx = geos_cached(*this);
+	std::shared_ptr<SpatGeosCache> gy = geos_cached(v);
+	GEOSContextHandle_t hGEOSCtxt = gx->ctxt;
+	// without the R-tree filter (e.g. "disjoint"), all geometries of y are candidates
+	bool filter = needsIntersect(relation, pattern);
+	std::vector<size_t> cand;
+	if (!filter) {
+		cand.resize(ny);
+		std::iota(cand.begin(), cand.end(), 0);
+	}
+	std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun;
+	if (pattern == 0) relFun = getPrepRelateFun(relation);
+	for (size_t i = 0; i < nx; i++) {
+		if (filter) gy->candidates(geoms[i], cand);
+		if (cand.empty()) continue;
+		const GEOSPreparedGeometry *pr = (pattern == 0) ? gx->prepared(i) : NULL;
+		for (size_t j : cand) {
+			char r;
+			if (pattern == 1) {
+				r = GEOSRelatePattern_r(hGEOSCtxt, gx->geoms[i].get(), gy->geoms[j].get(), relation.c_str());
+			} else {
+				r = relFun(hGEOSCtxt, pr, gy->geoms[j].get());
+			}
+			if (r == 1) {
+				out[i] = j;
+				break;
 			}
 		}
 	}
-	geos_finish(hGEOSCtxt);
 	return out;
 }
 
@@ -1065,50 +1198,56 @@ std::vector<int> SpatVector::relate(std::string relation, bool symmetrical) {
 		return out;
 	}
 
-	GEOSContextHandle_t hGEOSCtxt = geos_init();
-	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
+	std::shared_ptr<SpatGeosCache> gx = geos_cached(*this);
+	GEOSContextHandle_t hGEOSCtxt = gx->ctxt;
+	std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun;
+	if (pattern == 0) {
+		relFun = getPrepRelateFun(relation);
+	}
+	auto rel = [&](size_t i, size_t j) -> int {
+		if (pattern == 1) {
+			return GEOSRelatePattern_r(hGEOSCtxt, gx->geoms[i].get(), gx->geoms[j].get(), relation.c_str());
+		} 
+		return relFun(hGEOSCtxt, gx->prepared(i), gx->geoms[j].get());
+	};
+	bool filter = needsIntersect(relation, pattern);
+	std::vector<size_t> cand;
+	size_t s = size();
 
 	if (symmetrical) {
-		size_t s = size();
+		if (s < 2) return out;
 		size_t n = ((s-1) * s)/2;
-		out.reserve(n);
-		if (pattern == 1) {
-			for (size_t i=0; i<(s-1); i++) {
-				for (size_t j=(i+1); j<s; j++) {
-					out.push_back( GEOSRelatePattern_r(hGEOSCtxt, x[i].get(), x[j].get(), relation.c_str()));
+		out.resize(n, 0);
+		size_t off = 0;
+		for (size_t i=0; i<(s-1); i++) {
+			// out[off + j - i - 1] has the relation of i and j (j > i) 
+			if (filter) {
+				gx->candidates(geoms[i], cand);
+				for (size_t j : cand) {
+					if (j > i) out[off + j - i - 1] = rel(i, j);
 				}
-			}
-		} else {
-			std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun = getPrepRelateFun(relation);
-			for (size_t i=0; i<(s-1); i++) {
-				PrepGeomPtr pr = geos_ptr(GEOSPrepare_r(hGEOSCtxt, x[i].get()), hGEOSCtxt);
+			} else {
 				for (size_t j=(i+1); j<s; j++) {
-					out.push_back( relFun(hGEOSCtxt, pr.get(), x[j].get()));
+					out[off + j - i - 1] = rel(i, j);
 				}
-			} 			
+			}
+			off += s - i - 1;
 		}
 	} else {
-		size_t nx = size();
-		out.reserve(nx*nx);
-		if (pattern == 1) {
-			for (size_t i = 0; i < nx; i++) {
-				for (size_t j = 0; j < nx; j++) {
-					out.push_back( GEOSRelatePattern_r(hGEOSCtxt, x[i].get(), x[j].get(), relation.c_str()));
+		out.resize(s*s, 0);
+		for (size_t i = 0; i < s; i++) {
+			if (filter) {
+				gx->candidates(geoms[i], cand);
+				for (size_t j : cand) {
+					out[i*s+j] = rel(i, j);
 				}
-			}
-		} else {
-			std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun = getPrepRelateFun(relation);
-			for (size_t i = 0; i < nx; i++) {
-				PrepGeomPtr pr = geos_ptr(GEOSPrepare_r(hGEOSCtxt, x[i].get()), hGEOSCtxt);
-				for (size_t j = 0; j < nx; j++) {
-					out.push_back( relFun(hGEOSCtxt, pr.get(), x[j].get()));
+			} else {
+				for (size_t j = 0; j < s; j++) {
+					out[i*s+j] = rel(i, j);
 				}
-			} 
+			}
 		}
 	}
-
-	geos_finish(hGEOSCtxt);
-
 	return out;
 }
 
@@ -1118,9 +1257,11 @@ std::vector<double> SpatVector::geos_distance(SpatVector v, bool parallel) {
 
 	std::vector<double> out;
 
-	GEOSContextHandle_t hGEOSCtxt = geos_init();
-	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
-	std::vector<GeomPtr> y = geos_geoms(&v, hGEOSCtxt);
+	std::shared_ptr<SpatGeosCache> gx = geos_cached(*this);
+	std::shared_ptr<SpatGeosCache> gy = geos_cached(v);
+	GEOSContextHandle_t hGEOSCtxt = gx->ctxt;
+	std::vector<GeomPtr> *x = &gx->geoms;
+	std::vector<GeomPtr> *y = &gy->geoms;
 	size_t nx = size();
 	size_t ny = v.size();
 	double d;
@@ -1143,7 +1284,7 @@ std::vector<double> SpatVector::geos_distance(SpatVector v, bool parallel) {
 		if (nyone) {
 			out.reserve(nx);
 			for (size_t i = 0; i < nx; i++) {
-				if ( GEOSDistance_r(hGEOSCtxt, x[i].get(), y[0].get(), &d)) {
+				if ( GEOSDistance_r(hGEOSCtxt, (*x)[i].get(), (*y)[0].get(), &d)) {
 					out.push_back(d);
 				} else {
 					out.push_back(NAN);				
@@ -1152,7 +1293,7 @@ std::vector<double> SpatVector::geos_distance(SpatVector v, bool parallel) {
 		} else {
 			out.reserve(nx);
 			for (size_t i = 0; i < nx; i++) {
-				if ( GEOSDistance_r(hGEOSCtxt, x[i].get(), y[i].get(), &d)) {
+				if ( GEOSDistance_r(hGEOSCtxt, (*x)[i].get(), (*y)[i].get(), &d)) {
 					out.push_back(d);
 				} else {
 					out.push_back(NAN);				
@@ -1163,7 +1304,7 @@ std::vector<double> SpatVector::geos_distance(SpatVector v, bool parallel) {
 		out.reserve(nx*ny);
 		for (size_t i = 0; i < nx; i++) {
 			for (size_t j = 0; j < ny; j++) {
-				if ( GEOSDistance_r(hGEOSCtxt, x[i].get(), y[j].get(), &d)) {
+				if ( GEOSDistance_r(hGEOSCtxt, (*x)[i].get(), (*y)[j].get(), &d)) {
 					out.push_back(d);
 				} else {
 					out.push_back(NAN);				
@@ -1171,7 +1312,6 @@ std::vector<double> SpatVector::geos_distance(SpatVector v, bool parallel) {
 			}
 		}
 	}
-	geos_finish(hGEOSCtxt);
 	return out;
  }
 
@@ -1179,15 +1319,16 @@ std::vector<double> SpatVector::geos_distance(bool sequential) {
 
 	std::vector<double> out;
 
-	GEOSContextHandle_t hGEOSCtxt = geos_init();
-	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
+	std::shared_ptr<SpatGeosCache> gx = geos_cached(*this);
+	GEOSContextHandle_t hGEOSCtxt = gx->ctxt;
+	std::vector<GeomPtr> *x = &gx->geoms;
 	size_t s = size();
 	double d;
 	if (sequential) {
 		out.reserve(s);
 		out.push_back(0);
 		for (size_t i=0; i<(s-1); i++) {
-			if ( GEOSDistance_r(hGEOSCtxt, x[i].get(), x[i+1].get(), &d)) {
+			if ( GEOSDistance_r(hGEOSCtxt, (*x)[i].get(), (*x)[i+1].get(), &d)) {
 				out.push_back(d);
 			} else {
 				out.push_back(NAN);				
@@ -1197,7 +1338,7 @@ std::vector<double> SpatVector::geos_distance(bool sequential) {
 		out.reserve((s-1) * s / 2);
 		for (size_t i=0; i<(s-1); i++) {
 			for (size_t j=(i+1); j<s; j++) {
-				if ( GEOSDistance_r(hGEOSCtxt, x[i].get(), x[j].get(), &d)) {
+				if ( GEOSDistance_r(hGEOSCtxt, (*x)[i].get(), (*x)[j].get(), &d)) {
 					out.push_back(d);
 				} else {
 					out.push_back(NAN);				
@@ -1208,7 +1349,6 @@ std::vector<double> SpatVector::geos_distance(bool sequential) {
 	if (s == 1) {
 		out.push_back(0);
 	}	
-	geos_finish(hGEOSCtxt);
 	return out;
  }
 
@@ -1341,29 +1481,38 @@ SpatVector SpatVector::erase(SpatVector v) {
 	SpatVector out;
 	out.srs = srs;
 
-	GEOSContextHandle_t hGEOSCtxt = geos_init();
-	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
-	std::vector<GeomPtr> y = geos_geoms(&v, hGEOSCtxt);
+	std::shared_ptr<SpatGeosCache> gx = geos_cached(*this);
+	std::shared_ptr<SpatGeosCache> gy = geos_cached(v);
+	GEOSContextHandle_t hGEOSCtxt = gx->ctxt;
 	std::vector<GeomPtr> result;
 	std::vector<unsigned> ids;
 	ids.reserve(size());
 	size_t nx = size();
-	size_t ny = v.size();
-
+	std::vector<size_t> cand;
 	
 	for (size_t i = 0; i < nx; i++) {
-		GEOSGeometry* geom = x[i].get();
-		for (size_t j = 0; j < ny; j++) {
-			geom = GEOSDifference_r(hGEOSCtxt, geom, y[j].get());
+		GEOSGeometry* geom = gx->geoms[i].get();
+		gy->candidates(geoms[i], cand);
+		const GEOSPreparedGeometry *pr = cand.empty() ? NULL : gx->prepared(i);
+		for (size_t j : cand) {
+			// if x[i] does not intersect y[j], neither does what is left of it
+			if (!GEOSPreparedIntersects_r(hGEOSCtxt, pr, gy->geoms[j].get())) continue;
+			GEOSGeometry* dif = GEOSDifference_r(hGEOSCtxt, geom, gy->geoms[j].get());
+			if (geom != gx->geoms[i].get()) {
+				GEOSGeom_destroy_r(hGEOSCtxt, geom);
+			}
+			geom = dif;
 			if (geom == NULL) {
 				out.setError("GEOS exception");
-				geos_finish(hGEOSCtxt);
 				return(out);
 			} 
 			if (GEOSisEmpty_r(hGEOSCtxt, geom)) {
 				break;
 			}
 		}
+		if (geom == gx->geoms[i].get()) {
+			geom = GEOSGeom_clone_r(hGEOSCtxt, geom);
+		}
 		if (!GEOSisEmpty_r(hGEOSCtxt, geom)) {
 			result.push_back(geos_ptr(geom, hGEOSCtxt));
 			ids.push_back(i);
@@ -1378,7 +1527,6 @@ SpatVector SpatVector::erase(SpatVector v) {
 		out.srs = srs;
 		out.df = df.subset_rows(ids);
 	} 
-	geos_finish(hGEOSCtxt);
 	if (!srs.is_same(v.srs, true)) {
 		out.addWarning("different crs"); 
 	}
@@ -24,9 +24,11 @@
 #endif
 
 #include "spatVector.h"
+#include "spatScanline.h"
 #include <cstdarg> 
 #include <cstring> 
 #include <memory>
+#include <cstdint>
 #include <functional>
 
 
@@ -659,3 +661,134 @@ SpatVectorCollection coll_from_geos(std::vector<GeomPtr> &geoms, GEOSContextHand
 	return out;
 }
 
+
+
+// FNV-1a hash of "n" bytes
+inline void geos_hash_bytes(uint64_t &h, const void *p, size_t n) {
+	const unsigned char *b = (const unsigned char *) p;
+	for (size_t i=0; i<n; i++) {
+		h ^= b[i];
+		h *= 1099511628211ULL;
+	}
+}
+
+inline void geos_hash_xy(uint64_t &h, const std::vector<double> &x, const std::vector<double> &y) {
+	size_t n = x.size();
+	geos_hash_bytes(h, &n, sizeof(size_t));
+	if (n == 0) return;
+	geos_hash_bytes(h, x.data(), n * sizeof(double));
+	geos_hash_bytes(h, y.data(), n * sizeof(double));
+}
+
+// a hash of the type and coordinates (of all parts and holes) of the geometries,
+// to check if a SpatGeosCache still matches the geometries of its SpatVector.
+// The cache is shared by copies of a SpatVector, that may have other geometries
+uint64_t geos_cache_key(SpatVector &v) {
+	uint64_t h = 14695981039346656037ULL;
+	size_t n = v.size();
+	geos_hash_bytes(h, &n, sizeof(size_t));
+	if (n == 0) return h;
+	int gt = v.geoms.gtype();
+	geos_hash_bytes(h, &gt, sizeof(int));
+	if (v.geoms.packed()) {
+		SpatGeomColumns &c = v.geoms.columns();
+		geos_hash_xy(h, c.x, c.y);
+		for (const std::vector<size_t> *o : {&c.ring, &c.part, &c.geom}) {
+			size_t no = o->size();
+			geos_hash_bytes(h, &no, sizeof(size_t));
+			if (no > 0) geos_hash_bytes(h, o->data(), no * sizeof(size_t));
+		}
+	} else {
+		for (size_t i=0; i<n; i++) {
+			SpatGeom &g = v.geoms[i];
+			size_t np = g.parts.size();
+			geos_hash_bytes(h, &np, sizeof(size_t));
+			for (size_t j=0; j<np; j++) {
+				geos_hash_xy(h, g.parts[j].x, g.parts[j].y);
+				size_t nh = g.parts[j].holes.size();
+				geos_hash_bytes(h, &nh, sizeof(size_t));
+				for (size_t k=0; k<nh; k++) {
+					geos_hash_xy(h, g.parts[j].holes[k].x, g.parts[j].holes[k].y);
+				}
+			}
+		}
+	}
+	return h;
+}
+
+
+// A GEOS context that is shared by all SpatGeosCache objects that exist at
+// the same time, such that the geometries of two caches are used with the 
+// context that they were made with. It ends when the last cache is gone.
+class SpatGeosContext {
+	public:
+		GEOSContextHandle_t ctxt;
+		SpatGeosContext() { ctxt = geos_init(); }
+		~SpatGeosContext() { geos_finish(ctxt); }
+};
+
+std::shared_ptr<SpatGeosContext> geos_shared_context() {
+	static std::weak_ptr<SpatGeosContext> shared;
+	std::shared_ptr<SpatGeosContext> c = shared.lock();
+	if (!c) {
+		c = std::make_shared<SpatGeosContext>();
+		shared = c;
+	}
+	return c;
+}
+
+
+// The GEOS geometries of a SpatVector, with an R-tree of their extents and
+// their prepared geometries (made when first needed). It can be kept with
+// the SpatVector (see SpatVector::geos_cache) to skip the conversion in
+// repeated queries.
+class SpatGeosCache {
+	public:
+		std::shared_ptr<SpatGeosContext> context;
+		GEOSContextHandle_t ctxt;
+		std::vector<GeomPtr> geoms;
+		std::vector<PrepGeomPtr> prep;
+		SpatRTree tree;
+		uint64_t key;
+
+		SpatGeosCache(SpatVector &v) {
+			context = geos_shared_context();
+			ctxt = context->ctxt;
+			geoms = geos_geoms(&v, ctxt);
+			prep.resize(geoms.size());
+			tree = scan_index(v);
+			key = geos_cache_key(v);
+		}
+
+		~SpatGeosCache() {
+			// the prepared geometries refer to the geometries, and both to the context
+			prep.clear();
+			geoms.clear();
+		}
+
+		const GEOSPreparedGeometry* prepared(size_t i) {
+			if (!prep[i]) {
+				prep[i] = geos_ptr(GEOSPrepare_r(ctxt, geoms[i].get()), ctxt);
+			}
+			return prep[i].get();
+		}
+
+		// the (sorted) index of the geometries with an extent that intersects that of "g"
+		void candidates(const SpatGeom &g, std::vector<size_t> &ids) const {
+			tree.query(g.extent.xmin, g.extent.xmax, g.extent.ymin, g.extent.ymax, ids);
+		}
+};
+
+
+// the cache of "v" if it is still valid, or else a new one (that replaces
+// the cache of "v" if it had one)
+std::shared_ptr<SpatGeosCache> geos_cached(SpatVector &v) {
+	if (v.geoscache && (v.geoscache->key == geos_cache_key(v))) {
+		return v.geoscache;
+	}
+	std::shared_ptr<SpatGeosCache> g = std::make_shared<SpatGeosCache>(v);
+	if (v.geoscache) {
+		v.geoscache = g;
+	}
+	return g;
+}
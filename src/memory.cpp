@@ -21,22 +21,39 @@
 
 
 
+// the RAM (in bytes) that may be used; the fraction (memfrac) of the
+// available RAM, or the budget set by the user (memmax) if that is lower, 
+// minus what other rasters that are being written have reserved
+double allowedRAM(SpatOptions &opt) {
+	double supply = availableRAM() * opt.get_memfrac();
+	double budget = opt.get_memmax() * 1073741824;
+	if (budget > 0) {
+		supply = std::min(supply, budget);
+	}
+	return std::max(0.0, supply - reservedRAM());
+}
+
+
 bool SpatRaster::canProcessInMemory(SpatOptions &opt) {
 	if (opt.get_todisk()) return false;
-	double demand = size() * opt.ncopies;
-	double supply = (availableRAM()) * opt.get_memfrac();
+	// values in memory are always double
+	double demand = size() * opt.ncopies * sizeof(double);
+	double supply = allowedRAM(opt);
 	std::vector<double> v;
-	double maxsup = v.max_size(); //for 32 bit systems
+	double maxsup = v.max_size() * sizeof(double); //for 32 bit systems
 	supply = std::min(supply, maxsup);
 	return (demand < supply);
 }
 
 
 size_t SpatRaster::chunkSize(SpatOptions &opt) {
+	return chunkSize(opt, 8);
+}
+
+size_t SpatRaster::chunkSize(SpatOptions &opt, unsigned elsize) {
 	double n = opt.ncopies;
-	double frac = opt.get_memfrac();
-	double cells_in_row = ncol() * nlyr() * n;
-	double rows = (availableRAM()) * frac / cells_in_row;
+	double bytes_in_row = ncol() * nlyr() * n * elsize;
+	double rows = allowedRAM(opt) / bytes_in_row;
 	//double maxrows = 10000;
 	//rows = std::min(rows, maxrows);
 	size_t urows = floor(rows);
@@ -53,42 +70,100 @@ size_t SpatRaster::chunkSize(SpatOptions &opt) {
 std::vector<double> SpatRaster::mem_needs(SpatOptions &opt) {
 	//returning bytes
 	unsigned n = opt.ncopies; 
-	double memneed  = ncell() * (nlyr() * n);
+	double memneed  = ncell() * (nlyr() * n) * sizeof(double);
 	double memavail = availableRAM(); 
 	double frac = opt.get_memfrac();
 	double csize = chunkSize(opt);
 	double inmem = canProcessInMemory(opt); 
-	std::vector<double> out = {memneed, memavail, frac, csize, inmem} ;
+	double allowed = allowedRAM(opt);
+	std::vector<double> out = {memneed, memavail, frac, csize, inmem, allowed} ;
 	return out;
 }
 
+
+// split n rows (or columns) into chunks of at most "size" that end at a
+// tile boundary (tiles start at -"off") where that keeps them at least "minsize"
+void aligned_chunks(size_t n, size_t size, size_t tile, size_t off, size_t minsize, std::vector<size_t> &start, std::vector<size_t> &len) {
+	size = std::max(size, (size_t)1);
+	size_t r = 0;
+	while (r < n) {
+		size_t end = std::min(n, r + size);
+		if ((tile > 1) && (end < n)) {
+			size_t aligned = ((end + off) / tile) * tile;
+			if ((aligned > (r + off)) && ((aligned - off - r) >= minsize)) {
+				end = aligned - off;
+			}
+		}
+		start.push_back(r);
+		len.push_back(end - r);
+		r = end;
+	}
+}
+
+
 //BlockSize SpatRaster::getBlockSize(unsigned n, double frac, unsigned steps) {
-BlockSize SpatRaster::getBlockSize( SpatOptions &opt) {
+BlockSize SpatRaster::getBlockSize(SpatOptions &opt, BlockLayout layout) {
 
 	unsigned steps = opt.get_steps();
 
 	BlockSize bs;
 	size_t cs;
+	size_t nr = nrow();
+	size_t nc = ncol();
 
 	if (steps > 0) {
-		if (steps > nrow()) {
-			steps = nrow();
+		if (steps > nr) {
+			steps = nr;
 		}
 		bs.n = steps;
-		cs = nrow() / steps;
+		cs = nr / steps;
+		bs.row = std::vector<size_t>(bs.n);
+		bs.nrows = std::vector<size_t>(bs.n, cs);
+		size_t r = 0;
+		for (size_t i =0; i<bs.n; i++) {
+			bs.row[i] = r;
+			r += cs;
+		}
+		bs.nrows[bs.n-1] = cs - ((bs.n * cs) - nr);
 	} else {
-		cs = chunkSize(opt);
-		bs.n = std::ceil(nrow() / double(cs));
+		cs = chunkSize(opt, layout.elsize);
+		unsigned nt = opt.get_threads();
+		if (layout.threaded && (nt > 1)) {
+			// writeBlocks keeps up to two blocks per thread in memory
+			size_t tcs = std::ceil(nr / (2.0 * nt));
+			cs = std::max((size_t)1, std::min(cs / (2 * nt), tcs));
+			cs = std::max(cs, (size_t)opt.minrows);
+		}
+
+		// align the blocks with the tiles (or strips) of the file, 
+		// such that each tile is only read (and decompressed) once
+		size_t th = source[0].blockrows;
+		size_t tw = source[0].blockcols;
+		size_t roff = source[0].hasWindow ? source[0].window.off_row : 0;
+		size_t coff = source[0].hasWindow ? source[0].window.off_col : 0;
+
+		if (layout.tiles && (th > 1) && (cs < th) && (th <= nr) && (tw > 0) && (tw < nc)) {
+			// a row of tiles does not fit in memory; use windows of whole tiles
+			size_t ntiles = std::max((size_t)1, (cs * nc) / (th * tw));
+			std::vector<size_t> rows, nrows, cols, ncols;
+			aligned_chunks(nr, th, th, roff, 1, rows, nrows);
+			aligned_chunks(nc, ntiles * tw, tw, coff, 1, cols, ncols);
+			for (size_t i=0; i<rows.size(); i++) {
+				for (size_t j=0; j<cols.size(); j++) {
+					bs.row.push_back(rows[i]);
+					bs.nrows.push_back(nrows[i]);
+					bs.col.push_back(cols[j]);
+					bs.ncols.push_back(ncols[j]);
+				}
+			}
+		} else {
+			aligned_chunks(nr, cs, th, roff, opt.minrows, bs.row, bs.nrows);
+		}
+		bs.n = bs.row.size();
 	}
-	bs.row = std::vector<size_t>(bs.n);
-	bs.nrows = std::vector<size_t>(bs.n, cs);
-	size_t r = 0;
-	for (size_t i =0; i<bs.n; i++) {
-		bs.row[i] = r;
-		r += cs;
+	if (bs.col.size() == 0) {
+		bs.col.resize(bs.n, 0);
+		bs.ncols.resize(bs.n, nc);
 	}
-	bs.nrows[bs.n-1] = cs - ((bs.n * cs) - nrow());
-
 	return bs;
 }
-
@@ -0,0 +1,208 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <algorithm>
+#include "spatOverview.h"
+
+
+void SpatStreamStats::init(size_t nl) {
+	n = std::vector<double>(nl, 0);
+	mean = std::vector<double>(nl, 0);
+	m2 = std::vector<double>(nl, 0);
+	vmin = std::vector<double>(nl, NAN);
+	vmax = std::vector<double>(nl, NAN);
+}
+
+
+void SpatStreamStats::add(const double *v, size_t ncell, size_t lyr, double lo, double hi, bool isint) {
+	double bn = 0, bsum = 0;
+	double bmin = NAN, bmax = NAN;
+	for (size_t i=0; i<ncell; i++) {
+		double d = v[i];
+		if (std::isnan(d) || (d < lo) || (d > hi)) continue;
+		if (isint) d = std::trunc(d);
+		if (bn == 0) {
+			bmin = d;
+			bmax = d;
+		} else {
+			bmin = std::min(bmin, d);
+			bmax = std::max(bmax, d);
+		}
+		bn++;
+		bsum += d;
+	}
+	if (bn == 0) return;
+	double bmean = bsum / bn;
+	double bm2 = 0;
+	for (size_t i=0; i<ncell; i++) {
+		double d = v[i];
+		if (std::isnan(d) || (d < lo) || (d > hi)) continue;
+		if (isint) d = std::trunc(d);
+		bm2 += (d - bmean) * (d - bmean);
+	}
+	if (n[lyr] == 0) {
+		n[lyr] = bn;
+		mean[lyr] = bmean;
+		m2[lyr] = bm2;
+		vmin[lyr] = bmin;
+		vmax[lyr] = bmax;
+		return;
+	}
+	double tn = n[lyr] + bn;
+	double delta = bmean - mean[lyr];
+	mean[lyr] += delta * bn / tn;
+	m2[lyr] += bm2 + delta * delta * n[lyr] * bn / tn;
+	n[lyr] = tn;
+	vmin[lyr] = std::min(vmin[lyr], bmin);
+	vmax[lyr] = std::max(vmax[lyr], bmax);
+}
+
+
+double SpatStreamStats::sd(size_t lyr) {
+	if (n[lyr] == 0) return NAN;
+	return std::sqrt(m2[lyr] / n[lyr]);
+}
+
+
+
+bool SpatOverviewStream::init(size_t nr, size_t nc, size_t nl, size_t nlevels, bool avg) {
+	average = avg;
+	nlyr = nl;
+	nrow = {nr};
+	ncol = {nc};
+	for (size_t i=0; i<nlevels; i++) {
+		nr = (nr + 1) / 2;
+		nc = (nc + 1) / 2;
+		nrow.push_back(nr);
+		ncol.push_back(nc);
+	}
+	size_t n = nrow.size();
+	nextrow = std::vector<size_t>(n, 0);
+	ready_row = std::vector<size_t>(n, 0);
+	ready_nrows = std::vector<size_t>(n, 0);
+	ready.resize(n);
+	sum.resize(n);
+	cnt.resize(n);
+	for (size_t i=1; i<n; i++) {
+		ready[i].resize(nl);
+		sum[i].resize(nl * ncol[i]);
+		cnt[i].resize(nl * ncol[i]);
+	}
+	return n > 1;
+}
+
+
+// row "nextrow[level]" of "level"; for each layer, "stride" apart
+void SpatOverviewStream::add_row(size_t level, const double *s, const double *c, size_t stride) {
+	size_t r = nextrow[level];
+	nextrow[level]++;
+	size_t lev = level + 1;
+	size_t ncin = ncol[level];
+	size_t ncout = ncol[lev];
+	double *osum = sum[lev].data();
+	double *ocnt = cnt[lev].data();
+	bool first = (r % 2) == 0;
+	if (first) {
+		std::fill(sum[lev].begin(), sum[lev].end(), 0);
+		std::fill(cnt[lev].begin(), cnt[lev].end(), 0);
+	}
+	for (size_t lyr=0; lyr<nlyr; lyr++) {
+		const double *ls = s + lyr * stride;
+		const double *lc = c + lyr * stride;
+		double *ts = osum + lyr * ncout;
+		double *tc = ocnt + lyr * ncout;
+		if (average) {
+			for (size_t i=0; i<ncin; i++) {
+				ts[i/2] += ls[i];
+				tc[i/2] += lc[i];
+			}
+		} else if (first) {
+			for (size_t i=0; i<ncin; i+=2) {
+				ts[i/2] = ls[i];
+				tc[i/2] = lc[i];
+			}
+		}
+	}
+	if (first && ((r+1) < nrow[level])) return;
+
+	// a row of the next level is complete
+	for (size_t lyr=0; lyr<nlyr; lyr++) {
+		const double *ts = osum + lyr * ncout;
+		const double *tc = ocnt + lyr * ncout;
+		std::vector<double> &out = ready[lev][lyr];
+		for (size_t i=0; i<ncout; i++) {
+			out.push_back(tc[i] > 0 ? ts[i] / tc[i] : NAN);
+		}
+	}
+	ready_nrows[lev]++;
+	if ((lev+1) < nrow.size()) {
+		add_row(lev, osum, ocnt, ncout);
+	}
+}
+
+
+bool SpatOverviewStream::add(const std::vector<double> &v, size_t startrow, size_t nrows, double lo, double hi) {
+	if ((nrow.size() < 2) || (startrow != nextrow[0]) || ((startrow + nrows) > nrow[0])) {
+		return false;
+	}
+	size_t nc = ncol[0];
+	size_t ncell = nrows * nc;
+	if (v.size() != (ncell * nlyr)) {
+		return false;
+	}
+	std::vector<double> s(nlyr * nc), c(nlyr * nc);
+	for (size_t r=0; r<nrows; r++) {
+		for (size_t lyr=0; lyr<nlyr; lyr++) {
+			const double *d = v.data() + lyr * ncell + r * nc;
+			double *ls = s.data() + lyr * nc;
+			double *lc = c.data() + lyr * nc;
+			for (size_t i=0; i<nc; i++) {
+				bool na = std::isnan(d[i]) || (d[i] < lo) || (d[i] > hi);
+				ls[i] = na ? 0 : d[i];
+				lc[i] = na ? 0 : 1;
+			}
+		}
+		add_row(0, s.data(), c.data(), nc);
+	}
+	return true;
+}
+
+
+void SpatOverviewStream::written(size_t level) {
+	for (size_t lyr=0; lyr<nlyr; lyr++) {
+		ready[level][lyr].resize(0);
+	}
+	ready_row[level] += ready_nrows[level];
+	ready_nrows[level] = 0;
+}
+
+
+bool SpatOverviewStream::complete() {
+	return (nrow.size() > 1) && (nextrow[0] == nrow[0]);
+}
+
+
+size_t cog_overview_count(size_t nrow, size_t ncol, size_t blocksize) {
+	size_t n = 0;
+	while ((nrow > blocksize) || (ncol > blocksize)) {
+		nrow = (nrow + 1) / 2;
+		ncol = (ncol + 1) / 2;
+		n++;
+	}
+	return n;
+}
@@ -4,6 +4,9 @@
 #include "sys/types.h"
 #include "sys/sysinfo.h"
 #include <unistd.h>
+#include <fstream>
+#include <string>
+#include <sstream>
 #elif __APPLE__
 #include <mach/vm_statistics.h>
 #include <mach/mach_types.h>
@@ -11,21 +14,109 @@
 #include <mach/mach_host.h>
 #endif
 
+#include <mutex>
+#include <algorithm>
+#include "ram.h"
+
+
+#ifdef __linux__
+// the first number in a file (e.g. /sys/fs/cgroup/memory.max); 
+// false if there is no such file or no limit ("max")
+bool read_bytes(const std::string &filename, double &bytes) {
+	std::ifstream f(filename);
+	if (!f.is_open()) return false;
+	std::string s;
+	f >> s;
+	if ((s == "") || (s == "max")) return false;
+	bytes = std::strtod(s.c_str(), NULL);
+	// cgroup v1 reports a very large number if there is no limit
+	return ((bytes > 0) && (bytes < 1e18));
+}
+
+
+// MemAvailable includes reclaimable page cache, unlike sysinfo's freeram
+bool meminfo_available(double &bytes) {
+	std::ifstream f("/proc/meminfo");
+	if (!f.is_open()) return false;
+	std::string line;
+	while (std::getline(f, line)) {
+		if (line.compare(0, 13, "MemAvailable:") == 0) {
+			std::istringstream iss(line.substr(13));
+			double kb;
+			if (iss >> kb) {
+				bytes = kb * 1024;
+				return true;
+			}
+			return false;
+		}
+	}
+	return false;
+}
+
+
+// the value of "key" in a file with "key value" lines (e.g. memory.stat)
+bool read_stat(const std::string &filename, const std::string &key, double &value) {
+	std::ifstream f(filename);
+	if (!f.is_open()) return false;
+	std::string k;
+	double v;
+	while (f >> k >> v) {
+		if (k == key) {
+			value = v;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// memory that can still be used within the limit of the cgroup (container)
+// the usage includes the page cache; inactive file pages can be reclaimed
+bool cgroup_available(double &bytes) {
+	double limit, usage, cache;
+	// cgroup v2
+	if (read_bytes("/sys/fs/cgroup/memory.max", limit)) {
+		if (!read_bytes("/sys/fs/cgroup/memory.current", usage)) usage = 0;
+		if (read_stat("/sys/fs/cgroup/memory.stat", "inactive_file", cache)) {
+			usage = std::max(0.0, usage - cache);
+		}
+		bytes = std::max(0.0, limit - usage);
+		return true;
+	}
+	// cgroup v1
+	if (read_bytes("/sys/fs/cgroup/memory/memory.limit_in_bytes", limit)) {
+		if (!read_bytes("/sys/fs/cgroup/memory/memory.usage_in_bytes", usage)) usage = 0;
+		if (read_stat("/sys/fs/cgroup/memory/memory.stat", "total_inactive_file", cache)) {
+			usage = std::max(0.0, usage - cache);
+		}
+		bytes = std::max(0.0, limit - usage);
+		return true;
+	}
+	return false;
+}
+#endif
+
 
 double availableRAM() {
 //https://stackoverflow.com/questions/38490320/how-to-query-amount-of-allocated-memory-on-linux-and-osx
 //https://stackoverflow.com/questions/63166/how-to-determine-cpu-and-memory-consumption-from-inside-a-process
 	double ram = 1e+9;
-	// return available RAM in number of double (8 byte) cells.
+	// return available RAM in bytes
 	#ifdef _WIN32
 		MEMORYSTATUSEX statex;
 		statex.dwLength = sizeof(statex);
 		GlobalMemoryStatusEx(&statex);
 		ram = statex.ullAvailPhys;
 	#elif __linux__
-		struct sysinfo memInfo;
-		sysinfo (&memInfo);
-		ram = memInfo.freeram;
+		if (!meminfo_available(ram)) {
+			struct sysinfo memInfo;
+			sysinfo (&memInfo);
+			ram = (double)memInfo.freeram * memInfo.mem_unit;
+		}
+		double cgram;
+		if (cgroup_available(cgram)) {
+			ram = std::min(ram, cgram);
+		}
 	#elif __APPLE__
 
 		vm_size_t page_size;
@@ -45,6 +136,26 @@ double availableRAM() {
 		}
 	
 	#endif
-	return ram / 8;  // 8 bytes for each double
+	return ram;
+}
+
+
+static std::mutex ram_mutex;
+static double ram_reserved = 0;
+
+double reservedRAM() {
+	std::lock_guard<std::mutex> lock(ram_mutex);
+	return ram_reserved;
+}
+
+SpatRAMReservation::SpatRAMReservation(double b) {
+	bytes = b;
+	std::lock_guard<std::mutex> lock(ram_mutex);
+	ram_reserved += bytes;
+}
+
+SpatRAMReservation::~SpatRAMReservation() {
+	std::lock_guard<std::mutex> lock(ram_mutex);
+	ram_reserved = std::max(0.0, ram_reserved - bytes);
 }
 
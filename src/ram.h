@@ -1 +1,18 @@
-double availableRAM();
\ No newline at end of file
+#ifndef SPATRAM_GUARD
+#define SPATRAM_GUARD
+
+// available RAM in bytes (the OS or cgroup limit, whichever is lower)
+double availableRAM();
+
+// RAM that has been promised to rasters that are being written 
+// (see writeStart) and that may not have been allocated yet
+double reservedRAM();
+
+class SpatRAMReservation {
+	public:
+		double bytes;
+		SpatRAMReservation(double b);
+		~SpatRAMReservation();
+};
+
+#endif
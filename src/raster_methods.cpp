@@ -24,6 +24,9 @@
 #include "math_utils.h"
 #include "file_utils.h"
 #include "string_utils.h"
+#include "spatBlock.h"
+#include "spatIndex.h"
+#include "spatScanline.h"
 
 
 /*
@@ -148,61 +151,110 @@ std::vector<std::vector<double>> SpatRaster::get_aggregates(std::vector<double>
 }
 
 
-std::vector<double> compute_aggregates(std::vector<double> &in, size_t nr, size_t nc, size_t nl, std::vector<unsigned> dim, std::function<double(std::vector<double>&, bool)> fun, bool narm) {
+// the aggregates of a block of "nr" rows (a multiple of dim[0], except for the last block)
+// The values of the cells are added to the aggregate they belong to as the rows are scanned.
+// fun: 0:sum, 1:mean, 2:min, 3:max, 4:count; other functions use "fun" on the values of
+// each aggregate, in the order of layer, row and column, with NAN for cells outside the raster
+void compute_aggregates(const std::vector<double> &in, size_t nr, size_t nc, size_t nl, const std::vector<unsigned> &dim, int ifun, const std::function<double(std::vector<double>&, bool)> &fun, bool narm, std::vector<double> &out) {
 
 // dim 0, 1, 2, are the aggregations factors dy, dx, dz
 // and 3, 4, 5 are the new nrow, ncol, nlyr
 
 	size_t dy = dim[0], dx = dim[1], dz = dim[2];
-//	size_t bpC = dim[3];
-// adjust for chunk
-	size_t bpC = std::ceil(double(nr) / dim[0]);
-	size_t bpR = dim[4];
-	size_t bpL = bpR * bpC;
-
-	// new number of layers
-	size_t newNL = dim[5];
-
-	// new number of rows, adjusted for additional (expansion) rows
-	size_t adjnr = bpC * dy;
-
-	// number of aggregates
-	size_t nblocks = (bpR * bpC * newNL);
-	// cells per aggregate
-	size_t blockcells = dx * dy * dz;
-
-	// output: each row is a block
-	std::vector<double> out(nblocks, NAN);
-
-//    size_t nl = nlyr();
-//    size_t nc = ncol();
-    size_t ncells = nr * nc;
-    size_t lstart, rstart, cstart, lmax, rmax, cmax, f, lj, cell;
-
-	for (size_t b = 0; b < nblocks; b++) {
-		lstart = dz * (b / bpL);
-		rstart = (dy * (b / bpR)) % adjnr;
-		cstart = dx * (b % bpR);
-
-		lmax = std::min(nl, (lstart + dz));
-		rmax = std::min(nr, (rstart + dy));  // nrow -> nr
-		cmax = std::min(nc, (cstart + dx));
+	size_t onr = (nr + dy - 1) / dy;
+	size_t onc = dim[4];
+	size_t onl = dim[5];
+	size_t oncl = onr * onc;
+	size_t ncells = nr * nc;
+
+	if (ifun < 0) {
+		out.resize(oncl * onl);
+		std::vector<double> a(dx * dy * dz);
+		for (size_t ol=0; ol<onl; ol++) {
+			size_t lmax = std::min(nl, (ol + 1) * dz);
+			for (size_t orow=0; orow<onr; orow++) {
+				size_t rmax = std::min(nr, (orow + 1) * dy);
+				for (size_t oc=0; oc<onc; oc++) {
+					size_t cmax = std::min(nc, (oc + 1) * dx);
+					std::fill(a.begin(), a.end(), NAN);
+					size_t f = 0;
+					for (size_t j=ol*dz; j<lmax; j++) {
+						for (size_t r=orow*dy; r<rmax; r++) {
+							size_t cell = j * ncells + r * nc;
+							for (size_t c=oc*dx; c<cmax; c++) {
+								a[f] = in[cell + c];
+								f++;
+							}
+						}
+					}
+					out[ol * oncl + orow * onc + oc] = fun(a, narm);
+				}
+			}
+		}
+		return;
+	}
+
+	out.resize(0);
+	out.resize(oncl * onl, ifun == 4 ? 0 : NAN);
+	std::vector<size_t> n;
+	if (ifun == 1) n.resize(oncl * onl, 0);
+	// for "na.rm=FALSE", an NA (or a cell outside the raster) makes the aggregate NA
+	std::vector<bool> isna;
+	if ((!narm) && (ifun != 4)) isna.resize(oncl * onl, false);
+
+	for (size_t j=0; j<nl; j++) {
+		size_t ol = j / dz;
+		for (size_t r=0; r<nr; r++) {
+			const double *v = &in[j * ncells + r * nc];
+			size_t ko = ol * oncl + (r / dy) * onc;
+			for (size_t c=0; c<nc; c++) {
+				double d = v[c];
+				size_t k = ko + c / dx;
+				if (std::isnan(d)) {
+					if (!isna.empty()) isna[k] = true;
+					continue;
+				}
+				double &a = out[k];
+				switch (ifun) {
+					case 0: 
+						a = std::isnan(a) ? d : a + d;
+						break;
+					case 1: 
+						a = std::isnan(a) ? d : a + d;
+						n[k]++;
+						break;
+					case 2: 
+						if (std::isnan(a) || (d < a)) a = d;
+						break;
+					case 3: 
+						if (std::isnan(a) || (d > a)) a = d;
+						break;
+					default:
+						a++;
+				}
+			}
+		}
+	}
 
-		f = 0;
-		std::vector<double> a(blockcells, NAN);
-		for (size_t j = lstart; j < lmax; j++) {
-			lj = j * ncells;
-			for (size_t r = rstart; r < rmax; r++) {
-				cell = lj + r * nc;
-				for (size_t c = cstart; c < cmax; c++) {
-					a[f] = in[cell + c];
-					f++;
+	if (ifun == 1) {
+		for (size_t k=0; k<out.size(); k++) {
+			if (n[k] > 0) out[k] /= n[k];
+		}
+	}
+	if (!isna.empty()) {
+		bool outside = ((nr % dy) != 0) || ((nc % dx) != 0) || ((nl % dz) != 0);
+		for (size_t ol=0; ol<onl; ol++) {
+			for (size_t orow=0; orow<onr; orow++) {
+				for (size_t oc=0; oc<onc; oc++) {
+					size_t k = ol * oncl + orow * onc + oc;
+					if (outside && ((((orow + 1) * dy) > nr) || (((oc + 1) * dx) > nc) || (((ol + 1) * dz) > nl))) {
+						isna[k] = true;
+					}
+					if (isna[k]) out[k] = NAN;
 				}
 			}
 		}
-		out[b] = fun(a, narm);
 	}
-	return(out);
 }
 
 
@@ -236,7 +288,7 @@ SpatRaster SpatRaster::aggregate(std::vector<unsigned> fact, std::string fun, bo
 		return out; 
 	}
 
-	if (!haveFun(fun)) {
+	if ((fun != "count") && (!haveFun(fun))) {
 		out.setError("unknown function argument");
 		return out;
 	}
@@ -259,33 +311,35 @@ SpatRaster SpatRaster::aggregate(std::vector<unsigned> fact, std::string fun, bo
 #endif
 */
 
+	std::vector<std::string> fast {"sum", "mean", "min", "max", "count"};
+	int ifun = std::find(fast.begin(), fast.end(), fun) - fast.begin();
+	if (ifun == (int)fast.size()) ifun = -1;
 	std::function<double(std::vector<double>&, bool)> agFun = getFun(fun);
 
 	unsigned outnc = out.ncol();
 
-	//BlockSize bs = getBlockSize(4, opt.get_memfrac());
-	BlockSize bs = getBlockSize(opt);
-	//bs.n = floor(nrow() / fact[0]); # ambiguous on solaris
-	bs.n = std::floor(static_cast <double> (nrow() / fact[0]));
-
-	bs.nrows = std::vector<size_t>(bs.n, fact[0]);
-	bs.row.resize(bs.n);
-	for (size_t i =0; i<bs.n; i++) {
-		bs.row[i] = i * fact[0];
-	}
-	size_t lastrow = bs.row[bs.n - 1] + bs.nrows[bs.n - 1] + 1;
-	if (lastrow < nrow()) {
-		bs.row.push_back(lastrow);
-		bs.nrows.push_back(std::min(bs.nrows[bs.n-1], nrow()-lastrow));
-		bs.n += 1;
+	// blocks of whole rows of aggregates
+	opt.ncopies += 1;
+	BlockLayout layout;
+	layout.threaded = true;
+	BlockSize bs = getBlockSize(opt, layout);
+	size_t nr = nrow();
+	size_t brows = std::max((size_t)1, bs.nrows[0] / fact[0]) * fact[0];
+	bs.row.resize(0);
+	bs.nrows.resize(0);
+	for (size_t r=0; r<nr; r+=brows) {
+		bs.row.push_back(r);
+		bs.nrows.push_back(std::min(brows, nr - r));
 	}
+	bs.n = bs.row.size();
+
 	if (!readStart()) {
 		out.setError(getError());
 		return(out);
 	}
 
 	opt.steps = bs.n;
-	opt.minrows = fact[0];
+	opt.minrows = 1;
 
 	if (fun == "modal") {
 		if (nlyr() == out.nlyr()) {
@@ -296,16 +350,40 @@ SpatRaster SpatRaster::aggregate(std::vector<unsigned> fact, std::string fun, bo
 		}
 	}
 	
-	if (!out.writeStart(opt)) {
+	if (!out.writeStart(opt, layout)) {
 		readStop();
 		return out;
 	}
+	// the output rows of each block
+	out.bs.n = bs.n;
+	out.bs.row.resize(bs.n);
+	out.bs.nrows.resize(bs.n);
+	for (size_t i=0; i<bs.n; i++) {
+		out.bs.row[i] = bs.row[i] / fact[0];
+		out.bs.nrows[i] = (bs.nrows[i] + fact[0] - 1) / fact[0];
+	}
+	out.bs.col = std::vector<size_t>(bs.n, 0);
+	out.bs.ncols = std::vector<size_t>(bs.n, outnc);
 
 	size_t nc = ncol();
-	for (size_t i = 0; i < bs.n; i++) {
-        std::vector<double> vin = readValues(bs.row[i], bs.nrows[i], 0, nc);
-		std::vector<double> v  = compute_aggregates(vin, bs.nrows[i], nc, nlyr(), fact, agFun, narm);
-		if (!out.writeValues(v, i, 1, 0, outnc)) return out;
+	size_t nl = nlyr();
+	BlockReader reader = [&](size_t i, std::vector<std::vector<double>> &d) {
+		d.resize(1);
+		d[0] = readValues(bs.row[i], bs.nrows[i], 0, nc);
+		if (hasError()) {
+			out.setError(getError());
+			return false;
+		}
+		return true;
+	};
+	BlockWorker worker = [&bs, nc, nl, fact, ifun, agFun, narm](size_t i, std::vector<std::vector<double>> &d) {
+		std::vector<double> v;
+		compute_aggregates(d[0], bs.nrows[i], nc, nl, fact, ifun, agFun, narm, v);
+		d[0].swap(v);
+	};
+	if (!out.writeBlocks(reader, worker, opt)) {
+		readStop();
+		return out;
 	}
 	out.writeStop();
 	readStop();
@@ -631,7 +709,7 @@ SpatRaster SpatRaster::apply(std::vector<unsigned> ind, std::string fun, bool na
 		out.setError(getError());
 		return(out);
 	}
- 	if (!out.writeStart(opt)) {
+	if (!out.writeStart(opt)) {
 		readStop();
 		return out;
 	}
@@ -678,6 +756,47 @@ SpatRaster SpatRaster::apply(std::vector<unsigned> ind, std::string fun, bool na
 
 
 
+template <typename T>
+bool mask_native(SpatRaster &x, SpatRaster &m, SpatRaster &out, bool inverse, double maskvalue, double updatevalue) {
+	T upd;
+	native_value(updatevalue, upd);
+	std::vector<T> v;
+	std::vector<double> mv;
+	size_t nc = out.ncol();
+	for (size_t i = 0; i < out.bs.n; i++) {
+		if (!x.readValuesNative(v, out.bs.row[i], out.bs.nrows[i], 0, nc)) {
+			out.setError(x.getError());
+			return false;
+		}
+		mv = m.readValues(out.bs.row[i], out.bs.nrows[i], 0, nc);
+		recycle(mv, v.size());
+		if (inverse) {
+			if (std::isnan(maskvalue)) {
+				for (size_t j=0; j < v.size(); j++) {
+					if (!std::isnan(mv[j])) v[j] = upd;
+				}
+			} else {
+				for (size_t j=0; j < v.size(); j++) {
+					if (mv[j] != maskvalue) v[j] = upd;
+				}
+			}
+		} else {
+			if (std::isnan(maskvalue)) {
+				for (size_t j=0; j < v.size(); j++) {
+					if (std::isnan(mv[j])) v[j] = upd;
+				}
+			} else {
+				for (size_t j=0; j < v.size(); j++) {
+					if (mv[j] == maskvalue) v[j] = upd;
+				}
+			}
+		}
+		if (!out.writeValuesNative(v, out.bs.row[i], out.bs.nrows[i], 0, nc)) return false;
+	}
+	return out.writeStop();
+}
+
+
 SpatRaster SpatRaster::mask(SpatRaster x, bool inverse, double maskvalue, double updatevalue, SpatOptions &opt) {
 
 	unsigned nl = std::max(nlyr(), x.nlyr());
@@ -695,46 +814,97 @@ SpatRaster SpatRaster::mask(SpatRaster x, bool inverse, double maskvalue, double
 		out.setError(x.getError());
 		return(out);
 	}
-  	if (!out.writeStart(opt)) {
+
+	// the values of "this" can be masked in their file datatype 
+	// if the update value can be stored in that type
+	std::string datatype;
+	bool native = (x.nlyr() <= nlyr()) && native_datatype(datatype) && native_value_fits(datatype, updatevalue);
+	if (native) {
+		native = native_output(datatype, opt);
+	}
+	BlockLayout layout;
+	layout.threaded = !native;
+	layout.tiles = !native;
+	if (native) {
+		layout.elsize = native_datatype_size(datatype);
+	}
+  	if (!out.writeStart(opt, layout)) {
 		readStop();
 		return out;
 	}
-	std::vector<double> v, m;
-	for (size_t i = 0; i < out.bs.n; i++) {
-		v = readValues(out.bs.row[i], out.bs.nrows[i], 0, ncol());
-		m = x.readValues(out.bs.row[i], out.bs.nrows[i], 0, ncol());
+	if (native) {
+		if (datatype == "INT1U") {
+			mask_native<uint8_t>(*this, x, out, inverse, maskvalue, updatevalue);
+		} else if (datatype == "INT2S") {
+			mask_native<int16_t>(*this, x, out, inverse, maskvalue, updatevalue);
+		} else if (datatype == "INT2U") {
+			mask_native<uint16_t>(*this, x, out, inverse, maskvalue, updatevalue);
+		} else if (datatype == "INT4S") {
+			mask_native<int32_t>(*this, x, out, inverse, maskvalue, updatevalue);
+		} else if (datatype == "INT4U") {
+			mask_native<uint32_t>(*this, x, out, inverse, maskvalue, updatevalue);
+		} else if (datatype == "FLT4S") {
+			mask_native<float>(*this, x, out, inverse, maskvalue, updatevalue);
+		} else {
+			mask_native<double>(*this, x, out, inverse, maskvalue, updatevalue);
+		}
+		readStop();
+		x.readStop();
+		return out;
+	}
+
+	BlockReader reader = [&](size_t i, std::vector<std::vector<double>> &d) {
+		d.resize(2);
+		d[0] = readBlock(out.bs, i);
+		d[1] = x.readBlock(out.bs, i);
+		if (hasError()) {
+			out.setError(getError());
+			return false;
+		}
+		if (x.hasError()) {
+			out.setError(x.getError());
+			return false;
+		}
+		return true;
+	};
+	BlockWorker worker = [inverse, maskvalue, updatevalue](size_t i, std::vector<std::vector<double>> &d) {
+		std::vector<double> &v = d[0];
+		std::vector<double> &m = d[1];
 		recycle(v, m);
 		if (inverse) {
 			if (std::isnan(maskvalue)) {
-				for (size_t i=0; i < v.size(); i++) {
-					if (!std::isnan(m[i])) {
-						v[i] = updatevalue;
+				for (size_t j=0; j < v.size(); j++) {
+					if (!std::isnan(m[j])) {
+						v[j] = updatevalue;
 					}
 				}
 			} else {
-				for (size_t i=0; i < v.size(); i++) {
-					if (m[i] != maskvalue) {
-						v[i] = updatevalue;
+				for (size_t j=0; j < v.size(); j++) {
+					if (m[j] != maskvalue) {
+						v[j] = updatevalue;
 					}
 				}
 			}
 		} else {
 			if (std::isnan(maskvalue)) {
-				for (size_t i=0; i < v.size(); i++) {
-					if (std::isnan(m[i])) {
-						v[i] = updatevalue;
+				for (size_t j=0; j < v.size(); j++) {
+					if (std::isnan(m[j])) {
+						v[j] = updatevalue;
 					}
 				}
 			} else {
-				for (size_t i=0; i < v.size(); i++) {
-					if (m[i] == maskvalue) {
-						v[i] = updatevalue;
+				for (size_t j=0; j < v.size(); j++) {
+					if (m[j] == maskvalue) {
+						v[j] = updatevalue;
 					}
 				}
 			}
 		}
-		if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;
-
+	};
+	if (!out.writeBlocks(reader, worker, opt)) {
+		readStop();
+		x.readStop();
+		return out;
 	}
 	out.writeStop();
 	readStop();
@@ -823,26 +993,55 @@ SpatRaster SpatRaster::mask(SpatRaster x, bool inverse, std::vector<double> mask
 
 SpatRaster SpatRaster::mask(SpatVector x, bool inverse, double updatevalue, bool touches, SpatOptions &opt) {
 
-	SpatRaster out;
+	SpatRaster out = geometry();
 	if (!hasValues()) {
 		out.setError("SpatRaster has no values");
 		return out;
 	}
-	if (inverse) {
-		out = rasterizeLyr(x, updatevalue, NAN, touches, true, opt);
-	} else {
-		SpatOptions topt(opt);
-		out = rasterizeLyr(x, 1, 0, touches, false, topt);
-		if (out.hasError()) {
-			return out;
+
+	// the cells covered by the geometries are found for each block,
+	// without first rasterizing them to a SpatRaster
+	SpatRTree tree = scan_index(x);
+	SpatExtent e = getExtent();
+	size_t nc = ncol();
+	size_t nl = nlyr();
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	if (!out.writeStart(opt)) {
+		readStop();
+		return out;
+	}
+	std::vector<size_t> ids;
+	std::vector<double> cells;
+	for (size_t i = 0; i < out.bs.n; i++) {
+		std::vector<double> v = readBlock(out.bs, i);
+		size_t ncb = out.bs.nrows[i] * nc;
+		double ymax = e.ymax - out.bs.row[i] * yres();
+		SpatScanGrid grid(e.xmin, ymax, xres(), yres(), out.bs.nrows[i], nc);
+		tree.query(e.xmin, e.xmax, ymax - out.bs.nrows[i] * yres(), ymax, ids);
+		std::vector<char> inside(ncb, 0);
+		for (size_t j=0; j<ids.size(); j++) {
+			scan_geometry(x.geoms[ids[j]], grid, touches, cells);
+			for (size_t k=0; k<cells.size(); k++) {
+				inside[cells[k]] = 1;
+			}
 		}
-		if (std::isnan(updatevalue)) {
-			out = mask(out, false, 0, updatevalue, opt);
-		} else {
-			out = mask(out, false, 0, updatevalue, topt);
-			out = out.mask(*this, false, NAN, NAN, opt);
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			double *d = &v[lyr * ncb];
+			for (size_t k=0; k<ncb; k++) {
+				if (inverse) {
+					if (inside[k]) d[k] = updatevalue;
+				} else if ((!inside[k]) && (!std::isnan(d[k]))) {
+					d[k] = updatevalue;
+				}
+			}
 		}
+		if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, nc)) return out;
 	}
+	out.writeStop();
+	readStop();
 	return(out);
 }
 
@@ -865,7 +1064,7 @@ SpatRaster SpatRaster::transpose(SpatOptions &opt) {
 		out.setError(getError());
 		return(out);
 	}
- 	if (!out.writeStart(opt)) {
+	if (!out.writeStart(opt)) {
 		readStop();
 		return out;
 	}
@@ -1059,14 +1258,28 @@ SpatRaster SpatRaster::clamp(double low, double high, bool usevalue, SpatOptions
 		return(out);
 	}
 
-  	if (!out.writeStart(opt)) {
+	BlockLayout layout;
+	layout.threaded = true;
+	layout.tiles = true;
+  	if (!out.writeStart(opt, layout)) {
 		readStop();
 		return out;
 	}
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> v = readBlock(out.bs, i);
-		clamp_vector(v, low, high, usevalue);
-		if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;
+	BlockReader reader = [&](size_t i, std::vector<std::vector<double>> &d) {
+		d.resize(1);
+		d[0] = readBlock(out.bs, i);
+		if (hasError()) {
+			out.setError(getError());
+			return false;
+		}
+		return true;
+	};
+	BlockWorker worker = [low, high, usevalue](size_t i, std::vector<std::vector<double>> &d) {
+		clamp_vector(d[0], low, high, usevalue);
+	};
+	if (!out.writeBlocks(reader, worker, opt)) {
+		readStop();
+		return out;
 	}
 	readStop();
 	out.writeStop();
@@ -1187,7 +1400,7 @@ SpatRaster SpatRaster::rapply(SpatRaster x, double first, double last, std::stri
 	std::function<double(std::vector<double>&, bool)> theFun = getFun(fun);
 
 	int nl = nlyr();
- 	if (!out.writeStart(opt)) {
+	if (!out.writeStart(opt)) {
 		readStop();
 		return out;
 	}
@@ -1765,7 +1978,7 @@ SpatRaster SpatRaster::rotate(bool left, SpatOptions &opt) {
 		out.setError(getError());
 		return(out);
 	}
- 	if (!out.writeStart(opt)) {
+	if (!out.writeStart(opt)) {
 		readStop();
 		return out;
 	}
@@ -1955,7 +2168,7 @@ SpatRaster SpatRaster::extend(SpatExtent e, SpatOptions &opt) {
 		return(out);
 	}
 
- 	if (!out.writeStart(opt)) {
+	if (!out.writeStart(opt)) {
 		readStop();
 		return out;
 	}
@@ -2029,7 +2242,18 @@ SpatRaster SpatRaster::crop(SpatExtent e, std::string snap, SpatOptions &opt) {
 	}
 
 	opt.ncopies = 2;
- 	if (!out.writeStart(opt)) {
+	std::string datatype;
+	bool native = native_output(datatype, opt);
+	BlockLayout layout;
+	if (native) {
+		layout.elsize = native_datatype_size(datatype);
+	}
+	if (!out.writeStart(opt, layout)) {
+		readStop();
+		return out;
+	}
+	if (native) {
+		copyValuesNative(out, datatype, row1, col1);
 		readStop();
 		return out;
 	}
@@ -2234,15 +2458,152 @@ SpatRaster SpatRasterCollection::merge(SpatOptions &opt) {
 
 
 
+// combines the values of the (aligned) rasters that overlap with a block of the output
+// For the median, the values of each raster are kept, only for the rows that it overlaps with
+class MosaicBlock {
+	public:
+		int fun; // 0:first, 1:sum, 2:mean, 3:min, 4:max, 5:median
+		size_t nl, nr, nc, ncl;
+		size_t nfilled = 0;
+		std::vector<double> v, n;
+		// median: the first row, number of rows and offset in "v" of each raster 
+		std::vector<size_t> sr0, snr, soff;
+
+		MosaicBlock(int f, size_t nlyr, size_t nrows, size_t ncols) {
+			fun = f;
+			nl = nlyr;
+			nr = nrows;
+			nc = ncols;
+			ncl = nrows * ncols;
+			if (fun != 5) v.resize(ncl * nl, NAN);
+			if (fun == 2) n.resize(ncl * nl, 0);
+		}
+
+		bool complete() {
+			return (fun == 0) && (nfilled == (ncl * nl));
+		}
+
+		// "x" has the values of "xnl" layers for "nrows" rows and "xnc" columns, that go to
+		// row "r0" and column "c0" of the block. Layers are recycled if xnl < nl
+		void add(const std::vector<double> &x, size_t xnl, size_t nrows, size_t xnc, size_t r0, size_t c0) {
+			size_t xncl = nrows * xnc;
+			size_t jn = c0 < nc ? std::min(xnc, nc - c0) : 0;
+			if (fun == 5) {
+				sr0.push_back(r0);
+				snr.push_back(nrows);
+				soff.push_back(v.size());
+				v.resize(v.size() + nrows * nc * nl, NAN);
+			}
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				const double *xl = &x[(lyr % xnl) * xncl];
+				for (size_t i=0; i<nrows; i++) {
+					const double *xr = xl + i * xnc;
+					size_t k;
+					if (fun == 5) {
+						k = soff.back() + lyr * nrows * nc + i * nc + c0;
+					} else {
+						k = lyr * ncl + (r0 + i) * nc + c0;
+					}
+					for (size_t j=0; j<jn; j++) {
+						double d = xr[j];
+						if (std::isnan(d)) continue;
+						double &a = v[k+j];
+						switch (fun) {
+							case 0:
+								if (std::isnan(a)) {
+									a = d;
+									nfilled++;
+								}
+								break;
+							case 1:
+								a = std::isnan(a) ? d : a + d;
+								break;
+							case 2:
+								a = std::isnan(a) ? d : a + d;
+								n[k+j]++;
+								break;
+							case 3:
+								if (std::isnan(a) || (d < a)) a = d;
+								break;
+							case 4:
+								if (std::isnan(a) || (d > a)) a = d;
+								break;
+							default:
+								a = d;
+						}
+					}
+				}
+			}
+		}
+
+		std::vector<double> get() {
+			if (fun == 2) {
+				for (size_t i=0; i<v.size(); i++) {
+					v[i] /= n[i];
+				}
+			} else if (fun == 5) {
+				std::vector<double> out(ncl * nl, NAN);
+				std::vector<double> c;
+				c.reserve(sr0.size());
+				std::vector<size_t> rs;
+				for (size_t r=0; r<nr; r++) {
+					// the rasters that have values for this row
+					rs.resize(0);
+					for (size_t s=0; s<sr0.size(); s++) {
+						if ((r >= sr0[s]) && (r < (sr0[s] + snr[s]))) rs.push_back(s);
+					}
+					if (rs.empty()) continue;
+					for (size_t lyr=0; lyr<nl; lyr++) {
+						for (size_t j=0; j<nc; j++) {
+							c.resize(0);
+							for (size_t s : rs) {
+								double d = v[soff[s] + lyr * snr[s] * nc + (r - sr0[s]) * nc + j];
+								if (!std::isnan(d)) c.push_back(d);
+							}
+							out[lyr * ncl + r * nc + j] = vmedian(c, false);
+						}
+					}
+				}
+				return out;
+			}
+			return v;
+		}
+};
+
+
+// the first row and column of "x" in the grid of "out" (they have the same resolution and origin)
+void mosaic_offset(SpatRaster &x, SpatRaster &out, int_64 &row, int_64 &col) {
+	SpatExtent ex = x.getExtent();
+	SpatExtent eo = out.getExtent();
+	row = std::round((eo.ymax - ex.ymax) / out.yres());
+	col = std::round((ex.xmin - eo.xmin) / out.xres());
+}
+
+
+// read the rows of "x" (with its first row at "xrow" in "out") that are in the block of "out"
+// that starts at "brow" and has "bnrows" rows
+bool mosaic_read(SpatRaster &x, int_64 xrow, int_64 xcol, int_64 brow, int_64 bnrows, MosaicBlock &b) {
+	int_64 r1 = std::max(xrow, brow);
+	int_64 r2 = std::min(xrow + (int_64)x.nrow(), brow + bnrows);
+	if ((r2 <= r1) || (xcol < 0)) return true;
+	std::vector<double> v = x.readValues(r1 - xrow, r2 - r1, 0, x.ncol());
+	if (x.hasError()) return false;
+	b.add(v, x.nlyr(), r2 - r1, x.ncol(), r1 - brow, xcol);
+	return true;
+}
+
+
 SpatRaster SpatRasterCollection::mosaic(std::string fun, SpatOptions &opt) {
 
 	SpatRaster out;
 
-	std::vector<std::string> f {"first", "sum", "mean", "median", "min", "max"};
-	if (std::find(f.begin(), f.end(), fun) == f.end()) {
+	std::vector<std::string> f {"first", "sum", "mean", "min", "max", "median"};
+	std::vector<std::string>::iterator fit = std::find(f.begin(), f.end(), fun);
+	if (fit == f.end()) {
 		out.setError("not a valid function");
 		return out;
 	}
+	int ifun = fit - f.begin();
 
 	unsigned n = size();
 
@@ -2259,7 +2620,6 @@ SpatRaster SpatRasterCollection::mosaic(std::string fun, SpatOptions &opt) {
 	hvals[0] = ds[0].hasValues();
 	SpatExtent e = ds[0].getExtent();
 	unsigned nl = ds[0].nlyr();
-	std::vector<bool> resample(n, false);
 	for (size_t i=1; i<n; i++) {
 									//  lyrs, crs, warncrs, ext, rowcol, res
 		if (!ds[0].compare_geom(ds[i], false, false, false, false, false, true)) {
@@ -2284,67 +2644,120 @@ SpatRaster SpatRasterCollection::mosaic(std::string fun, SpatOptions &opt) {
 		return out;
 	}	
 
-	SpatExtent eout = out.getExtent();
-	double hyr = out.yres()/2;
-
+	// rasters that are not aligned with the output are resampled for each block 
+	// (to avoid warping them all before starting). The others are read directly.
+	std::vector<bool> resample(n, false);
+	std::vector<int_64> xrow(n), xcol(n);
+	std::vector<double> xmin(n), xmax(n), ymin(n), ymax(n);
 	std::string warn = "";
 	for (size_t i=0; i<n; i++) {
-		SpatOptions topt(opt);
-		if(!ds[i].shared_basegeom(out, 0.1, true)) {
-			SpatRaster temp = out.crop(ds[i].getExtent(), "near", topt);
-			std::vector<bool> hascats = ds[i].hasCategories();
-			std::string method = hascats[0] ? "near" : "bilinear";
-			ds[i] = ds[i].warper(temp, "", method, false, topt);
-			if (ds[i].hasError()) {
-				out.setError(ds[i].getError());
-				return out;
-			}
+		if (ds[i].shared_basegeom(out, 0.1, true)) {
+			mosaic_offset(ds[i], out, xrow[i], xcol[i]);
+		} else {
+			resample[i] = true;
 			warn = "rasters did not align and were resampled";
 		}
+		SpatExtent ei = ds[i].getExtent();
+		xmin[i] = ei.xmin;
+		xmax[i] = ei.xmax;
+		ymin[i] = ei.ymin;
+		ymax[i] = ei.ymax;
 	}
 	if (warn != "") out.addWarning(warn);
-	
+	SpatRTree tree(xmin, xmax, ymin, ymax);
+
+	SpatExtent eout = out.getExtent();
+	double hyr = out.yres()/2;
+	std::vector<size_t> cand;
+
+	if (ifun == 5) {
+		// for the median, a block keeps the values of each raster that overlaps with it, for
+		// the rows that it overlaps with. That is at most the largest number of rasters that
+		// overlap with a row (at the top row of one of them) times the number of rows
+		size_t ncand = 1;
+		for (size_t i=0; i<n; i++) {
+			tree.query(eout.xmin, eout.xmax, ymax[i] - hyr, ymax[i] - hyr, cand);
+			ncand = std::max(ncand, cand.size());
+		}
+		opt.ncopies += 2 + ncand;
+	} else {
+		opt.ncopies += ifun == 2 ? 4 : 3;
+	}
  	if (!out.writeStart(opt)) { return out; }
 	SpatOptions sopt(opt);
 	sopt.progressbar = false;
-	std::vector<double> v;
+	sopt.set_filenames({""});
+
+	// rasters are opened when they are first needed, and closed after their last row was read
+	std::vector<bool> isopen(n, false);
+	std::string errmsg;
 	for (size_t i=0; i < out.bs.n; i++) {
-		eout.ymin = out.yFromRow(out.bs.row[i] + out.bs.nrows[i] - 1) - hyr;
-		SpatRasterStack s;
-		SpatRaster r;
-		for (size_t j=0; j<n; j++) {
-			e = ds[j].getExtent();
-			e.intersect(eout);
-			if ( e.valid_notequal() ) {
-				r = ds[j].crop(eout, "near", sopt);
-				//SpatExtent ec = r.getExtent();
-				r = r.extend(eout, sopt);
-				//SpatExtent ee = r.getExtent();
-				if (!s.push_back(r, "", "", "", false)) {
-					out.setError("internal error: " + s.getError());
-					out.writeStop();
-					return out;
+		int_64 brow = out.bs.row[i];
+		int_64 bnrows = out.bs.nrows[i];
+		eout.ymax = out.yFromRow(brow) + hyr;
+		eout.ymin = out.yFromRow(brow + bnrows - 1) - hyr;
+		tree.query(eout.xmin, eout.xmax, eout.ymin, eout.ymax, cand);
+
+		MosaicBlock b(ifun, nl, bnrows, out.ncol());
+		for (size_t j=0; j<cand.size(); j++) {
+			if (b.complete()) break;
+			size_t k = cand[j];
+			if (resample[k]) {
+				e = ds[k].getExtent();
+				e.intersect(eout);
+				if (!e.valid_notequal()) continue;
+				SpatRaster temp = out.crop(e, "near", sopt);
+				if ((temp.nrow() == 0) || (temp.ncol() == 0)) continue;
+				std::vector<bool> hascats = ds[k].hasCategories();
+				std::string method = hascats[0] ? "near" : "bilinear";
+				temp = ds[k].warper(temp, "", method, false, sopt);
+				if (temp.hasError()) {
+					errmsg = temp.getError();
+					break;
+				}
+				int_64 trow, tcol;
+				mosaic_offset(temp, out, trow, tcol);
+				if (!temp.readStart()) {
+					errmsg = temp.getError();
+					break;
+				}
+				bool ok = mosaic_read(temp, trow, tcol, brow, bnrows, b);
+				temp.readStop();
+				if (!ok) {
+					errmsg = temp.getError();
+					break;
+				}
+			} else {
+				if (!isopen[k]) {
+					if (!ds[k].readStart()) {
+						errmsg = ds[k].getError();
+						break;
+					}
+					isopen[k] = true;
+				}
+				if (!mosaic_read(ds[k], xrow[k], xcol[k], brow, bnrows, b)) {
+					errmsg = ds[k].getError();
+					break;
+				}
+				if ((xrow[k] + (int_64)ds[k].nrow()) <= (brow + bnrows)) {
+					ds[k].readStop();
+					isopen[k] = false;
 				}
 			}
-		} 
-		size_t ncls = out.bs.nrows[i] * out.ncol() * nl;
-		if (s.size() > 0) {
-			r = s.summary(fun, true, sopt);
-			if (r.hasError()) {
-				out.setError("internal error: " + r.getError());
-				out.writeStop();
-				return out;
-			}
-			if (!r.getValuesSource(0, v)) {
-				out.setError("internal error: " + r.getError());
-				out.writeStop();
-				return out;			
+		}
+		if (errmsg != "") {
+			for (size_t k=0; k<n; k++) {
+				if (isopen[k]) ds[k].readStop();
 			}
-			recycle(v, ncls);
-		} else {
-			v = std::vector<double>(ncls, NAN); 
+			out.setError(errmsg);
+			out.writeStop();
+			return out;
 		}
-		if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, out.ncol())) return out;
+		std::vector<double> v = b.get();
+		if (!out.writeValues(v, brow, bnrows, 0, out.ncol())) return out;
+	}
+	for (size_t k=0; k<n; k++) {
+		if (isopen[k]) ds[k].readStop();
 	}
 	out.writeStop();
 	return(out);
@@ -3053,143 +3466,132 @@ SpatRaster SpatRaster::reclassify(std::vector<double> rcl, unsigned nc, unsigned
 
 
 
-std::vector<std::vector<double>> clump_getRCL(std::vector<std::vector<size_t>> rcl, size_t n) {
-	std::vector<std::vector<size_t>> rcl2(rcl[0].size());
-	for (size_t i=0; i<rcl[0].size(); i++) {
-		rcl2[i].push_back(rcl[0][i]);
-		rcl2[i].push_back(rcl[1][i]);
-	}
-    std::sort(rcl2.begin(), rcl2.end());
-    rcl2.erase(std::unique(rcl2.begin(), rcl2.end()), rcl2.end());
-	std::vector<std::vector<double>> out(2);
-	for (size_t i=0; i<rcl2.size(); i++) {
-		out[0].push_back(rcl2[i][1]);
-		out[1].push_back(rcl2[i][0]);
-	}
-	// from - to 
-	// 3 - 1
-	// 4 - 3
-    // becomes
-    // 3 - 1
-    // 4 - 1
-	for (size_t i=1; i<out[0].size(); i++) {
-		for (size_t j=0; j<i; j++) {
-			if (out[0][i] == out[1][j]) {
-				out[1][j] = out[0][i];
-			}
-		}
-	}
-
-	std::vector<double> lost = out[0];
-	lost.push_back(n);
-	size_t sub = 0;
-	for (size_t i=0; i<lost.size(); i++) {
-		sub++;
-		for (size_t j=lost[i]+1; j<lost[i+1]; j++) {
-			out[0].push_back(j);
-			out[1].push_back(j-sub);
-		}
-	}
-	return out;
-}
-
-
-void clump_replace(std::vector<double> &v, size_t n, const std::vector<double>& d, size_t cstart, std::vector<std::vector<size_t>>& rcl) {
-	for (size_t i=0; i<n; i++) {
-		for (size_t j=1; j<d.size(); j++) {
-			if (v[i] == d[j]) {
-				v[i] = d[0];
-			}
-		}
-	}
-	if (d[0] < cstart) {
-		for (size_t j=1; j<d.size(); j++) {
-			rcl[0].push_back(d[0]);
-			rcl[1].push_back(d[j]);
-		}
-	}
-}
-
-
-void clump_test(std::vector<double> &d) {
-	d.erase(std::remove_if(d.begin(), d.end(),
-		[](const double& v) { return std::isnan(v); }), d.end());
-	std::sort(d.begin(), d.end());
-	d.erase(std::unique(d.begin(), d.end()), d.end());
-}
-
-void broom_clumps(std::vector<double> &v, std::vector<double>& above, const size_t &dirs, size_t &ncps, const size_t &nr, const size_t &nc, std::vector<std::vector<size_t>> &rcl) {
-
-	size_t nstart = ncps;
-
-	bool d4 = dirs == 4;
-
-	if ( !std::isnan(v[0]) ) { //first cell, no cell left of it
-		if (std::isnan(above[0])) {
-			v[0] = ncps;
-			ncps++;
-		} else {
-			v[0] = above[0];
-		}
-	}
-
-	for (size_t i=1; i<nc; i++) { //first row, no row above it, use "above"
-		if (!std::isnan(v[i])) {
-			std::vector<double> d;
-			if (d4) {
-				d = {above[i], v[i-1]} ;
+// Connected component labelling. Cells get a provisional label as the rows
+// are scanned, and labels that turn out to belong to the same clump are
+// merged in a union-find table. Only the labels of the previous row are kept.
+// The number of cells and the first and last row and column of each label are
+// also kept (see SpatRaster::patchStats)
+class ClumpLabels {
+	public:
+		std::vector<size_t> parent;  // label 0 is for NA cells
+		std::vector<double> ncells, rmin, rmax, cmin, cmax;
+		std::vector<size_t> above;
+		bool d8;
+		bool merged = false;
+
+		ClumpLabels(size_t nc, bool eight) {
+			d8 = eight;
+			above.resize(nc, 0);
+			parent.push_back(0);
+			ncells.push_back(0);
+			rmin.push_back(0);
+			rmax.push_back(0);
+			cmin.push_back(0);
+			cmax.push_back(0);
+		}
+
+		size_t find(size_t x) {
+			while (parent[x] != x) {
+				parent[x] = parent[parent[x]];
+				x = parent[x];
+			}
+			return x;
+		}
+
+		// the lowest label becomes the root
+		void unite(size_t a, size_t b) {
+			a = find(a);
+			b = find(b);
+			if (a == b) return;
+			merged = true;
+			if (a < b) {
+				parent[b] = a;
 			} else {
-				d = {above[i], above[i-1], v[i-1]} ;
-			}
-			clump_test(d);
-			if (d.size() > 0) {
-				v[i] = d[0];
-				if (d.size() > 1) {
-					clump_replace(v, i, d, nstart, rcl);
-				}
-			} else {
-				v[i] = ncps;
-				ncps++;
-			}
-		}
-	}
-
-
-	for (size_t r=1; r<nr; r++) { //other rows
-		size_t i=r*nc;
-		if (!std::isnan(v[i])) { // first cell
-			if (std::isnan(v[i-nc])) {
-				v[i] = ncps;
-				ncps++;
-			} else {
-				v[i] = v[i-nc];
-			}
-		}
-		for (size_t i=r*nc+1; i<((r+1)*nc); i++) { // other cells
-			if (!std::isnan(v[i])) {
-				std::vector<double> d;
-				if (d4) {
-					d = {v[i-nc], v[i-1]} ;
-				} else {
-					d = {v[i-nc], v[i-nc-1], v[i-1]} ;
-				}
-				clump_test(d);
-				if (d.size() > 0) {
-					v[i] = d[0];
-					if (d.size() > 1) {
-						clump_replace(v, i, d, nstart, rcl);
+				parent[a] = b;
+			}
+		}
+
+		size_t newlabel(size_t row, size_t col) {
+			size_t id = parent.size();
+			parent.push_back(id);
+			ncells.push_back(0);
+			rmin.push_back(row);
+			rmax.push_back(row);
+			cmin.push_back(col);
+			cmax.push_back(col);
+			return id;
+		}
+
+		// label the cells of "v" (nr rows that start at row "row") that are not NA
+		void scan(std::vector<double> &v, size_t row, size_t nr) {
+			size_t nc = above.size();
+			std::vector<size_t> cur(nc);
+			for (size_t r=0; r<nr; r++) {
+				double *vr = &v[r * nc];
+				for (size_t c=0; c<nc; c++) {
+					if (std::isnan(vr[c])) {
+						cur[c] = 0;
+						continue;
+					}
+					size_t lab = 0;
+					size_t nb[4] = { c > 0 ? cur[c-1] : 0, above[c], 0, 0 };
+					if (d8) {
+						if (c > 0) nb[2] = above[c-1];
+						if (c < (nc-1)) nb[3] = above[c+1];
+					}
+					for (size_t k=0; k<4; k++) {
+						if (nb[k] == 0) continue;
+						if (lab == 0) {
+							lab = nb[k];
+						} else if (nb[k] != lab) {
+							unite(lab, nb[k]);
+						}
 					}
+					if (lab == 0) lab = newlabel(row + r, c);
+					cur[c] = lab;
+					ncells[lab]++;
+					rmax[lab] = row + r;
+					cmin[lab] = std::min(cmin[lab], (double)c);
+					cmax[lab] = std::max(cmax[lab], (double)c);
+					vr[c] = lab;
+				}
+				above.swap(cur);
+			}
+		}
+
+		// the final (consecutive) number of each provisional label, and the
+		// number of cells and bounding box (rows and columns) of each clump
+		std::vector<double> relabel(std::vector<std::vector<double>> &stats) {
+			size_t n = parent.size();
+			std::vector<double> final(n, NAN);
+			stats.resize(0);
+			stats.resize(6);
+			double id = 0;
+			for (size_t i=1; i<n; i++) {
+				size_t r = find(i);
+				if (r == i) {
+					id++;
+					final[i] = id;
+					stats[0].push_back(id);
+					stats[1].push_back(ncells[i]);
+					stats[2].push_back(rmin[i]);
+					stats[3].push_back(rmax[i]);
+					stats[4].push_back(cmin[i]);
+					stats[5].push_back(cmax[i]);
 				} else {
-					v[i] = ncps;
-					ncps++;
+					// the root has a lower label, and thus already has its final number
+					final[i] = final[r];
+					size_t k = final[r] - 1;
+					stats[1][k] += ncells[i];
+					stats[2][k] = std::min(stats[2][k], rmin[i]);
+					stats[3][k] = std::max(stats[3][k], rmax[i]);
+					stats[4][k] = std::min(stats[4][k], cmin[i]);
+					stats[5][k] = std::max(stats[5][k], cmax[i]);
 				}
 			}
+			return final;
 		}
-	}
-	size_t off = (nr-1) * nc;
-	above = std::vector<double>(v.begin()+off, v.end());
-}
-
+};
 
 
 SpatRaster SpatRaster::clumps(int directions, bool zeroAsNA, SpatOptions &opt) {
@@ -3220,14 +3622,6 @@ SpatRaster SpatRaster::clumps(int directions, bool zeroAsNA, SpatOptions &opt) {
 		return out;
 	}
 
-	std::vector<size_t> dim = {nrow(), ncol()};
-
-	std::string tempfile = "";
-    std::vector<double> d, v, vv;
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
 	std::string filename = opt.get_filename();
 	if (filename != "") {
 		bool overwrite = opt.get_overwrite();
@@ -3237,31 +3631,136 @@ SpatRaster SpatRaster::clumps(int directions, bool zeroAsNA, SpatOptions &opt) {
 			return(out);
 		}
 	}
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
 
-	opt.set_filenames({""});
- 	if (!out.writeStart(opt)) { return out; }
+	// first pass: provisional labels, to a scratch raster that can hold
+	// any label (not in the datatype or file that the user asked for)
+	SpatOptions topt(opt);
+	topt.set_filenames({""});
+	topt.set_datatype("FLT8S");
+	SpatRaster tmp = geometry(1);
+ 	if (!tmp.writeStart(topt)) { 
+		readStop();
+		out.setError(tmp.getError());
+		return out; 
+	}
 	size_t nc = ncol();
-	size_t ncps = 1;
-	std::vector<double> above(nc, NAN);
-	std::vector<std::vector<size_t>> rcl(2);
-	for (size_t i = 0; i < out.bs.n; i++) {
-        v = readBlock(out.bs, i);
+	ClumpLabels cl(nc, directions == 8);
+	std::vector<double> v;
+	for (size_t i = 0; i < tmp.bs.n; i++) {
+		v = readBlock(tmp.bs, i);
 		if (zeroAsNA) {
 			std::replace(v.begin(), v.end(), 0.0, (double)NAN);
 		}
-        broom_clumps(v, above, directions, ncps, out.bs.nrows[i], nc, rcl);
-		if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, nc)) return out;
+		cl.scan(v, tmp.bs.row[i], tmp.bs.nrows[i]);
+		if (!tmp.writeValues(v, tmp.bs.row[i], tmp.bs.nrows[i], 0, nc)) {
+			readStop();
+			out.setError(tmp.getError());
+			return out;
+		}
 	}
-	out.writeStop();
+	tmp.writeStop();
 	readStop();
 
-	opt.set_filenames({filename});
-	if (rcl[0].size() > 0) {
-		std::vector<std::vector<double>> rc = clump_getRCL(rcl, ncps);
-		out = out.reclassify(rc, 3, true, false, opt);
-	} else if (filename != "") {
-		out = out.writeRaster(opt);
+	std::vector<std::vector<double>> stats;
+	std::vector<double> final = cl.relabel(stats);
+	if ((!cl.merged) && (filename == "")) {
+		// the provisional labels are the final labels
+		return tmp;
+	}
+
+	// second pass: the final labels, with the user's options
+	if (!tmp.readStart()) {
+		out.setError(tmp.getError());
+		return(out);
+	}
+ 	if (!out.writeStart(opt)) { 
+		tmp.readStop();
+		return out; 
+	}
+	size_t nf = final.size();
+	for (size_t i = 0; i < out.bs.n; i++) {
+		v = tmp.readBlock(out.bs, i);
+		if (cl.merged) {
+			for (double &d : v) {
+				if (std::isnan(d)) continue;
+				size_t k = d;
+				d = ((d >= 0) && (k < nf)) ? final[k] : NAN;
+			}
+		}
+		if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, nc)) {
+			tmp.readStop();
+			return out;
+		}
+	}
+	out.writeStop();
+	tmp.readStop();
+	return out;
+}
+
+
+// the number of cells and the extent of each patch (as numbered by clumps)
+SpatDataFrame SpatRaster::patchStats(int directions, bool zeroAsNA, SpatOptions &opt) {
+
+	SpatDataFrame out;
+	if (!(directions == 4 || directions == 8)) {
+		out.setError("directions must be 4 or 8");
+		return out;
 	}
+	if (!hasValues()) {
+		out.setError("cannot compute patches for a raster with no values");
+		return out;
+	}
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	size_t nc = ncol();
+	size_t nl = nlyr();
+	BlockSize bs = getBlockSize(opt);
+	SpatExtent e = getExtent();
+	double xr = xres();
+	double yr = yres();
+	std::vector<ClumpLabels> cl(nl, ClumpLabels(nc, directions == 8));
+	for (size_t i = 0; i < bs.n; i++) {
+		std::vector<double> v = readValues(bs.row[i], bs.nrows[i], 0, nc);
+		if (zeroAsNA) {
+			std::replace(v.begin(), v.end(), 0.0, (double)NAN);
+		}
+		size_t off = bs.nrows[i] * nc;
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			std::vector<double> vl(v.begin() + lyr * off, v.begin() + (lyr+1) * off);
+			cl[lyr].scan(vl, bs.row[i], bs.nrows[i]);
+		}
+	}
+	std::vector<double> layer, zone, ncells, xmin, xmax, ymin, ymax;
+	for (size_t lyr=0; lyr<nl; lyr++) {
+		std::vector<std::vector<double>> stats;
+		cl[lyr].relabel(stats);
+		size_t n = stats[0].size();
+		layer.insert(layer.end(), n, lyr + 1);
+		zone.insert(zone.end(), stats[0].begin(), stats[0].end());
+		ncells.insert(ncells.end(), stats[1].begin(), stats[1].end());
+		for (size_t j=0; j<n; j++) {
+			ymax.push_back(e.ymax - stats[2][j] * yr);
+			ymin.push_back(e.ymax - (stats[3][j] + 1) * yr);
+			xmin.push_back(e.xmin + stats[4][j] * xr);
+			xmax.push_back(e.xmin + (stats[5][j] + 1) * xr);
+		}
+	}
+	readStop();
+	if (nl > 1) {
+		out.add_column(layer, "layer");
+	}
+	out.add_column(zone, "zone");
+	out.add_column(ncells, "ncell");
+	out.add_column(xmin, "xmin");
+	out.add_column(xmax, "xmax");
+	out.add_column(ymin, "ymin");
+	out.add_column(ymax, "ymax");
 	return out;
 }
 
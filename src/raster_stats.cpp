@@ -21,84 +21,105 @@
 #include <cmath>
 #include <algorithm>
 #include <map>
+#include <unordered_map>
+#include <deque>
+#include <future>
+#include <system_error>
+#include <numeric>
 
 #include "vecmath.h"
 #include "math_utils.h"
 #include "string_utils.h"
+#include "spatCount.h"
 
-std::map<double, unsigned long long> table(std::vector<double> &v) {
-	std::map<double, unsigned long long> count;
-	for_each( v.begin(), v.end(), [&count]( double val ){
-			if(!std::isnan(val)) count[val]++;
-		}
-	);
-	return count;
-}
-
+typedef std::function<void(std::vector<double> &v, size_t ncell, std::vector<SpatCountTable> &tabs)> BlockCounter;
 
-std::map<double, unsigned long long int> ctable(std::map<double, unsigned long long int> &x, std::map<double, unsigned long long int> &y) {
-	for(auto p : y) {
-		x[p.first] += p.second;
+// count the values of the blocks of x with "counter", starting with "tabs" (empty tables). 
+// The blocks are read in order, and counted by up to "threads" threads
+bool count_blocks(SpatRaster &x, std::vector<SpatCountTable> &tabs, BlockCounter counter, SpatOptions &opt) {
+	BlockSize bs = x.getBlockSize(opt);
+	if (!x.readStart()) {
+		return false;
+	}
+	size_t nc = x.ncol();
+	size_t nt = std::min((size_t)opt.get_threads(), (size_t)bs.n);
+	const std::vector<SpatCountTable> empty = tabs;
+	std::deque<std::future<std::vector<SpatCountTable>>> running;
+	for (size_t i = 0; i < bs.n; i++) {
+		std::shared_ptr<std::vector<double>> v = std::make_shared<std::vector<double>>(x.readBlock(bs, i));
+		if (x.hasError()) break;
+		size_t ncell = bs.nrows[i] * nc;
+		if (nt > 1) {
+			try {
+				running.push_back(std::async(std::launch::async, [v, ncell, &empty, &counter]() -> std::vector<SpatCountTable> {
+					std::vector<SpatCountTable> t = empty;
+					counter(*v, ncell, t);
+					return t;
+				}));
+			} catch (std::system_error &e) {
+				// no thread available
+				nt = 1;
+			}
+		}
+		if (nt < 2) {
+			counter(*v, ncell, tabs);
+		}
+		while ((running.size() >= nt) || ((i == (bs.n-1)) && (running.size() > 0))) {
+			std::vector<SpatCountTable> t = running.front().get();
+			running.pop_front();
+			for (size_t j=0; j<tabs.size(); j++) {
+				tabs[j].merge(t[j]);
+			}
+		}
+	}
+	while (running.size() > 0) {
+		running.front().wait();
+		running.pop_front();
 	}
-	return(x);
+	x.readStop();
+	return !x.hasError();
 }
 
 
-std::vector<double> vtable(std::map<double, unsigned long long int> &x) {
-	std::vector<std::vector<double>> out(2);
-	for( auto p : x ) {
-		out[0].push_back(p.first);
-		out[1].push_back(p.second);
+// the number of small integers that can be counted in an array
+size_t dense_size(SpatRaster &x) {
+	std::string datatype;
+	if (x.native_datatype(datatype)) {
+		if (datatype == "INT1U") return 256;
+		if (datatype == "INT2U") return 65536;
 	}
-	out[0].insert(out[0].end(), out[1].begin(), out[1].end());
-	return out[0];
+	return 0;
 }
 
 
-
 std::vector<std::vector<double>> SpatRaster::freq(bool bylayer, bool round, int digits, SpatOptions &opt) {
 	std::vector<std::vector<double>> out;
 	if (!hasValues()) return out;
-	BlockSize bs = getBlockSize(opt);
-	unsigned nc = ncol();
 	unsigned nl = nlyr();
-	if (!readStart()) {
-		return(out);
-	}
 
-	if (bylayer) {
-		out.resize(nl);
-		std::vector<std::map<double, unsigned long long int>> tabs(nl);
-		for (size_t i = 0; i < bs.n; i++) {
-			unsigned nrc = bs.nrows[i] * nc;
-			std::vector<double> v = readValues(bs.row[i], bs.nrows[i], 0, nc);
-			if (round) {
-				for(double& d : v) d = roundn(d, digits);
-			}
-			for (size_t lyr=0; lyr<nl; lyr++) {
-				unsigned off = lyr*nrc;
-				std::vector<double> vv(v.begin()+off, v.begin() + off + nrc);
-				std::map<double, unsigned long long int> tab = table(vv);
-				tabs[lyr] = ctable(tabs[lyr], tab);
-			}
+	size_t nd = dense_size(*this);
+	std::vector<SpatCountTable> tabs(bylayer ? nl : 1, SpatCountTable(1, nd));
+	BlockCounter counter = [nl, round, digits, bylayer](std::vector<double> &v, size_t ncell, std::vector<SpatCountTable> &t) {
+		if (round) {
+			for (double& d : v) d = roundn(d, digits);
 		}
 		for (size_t lyr=0; lyr<nl; lyr++) {
-			out[lyr] = vtable(tabs[lyr]);
-		}
-	} else {
-		out.resize(1);
-		std::map<double, long long unsigned> tabs;
-		for (size_t i = 0; i < bs.n; i++) {
-			std::vector<double> v = readValues(bs.row[i], bs.nrows[i], 0, nc);
-			if (round) {
-				for (double& d : v) d = roundn(d, digits);
+			SpatCountTable &tab = bylayer ? t[lyr] : t[0];
+			size_t off = lyr * ncell;
+			for (size_t j=off; j<(off+ncell); j++) {
+				if (!std::isnan(v[j])) tab.add(v[j]);
 			}
-			std::map<double, long long unsigned> tab = table(v);
-			tabs = ctable(tabs, tab);
 		}
-		out[0] = vtable(tabs);
+	};
+	if (!count_blocks(*this, tabs, counter, opt)) {
+		return out;
+	}
+	out.resize(tabs.size());
+	for (size_t i=0; i<tabs.size(); i++) {
+		std::vector<std::vector<double>> tab = tabs[i].table();
+		out[i] = tab[0];
+		out[i].insert(out[i].end(), tab[1].begin(), tab[1].end());
 	}
-	readStop();
 	return(out);
 }
 
@@ -222,79 +243,87 @@ void unique_values_alt(std::vector<double> &d) {
 }
 
 
-void unique_values(std::vector<double> &d) {
-	d.erase(std::remove_if(d.begin(), d.end(),
-            [](const double& value) { return std::isnan(value); }), d.end());
-	std::set<double> u { d.begin(), d.end()};
-	std::copy(u.begin(), u.end(), d.begin());
-	d.erase(d.begin()+u.size(), d.end());
-}
-
-
 std::vector<std::vector<double>> SpatRaster::unique(bool bylayer, SpatOptions &opt) {
 
 	std::vector<std::vector<double>> out;
 	if (!hasValues()) return out;
 
-	constexpr double lowest_double = std::numeric_limits<double>::lowest();
-
-	BlockSize bs = getBlockSize(opt);
-	unsigned nc = ncol();
 	unsigned nl = nlyr();
-	if (!readStart()) {
-		return(out);
-	}
-	out.resize(nl);
-
 	if (nl == 1) bylayer = true;
+
+	std::vector<SpatCountTable> tabs;
+	BlockCounter counter;
 	if (bylayer) {
-		for (size_t i = 0; i < bs.n; i++) {
-			unsigned n = bs.nrows[i] * nc;
-			std::vector<double> v = readValues(bs.row[i], bs.nrows[i], 0, nc);
+		tabs.resize(nl, SpatCountTable(1, dense_size(*this)));
+		counter = [nl](std::vector<double> &v, size_t ncell, std::vector<SpatCountTable> &t) {
 			for (size_t lyr=0; lyr<nl; lyr++) {
-				unsigned off = lyr*n;
-				out[lyr].insert(out[lyr].end(), v.begin()+off, v.begin()+off+n);
-				unique_values(out[lyr]);
+				size_t off = lyr * ncell;
+				for (size_t j=off; j<(off+ncell); j++) {
+					if (!std::isnan(v[j])) t[lyr].add(v[j]);
+				}
 			}
-		}
+		};
 	} else {
-		std::vector<std::vector<double>> temp;
-		for (size_t i = 0; i < bs.n; i++) {
-			unsigned n = bs.nrows[i] * nc;
-			std::vector<std::vector<double>> m(n, std::vector<double>(nl));
-			std::vector<double> v = readValues(bs.row[i], bs.nrows[i], 0, nc);
-			for (size_t j = 0; j < v.size(); j++) {
-				if (std::isnan(v[j])) v[j] = lowest_double;
-			}
-
-			for (size_t lyr=0; lyr<nl; lyr++) {
-				unsigned off = lyr*n;
-				for (size_t j=0; j<n; j++) {
-					m[j][lyr] = v[off+j];
+		// combinations of values (including NA) across layers
+		tabs.resize(1, SpatCountTable(nl));
+		counter = [nl](std::vector<double> &v, size_t ncell, std::vector<SpatCountTable> &t) {
+			std::vector<double> key(nl);
+			for (size_t j=0; j<ncell; j++) {
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					key[lyr] = v[lyr*ncell+j];
 				}
+				t[0].add(&key[0]);
 			}
-			std::sort(m.begin(), m.end());
-			m.erase(std::unique(m.begin(), m.end()), m.end());
-			for (size_t j=0; j<m.size(); j++) {
-				temp.insert(temp.end(), m[j]);
-			}
+		};
+	}
+	if (!count_blocks(*this, tabs, counter, opt)) {
+		return out;
+	}
+	if (bylayer) {
+		out.resize(nl);
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			out[lyr] = tabs[lyr].table()[0];
 		}
-		std::sort(temp.begin(), temp.end());
-		temp.erase(std::unique(temp.begin(), temp.end()), temp.end());
-		for (size_t i = 0; i < temp.size(); i++) {
-			for (size_t j = 0; j < temp[0].size(); j++) {
-				out[j].resize(temp.size());
-				if (temp[i][j] == lowest_double) {
-					out[j][i] = NAN;
-				} else {
-					out[j][i] = temp[i][j];
-				}
+	} else {
+		out = tabs[0].table();
+		out.pop_back();
+	}
+	return(out);
+}
+
+
+// cross-tabulation of the layers. Returns a column for each layer with the 
+// combinations of values that occur, and a column with their counts
+std::vector<std::vector<double>> SpatRaster::crosstab(bool round, int digits, bool narm, SpatOptions &opt) {
+
+	std::vector<std::vector<double>> out;
+	if (!hasValues()) return out;
+	unsigned nl = nlyr();
+	if (nl < 2) {
+		setError("needs at least 2 layers");
+		return out;
+	}
+
+	std::vector<SpatCountTable> tabs(1, SpatCountTable(nl));
+	BlockCounter counter = [nl, round, digits, narm](std::vector<double> &v, size_t ncell, std::vector<SpatCountTable> &t) {
+		if (round) {
+			for (double& d : v) d = roundn(d, digits);
+		}
+		std::vector<double> key(nl);
+		for (size_t j=0; j<ncell; j++) {
+			bool hasNA = false;
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				key[lyr] = v[lyr*ncell+j];
+				hasNA = hasNA || std::isnan(key[lyr]);
 			}
+			if (narm && hasNA) continue;
+			t[0].add(&key[0]);
 		}
+	};
+	if (!count_blocks(*this, tabs, counter, opt)) {
+		return out;
 	}
-	readStop();
-
-	return(out);
+	return tabs[0].table();
 }
 
 
@@ -374,64 +403,253 @@ void jointstats_old(const std::vector<double> &u, const std::vector<double> &v,
 */
 
 
-void jointstats(const std::vector<double> &u, const std::vector<double> &v, const std::vector<double> &z, std::string fun, bool narm, std::vector<double>& out, std::vector<double> &cnt) {
+// the statistics that zonal can compute
+class ZonalFun {
+	public:
+		std::string fun;
+		std::vector<double> probs;
+		bool moments = false;   // sd, sdpop
+		bool quantiles = false; // median, quantile
+		// quantiles from a sketch of at most 256 values per zone
+		bool approx = false;
+		ZonalFun(std::string f, std::vector<double> p, bool appr) {
+			fun = f;
+			approx = appr;
+			moments = (fun == "sd") || (fun == "sdpop");
+			quantiles = (fun == "median") || (fun == "quantile");
+			probs = (fun == "median") ? std::vector<double>{0.5} : p;
+		}
+};
+
+
+// streaming statistics of the values of one layer in one zone. 
+// Partial results (of different blocks) are combined with "merge"
+class ZonalStat {
+	public:
+		double n = 0;    // values that are not NA
+		double nna = 0;  // NA values
+		double sum = 0;
+		double mean = 0;
+		double m2 = 0;   // sum of the squared deviations from the mean 
+		double min = std::numeric_limits<double>::infinity();
+		double max = -std::numeric_limits<double>::infinity();
+		// all values (with weight 1), or, if approx, (value, weight) centroids
+		// for approximate quantiles. These are exact as long as there are 
+		// no more than 2*sketch_size values
+		std::vector<std::pair<double, double>> sketch;
+		static const size_t sketch_size = 128;
+
+		void add(const double &v, const ZonalFun &f) {
+			if (std::isnan(v)) {
+				nna++;
+				return;
+			}
+			n++;
+			sum += v;
+			if (v < min) min = v;
+			if (v > max) max = v;
+			if (f.moments) {
+				double d = v - mean;
+				mean += d / n;
+				m2 += d * (v - mean);
+			}
+			if (f.quantiles) {
+				sketch.push_back({v, 1});
+				if (f.approx && (sketch.size() > (2 * sketch_size))) compress();
+			}
+		}
 
-	std::vector<std::vector<double>> dat(u.size());
-	if (narm) {
-		for (size_t i=0; i<z.size(); i++) {
-			if ((!std::isnan(z[i])) && (!std::isnan(v[i]))) {
-				dat[z[i]].push_back(v[i]);	
+		void merge(const ZonalStat &x, const ZonalFun &f) {
+			nna += x.nna;
+			if (x.n == 0) return;
+			if (f.moments) {
+				double nn = n + x.n;
+				double d = x.mean - mean;
+				mean += d * x.n / nn;
+				m2 += x.m2 + d * d * n * x.n / nn;
+			}
+			n += x.n;
+			sum += x.sum;
+			min = std::min(min, x.min);
+			max = std::max(max, x.max);
+			if (f.quantiles) {
+				sketch.insert(sketch.end(), x.sketch.begin(), x.sketch.end());
+				if (f.approx && (sketch.size() > (2 * sketch_size))) compress();
 			}
 		}
-	} else {
-		for (size_t i=0; i<z.size(); i++) {
-			if (!std::isnan(z[i])) {
-				dat[z[i]].push_back(v[i]);	
+
+		// merge adjacent centroids such that none has a weight larger than n/sketch_size
+		void compress() {
+			std::sort(sketch.begin(), sketch.end());
+			double maxw = std::max(1.0, n / sketch_size);
+			size_t j = 0;
+			for (size_t i=1; i<sketch.size(); i++) {
+				double w = sketch[j].second + sketch[i].second;
+				if (w <= maxw) {
+					sketch[j].first += (sketch[i].first - sketch[j].first) * sketch[i].second / w;
+					sketch[j].second = w;
+				} else {
+					j++;
+					sketch[j] = sketch[i];
+				}
 			}
+			sketch.resize(j+1);
 		}
-	}
-	if (fun=="sum") {
-		for (size_t i=0; i<u.size(); i++) {	
-			if (dat[i].size() > 0) {
-				out[i] += vsum(dat[i], false);
+
+		// as type 7 in R's quantile; each centroid is placed at the mid rank of its values
+		std::vector<double> quantile(const std::vector<double> &probs) {
+			std::vector<double> q(probs.size(), NAN);
+			if (n == 0) return q;
+			std::sort(sketch.begin(), sketch.end());
+			size_t ns = sketch.size();
+			std::vector<double> pos(ns);
+			double cum = 0;
+			for (size_t i=0; i<ns; i++) {
+				pos[i] = cum + (sketch[i].second - 1) / 2;
+				cum += sketch[i].second;
 			}
+			for (size_t i=0; i<probs.size(); i++) {
+				double x = probs[i] * (n - 1);
+				if (x <= pos[0]) {
+					q[i] = (pos[0] > 0) ? min + (sketch[0].first - min) * x / pos[0] : sketch[0].first;
+				} else if (x >= pos[ns-1]) {
+					double d = (n - 1) - pos[ns-1];
+					q[i] = (d > 0) ? sketch[ns-1].first + (max - sketch[ns-1].first) * (x - pos[ns-1]) / d : sketch[ns-1].first;
+				} else {
+					size_t k = std::upper_bound(pos.begin(), pos.end(), x) - pos.begin();
+					double f = (x - pos[k-1]) / (pos[k] - pos[k-1]);
+					q[i] = sketch[k-1].first + f * (sketch[k].first - sketch[k-1].first);
+				}
+			}
+			return q;
 		}
-	}
-	if (fun=="mean") {
-		for (size_t i=0; i<u.size(); i++) {	
-			if (dat[i].size() > 0) {
-				out[i] += vsum(dat[i], false);
-				cnt[i] += dat[i].size();
+
+		std::vector<double> value(const ZonalFun &f, bool narm) {
+			if (f.fun == "count") {
+				return {narm ? n : n + nna};
+			}
+			if ((!narm) && (nna > 0)) {
+				return std::vector<double>(f.quantiles ? f.probs.size() : 1, NAN);
+			} 
+			if (f.quantiles) {
+				return quantile(f.probs);
+			} else if (f.fun == "sum") {
+				return {sum};
+			} else if (n == 0) {
+				return {NAN};
+			} else if (f.fun == "mean") {
+				return {sum / n};
+			} else if (f.fun == "min") {
+				return {min};
+			} else if (f.fun == "max") {
+				return {max};
+			} else if (f.fun == "sd") {
+				return {n > 1 ? std::sqrt(m2 / (n-1)) : NAN};
+			} else if (f.fun == "sdpop") {
+				return {std::sqrt(m2 / n)};
 			}
+			return {NAN};
 		}
-	}
-	if (fun=="min") {
-		for (size_t i=0; i<u.size(); i++) {	
-			if (dat[i].size() > 0) {
-				double mn = vmin(dat[i], false);
-				out[i] = std::min(out[i], mn);
+};
+
+
+// the statistics for all zones in (a part of) a raster. Zones get an index 
+// in the order in which they are found. Integer zones within a limited range
+// are looked up in a table, other zones in a hash map
+class ZonalPartial {
+	public:
+		size_t nl = 1;
+		std::vector<double> zones;
+		std::vector<ZonalStat> stats; // zones x layers
+		std::unordered_map<double, size_t> hash;
+		std::vector<int> table;
+		double tmin = 0;
+
+		ZonalPartial(size_t nlyr, double zmin, double zmax) {
+			nl = nlyr;
+			if ((!std::isnan(zmin)) && (!std::isnan(zmax)) && (zmin == std::trunc(zmin)) && ((zmax - zmin) < 1048576)) {
+				tmin = zmin;
+				table.resize(zmax - zmin + 1, -1);
 			}
 		}
-	}
-	if (fun=="max") {
-		for (size_t i=0; i<u.size(); i++) {	
-			if (dat[i].size() > 0) {
-				double mx = vmax(dat[i], false);
-				out[i] = std::max(out[i], mx);
+
+		size_t index(double z) {
+			z += 0.0; // -0 == 0
+			if (table.size() > 0) {
+				double d = z - tmin;
+				if ((d >= 0) && (d < table.size()) && (d == std::trunc(d))) {
+					int &j = table[(size_t)d];
+					if (j < 0) {
+						j = add_zone(z);
+					}
+					return j;
+				}
+			}
+			std::unordered_map<double, size_t>::iterator it = hash.find(z);
+			if (it != hash.end()) {
+				return it->second;
 			}
+			size_t j = add_zone(z);
+			hash[z] = j;
+			return j;
 		}
-	}
-}
 
+		size_t add_zone(double z) {
+			zones.push_back(z);
+			stats.resize(stats.size() + nl);
+			return zones.size() - 1;
+		}
+
+		// v has the values of nl layers for the cells with zones zv
+		void add(const std::vector<double> &v, const std::vector<double> &zv, const ZonalFun &f) {
+			size_t nc = zv.size();
+			double lastz = NAN;
+			size_t j = 0;
+			for (size_t i=0; i<nc; i++) {
+				if (std::isnan(zv[i])) continue;
+				// zones tend to be spatially clustered
+				if (zv[i] != lastz) {
+					lastz = zv[i];
+					j = index(lastz);
+				}
+				ZonalStat *s = &stats[j*nl];
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					s[lyr].add(v[lyr*nc+i], f);
+				}
+			}
+		}
+
+		void merge(const ZonalPartial &x, const ZonalFun &f) {
+			for (size_t i=0; i<x.zones.size(); i++) {
+				size_t j = index(x.zones[i]);
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					stats[j*nl+lyr].merge(x.stats[i*nl+lyr], f);
+				}
+			}
+		}
+};
 
-SpatDataFrame SpatRaster::zonal(SpatRaster z, std::string fun, bool narm, SpatOptions &opt) {
+
+SpatDataFrame SpatRaster::zonal(SpatRaster z, std::string fun, bool narm, std::vector<double> probs, bool approx, SpatOptions &opt) {
 
 	SpatDataFrame out;
-	std::vector<std::string> f {"sum", "mean", "min", "max"};
+	std::vector<std::string> f {"sum", "mean", "min", "max", "count", "sd", "sdpop", "median", "quantile"};
 	if (std::find(f.begin(), f.end(), fun) == f.end()) {
 		out.setError("not a valid function");
 		return(out);
 	}
+	if (fun == "quantile") {
+		if (probs.size() == 0) {
+			out.setError("no probs");
+			return out;
+		}
+		for (size_t i=0; i<probs.size(); i++) {
+			if (std::isnan(probs[i]) || (probs[i] < 0) || (probs[i] > 1)) {
+				out.setError("invalid probs");
+				return out;
+			}
+		}
+	}
 	if (!hasValues()) {
 		out.setError("SpatRaster has no values");
 		return(out);
@@ -452,16 +670,14 @@ SpatDataFrame SpatRaster::zonal(SpatRaster z, std::string fun, bool narm, SpatOp
 		out.addWarning("only the first zonal layer is used"); 
 	}
 
+	ZonalFun zf(fun, probs, approx);
 	size_t nl = nlyr();
-	std::vector<std::vector<double>> uq = z.unique(true, opt);
-	std::vector<double> u = uq[0];
-	double initv = 0;
-	double posinf = std::numeric_limits<double>::infinity();
-	double neginf = -posinf;
-	if (fun == "max") initv = neginf;
-	if (fun == "min") initv = posinf;
-	std::vector<std::vector<double>> stats(nl, std::vector<double>(u.size(), initv));
-	std::vector<std::vector<double>> cnt(nl, std::vector<double>(u.size(), 0));
+	double zmin = NAN, zmax = NAN;
+	if (z.hasRange()[0]) {
+		zmin = z.range_min()[0];
+		zmax = z.range_max()[0];
+	}
+
 	if (!readStart()) {
 		out.setError(getError());
 		return(out);
@@ -470,74 +686,82 @@ SpatDataFrame SpatRaster::zonal(SpatRaster z, std::string fun, bool narm, SpatOp
 		out.setError(z.getError());
 		return(out);
 	}
-	opt.ncopies = 6;
-	BlockSize bs = getBlockSize(opt);
+	opt.ncopies = 4;
+	BlockLayout layout;
+	layout.threaded = true;
+	BlockSize bs = getBlockSize(opt, layout);
+	size_t nt = std::min((size_t)opt.get_threads(), (size_t)bs.n);
+
+	// the blocks are read in order, and summarized by up to nt threads
+	ZonalPartial zp(nl, zmin, zmax);
+	std::deque<std::future<ZonalPartial>> running;
 	for (size_t i=0; i<bs.n; i++) {
-		std::vector<double> v =    readValues(bs.row[i], bs.nrows[i], 0, ncol());
-		std::vector<double> zv = z.readValues(bs.row[i], bs.nrows[i], 0, ncol());
-		std::vector<double> zvr(zv.size());
-		for (size_t j=0; j<zvr.size(); j++)	 {
-			if (std::isnan(zv[j])) {
-				zvr[j] = NAN;				
-			} else {
-				for (size_t k=0; k<u.size(); k++) {	
-					if (zv[j] == u[k]) {
-						zvr[j] = k;
-						continue;
-					}
-				}
+		std::shared_ptr<std::vector<double>> v = std::make_shared<std::vector<double>>(readBlock(bs, i));
+		std::shared_ptr<std::vector<double>> zv = std::make_shared<std::vector<double>>(z.readBlock(bs, i));
+		if (hasError() || z.hasError()) break;
+		if (nt > 1) {
+			try {
+				running.push_back(std::async(std::launch::async, [v, zv, nl, zmin, zmax, &zf]() -> ZonalPartial {
+					ZonalPartial p(nl, zmin, zmax);
+					p.add(*v, *zv, zf);
+					return p;
+				}));
+			} catch (std::system_error &e) {
+				// no thread available
+				nt = 1;
 			}
 		}
-		zv.resize(0);
-		unsigned off = bs.nrows[i] * ncol() ;
-		if (nl > 1) {
-			for (size_t lyr=0; lyr<nl; lyr++) {
-				unsigned offset = lyr * off;
-				std::vector<double> vx( v.begin()+offset,  v.begin()+offset+off);
-				jointstats(u, vx, zvr, fun, narm, stats[lyr], cnt[lyr]);
-			}
-		} else {
-			jointstats(u, v, zvr, fun, narm, stats[0], cnt[0]);
+		if (nt < 2) {
+			zp.add(*v, *zv, zf);
+		}
+		while ((running.size() >= nt) || ((i == (bs.n-1)) && (running.size() > 0))) {
+			zp.merge(running.front().get(), zf);
+			running.pop_front();
 		}
 	}
+	while (running.size() > 0) {
+		running.front().wait();
+		running.pop_front();
+	}
 	readStop();
 	z.readStop();
+	if (hasError()) {
+		out.setError(getError());
+		return out;
+	}
+	if (z.hasError()) {
+		out.setError(z.getError());
+		return out;
+	}
 
+	std::vector<size_t> ord(zp.zones.size());
+	std::iota(ord.begin(), ord.end(), 0);
+	std::sort(ord.begin(), ord.end(), [&zp](size_t a, size_t b) { return zp.zones[a] < zp.zones[b]; });
 
-	if (fun=="mean") {
-		for (size_t lyr=0; lyr<nlyr(); lyr++) {
-			for (size_t j=0; j<u.size(); j++) {
-				if (cnt[lyr][j] > 0) {
-					stats[lyr][j] = stats[lyr][j] / cnt[lyr][j];
-				} else {
-					stats[lyr][j] = NAN;
-				}
+	size_t np = zf.quantiles ? zf.probs.size() : 1;
+	std::vector<double> u(ord.size());
+	std::vector<std::vector<double>> stats(nl * np, std::vector<double>(ord.size()));
+	for (size_t i=0; i<ord.size(); i++) {
+		u[i] = zp.zones[ord[i]];
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			std::vector<double> s = zp.stats[ord[i]*nl + lyr].value(zf, narm);
+			for (size_t k=0; k<np; k++) {
+				stats[lyr*np+k][i] = s[k];
 			}
 		}
-	} 
-	
-	else if (fun == "min") {
-		for (size_t lyr=0; lyr<nlyr(); lyr++) {
-			for (size_t j=0; j<u.size(); j++) {
-				if (stats[lyr][j] == posinf) {
-					stats[lyr][j] = NAN;
-				}
-			}
-		}		
-	} else if (fun == "max") {
-		for (size_t lyr=0; lyr<nlyr(); lyr++) {
-			for (size_t j=0; j<u.size(); j++) {
-				if (stats[lyr][j] == neginf) {
-					stats[lyr][j] = NAN;
-				}
-			}
-		}		
 	}
 
 	out.add_column(u, "zone");
 	std::vector<std::string> nms = getNames();
-	for (size_t i=0; i<nlyr(); i++) {
-		out.add_column(stats[i], nms[i]);
+	std::vector<std::string> qnms;
+	if (fun == "quantile") {
+		qnms = double_to_string(zf.probs, "q");
+	}
+	for (size_t lyr=0; lyr<nl; lyr++) {
+		for (size_t k=0; k<np; k++) {
+			std::string nm = (fun == "quantile") ? nms[lyr] + "_" + qnms[k] : nms[lyr];
+			out.add_column(stats[lyr*np+k], nm);
+		}
 	}
 	return(out);
 }
@@ -1,14 +1,7 @@
-#include "ogr_spatialref.h"
-
 #include "spatRaster.h"
-#include "file_utils.h"
-
-#include "gdal_alg.h"
-#include "ogrsf_frmts.h"
-
 #include "spatFactor.h"
 #include "recycle.h"
-#include "gdalio.h"
+#include "spatScanline.h"
 
 SpatRaster rasterizePoints(SpatVector p, SpatRaster r, std::vector<double> values, double background, SpatOptions &opt) {
 	r.setError("not implemented in C++ yet");
@@ -17,168 +10,109 @@ SpatRaster rasterizePoints(SpatVector p, SpatRaster r, std::vector<double> value
 
 
 
-bool SpatRaster::getDSh(GDALDatasetH &rstDS, SpatRaster out, std::string &filename, std::string &driver, double &naval, std::string &msg, bool update, double background, SpatOptions opt) {
-
-	filename = opt.get_filename();
-	if (filename == "") {
-		if (canProcessInMemory(opt)) {
-			driver = "MEM";
-		} else {
-			filename = tempFile(opt.get_tempdir(), ".tif");
-			opt.set_filenames({filename});
-			driver = "GTiff";
-		} 
-	} else {
-		std::string driver = opt.get_filetype();
-		getGDALdriver(filename, driver);
-		if (driver == "") {
-			msg = "cannot guess file type from filename";
-			return false;
+// burn "values" (one for each geometry) into the cells of the block of rows
+// that "grid" refers to. "v" has the values of "nl" layers for the block.
+// With "twopass" (polygons with "touches", not "add") all geometries are 
+// first burned with their touched cells, and then with the cells that have 
+// their center inside, such that cells on a shared border get the value of 
+// the polygon that covers their center. With "add", there is one pass, in 
+// which each geometry adds its value once to each cell that it touches.
+void burn_block(SpatVector &x, const std::vector<size_t> &ids, const std::vector<double> &values, const SpatScanGrid &grid, bool touches, bool twopass, bool add, bool weights, size_t nl, std::vector<double> &v) {
+
+	size_t nc = grid.nrow * grid.ncol;
+	std::vector<double> cells, fraction;
+	if (weights) {
+		for (size_t i=0; i<ids.size(); i++) {
+			scan_coverage(x.geoms[ids[i]], grid, cells, fraction);
+			for (size_t j=0; j<cells.size(); j++) {
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					double &d = v[lyr * nc + cells[j]];
+					if (std::isnan(d)) {
+						d = fraction[j];
+					} else if (add) {
+						d += fraction[j];
+					} else {
+						d = std::min(1.0, d + fraction[j]);
+					}
+				}
+			}
 		}
-		if (!can_write(filename, opt.get_overwrite(), msg)) {
-			return false;
-		}	
+		return;
 	}
 
-	if (update) {
-		size_t ns = source.size();
-		if (driver == "MEM") {
-			if (ns > 1) {
-				// force into single source
-				SpatOptions svopt;
-				SpatRaster tmp = geometry();
-				std::vector<double> v = getValues();
-				tmp.setValues(v, svopt);
-				if (!tmp.open_gdal(rstDS, 0, opt)) {
-					msg = "cannot open dataset";
-					return false;
-				}
-			} else {
-				if (!open_gdal(rstDS, 0, opt)) {
-					msg = "cannot open dataset";
-					return false;
+	for (size_t pass=0; pass<(twopass ? 2 : 1); pass++) {
+		bool tch = touches && (pass == 0);
+		for (size_t i=0; i<ids.size(); i++) {
+			double value = values[ids[i]];
+			scan_geometry(x.geoms[ids[i]], grid, tch, cells);
+			for (size_t j=0; j<cells.size(); j++) {
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					double &d = v[lyr * nc + cells[j]];
+					if (add && !std::isnan(d)) {
+						d += value;
+					} else {
+						d = value;
+					}
 				}
 			}
+		}
+	}
+}
+
+
+// rasterize "x" into "out", block by block. With "update", the values of
+// "r" are used instead of the "background"
+void rasterize_blocks(SpatRaster &r, SpatRaster &out, SpatVector &x, std::vector<double> &values, double background, bool touches, bool add, bool weights, bool update, SpatOptions &opt) {
+
+	bool twopass = touches && (!weights) && (!add) && (x.type() == "polygons") && (x.size() > 1);
+	SpatRTree tree = scan_index(x);
+	size_t nl = out.nlyr();
+	size_t nc = out.ncol();
+	SpatExtent e = out.getExtent();
+	double xres = out.xres();
+	double yres = out.yres();
+
+	if (update && (!r.readStart())) {
+		out.setError(r.getError());
+		return;
+	}
+	if (!out.writeStart(opt)) {
+		if (update) r.readStop();
+		return;
+	}
+	std::vector<size_t> ids;
+	for (size_t i = 0; i < out.bs.n; i++) {
+		std::vector<double> v;
+		if (update) {
+			v = r.readBlock(out.bs, i);
 		} else {
-			// make a copy first
-			// including for the odd case that MEM is false but the source in memory
-			if ( (ns > 1) || (!sources_from_file()) ) {
-				SpatRaster out = writeRaster(opt);
-			} else {
-				// writeRaster should do the below? copyRaster?
-				//rstDS = openGDAL(tmp.source[0].filename, GDAL_OF_RASTER | GDAL_OF_READONLY);
-				GDALDatasetH hSrcDS = GDALOpenEx(source[0].filename.c_str(), GDAL_OF_RASTER | GDAL_OF_READONLY, NULL, NULL, NULL);
-				if(hSrcDS == NULL) {
-					msg = "cannot open source dataset";
-					return false;
-				}
-				GDALDriverH hDriver = GDALGetDatasetDriver(hSrcDS);
-				GDALDatasetH hDstDS = GDALCreateCopy( hDriver, filename.c_str(), hSrcDS, FALSE, NULL, NULL, NULL );
-				GDALClose(hSrcDS);
-				if(hDstDS == NULL) {
-					msg  = "cannot create dataset";
-					return false;
-				}
-				GDALClose(hDstDS);
-			}
-			rstDS = GDALOpenEx(filename.c_str(), GDAL_OF_RASTER | GDAL_OF_UPDATE, NULL, NULL, NULL);
+			v.resize(out.bs.nrows[i] * nc * nl, background);
 		}
-	} else {
-		if (!out.create_gdalDS(rstDS, filename, driver, true, background, source[0].has_scale_offset, source[0].scale, source[0].offset, opt)) {
-			msg = "cannot create dataset";
-			return false;
+		double ymax = e.ymax - out.bs.row[i] * yres;
+		SpatScanGrid grid(e.xmin, ymax, xres, yres, out.bs.nrows[i], nc);
+		tree.query(e.xmin, e.xmax, ymax - out.bs.nrows[i] * yres, ymax, ids);
+		burn_block(x, ids, values, grid, touches, twopass, add, weights, nl, v);
+		if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, nc)) {
+			if (update) r.readStop();
+			return;
 		}
 	}
-
-	GDALRasterBandH hBand = GDALGetRasterBand(rstDS, 1);
-	GDALDataType gdt = GDALGetRasterDataType(hBand);
-	getNAvalue(gdt, naval);
-	int hasNA;
-	double naflag = GDALGetRasterNoDataValue(hBand, &hasNA);
-	naval = hasNA ? naflag : naval;
-	return true;
+	out.writeStop();
+	if (update) r.readStop();
 }
 
+
 SpatRaster SpatRaster::rasterizeLyr(SpatVector x, double value, double background, bool touches, bool update, SpatOptions &opt) {
 
-	std::string gtype = x.type();
 	SpatRaster out;
-	out.setNames({"ID"});
-
 	if ( !hasValues() ) update = false;
 	if (update) { // all lyrs
 		out = geometry(-1, true, true);
 	} else {
 		out = geometry(1);
 	}
-
-	GDALDataset *vecDS = x.write_ogr("", "lyr", "Memory", true);
-	if (x.hasError()) {
-		out.setError(x.getError());
-		return out;
-	}
-
-	OGRLayer *poLayer = vecDS->GetLayer(0);
-#if GDAL_VERSION_MAJOR <= 2 && GDAL_VERSION_MINOR <= 2
-	OGRLayerH hLyr = poLayer;
-#else
-	OGRLayerH hLyr = poLayer->ToHandle(poLayer);
-#endif
-    std::vector<OGRLayerH> ahLayers;
-	ahLayers.push_back( hLyr );
-
-	std::string errmsg, driver, filename;
-	GDALDatasetH rstDS;
-	double naval;
-	if (!getDSh(rstDS, out, filename, driver, naval, errmsg, update, background, opt)) {
-		out.setError(errmsg);
-		return out;
-	}
-	if (std::isnan(value)) {
-		// passing NULL instead may also work.
-		value = naval;
-	}
-	
-	std::vector<int> bands(out.nlyr());
-	std::iota(bands.begin(), bands.end(), 1);
-	std::vector<double> values(out.nlyr(), value);
-	
-	char** papszOptions = NULL;
-	CPLErr err;
-	if (touches) {
-		papszOptions = CSLSetNameValue(papszOptions, "ALL_TOUCHED", "TRUE"); 
-	}
-	err = GDALRasterizeLayers(rstDS, static_cast<int>(bands.size()), &(bands[0]),
-			1, &(ahLayers[0]), NULL, NULL, &(values[0]), papszOptions, NULL, NULL);
-			
-	CSLDestroy(papszOptions);	
-			
-//	for (size_t i=0; i<ahGeometries.size(); i++) {
-//		OGR_G_DestroyGeometry(ahGeometries[i]);			
-//	}
-	GDALClose(vecDS);
-	
-	if ( err != CE_None ) {
-		out.setError("rasterization failed");
-		GDALClose(rstDS);
-		return out;
-	}
-	
-	if (driver == "MEM") {
-		if (!out.from_gdalMEM(rstDS, false, true)) {
-			out.setError("rasterization failed (mem)");
-		}
-	}
-	
-	GDALRasterBandH band = GDALGetRasterBand(rstDS, 1);
-	double adfMinMax[2];
-	GDALComputeRasterMinMax(band, false, adfMinMax);
-	GDALSetRasterStatistics(band, adfMinMax[0], adfMinMax[1], -9999, -9999);
-
-	GDALClose(rstDS);
-	if (driver != "MEM") {
-		out = SpatRaster(filename, {-1}, {""});
-	}
+	std::vector<double> values(x.size(), value);
+	rasterize_blocks(*this, out, x, values, background, touches, false, false, update, opt);
 	return out;
 }
 
@@ -189,21 +123,7 @@ SpatRaster SpatRaster::rasterize(SpatVector x, std::string field, std::vector<do
 	std::string gtype = x.type();
 	bool ispol = gtype == "polygons";
 	if (weights) update = false;
-	
-	if (weights && ispol) {
-		SpatOptions sopts(opt);
-		SpatRaster wout = geometry(1);
-		unsigned agx = 1000 / ncol();
-		agx = std::max((unsigned)10, agx); 
-		unsigned agy = 1000 / nrow();
-		agy = std::max((unsigned)10, agy);
-		wout = wout.disaggregate({agx, agy}, sopts);
-		field = "";
-		double f = agx * agy;
-		wout = wout.rasterize(x, field, {1/f}, background, touches, add, false, false, false, sopts);
-		wout = wout.aggregate({agx, agy}, "sum", true, opt);
-		return wout;
-	}
+	if (!ispol) weights = false;
 
 	SpatRaster out;
 	if ( !hasValues() ) update = false;
@@ -214,11 +134,6 @@ SpatRaster SpatRaster::rasterize(SpatVector x, std::string field, std::vector<do
 		out.setNames({field});
 	}
 
-	if (ispol && touches && add) {
-		add = false;
-		out.addWarning("you cannot use add and touches at the same time");
-	}
-
 	if (field != "") {
 		int i = x.df.get_fieldindex(field);
 		if (i < 0) {
@@ -256,258 +171,57 @@ SpatRaster SpatRaster::rasterize(SpatVector x, std::string field, std::vector<do
 		recycle(values, nGeoms);
 	}
 
-	GDALDataset *vecDS = x.write_ogr("", "lyr", "Memory", true);
-	if (x.hasError()) {
-		out.setError(x.getError());
-		return out;
-	}
-    std::vector<OGRGeometryH> ahGeometries;
-	OGRLayer *poLayer = vecDS->GetLayer(0);
-	poLayer->ResetReading();
-	OGRFeature *poFeature;
-	
-
-	while( (poFeature = poLayer->GetNextFeature()) != NULL ) {
-		OGRGeometry *poGeometry = poFeature->StealGeometry();
-#if GDAL_VERSION_MAJOR <= 2 && GDAL_VERSION_MINOR <= 2
-        OGRGeometryH hGeom = poGeometry;
-#else
-		OGRGeometryH hGeom = poGeometry->ToHandle(poGeometry);
-#endif
-		ahGeometries.push_back( hGeom );
-	}
-	OGRFeature::DestroyFeature( poFeature );
-	GDALClose(vecDS);
-
-	std::string errmsg, driver, filename;
-	GDALDatasetH rstDS;
-	double naval;
 	if (add) {	background = 0;	}
-
-	if (!getDSh(rstDS, out, filename, driver, naval, errmsg, update, background, opt)) {
-		out.setError(errmsg);
-		return out;
-	}
-	for (double &d : values) d = std::isnan(d) ? naval : d;
-		// passing NULL instead may also work.
-
-
-	std::vector<int> bands(out.nlyr());
-	std::iota(bands.begin(), bands.end(), 1);
-	rep_each(values, out.nlyr());
-
-
-	char** papszOptions = NULL;
-	CPLErr err;
-	if (ispol && touches && (nGeoms > 1)) {
-		// first to get the touches
-		papszOptions = CSLSetNameValue(papszOptions, "ALL_TOUCHED", "TRUE"); 
-		err = GDALRasterizeGeometries(rstDS, 
-				static_cast<int>(bands.size()), &(bands[0]),
-				static_cast<int>(ahGeometries.size()), &(ahGeometries[0]),
-				NULL, NULL, &(values[0]), papszOptions, NULL, NULL);		
-		CSLDestroy(papszOptions);	
-
-		if ( err != CE_None ) {
-			out.setError("rasterization failed");
-			GDALClose(rstDS);
-			for (size_t i=0; i<ahGeometries.size(); i++) {
-				OGR_G_DestroyGeometry(ahGeometries[i]);			
-			}
-			return out;
-		}
-		//GDALFlushCache(rstDS);
-		// second time to fix the internal area
-		err = GDALRasterizeGeometries(rstDS, 
-				static_cast<int>(bands.size()), &(bands[0]),
-				static_cast<int>(ahGeometries.size()), &(ahGeometries[0]),
-				NULL, NULL, &(values[0]), NULL, NULL, NULL);
-
-	} else {
-		if (touches) {
-			papszOptions = CSLSetNameValue(papszOptions, "ALL_TOUCHED", "TRUE"); 
-		} else if (add) {
-			papszOptions = CSLSetNameValue(papszOptions, "MERGE_ALG", "ADD"); 
-		}
-		err = GDALRasterizeGeometries(rstDS, 
-				static_cast<int>(bands.size()), &(bands[0]),
-				static_cast<int>(ahGeometries.size()), &(ahGeometries[0]),
-				NULL, NULL, &(values[0]), papszOptions, NULL, NULL);
-				
-		CSLDestroy(papszOptions);	
-	}
-			
-	for (size_t i=0; i<ahGeometries.size(); i++) {
-		OGR_G_DestroyGeometry(ahGeometries[i]);			
-	}
-	
-	if ( err != CE_None ) {
-		out.setError("rasterization failed");
-		GDALClose(rstDS);
-		return out;
-	}
-	
-	if (driver == "MEM") {
-		if (!out.from_gdalMEM(rstDS, false, true)) {
-			out.setError("rasterization failed (mem)");
-		}
-	}
-	
-	GDALRasterBandH band = GDALGetRasterBand(rstDS, 1);
-	
-	if (minmax) {
-		double adfMinMax[2];
-		GDALComputeRasterMinMax(band, false, adfMinMax);
-		GDALSetRasterStatistics(band, adfMinMax[0], adfMinMax[1], -9999, -9999);
-	}
-	
-	GDALClose(rstDS);
-	if (driver != "MEM") {
-		out = SpatRaster(filename, {-1}, {""});
-	} else {
-		std::string fname = opt.get_filename();
-		if (fname != "") {
-			out = out.writeRaster(opt);
-		}
-	}
+	rasterize_blocks(*this, out, x, values, background, touches, add, weights, update, opt);
 	return out;
 }
 
 
 std::vector<double> SpatRaster::rasterizeCells(SpatVector &v, bool touches) { 
 // note that this is only for lines and polygons
-    SpatOptions opt;
-	SpatRaster r = geometry(1);
 	SpatExtent e = getExtent();
-	e.intersect(v.getExtent());
-	if ( !e.valid() ) {
-		std::vector<double> out(1, NAN);
-		return out;
+	SpatScanGrid grid(e.xmin, e.ymax, xres(), yres(), nrow(), ncol());
+	std::vector<double> out, cells;
+	for (size_t i=0; i<v.size(); i++) {
+		scan_geometry(v.geoms[i], grid, touches, cells);
+		out.insert(out.end(), cells.begin(), cells.end());
+	}
+	if (v.size() > 1) {
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
 	}
-	
-	SpatRaster rc = r.crop(e, "out", opt);
-	std::vector<double> feats(1, 1) ;		
-    SpatRaster rcr = rc.rasterize(v, "", feats, NAN, touches, false, false, false, false, opt); 
-	SpatVector pts = rcr.as_points(false, true, opt);
-	if (pts.size() == 0) {
-		std::vector<double> out(1, NAN);
-		return out;
+	if (out.size() == 0) {
+		out.push_back(NAN);
 	}
-	
-    SpatDataFrame vd = pts.getGeometryDF();
-    std::vector<double> x = vd.getD(0);
-    std::vector<double> y = vd.getD(1);
-	std::vector<double> cells = r.cellFromXY(x, y);
-	return cells;
+	return out;
 }
 
 void SpatRaster::rasterizeCellsWeights(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v) { 
 // note that this is only for polygons
-    SpatOptions opt;
-	opt.progress = nrow()+1;
-	SpatRaster rr = geometry(1);
-	std::vector<unsigned> fact = {10, 10};
-	SpatExtent e = getExtent();
-	SpatExtent ve = v.getExtent();
-	e.intersect(ve);
-	if ( !e.valid() ) {
-		return;
-	}
-	SpatRaster r = rr.crop(v.extent, "out", opt);
-	r = r.disaggregate(fact, opt);
-	std::vector<double> feats(1, 1) ;	
-	r = r.rasterize(v, "", feats, NAN, true, false, false, false, false, opt); 
-	r = r.arith(100.0, "/", false, opt);
-	r = r.aggregate(fact, "sum", true, opt);
-	SpatVector pts = r.as_points(true, true, opt);
-	if (pts.size() == 0) {
-		weights.resize(1);
-		weights[0] = NAN;
-		cells.resize(1);
-		cells[0] = NAN;
-	} else {
-		SpatDataFrame vd = pts.getGeometryDF();
-		std::vector<double> x = vd.getD(0);
-		std::vector<double> y = vd.getD(1);
-		cells = rr.cellFromXY(x, y);
-		weights = pts.df.dv[0];
-	}
-	return;
+	rasterizeCellsExact(cells, weights, v);
 }
 
 void SpatRaster::rasterizeCellsExact(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v) { 
-    
-	SpatOptions opt;
-	opt.progress = nrow()+1;
-	SpatRaster r = geometry(1);
-	r = r.crop(v.extent, "out", opt);
-
-	if (r.ncell() < 1000) {
-		std::vector<double> feats(1, 1) ;	
-		r = r.rasterize(v, "", feats, NAN, true, false, false, false, false, opt); 
-
-		SpatVector pts = r.as_points(true, true, opt);
-		if (pts.size() == 0) {
-			weights.resize(1);
-			weights[0] = NAN;			
-			cells.resize(1);
-			cells[0] = NAN;
-		} else {
-			SpatDataFrame vd = pts.getGeometryDF();
-			std::vector<double> x = vd.getD(0);
-			std::vector<double> y = vd.getD(1);
-			cells = cellFromXY(x, y);
-
-			SpatVector rv = r.as_polygons(false, false, false, true, opt);
-			std::vector<double> csize = rv.area("m", true, {});
-			rv.df.add_column(csize, "area");
-			rv = rv.crop(v);
-			weights = rv.area("m", true, {});
-			for (size_t i=0; i<weights.size(); i++) {
-				weights[i] /= rv.df.dv[0][i];
-			}
-		}
+// the fraction of each cell that is covered, computed from the planar
+// coordinates (the polygon is not split into parts for each cell)
+	SpatExtent e = getExtent();
+	SpatScanGrid grid(e.xmin, e.ymax, xres(), yres(), nrow(), ncol());
+	cells.resize(0);
+	weights.resize(0);
+	if (v.size() == 1) {
+		scan_coverage(v.geoms[0], grid, cells, weights);
 	} else {
-		std::vector<double> feats(1, 1) ;	
-		SpatVector vv = v.as_lines();
-		SpatRaster b = r.rasterize(vv, "", feats, NAN, true, false, false, false, false, opt); 
-		SpatVector pts = b.as_points(true, true, opt);
-		if (pts.nrow() > 0) {
-			SpatDataFrame vd = pts.getGeometryDF();
-			std::vector<double> x = vd.getD(0);
-			std::vector<double> y = vd.getD(1);
-			cells = cellFromXY(x, y);
-			
-			SpatVector bv = b.as_polygons(false, false, false, true, opt);
-			std::vector<double> csize = bv.area("m", true, {});
-			bv.df.add_column(csize, "cellsize");
-			bv.df.add_column(cells, "cellnr");
-			bv = bv.crop(v);
-			weights = bv.area("m", true, {});
-			for (size_t i=0; i<weights.size(); i++) {
-				weights[i] /= bv.df.dv[0][i];
-			}
-			cells = bv.df.dv[1];
-		}
-		// touches = false
-		r = r.rasterize(v, "", feats, NAN, false, false, false, false, false, opt); 
-		pts = r.as_points(true, true, opt);
-		if (pts.nrow() > 0) {
-			SpatDataFrame vd = pts.getGeometryDF();
-			std::vector<double> x = vd.getD(0);
-			std::vector<double> y = vd.getD(1);
-			std::vector<double> cells2 = cellFromXY(x, y);
-			cells.insert(cells.end(), cells2.begin(), cells2.end());
-			weights.resize(weights.size() + cells2.size(), 1);	
-		}
-		
-		if (cells.size() == 0) {
-			weights.resize(1);
-			weights[0] = NAN;			
-			cells.resize(1);
-			cells[0] = NAN;
+		std::vector<double> c, w;
+		for (size_t i=0; i<v.size(); i++) {
+			scan_coverage(v.geoms[i], grid, c, w);
+			cells.insert(cells.end(), c.begin(), c.end());
+			weights.insert(weights.end(), w.begin(), w.end());
 		}
 	}
+	if (cells.size() == 0) {
+		weights.resize(1);
+		weights[0] = NAN;			
+		cells.resize(1);
+		cells[0] = NAN;
+	}
 }
-
-
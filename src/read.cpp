@@ -16,6 +16,8 @@
 // along with spat. If not, see <http://www.gnu.org/licenses/>.
 
 #include "spatRaster.h"
+#include "spatBlock.h"
+#include "spatAsync.h"
 
 bool SpatRaster::readStart() {
 
@@ -28,7 +30,7 @@ bool SpatRaster::readStart() {
 			addWarning("source already open for reading");
 			continue;
 		}
-		if (source[i].memory) {
+		if (source[i].memory || source[i].scratch) {
 			source[i].open_read = true;
 		} else if (source[i].multidim) {
 			if (!readStartMulti(i)) {
@@ -40,13 +42,18 @@ bool SpatRaster::readStart() {
 			}
 		}
 	}
+	if (prefetchable()) {
+		prefetch = std::make_shared<SpatAsyncRead>();
+	}
 	return true;
 }
 
 bool SpatRaster::readStop() {
+	prefetchStop();
+	prefetch.reset();
 	for (size_t i=0; i<nsrc(); i++) {
 		if (source[i].open_read) {
-			if (source[i].memory) {
+			if (source[i].memory || source[i].scratch) {
 				source[i].open_read = false;
 			} else if (source[i].multidim) {
 				readStopMulti(i);
@@ -60,16 +67,21 @@ bool SpatRaster::readStop() {
 
 
 // BSQ
+// for files, the next block is read on another thread while this one is used
 std::vector<double> SpatRaster::readBlock(BlockSize bs, unsigned i){
-	return readValues(bs.row[i], bs.nrows[i], 0, ncol());
+	std::vector<double> v = readValues(bs.row[i], bs.nrows[i], bs.col[i], bs.ncols[i]);
+	if (prefetch && ((i+1) < bs.n)) {
+		prefetchStart(bs.row[i+1], bs.nrows[i+1], bs.col[i+1], bs.ncols[i+1]);
+	}
+	return v;
 }
 
 
 // 2D BSQ
 std::vector<std::vector<double>> SpatRaster::readBlock2(BlockSize bs, unsigned i) {
-	std::vector<double> x = readValues(bs.row[i], bs.nrows[i], 0, ncol());
+	std::vector<double> x = readBlock(bs, i);
 	std::vector<std::vector<double>> v(nlyr());
-	size_t off = bs.nrows[i] * ncol();
+	size_t off = bs.nrows[i] * bs.ncols[i];
 	for (size_t i=0; i<nlyr(); i++) {
 		v[i] = std::vector<double>(x.begin()+(i*off), x.begin()+((i+1)*off));
 	}
@@ -78,9 +90,9 @@ std::vector<std::vector<double>> SpatRaster::readBlock2(BlockSize bs, unsigned i
 
 // BIP
 std::vector<double> SpatRaster::readBlockIP(BlockSize bs, unsigned i) {
-	std::vector<double> x = readValues(bs.row[i], bs.nrows[i], 0, ncol());
+	std::vector<double> x = readBlock(bs, i);
 	std::vector<double> v(x.size());
-	size_t off = bs.nrows[i] * ncol();
+	size_t off = bs.nrows[i] * bs.ncols[i];
 	size_t nl = nlyr();
 	for (size_t i=0; i<nl; i++) {
 		std::vector<double> lyr = std::vector<double>(x.begin()+(i*off), x.begin()+((i+1)*off));
@@ -162,6 +174,9 @@ void SpatRaster::readChunkMEM(std::vector<double> &out, size_t src, size_t row,
 std::vector<double> SpatRaster::readValues(size_t row, size_t nrows, size_t col, size_t ncols){
 
 	std::vector<double> out;
+	if (prefetch && prefetchGet(out, row, nrows, col, ncols)) {
+		return out;
+	}
 
 	if (((row + nrows) > nrow()) || ((col + ncols) > ncol())) {
 		setError("invalid rows/columns");
@@ -189,6 +204,8 @@ std::vector<double> SpatRaster::readValues(size_t row, size_t nrows, size_t col,
 	for (size_t src=0; src<n; src++) {
 		if (source[src].memory) {
 			readChunkMEM(out, src, row, nrows, col, ncols);
+		} else if (source[src].scratch) {
+			readChunkScratch(out, src, row, nrows, col, ncols);
 		} else {
 			// read from file
 			#ifdef useGDAL
@@ -231,6 +248,99 @@ std::vector<double> SpatRaster::readValues(size_t row, size_t nrows, size_t col,
 
 
 
+// true if all sources are files with the same datatype, 
+// and the values do not need to be transformed (scale/offset)
+// and their nodata values cannot be confused with valid values
+bool SpatRaster::native_datatype(std::string &datatype) {
+	datatype = "";
+	if (!hasValues()) return false;
+	for (size_t i=0; i<nsrc(); i++) {
+		if (source[i].memory || source[i].multidim || source[i].rotated) {
+			return false;
+		}
+		if (!is_native_datatype(source[i].datatype)) {
+			return false;
+		}
+		if (!source[i].native_NA) {
+			return false;
+		}
+		if (source[i].hasNAflag && (!native_NA_compatible(source[i].datatype, source[i].NAflag))) {
+			return false;
+		}
+		for (size_t j=0; j<source[i].has_scale_offset.size(); j++) {
+			if (source[i].has_scale_offset[j]) return false;
+		}
+		if (i == 0) {
+			datatype = source[i].datatype;
+		} else if (source[i].datatype != datatype) {
+			datatype = "";
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// use the native datatype for output if the user asked for that datatype
+bool SpatRaster::native_output(std::string &datatype, SpatOptions &opt) {
+	if (!native_datatype(datatype)) {
+		return false;
+	}
+	if ((!opt.datatype_set) || (opt.get_datatype() != datatype)) {
+		return false;
+	}
+	return true;
+}
+
+
+template <typename T>
+bool SpatRaster::readValuesNative(std::vector<T> &out, size_t row, size_t nrows, size_t col, size_t ncols){
+
+	out.resize(0);
+	prefetchStop();
+	if (((row + nrows) > nrow()) || ((col + ncols) > ncol())) {
+		setError("invalid rows/columns");
+		return false;
+	}
+	if ((nrows==0) | (ncols==0)) {
+		return true;
+	}
+	size_t n = nrows * ncols * nlyr();
+	if (!hasValues()) {
+		out.resize(n, SpatType<T>::na());
+		addWarning("raster has no values");
+		return true;
+	}
+
+	out.reserve(n);
+	for (size_t src=0; src<nsrc(); src++) {
+		if (source[src].memory) {
+			std::vector<double> d;
+			readChunkMEM(d, src, row, nrows, col, ncols);
+			std::vector<T> v;
+			double_to_native(d, v);
+			out.insert(out.end(), v.begin(), v.end());
+		} else if (source[src].scratch) {
+			readChunkScratchNative(out, src, row, nrows, col, ncols);
+		} else {
+			#ifdef useGDAL
+			readChunkGDALNative(out, src, row, nrows, col, ncols);
+			#endif
+		}
+	}
+	return (out.size() == n);
+}
+
+template bool SpatRaster::readValuesNative(std::vector<uint8_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::readValuesNative(std::vector<int16_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::readValuesNative(std::vector<uint16_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::readValuesNative(std::vector<int32_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::readValuesNative(std::vector<uint32_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::readValuesNative(std::vector<float> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::readValuesNative(std::vector<double> &, size_t, size_t, size_t, size_t);
+
+
+
 bool SpatRaster::readAll() {
 	if (!hasValues()) {
 		return true; 
@@ -241,7 +351,13 @@ bool SpatRaster::readAll() {
 	size_t n = nsrc();
 	for (size_t src=0; src<n; src++) {
 		if (!source[src].memory) {
-			readChunkGDAL(source[src].values, src, row, nrows, col, ncols);
+			if (source[src].scratch) {
+				readChunkScratch(source[src].values, src, row, nrows, col, ncols);
+				source[src].scratch.reset();
+				source[src].driver = "memory";
+			} else {
+				readChunkGDAL(source[src].values, src, row, nrows, col, ncols);
+			}
 			source[src].memory = true;
 			source[src].filename = "";
 		}
@@ -289,6 +405,8 @@ std::vector<double> SpatRaster::getValues(long lyr) {
 		for (size_t src=0; src<n; src++) {
 			if (source[src].memory) {
 				out.insert(out.end(), source[src].values.begin(), source[src].values.end());
+			} else if (source[src].scratch) {
+				readChunkScratch(out, src, 0, nrow(), 0, ncol());
 			} else {
 				#ifdef useGDAL
 				std::vector<double> fvals = readValuesGDAL(src, 0, nrow(), 0, ncol());
@@ -337,6 +455,9 @@ bool SpatRaster::getValuesSource(size_t src, std::vector<double> &out) {
 
 	if (source[src].memory) {
 		out = std::vector<double>(source[src].values.begin(), source[src].values.end());
+	} else if (source[src].scratch) {
+		out.resize(0);
+		readChunkScratch(out, src, 0, nrow(), 0, ncol());
 	} else {
 		#ifdef useGDAL
 		out = readValuesGDAL(src, 0, nrow(), 0, ncol());
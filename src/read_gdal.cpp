@@ -29,6 +29,9 @@
 #include "spatTime.h"
 #include "recycle.h"
 #include "gdalio.h"
+#include "spatBlock.h"
+#include "spatSIMD.h"
+#include "spatAsync.h"
 
 //#include "NA.h"
 
@@ -523,6 +526,34 @@ bool SpatRaster::constructFromFile(std::string fname, std::vector<int> subds, st
 
 
 		//std::string dtype = GDALGetDataTypeName(poBand->GetRasterDataType());
+		std::string dtype;
+		if (!getTerraDataType(poBand->GetRasterDataType(), dtype)) {
+			dtype = "";
+		} else if (dtype == "INT1U") {
+			const char *ptype = poBand->GetMetadataItem("PIXELTYPE", "IMAGE_STRUCTURE");
+			if ((ptype != NULL) && (std::string(ptype) == "SIGNEDBYTE")) {
+				dtype = "";
+			}
+		}
+		// integer values are only read natively if the NA value of the datatype is the nodata value
+		// otherwise valid values (e.g. 255 for INT1U) would become NA
+		double naflag = poBand->GetNoDataValue(&success);
+		if (success) {
+			if (!native_NA_compatible(dtype, naflag)) {
+				s.native_NA = false;
+			}
+		} else if ((dtype != "FLT4S") && (dtype != "FLT8S")) {
+			s.native_NA = false;
+		}
+		if (i == 0) {
+			s.datatype = dtype;
+			int bcols, brows;
+			poBand->GetBlockSize(&bcols, &brows);
+			s.blockrows = brows;
+			s.blockcols = bcols;
+		} else if (s.datatype != dtype) {
+			s.datatype = "";
+		}
 
 		adfMinMax[0] = poBand->GetMinimum( &bGotMin );
 		adfMinMax[1] = poBand->GetMaximum( &bGotMax );
@@ -657,7 +688,6 @@ bool SpatRaster::readStopGDAL(unsigned src) {
 
 void NAso(std::vector<double> &d, size_t n, const std::vector<double> &flags, const std::vector<double> &scale, const std::vector<double>  &offset, const std::vector<bool> &haveso, const bool haveUserNAflag, const double userNAflag){
 	size_t nl = flags.size();
-	double na = NAN;
 
 	for (size_t i=0; i<nl; i++) {
 		size_t start = i*n;
@@ -665,36 +695,30 @@ void NAso(std::vector<double> &d, size_t n, const std::vector<double> &flags, co
 			double flag = flags[i];
 			// a hack to avoid problems with double derived from float - double comparison
 			if (flag < -3.4e+37) {
-				flag = -3.4e+37;
-				for (size_t j=start; j<(start+n); j++) {
-					if (d[j] < flag) {
-						d[j] = NAN;
-					} 
-				}
+				simd_set_na(d.data()+start, n, -3.4e+37, true);
 			} else {
-				std::replace(d.begin()+start, d.begin()+start+n, flag, na); 
+				simd_set_na(d.data()+start, n, flag, false);
 			}
 		}
 		if (haveso[i]) {
-			for (size_t j=start; j<(start+n); j++) {
-				d[j] = d[j] * scale[i] + offset[i];
-			}
+			simd_scale_offset(d.data()+start, n, scale[i], offset[i]);
 		}
 	}
 	if (haveUserNAflag) {
-		std::replace(d.begin(), d.end(), userNAflag, na); 		
+		simd_set_na(d.data(), d.size(), userNAflag, false);
 	}
 }
 
 
-void vflip(std::vector<double> &v, const size_t &ncell, const size_t &nrows, const size_t &ncols, const size_t &nl) {
+template <typename T>
+void vflip(std::vector<T> &v, const size_t &ncell, const size_t &nrows, const size_t &ncols, const size_t &nl) {
 	for (size_t i=0; i<nl; i++) {
 		size_t off = i*ncell;
 		size_t nr = nrows/2;
 		for (size_t j=0; j<nr; j++) {
 			size_t d1 = off + j * ncols;
 			size_t d2 = off + (nrows-j-1) * ncols;
-			std::vector<double> r(v.begin()+d1, v.begin()+d1+ncols);
+			std::vector<T> r(v.begin()+d1, v.begin()+d1+ncols);
 			std::copy(v.begin()+d2, v.begin()+d2+ncols, v.begin()+d1);
 			std::copy(r.begin(), r.end(), v.begin()+d2);
 		}
@@ -702,6 +726,55 @@ void vflip(std::vector<double> &v, const size_t &ncell, const size_t &nrows, con
 }
 
 
+// the dataset, bands and file row/col of the window of source src that
+// starts at row/col of this SpatRaster
+SpatAsyncWindow SpatRaster::gdalWindow(unsigned src, size_t row, size_t col) {
+	SpatAsyncWindow w;
+	w.ds = source[src].gdalconnection;
+	w.nl = source[src].nlyr;
+	w.row = row;
+	w.col = col;
+	if (source[src].hasWindow) { // ignoring the expanded case.
+		w.row += source[src].window.off_row;
+		w.col += source[src].window.off_col;
+	}
+	if (!source[src].in_order()) {
+		w.bands.reserve(w.nl);
+		for (size_t i=0; i < w.nl; i++) {
+			w.bands.push_back(source[src].layers[i]+1);
+		}
+	}
+	return w;
+}
+
+
+// does not touch a SpatRaster, such that it can be used on another thread
+CPLErr read_window_gdal(const SpatAsyncWindow &w, size_t nrows, size_t ncols, std::vector<double> &out) {
+	out.resize(nrows * ncols * w.nl);
+	int *bands = w.bands.size() > 0 ? const_cast<int*>(&w.bands[0]) : NULL;
+	return w.ds->RasterIO(GF_Read, w.col, w.row, ncols, nrows, &out[0], ncols, nrows, GDT_Float64, w.nl, bands, 0, 0, 0, NULL);
+}
+
+
+// NA flags, scale/offset and flipping of the values of source src
+void SpatRaster::readChunkGDALFinish(std::vector<double> &out, unsigned src, size_t nrows, size_t ncols) {
+	size_t ncell = ncols * nrows;
+	unsigned nl = source[src].nlyr;
+	int hasNA;
+	std::vector<double> naflags(nl, NAN);
+	GDALRasterBand  *poBand;
+	for (size_t i=0; i<nl; i++) {
+		poBand = source[src].gdalconnection->GetRasterBand(source[src].layers[i]+1);
+		double naflag = poBand->GetNoDataValue(&hasNA);
+		if (hasNA)  naflags[i] = naflag;
+	}		
+	NAso(out, ncell, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
+	if (source[src].flipped) {
+		vflip(out, ncell, nrows, ncols, nl);
+	}
+}
+
+
 void SpatRaster::readChunkGDAL(std::vector<double> &data, unsigned src, size_t row, unsigned nrows, size_t col, unsigned ncols) {
 
 	if (source[src].multidim) {
@@ -709,12 +782,50 @@ void SpatRaster::readChunkGDAL(std::vector<double> &data, unsigned src, size_t r
 		return;
 	}
 
+	if (source[src].rotated) {
+		setError("cannot read from rotated files. First use 'rectify'");
+		return;
+	}
+
+	if (!source[src].open_read) {
+		setError("the file is not open for reading");
+		return;
+	}
+
+	std::vector<double> out;
+	CPLErr err = read_window_gdal(gdalWindow(src, row, col), nrows, ncols, out);
+	if (err != CE_None ) {
+		setError("cannot read values");
+		return;
+	}
+	readChunkGDALFinish(out, src, nrows, ncols);
+	data.insert(data.end(), out.begin(), out.end());		
+}
+
+
+
+
+template <typename T>
+void SpatRaster::readChunkGDALNative(std::vector<T> &data, unsigned src, size_t row, unsigned nrows, size_t col, unsigned ncols) {
+
+	bool so = false;
+	for (size_t i=0; i<source[src].has_scale_offset.size(); i++) {
+		so = so || source[src].has_scale_offset[i];
+	}
+	if (source[src].multidim || so) {
+		std::vector<double> d;
+		readChunkGDAL(d, src, row, nrows, col, ncols);
+		std::vector<T> v;
+		double_to_native(d, v);
+		data.insert(data.end(), v.begin(), v.end());
+		return;
+	}
+
 	if (source[src].hasWindow) { // ignoring the expanded case.
 		row = row + source[src].window.off_row;
 		col = col + source[src].window.off_col;
 	}
 
-	std::vector<double> errout;
 	if (source[src].rotated) {
 		setError("cannot read from rotated files. First use 'rectify'");
 		return;
@@ -725,12 +836,12 @@ void SpatRaster::readChunkGDAL(std::vector<double> &data, unsigned src, size_t r
 		return;
 	}
 
-	unsigned ncell = ncols * nrows;
+	GDALDataType gdt;
+	getGDALDataType(SpatType<T>::name(), gdt);
+
+	size_t ncell = ncols * nrows;
 	unsigned nl = source[src].nlyr;
-	std::vector<double> out(ncell * nl);
-	int hasNA;
-	std::vector<double> naflags(nl, NAN);
-	CPLErr err = CE_None;
+	std::vector<T> out(ncell * nl);
 
 	std::vector<int> panBandMap;
 	if (!source[src].in_order()) {
@@ -740,47 +851,40 @@ void SpatRaster::readChunkGDAL(std::vector<double> &data, unsigned src, size_t r
 		}
 	}
 
+	CPLErr err = CE_None;
 	if (panBandMap.size() > 0) {
-		err = source[src].gdalconnection->RasterIO(GF_Read, col, row, ncols, nrows, &out[0], ncols, nrows, GDT_Float64, nl, &panBandMap[0], 0, 0, 0, NULL);
+		err = source[src].gdalconnection->RasterIO(GF_Read, col, row, ncols, nrows, &out[0], ncols, nrows, gdt, nl, &panBandMap[0], 0, 0, 0, NULL);
 	} else {
-		err = source[src].gdalconnection->RasterIO(GF_Read, col, row, ncols, nrows, &out[0], ncols, nrows, GDT_Float64, nl, NULL, 0, 0, 0, NULL);	
-	}
-	
-	GDALRasterBand  *poBand;
-	if (err == CE_None ) { 
-		for (size_t i=0; i<nl; i++) {
-			poBand = source[src].gdalconnection->GetRasterBand(source[src].layers[i]+1);
-			double naflag = poBand->GetNoDataValue(&hasNA);
-			if (hasNA)  naflags[i] = naflag;
-		}		
-		NAso(out, ncell, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
-	}
-
-/*
-	for (size_t i=0; i < nl; i++) {
-		cell = ncell * i;
-		poBand = source[src].gdalconnection->GetRasterBand(source[src].layers[i] + 1);
-		double naflag = poBand->GetNoDataValue(&hasNA);
-		if (!hasNA) { naflag = NAN; }
-		GDALDataType gdtype = poBand->GetRasterDataType();
-		if (gdtype == GDT_Float64) {
-			err = poBand->RasterIO(GF_Read, col, row, ncols, nrows, &out[cell], ncols, nrows, gdtype, 0, 0);
-			if (err != CE_None ) { break; }
-			set_NA(out, naflag);
-		}
+		err = source[src].gdalconnection->RasterIO(GF_Read, col, row, ncols, nrows, &out[0], ncols, nrows, gdt, nl, NULL, 0, 0, 0, NULL);	
 	}
-*/
 	if (err != CE_None ) {
 		setError("cannot read values");
 		return;
 	}
 
+	int hasNA;
+	GDALRasterBand *poBand;
+	for (size_t i=0; i<nl; i++) {
+		poBand = source[src].gdalconnection->GetRasterBand(source[src].layers[i]+1);
+		double naflag = poBand->GetNoDataValue(&hasNA);
+		size_t start = i * ncell;
+		if (hasNA) native_set_NA(out, start, start+ncell, naflag);
+		if (source[src].hasNAflag) native_set_NA(out, start, start+ncell, source[src].NAflag);
+	}
+
 	if (source[src].flipped) {
 		vflip(out, ncell, nrows, ncols, nl);
 	}
 	data.insert(data.end(), out.begin(), out.end());		
 }
 
+template void SpatRaster::readChunkGDALNative(std::vector<uint8_t> &, unsigned, size_t, unsigned, size_t, unsigned);
+template void SpatRaster::readChunkGDALNative(std::vector<int16_t> &, unsigned, size_t, unsigned, size_t, unsigned);
+template void SpatRaster::readChunkGDALNative(std::vector<uint16_t> &, unsigned, size_t, unsigned, size_t, unsigned);
+template void SpatRaster::readChunkGDALNative(std::vector<int32_t> &, unsigned, size_t, unsigned, size_t, unsigned);
+template void SpatRaster::readChunkGDALNative(std::vector<uint32_t> &, unsigned, size_t, unsigned, size_t, unsigned);
+template void SpatRaster::readChunkGDALNative(std::vector<float> &, unsigned, size_t, unsigned, size_t, unsigned);
+template void SpatRaster::readChunkGDALNative(std::vector<double> &, unsigned, size_t, unsigned, size_t, unsigned);
 
 
 
@@ -792,6 +896,16 @@ std::vector<double> SpatRaster::readValuesGDAL(unsigned src, size_t row, size_t
 		return errout;
 	}
 
+	if (source[src].multidim) {
+		std::vector<double> out;
+		std::vector<unsigned> lyrs = source[src].layers;
+		if (lyr >= 0) lyrs = {source[src].layers[lyr]};
+		if (!readMulti(out, src, row, nrows, col, ncols, lyrs)) {
+			return errout;
+		}
+		return out;
+	}
+
 	if (source[src].hasWindow) { // ignoring the expanded case.
 		row = row + source[src].window.off_row;
 		col = col + source[src].window.off_col;
@@ -941,153 +1055,181 @@ std::vector<double> SpatRaster::readGDALsample(unsigned src, size_t srows, size_
 
 
 
-std::vector<std::vector<double>> SpatRaster::readRowColGDAL(unsigned src, std::vector<int_64> &rows, const std::vector<int_64> &cols) {
-
-	std::vector<std::vector<double>> errout;
-	if (source[src].rotated) {
-		setError("cannot read from rotated files. First use 'rectify'");
-		return errout;
-	}
-
-    GDALDataset *poDataset = openGDAL(source[src].filename, GDAL_OF_RASTER | GDAL_OF_READONLY);
+// Values of cells (rows, cols) of the layers "lyrs", layer by layer (all cells of 
+// the first layer first). The cells are sorted by the block (tile or strip) of the
+// file that they are in, such that each block is decompressed once (and then kept
+// in the GDAL block cache until all its cells are read). If there are many cells in 
+// a block, the window with these cells is read at once; otherwise cell by cell.
+bool read_rowcol_blocks(GDALDataset *poDataset, const std::vector<unsigned> &lyrs, bool in_order, const std::vector<int_64> &rows, const std::vector<int_64> &cols, size_t brows, size_t bcols, std::vector<double> &out) {
 
-	GDALRasterBand *poBand;
+	size_t n = rows.size();
+	size_t nl = lyrs.size();
+	out.resize(0);
+	out.resize(n * nl, NAN);
 	
-    if( poDataset == NULL )  {
-		return errout;
-	}
-
-	std::vector<unsigned> lyrs = source[src].layers;
-	unsigned nl = lyrs.size();
-	unsigned n = rows.size();
-
-	size_t fnr = nrow() - 1;
-	if (source[src].flipped) {
-		for (size_t i=0; i<n; i++) {
-			rows[i] = fnr - rows[i];
-		}
-	}
-
 	std::vector<int> panBandMap;
-	if (!source[src].in_order()) {
+	if (!in_order) {
 		panBandMap.reserve(nl);
 		for (size_t i=0; i < nl; i++) {
 			panBandMap.push_back(lyrs[i]+1);
 		}
 	}
-
-	std::vector<double> out(n * nl, NAN);
-	CPLErr err = CE_None;
-	for (size_t j=0; j < n; j++) {
-		if ((cols[j] < 0) || (rows[j] < 0)) continue;
-		if (panBandMap.size() > 0) {
-			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, &panBandMap[0], 0, 0, 0, NULL);
-		} else {
-			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, NULL, 0, 0, 0, NULL);
-		}
-		if (err != CE_None ) { 
-			break;
-		}
-	}
-
-	if (err == CE_None ) { 
-		std::vector<double> naflags(nl, NAN);
-		int hasNA;
-		for (size_t i=0; i<nl; i++) {
-			poBand = poDataset->GetRasterBand(lyrs[i]+1);
-			double naflag = poBand->GetNoDataValue(&hasNA);
-			if (hasNA)  naflags[i] = naflag;
+	int *bandmap = panBandMap.size() > 0 ? &panBandMap[0] : NULL;
+
+	int_64 fnr = poDataset->GetRasterYSize();
+	int_64 fnc = poDataset->GetRasterXSize();
+	brows = std::max((size_t)1, brows);
+	bcols = std::max((size_t)1, bcols);
+	size_t nbc = (fnc + bcols - 1) / bcols;
+
+	std::vector<size_t> idx;
+	std::vector<uint64_t> block;
+	idx.reserve(n);
+	block.reserve(n);
+	for (size_t i=0; i<n; i++) {
+		if ((rows[i] < 0) || (cols[i] < 0) || (rows[i] >= fnr) || (cols[i] >= fnc)) continue;
+		idx.push_back(i);
+		block.push_back((rows[i] / brows) * nbc + (cols[i] / bcols));
+	}
+	// by block, and within a block by row and column
+	std::vector<size_t> ord(idx.size());
+	std::iota(ord.begin(), ord.end(), 0);
+	std::sort(ord.begin(), ord.end(), [&](size_t a, size_t b) {
+		if (block[a] != block[b]) return block[a] < block[b];
+		if (rows[idx[a]] != rows[idx[b]]) return rows[idx[a]] < rows[idx[b]];
+		return cols[idx[a]] < cols[idx[b]];
+	});
+
+	std::vector<double> cell(nl);
+	std::vector<double> win;
+	size_t i = 0;
+	while (i < ord.size()) {
+		size_t j = i;
+		int_64 r0 = rows[idx[ord[i]]], r1 = r0;
+		int_64 c0 = cols[idx[ord[i]]], c1 = c0;
+		while ((j < ord.size()) && (block[ord[j]] == block[ord[i]])) {
+			size_t k = idx[ord[j]];
+			r1 = std::max(r1, rows[k]);
+			c0 = std::min(c0, cols[k]);
+			c1 = std::max(c1, cols[k]);
+			j++;
 		}
-		NAso(out, n, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
-	}
-
-	GDALClose((GDALDatasetH) poDataset);
-	if (err != CE_None ) {
-		setError("cannot read values");
-		return errout;
-	}
-
-
-	size_t nr = rows.size();
-	std::vector<std::vector<double>> r(nl, std::vector<double> (nr));
-	for (size_t i=0; i<nr; i++) {
-		for (size_t j=0; j<nl; j++) {
-			size_t k = (i*nl) + j;
-			r[j][i] = out[k];  
+		size_t wnr = r1 - r0 + 1;
+		size_t wnc = c1 - c0 + 1;
+		size_t wn = wnr * wnc;
+		if ((((j - i) * 16) >= wn) && ((wn * nl) <= 16777216)) {
+			win.resize(wn * nl);
+			CPLErr err = poDataset->RasterIO(GF_Read, c0, r0, wnc, wnr, &win[0], wnc, wnr, GDT_Float64, nl, bandmap, 0, 0, 0, NULL);
+			if (err != CE_None) return false;
+			for (size_t m=i; m<j; m++) {
+				size_t k = idx[ord[m]];
+				size_t off = (rows[k] - r0) * wnc + (cols[k] - c0);
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					out[lyr * n + k] = win[lyr * wn + off];
+				}
+			}
+		} else {
+			for (size_t m=i; m<j; m++) {
+				size_t k = idx[ord[m]];
+				CPLErr err = poDataset->RasterIO(GF_Read, cols[k], rows[k], 1, 1, &cell[0], 1, 1, GDT_Float64, nl, bandmap, 0, 0, 0, NULL);
+				if (err != CE_None) return false;
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					out[lyr * n + k] = cell[lyr];
+				}
+			}
 		}
+		i = j;
 	}
-	return r;
+	return true;
 }
 
 
+// values for the cells in rows and cols, layer by layer
+bool SpatRaster::readRowColBlocksGDAL(unsigned src, const std::vector<int_64> &rows, const std::vector<int_64> &cols, std::vector<double> &out) {
 
-
-std::vector<double> SpatRaster::readRowColGDALFlat(unsigned src, std::vector<int_64> &rows, const std::vector<int_64> &cols) {
-
-	std::vector<double> errout;
 	if (source[src].rotated) {
 		setError("cannot read from rotated files. First use 'rectify'");
-		return errout;
+		return false;
 	}
 
-    GDALDataset *poDataset = openGDAL(source[src].filename, GDAL_OF_RASTER | GDAL_OF_READONLY);
+	if (source[src].multidim) {
+		return readRowColMulti(src, rows, cols, out);
+	}
 
-	GDALRasterBand *poBand;
-	
-    if( poDataset == NULL )  {
-		return errout;
+	// use the dataset that is open for reading (readStart), if any
+	GDALDataset *poDataset;
+	bool isopen = source[src].open_read && (source[src].gdalconnection != NULL);
+	if (isopen) {
+		prefetchStop();
+		poDataset = source[src].gdalconnection;
+	} else {
+		poDataset = openGDAL(source[src].filename, GDAL_OF_RASTER | GDAL_OF_READONLY);
+	    if( poDataset == NULL )  {
+			setError("cannot read values");
+			return false;
+		}
 	}
 
 	std::vector<unsigned> lyrs = source[src].layers;
-	unsigned nl = lyrs.size();
-	unsigned n = rows.size();
+	size_t nl = lyrs.size();
+	size_t n = rows.size();
 
-	size_t fnr = nrow() - 1;
+	std::vector<int_64> frows;
 	if (source[src].flipped) {
+		int_64 fnr = nrow() - 1;
+		frows.reserve(n);
 		for (size_t i=0; i<n; i++) {
-			rows[i] = fnr - rows[i];
-		}
-	}
-
-	std::vector<int> panBandMap;
-	if (!source[src].in_order()) {
-		panBandMap.reserve(nl);
-		for (size_t i=0; i < nl; i++) {
-			panBandMap.push_back(lyrs[i]+1);
+			frows.push_back(rows[i] < 0 ? rows[i] : fnr - rows[i]);
 		}
 	}
 
-	std::vector<double> out(n * nl, NAN);
-	CPLErr err = CE_None;
-	for (size_t j=0; j < n; j++) {
-		if ((cols[j] < 0) || (rows[j] < 0)) continue;
-		if (panBandMap.size() > 0) {
-			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, &panBandMap[0], 0, 0, 0, NULL);
-		} else {
-			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, NULL, 0, 0, 0, NULL);
-		}
-		if (err != CE_None ) { 
-			break;
-		}
-	}
+	bool ok = read_rowcol_blocks(poDataset, lyrs, source[src].in_order(), source[src].flipped ? frows : rows, cols, source[src].blockrows, source[src].blockcols, out);
 
-	if (err == CE_None ) { 
+	if (ok) { 
 		std::vector<double> naflags(nl, NAN);
 		int hasNA;
 		for (size_t i=0; i<nl; i++) {
-			poBand = poDataset->GetRasterBand(lyrs[i]+1);
+			GDALRasterBand *poBand = poDataset->GetRasterBand(lyrs[i]+1);
 			double naflag = poBand->GetNoDataValue(&hasNA);
 			if (hasNA)  naflags[i] = naflag;
 		}
 		NAso(out, n, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
 	}
 
-	GDALClose((GDALDatasetH) poDataset);
-	if (err != CE_None ) {
+	if (!isopen) {
+		GDALClose((GDALDatasetH) poDataset);
+	}
+	if (!ok) {
 		setError("cannot read values");
+		return false;
+	}
+	return true;
+}
+
+
+std::vector<std::vector<double>> SpatRaster::readRowColGDAL(unsigned src, std::vector<int_64> &rows, const std::vector<int_64> &cols) {
+
+	std::vector<std::vector<double>> errout;
+	std::vector<double> out;
+	if (!readRowColBlocksGDAL(src, rows, cols, out)) {
 		return errout;
 	}
+	size_t nl = source[src].layers.size();
+	size_t n = rows.size();
+	std::vector<std::vector<double>> r(nl);
+	for (size_t i=0; i<nl; i++) {
+		r[i] = std::vector<double>(out.begin() + i*n, out.begin() + (i+1)*n);
+	}
+	return r;
+}
+
 
+std::vector<double> SpatRaster::readRowColGDALFlat(unsigned src, std::vector<int_64> &rows, const std::vector<int_64> &cols) {
+
+	std::vector<double> out;
+	if (!readRowColBlocksGDAL(src, rows, cols, out)) {
+		out.resize(0);
+	}
 	return out;
 }
 
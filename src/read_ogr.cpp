@@ -25,6 +25,8 @@
 #include "crs.h"
 
 #include "string_utils.h"
+#include "NA.h"
+#include <numeric>
 
 std::string geomType(OGRLayer *poLayer) {
 	std::string s = "";
@@ -41,62 +43,276 @@ std::string geomType(OGRLayer *poLayer) {
 }
 
 
-SpatDataFrame readAttributes(OGRLayer *poLayer) {
-	SpatDataFrame df;
+// the data type of an attribute in a SpatDataFrame
+unsigned ogr_dtype(OGRFieldType ft) {
+	if (ft == OFTReal) {
+		return 0;
+	} else if ((ft == OFTInteger) | (ft == OFTInteger64)) {
+		return 1;
+	}
+	return 2;
+}
 
-    OGRFeatureDefn *poFDefn = poLayer->GetLayerDefn();
-	size_t nfields = poFDefn->GetFieldCount();
-	if (nfields == 0) return df;
 
-	OGRFieldType ft;
-    poLayer->ResetReading();
-    OGRFeature *poFeature;
-	OGRFieldDefn *poFieldDefn;
-	df.resize_cols(nfields);
-	bool first = true;
-	unsigned dtype;
-    while( (poFeature = poLayer->GetNextFeature()) != NULL ) {
-		if (first) {
-			for (size_t i = 0; i < nfields; i++ ) {
-				poFieldDefn = poFDefn->GetFieldDefn(i);
-				std::string fname = poFieldDefn->GetNameRef();
-				ft = poFieldDefn->GetType();
-				if (ft == OFTReal) {
-					dtype = 0;
-				} else if ((ft == OFTInteger) | (ft == OFTInteger64)) {
-					dtype = 1;
-				} else {
-					dtype = 2;
-				}
-				df.add_column(dtype, fname);
+// one pass over the features of a layer, for the attributes (fields "fi")
+// and the geometries. The geometries are exported to WKB and decoded into
+// the flat coordinate vectors
+bool ogr_read_features(OGRLayer *poLayer, const std::vector<int> &fi, bool readgeom, SpatDataFrame &df, SpatGeomColumns &gc, bool &hasZ, bool &hasM, size_t &nbad) {
+
+	OGRFeatureDefn *poFDefn = poLayer->GetLayerDefn();
+	size_t nf = fi.size();
+	std::vector<OGRFieldType> ft(nf);
+	for (size_t k=0; k<nf; k++) {
+		ft[k] = poFDefn->GetFieldDefn(fi[k])->GetType();
+	}
+	GIntBig n = poLayer->GetFeatureCount(FALSE);
+	if (n > 0) {
+		for (size_t k=0; k<nf; k++) {
+			unsigned j = df.iplace[k];
+			unsigned dtype = ogr_dtype(ft[k]);
+			if (dtype == 0) {
+				df.dv[j].reserve(n);
+			} else if (dtype == 1) {
+				df.iv[j].reserve(n);
+			} else {
+				df.sv[j].reserve(n);
 			}
-			first = false;
 		}
+	}
+	long longNA = NA<long>::value;
+	std::vector<unsigned char> wkb;
 
-		for (size_t i = 0; i < nfields; i++ ) {
-			poFieldDefn = poFDefn->GetFieldDefn( i );
-			unsigned j = df.iplace[i];
-			switch( poFieldDefn->GetType() ) {
+	poLayer->ResetReading();
+	OGRFeature *poFeature;
+	while( (poFeature = poLayer->GetNextFeature()) != NULL ) {
+		for (size_t k=0; k<nf; k++) {
+			int i = fi[k];
+			unsigned j = df.iplace[k];
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,2,0)
+			bool isset = poFeature->IsFieldSetAndNotNull(i);
+#else
+			bool isset = poFeature->IsFieldSet(i);
+#endif
+			switch( ft[k] ) {
 				case OFTReal:
-					df.dv[j].push_back(poFeature->GetFieldAsDouble(i));
+					df.dv[j].push_back(isset ? poFeature->GetFieldAsDouble(i) : NAN);
 					break;
 				case OFTInteger:
-					df.iv[j].push_back(poFeature->GetFieldAsInteger( i ));
-					break;
 				case OFTInteger64:
-					df.iv[j].push_back(poFeature->GetFieldAsInteger64( i ));
+					df.iv[j].push_back(isset ? (long) poFeature->GetFieldAsInteger64(i) : longNA);
 					break;
-	//          case OFTString:
 				default:
-					df.sv[j].push_back(poFeature->GetFieldAsString( i ));
+					df.sv[j].push_back(isset ? poFeature->GetFieldAsString(i) : df.NAS);
 					break;
 			}
 		}
+		if (readgeom) {
+			OGRGeometry *poGeometry = poFeature->GetGeometryRef();
+			if (poGeometry == NULL) {
+				gc.add_empty();
+			} else {
+				size_t size = poGeometry->WkbSize();
+				wkb.resize(size);
+				if ((poGeometry->exportToWkb(wkbNDR, wkb.data(), wkbVariantIso) != OGRERR_NONE) || 
+						(!gc.add_wkb(wkb.data(), size, hasZ, hasM))) {
+					gc.add_empty();
+					nbad++;
+				}
+			}
+		}
 		OGRFeature::DestroyFeature( poFeature );
 	}
-	return df;
+	return true;
+}
+
+
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,6,0)
+
+// Arrow C data interface (see ogr_recordbatch.h)
+
+inline bool arrow_valid(const struct ArrowArray *a, int64_t i) {
+	const uint8_t *v = (const uint8_t*) a->buffers[0];
+	if ((v == NULL) || (a->null_count == 0)) return true;
+	return (v[i >> 3] >> (i & 7)) & 1;
+}
+
+template <typename T, typename O>
+void arrow_values(const struct ArrowArray *a, int64_t off, int64_t n, std::vector<O> &out, O na) {
+	const T *d = (const T*) a->buffers[1];
+	for (int64_t r=0; r<n; r++) {
+		int64_t i = off + r;
+		out.push_back(arrow_valid(a, i) ? (O) d[i] : na);
+	}
 }
 
+template <typename T>
+void arrow_strings(const struct ArrowArray *a, int64_t off, int64_t n, std::vector<std::string> &out, const std::string &na) {
+	const T *o = (const T*) a->buffers[1];
+	const char *d = (const char*) a->buffers[2];
+	for (int64_t r=0; r<n; r++) {
+		int64_t i = off + r;
+		if (arrow_valid(a, i)) {
+			out.push_back(std::string(d + o[i], o[i+1] - o[i]));
+		} else {
+			out.push_back(na);
+		}
+	}
+}
+
+// numbers of an Arrow column of any integer or floating point type
+template <typename O>
+bool arrow_numbers(const std::string &fmt, const struct ArrowArray *a, int64_t off, int64_t n, std::vector<O> &out, O na) {
+	if (fmt == "g") {
+		arrow_values<double, O>(a, off, n, out, na);
+	} else if (fmt == "f") {
+		arrow_values<float, O>(a, off, n, out, na);
+	} else if (fmt == "l") {
+		arrow_values<int64_t, O>(a, off, n, out, na);
+	} else if (fmt == "i") {
+		arrow_values<int32_t, O>(a, off, n, out, na);
+	} else if (fmt == "s") {
+		arrow_values<int16_t, O>(a, off, n, out, na);
+	} else if (fmt == "c") {
+		arrow_values<int8_t, O>(a, off, n, out, na);
+	} else if (fmt == "L") {
+		arrow_values<uint64_t, O>(a, off, n, out, na);
+	} else if (fmt == "I") {
+		arrow_values<uint32_t, O>(a, off, n, out, na);
+	} else if (fmt == "S") {
+		arrow_values<uint16_t, O>(a, off, n, out, na);
+	} else if (fmt == "C") {
+		arrow_values<uint8_t, O>(a, off, n, out, na);
+	} else if (fmt == "b") {
+		const uint8_t *d = (const uint8_t*) a->buffers[1];
+		for (int64_t r=0; r<n; r++) {
+			int64_t i = off + r;
+			out.push_back(arrow_valid(a, i) ? (O) ((d[i >> 3] >> (i & 7)) & 1) : na);
+		}
+	} else {
+		return false;
+	}
+	return true;
+}
+
+
+// the same as ogr_read_features, but reading batches of features as
+// columns with the Arrow stream of the layer. Returns false (and the
+// caller starts over with ogr_read_features) if there are attributes
+// that are not numbers or strings, or if a column cannot be decoded
+bool ogr_read_arrow(OGRLayer *poLayer, const std::vector<int> &fi, bool readgeom, SpatDataFrame &df, SpatGeomColumns &gc, bool &hasZ, bool &hasM, size_t &nbad) {
+
+	OGRFeatureDefn *poFDefn = poLayer->GetLayerDefn();
+	size_t nf = fi.size();
+	std::vector<std::string> fnames(nf);
+	std::vector<unsigned> dtype(nf);
+	for (size_t k=0; k<nf; k++) {
+		OGRFieldDefn *poFieldDefn = poFDefn->GetFieldDefn(fi[k]);
+		OGRFieldType ft = poFieldDefn->GetType();
+		if ((ft != OFTReal) && (ft != OFTInteger) && (ft != OFTInteger64) && (ft != OFTString)) {
+			// e.g. dates, that are read as strings
+			return false;
+		}
+		fnames[k] = poFieldDefn->GetNameRef();
+		dtype[k] = ogr_dtype(ft);
+	}
+
+	poLayer->ResetReading();
+	char **papszOptions = NULL;
+	papszOptions = CSLSetNameValue(papszOptions, "INCLUDE_FID", "NO");
+	papszOptions = CSLSetNameValue(papszOptions, "MAX_FEATURES_IN_BATCH", "65536");
+	struct ArrowArrayStream stream;
+	bool ok = poLayer->GetArrowStream(&stream, papszOptions);
+	CSLDestroy(papszOptions);
+	if (!ok) return false;
+
+	struct ArrowSchema schema;
+	if (stream.get_schema(&stream, &schema) != 0) {
+		stream.release(&stream);
+		return false;
+	}
+
+	// the columns of the fields and of the geometry
+	std::vector<int64_t> col(nf, -1);
+	int64_t gcol = -1;
+	std::string gname = poLayer->GetGeometryColumn();
+	if (gname == "") gname = "wkb_geometry";
+	for (int64_t c=0; c<schema.n_children; c++) {
+		const struct ArrowSchema *cs = schema.children[c];
+		std::string name = cs->name == NULL ? "" : cs->name;
+		std::string fmt = cs->format;
+		if (cs->dictionary != NULL) continue;
+		bool isfield = false;
+		for (size_t k=0; k<nf; k++) {
+			if (name == fnames[k]) {
+				col[k] = c;
+				isfield = true;
+			}
+		}
+		if (readgeom && (!isfield) && ((fmt == "z") || (fmt == "Z"))) {
+			if ((gcol < 0) || (name == gname)) gcol = c;
+		}
+	}
+	for (size_t k=0; k<nf; k++) {
+		ok = ok && (col[k] >= 0);
+	}
+	if (readgeom) ok = ok && (gcol >= 0);
+
+	long longNA = NA<long>::value;
+	while (ok) {
+		struct ArrowArray array;
+		if (stream.get_next(&stream, &array) != 0) {
+			ok = false;
+			break;
+		}
+		if (array.release == NULL) break;
+		int64_t n = array.length;
+		for (size_t k=0; ok && (k<nf); k++) {
+			const struct ArrowArray *a = array.children[col[k]];
+			std::string fmt = schema.children[col[k]]->format;
+			int64_t off = array.offset + a->offset;
+			unsigned j = df.iplace[k];
+			if (dtype[k] == 0) {
+				ok = arrow_numbers(fmt, a, off, n, df.dv[j], (double)NAN);
+			} else if (dtype[k] == 1) {
+				ok = arrow_numbers(fmt, a, off, n, df.iv[j], longNA);
+			} else if (fmt == "u") {
+				arrow_strings<int32_t>(a, off, n, df.sv[j], df.NAS);
+			} else if (fmt == "U") {
+				arrow_strings<int64_t>(a, off, n, df.sv[j], df.NAS);
+			} else {
+				ok = false;
+			}
+		}
+		if (ok && readgeom) {
+			const struct ArrowArray *a = array.children[gcol];
+			bool large = std::string(schema.children[gcol]->format) == "Z";
+			const int32_t *o32 = (const int32_t*) a->buffers[1];
+			const int64_t *o64 = (const int64_t*) a->buffers[1];
+			const unsigned char *d = (const unsigned char*) a->buffers[2];
+			int64_t off = array.offset + a->offset;
+			for (int64_t r=0; r<n; r++) {
+				int64_t i = off + r;
+				if (!arrow_valid(a, i)) {
+					gc.add_empty();
+					continue;
+				}
+				int64_t start = large ? o64[i] : o32[i];
+				int64_t end = large ? o64[i+1] : o32[i+1];
+				if ((end <= start) || (!gc.add_wkb(d + start, end - start, hasZ, hasM))) {
+					gc.add_empty();
+					nbad++;
+				}
+			}
+		}
+		array.release(&array);
+	}
+	schema.release(&schema);
+	stream.release(&stream);
+	return ok;
+}
+
+#endif
+
 
 /*
 std::string getDs_WKT(GDALDataset *poDataset) { 
@@ -305,10 +521,25 @@ SpatGeom getMultiPolygonsGeom(OGRGeometry *poGeometry) {
 }
 
 
-bool SpatVector::read_ogr(GDALDataset *poDS) {
+bool SpatVector::read_ogr(GDALDataset *poDS, std::string layer, std::string where, std::vector<double> extent, std::vector<std::string> fields) {
+
+	OGRLayer *poLayer;
+	if (layer == "") {
+		poLayer = poDS->GetLayer(0);
+		if (poLayer == NULL) {
+			setError("the data source has no layers");
+			return false;
+		}
+	} else {
+		poLayer = poDS->GetLayerByName(layer.c_str());
+		if (poLayer == NULL) {
+			setError("layer not found: " + layer);
+			return false;
+		}
+	}
 
 	std::string crs = "";
-	OGRSpatialReference *poSRS = poDS->GetLayer(0)->GetSpatialRef();
+	OGRSpatialReference *poSRS = poLayer->GetSpatialRef();
 	if (poSRS) {
 		char *psz = NULL;
 		OGRErr err = poSRS->exportToWkt(&psz);
@@ -319,99 +550,125 @@ bool SpatVector::read_ogr(GDALDataset *poDS) {
 		CPLFree(psz);
 	}
 
-	OGRLayer *poLayer = poDS->GetLayer(0);
-	df = readAttributes(poLayer);
 	OGRwkbGeometryType wkbgeom = wkbFlatten(poLayer->GetGeomType());
-	OGRFeature *poFeature;
-	
-	poLayer->ResetReading();
-	poFeature = poLayer->GetNextFeature();
-	if (poFeature != NULL) {
-		OGRGeometry *poGeometry = poFeature->GetGeometryRef();
-		if (poGeometry != NULL) {
-			if (poGeometry->Is3D()) {
-				addWarning("Z coordinates ignored");
-			}
-			if (poGeometry->IsMeasured()) {
-				addWarning("M coordinates ignored");
-			}
-		}
-	}
-	OGRFeature::DestroyFeature( poFeature );
-	poLayer->ResetReading();
-	SpatGeom g;
-	
+	SpatGeomColumns gc;
 	if ((wkbgeom == wkbPoint) | (wkbgeom == wkbMultiPoint)) {
-		//SpatPart p(0,0);
-		while( (poFeature = poLayer->GetNextFeature()) != NULL ) {
-			OGRGeometry *poGeometry = poFeature->GetGeometryRef();
-			if (poGeometry != NULL) {				
-				if ( wkbFlatten(poGeometry->getGeometryType()) == wkbPoint ) {
-					g = getPointGeom(poGeometry);			
-				} else {
-					g = getMultiPointGeom(poGeometry);			
-				}
-			} else {
-				SpatPart p;
-				g = SpatGeom();
-				g.addPart(p);
-			}
-			addGeom(g);
-			OGRFeature::DestroyFeature( poFeature );
-		}
+		gc.gtype = points;
 	} else if (wkbgeom == wkbLineString || wkbgeom == wkbMultiLineString) {
-		while ( (poFeature = poLayer->GetNextFeature()) != NULL ) {
-			OGRGeometry *poGeometry = poFeature->GetGeometryRef();
-			if (poGeometry != NULL) {
-				if (wkbFlatten ( poGeometry ->getGeometryType() ) == wkbLineString) {
-					g = getLinesGeom(poGeometry);
-				} else {
-					g = getMultiLinesGeom(poGeometry);
-				}
-			} else {
-				SpatPart p;
-				g = SpatGeom();
-				g.addPart(p);
-			}
-			addGeom(g);
-			OGRFeature::DestroyFeature( poFeature );
-		}
+		gc.gtype = lines;
 	} else if ( wkbgeom == wkbPolygon || wkbgeom == wkbMultiPolygon) {
-		while ( (poFeature = poLayer->GetNextFeature()) != NULL ) {
-			OGRGeometry *poGeometry = poFeature->GetGeometryRef();
-			if (poGeometry != NULL) {
-				wkbgeom = wkbFlatten(poGeometry->getGeometryType());
-				if (wkbgeom == wkbPolygon) {
-					g = getPolygonsGeom(poGeometry);
-				} else if (wkbgeom == wkbMultiPolygon ) {
-					g = getMultiPolygonsGeom(poGeometry);
-				} 
-			} else {
-				g = SpatGeom();
-			}
-			addGeom(g);
-			OGRFeature::DestroyFeature( poFeature );
-		}
+		gc.gtype = polygons;
 	} else if (wkbgeom != wkbNone) {
 		const char *geomtypechar = OGRGeometryTypeToName(wkbgeom);
 		std::string strgeomtype = geomtypechar;
 		std::string s = "cannot read this geometry type: "+ strgeomtype;
 		setError(s);
-		return false;			
+		return false;
+	}
+	bool readgeom = wkbgeom != wkbNone;
+
+	// the fields to read; the driver skips the others
+	OGRFeatureDefn *poFDefn = poLayer->GetLayerDefn();
+	size_t nfields = poFDefn->GetFieldCount();
+	std::vector<int> fi;
+	if (fields.size() == 0) {
+		fi.resize(nfields);
+		std::iota(fi.begin(), fi.end(), 0);
+	} else {
+		std::vector<bool> keep(nfields, false);
+		for (size_t i=0; i<fields.size(); i++) {
+			int k = poFDefn->GetFieldIndex(fields[i].c_str());
+			if (k < 0) {
+				setError("unknown field: " + fields[i]);
+				return false;
+			}
+			if (!keep[k]) fi.push_back(k);
+			keep[k] = true;
+		}
+		// fields that may be used by the attribute filter are read, but not returned
+		std::string lwhere = where;
+		lowercase(lwhere);
+		char **papszIgnored = NULL;
+		for (size_t i=0; i<nfields; i++) {
+			if (!keep[i]) {
+				std::string fname = poFDefn->GetFieldDefn(i)->GetNameRef();
+				lowercase(fname);
+				if ((where != "") && (lwhere.find(fname) != std::string::npos)) continue;
+				papszIgnored = CSLAddString(papszIgnored, poFDefn->GetFieldDefn(i)->GetNameRef());
+			}
+		}
+		papszIgnored = CSLAddString(papszIgnored, "OGR_STYLE");
+		poLayer->SetIgnoredFields((const char**)papszIgnored);
+		CSLDestroy(papszIgnored);
+	}
+
+	// spatial and attribute filters
+	if (extent.size() == 4) {
+		poLayer->SetSpatialFilterRect(extent[0], extent[2], extent[1], extent[3]);
+	}
+	if (where != "") {
+		if (poLayer->SetAttributeFilter(where.c_str()) != OGRERR_NONE) {
+			setError("invalid attribute filter: " + where);
+			poLayer->SetSpatialFilter(NULL);
+			poLayer->SetIgnoredFields(NULL);
+			return false;
+		}
+	}
+
+	SpatDataFrame d;
+	for (size_t k=0; k<fi.size(); k++) {
+		OGRFieldDefn *poFieldDefn = poFDefn->GetFieldDefn(fi[k]);
+		d.add_column(ogr_dtype(poFieldDefn->GetType()), poFieldDefn->GetNameRef());
+	}
+	SpatGeomColumns g = gc;
+	bool hasZ = false, hasM = false;
+	size_t nbad = 0;
+	bool done = false;
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,6,0)
+	done = ogr_read_arrow(poLayer, fi, readgeom, d, g, hasZ, hasM, nbad);
+	if (!done) {
+		// start over
+		d = d.skeleton();
+		g = gc;
+		hasZ = false;
+		hasM = false;
+		nbad = 0;
+	}
+#endif
+	if (!done) {
+		ogr_read_features(poLayer, fi, readgeom, d, g, hasZ, hasM, nbad);
+	}
+
+	if (extent.size() == 4) poLayer->SetSpatialFilter(NULL);
+	if (where != "") poLayer->SetAttributeFilter(NULL);
+	if (fields.size() > 0) poLayer->SetIgnoredFields(NULL);
+
+	df = d;
+	if (readgeom) {
+		geoms.setColumns(g);
+		computeExtent();
+	}
+	if (hasZ) {
+		addWarning("Z coordinates ignored");
+	}
+	if (hasM) {
+		addWarning("M coordinates ignored");
+	}
+	if (nbad > 0) {
+		addWarning(std::to_string(nbad) + " geometries of another type, or that could not be read, are empty");
 	}
-	
  	return true;
 }
 
 
-bool SpatVector::read(std::string fname) {
+bool SpatVector::read(std::string fname, std::string layer, std::string where, std::vector<double> extent, std::vector<std::string> fields) {
     //OGRRegisterAll();
     GDALDataset *poDS = static_cast<GDALDataset*>(GDALOpenEx( fname.c_str(), GDAL_OF_VECTOR, NULL, NULL, NULL ));
     if( poDS == NULL ) {
         setError("Cannot open this file as a SpatVector");
 		return false;
     }
-	bool success = read_ogr(poDS);
+	bool success = read_ogr(poDS, layer, where, extent, fields);
 	if (poDS != NULL) GDALClose( poDS );
 	return success;
 }
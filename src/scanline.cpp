@@ -0,0 +1,402 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include "spatVector.h"
+#include "spatScanline.h"
+
+
+void sort_unique(std::vector<double> &cells) {
+	std::sort(cells.begin(), cells.end());
+	cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+}
+
+
+// the x coordinates where the edges of a ring cross the center of rows r0 to r1
+void ring_crossings(const std::vector<double> &x, const std::vector<double> &y, const SpatScanGrid &grid, long r0, long r1, std::vector<std::vector<double>> &xs) {
+	size_t n = x.size();
+	if (n < 3) return;
+	for (size_t i=0; i<n; i++) {
+		size_t j = (i+1) % n;
+		double y1 = y[i], y2 = y[j];
+		if (y1 == y2) continue;
+		double ylo = std::min(y1, y2);
+		double yhi = std::max(y1, y2);
+		// the rows that may have their center in [ylo, yhi)
+		long ra = std::max(r0, (long)std::floor((grid.ymax - yhi) / grid.yres - 0.5));
+		long rb = std::min(r1, (long)std::ceil((grid.ymax - ylo) / grid.yres - 0.5));
+		double dxdy = (x[j] - x[i]) / (y2 - y1);
+		for (long r=ra; r<=rb; r++) {
+			double yc = grid.ymax - (r + 0.5) * grid.yres;
+			if ((y1 <= yc) != (y2 <= yc)) {
+				xs[r - r0].push_back(x[i] + (yc - y1) * dxdy);
+			}
+		}
+	}
+}
+
+
+void polygon_part_cells(const SpatPart &p, const SpatScanGrid &grid, std::vector<double> &cells) {
+	if (p.y.size() < 3) return;
+	double ymin = *std::min_element(p.y.begin(), p.y.end());
+	double ymax = *std::max_element(p.y.begin(), p.y.end());
+	long r0 = std::max(0.0, std::ceil((grid.ymax - ymax) / grid.yres - 0.5));
+	long r1 = std::min((double)grid.nrow - 1, std::floor((grid.ymax - ymin) / grid.yres - 0.5));
+	if (r0 > r1) return;
+
+	std::vector<std::vector<double>> xs(r1 - r0 + 1);
+	ring_crossings(p.x, p.y, grid, r0, r1, xs);
+	for (size_t h=0; h<p.holes.size(); h++) {
+		ring_crossings(p.holes[h].x, p.holes[h].y, grid, r0, r1, xs);
+	}
+
+	double nc = grid.ncol;
+	for (long r=r0; r<=r1; r++) {
+		std::vector<double> &rx = xs[r - r0];
+		std::sort(rx.begin(), rx.end());
+		for (size_t k=1; k<rx.size(); k+=2) {
+			// the cells with their center in [rx[k-1], rx[k])
+			double ca = std::max(0.0, std::ceil((rx[k-1] - grid.xmin) / grid.xres - 0.5));
+			double cb = std::min(nc, std::ceil((rx[k] - grid.xmin) / grid.xres - 0.5));
+			for (double c=ca; c<cb; c++) {
+				cells.push_back(r * nc + c);
+			}
+		}
+	}
+}
+
+
+// the cells that the line from (x1, y1) to (x2, y2) passes through
+void segment_cells(double x1, double y1, double x2, double y2, const SpatScanGrid &grid, std::vector<double> &cells) {
+	double W = grid.ncol;
+	double H = grid.nrow;
+	double u1 = (x1 - grid.xmin) / grid.xres;
+	double v1 = (grid.ymax - y1) / grid.yres;
+	double du = (x2 - grid.xmin) / grid.xres - u1;
+	double dv = (grid.ymax - y2) / grid.yres - v1;
+
+	// clip to the grid (Liang-Barsky)
+	double t0 = 0, t1 = 1;
+	double p[4] = {-du, du, -dv, dv};
+	double q[4] = {u1, W - u1, v1, H - v1};
+	for (size_t k=0; k<4; k++) {
+		if (p[k] == 0) {
+			if (q[k] < 0) return;
+		} else {
+			double t = q[k] / p[k];
+			if (p[k] < 0) {
+				if (t > t1) return;
+				t0 = std::max(t0, t);
+			} else {
+				if (t < t0) return;
+				t1 = std::min(t1, t);
+			}
+		}
+	}
+	double au = u1 + t0 * du, av = v1 + t0 * dv;
+	double bu = u1 + t1 * du, bv = v1 + t1 * dv;
+	long nc = grid.ncol, nr = grid.nrow;
+	long c  = std::min(nc-1, std::max(0L, (long)std::floor(au)));
+	long r  = std::min(nr-1, std::max(0L, (long)std::floor(av)));
+	long ce = std::min(nc-1, std::max(0L, (long)std::floor(bu)));
+	long re = std::min(nr-1, std::max(0L, (long)std::floor(bv)));
+
+	double inf = std::numeric_limits<double>::infinity();
+	long sc = ce > c ? 1 : (ce < c ? -1 : 0);
+	long sr = re > r ? 1 : (re < r ? -1 : 0);
+	// the fraction of the (clipped) line to the next column and row boundary
+	double tmc = sc == 0 ? inf : ((sc > 0 ? c + 1 : c) - au) / (bu - au);
+	double tmr = sr == 0 ? inf : ((sr > 0 ? r + 1 : r) - av) / (bv - av);
+	double tdc = sc == 0 ? inf : 1 / std::fabs(bu - au);
+	double tdr = sr == 0 ? inf : 1 / std::fabs(bv - av);
+
+	size_t n = std::abs(ce - c) + std::abs(re - r) + 1;
+	for (size_t i=0; i<n; i++) {
+		cells.push_back(r * W + c);
+		if ((c == ce) && (r == re)) break;
+		if (((tmc < tmr) && (c != ce)) || (r == re)) {
+			c += sc;
+			tmc += tdc;
+		} else {
+			r += sr;
+			tmr += tdr;
+		}
+	}
+}
+
+
+void ring_cells(const std::vector<double> &x, const std::vector<double> &y, const SpatScanGrid &grid, bool closed, std::vector<double> &cells) {
+	size_t n = x.size();
+	if (n == 0) return;
+	if (n == 1) {
+		segment_cells(x[0], y[0], x[0], y[0], grid, cells);
+		return;
+	}
+	size_t m = closed ? n : n-1;
+	for (size_t i=0; i<m; i++) {
+		size_t j = (i+1) % n;
+		segment_cells(x[i], y[i], x[j], y[j], grid, cells);
+	}
+}
+
+
+void scan_polygon(const SpatGeom &g, const SpatScanGrid &grid, bool touches, std::vector<double> &cells) {
+	cells.resize(0);
+	for (size_t i=0; i<g.parts.size(); i++) {
+		const SpatPart &p = g.parts[i];
+		polygon_part_cells(p, grid, cells);
+		if (touches) {
+			ring_cells(p.x, p.y, grid, true, cells);
+			for (size_t h=0; h<p.holes.size(); h++) {
+				ring_cells(p.holes[h].x, p.holes[h].y, grid, true, cells);
+			}
+		}
+	}
+	sort_unique(cells);
+}
+
+
+void scan_lines(const SpatGeom &g, const SpatScanGrid &grid, std::vector<double> &cells) {
+	cells.resize(0);
+	for (size_t i=0; i<g.parts.size(); i++) {
+		ring_cells(g.parts[i].x, g.parts[i].y, grid, false, cells);
+	}
+	sort_unique(cells);
+}
+
+
+void scan_points(const SpatGeom &g, const SpatScanGrid &grid, std::vector<double> &cells) {
+	cells.resize(0);
+	double nc = grid.ncol, nr = grid.nrow;
+	for (size_t i=0; i<g.parts.size(); i++) {
+		const SpatPart &p = g.parts[i];
+		for (size_t j=0; j<p.x.size(); j++) {
+			double c = std::floor((p.x[j] - grid.xmin) / grid.xres);
+			double r = std::floor((grid.ymax - p.y[j]) / grid.yres);
+			// points on the right and bottom side of the grid are in the last column or row
+			if (c == nc) c = nc - 1;
+			if (r == nr) r = nr - 1;
+			if ((c >= 0) && (c < nc) && (r >= 0) && (r < nr)) {
+				cells.push_back(r * nc + c);
+			}
+		}
+	}
+	sort_unique(cells);
+}
+
+
+void scan_geometry(const SpatGeom &g, const SpatScanGrid &grid, bool touches, std::vector<double> &cells) {
+	if (g.gtype == polygons) {
+		scan_polygon(g, grid, touches, cells);
+	} else if (g.gtype == lines) {
+		scan_lines(g, grid, cells);
+	} else {
+		scan_points(g, grid, cells);
+	}
+}
+
+
+
+// Coverage: the signed area of the polygon is accumulated in a buffer with a
+// row for each row of cells (and two extra columns), such that the running
+// sum of the values in a row is the area of the polygon in each cell. Each
+// edge adds, for each row it crosses, the area to its left in the cells it
+// passes through, and the remainder to the next cell. See the "font-rs"
+// rasterizer by Raph Levien. "u" and "v" are column and row coordinates.
+
+void accumulate_line(double u0, double v0, double u1, double v1, double sign, std::vector<double> &a, size_t w, long r0, long nr) {
+	if (v0 == v1) return;
+	double dir = sign;
+	if (v0 > v1) {
+		dir = -sign;
+		std::swap(u0, u1);
+		std::swap(v0, v1);
+	}
+	double dudv = (u1 - u0) / (v1 - v0);
+	long ya = std::max(r0, (long)std::floor(v0));
+	long yb = std::min(r0 + nr, (long)std::ceil(v1));
+	size_t stride = w + 2;
+	for (long y=ya; y<yb; y++) {
+		double vs = std::max((double)y, v0);
+		double ve = std::min(y + 1.0, v1);
+		double dy = ve - vs;
+		if (dy <= 0) continue;
+		double x = u0 + (vs - v0) * dudv;
+		double xnext = u0 + (ve - v0) * dudv;
+		double d = dy * dir;
+		double xa = std::min(x, xnext);
+		double xb = std::max(x, xnext);
+		double xafloor = std::floor(xa);
+		long xai = xafloor;
+		long xbi = std::ceil(xb);
+		double *ar = &a[(y - r0) * stride];
+		if (xbi <= (xai + 1)) {
+			double xmf = 0.5 * (x + xnext) - xafloor;
+			ar[xai] += d - d * xmf;
+			ar[xai+1] += d * xmf;
+		} else {
+			double s = 1 / (xb - xa);
+			double xaf = xa - xafloor;
+			double a0 = 0.5 * s * (1 - xaf) * (1 - xaf);
+			double xbf = xb - xbi + 1;
+			double am = 0.5 * s * xbf * xbf;
+			ar[xai] += d * a0;
+			if (xbi == (xai + 2)) {
+				ar[xai+1] += d * (1 - a0 - am);
+			} else {
+				double a1 = s * (1.5 - xaf);
+				ar[xai+1] += d * (a1 - a0);
+				for (long xi=xai+2; xi<(xbi-1); xi++) {
+					ar[xi] += d * s;
+				}
+				double a2 = a1 + (xbi - xai - 3) * s;
+				ar[xbi-1] += d * (1 - a2 - am);
+			}
+			ar[xbi] += d * am;
+		}
+	}
+}
+
+
+// the part of an edge that is left of the buffer is moved to its left side
+// (where it adds to all cells of the row), and the part that is right of it
+// to its right side (where it is ignored)
+void accumulate_edge(double u0, double v0, double u1, double v1, double sign, std::vector<double> &a, size_t w, long r0, long nr) {
+	if (v0 == v1) return;
+	if ((std::max(v0, v1) <= r0) || (std::min(v0, v1) >= (r0 + nr))) return;
+	double W = w;
+	double t[4] = {0, 1, 1, 1};
+	size_t nt = 1;
+	if (u0 != u1) {
+		double ta = (0 - u0) / (u1 - u0);
+		double tb = (W - u0) / (u1 - u0);
+		if ((ta > 0) && (ta < 1)) t[nt++] = ta;
+		if ((tb > 0) && (tb < 1)) t[nt++] = tb;
+		std::sort(t+1, t+nt);
+	}
+	t[nt++] = 1;
+	for (size_t i=1; i<nt; i++) {
+		if (t[i] <= t[i-1]) continue;
+		double ua = u0 + t[i-1] * (u1 - u0), va = v0 + t[i-1] * (v1 - v0);
+		double ub = u0 + t[i] * (u1 - u0), vb = v0 + t[i] * (v1 - v0);
+		ua = std::min(W, std::max(0.0, ua));
+		ub = std::min(W, std::max(0.0, ub));
+		accumulate_line(ua, va, ub, vb, sign, a, w, r0, nr);
+	}
+}
+
+
+double ring_area(const std::vector<double> &x, const std::vector<double> &y) {
+	double a = 0;
+	size_t n = x.size();
+	for (size_t i=0; i<n; i++) {
+		size_t j = (i+1) % n;
+		a += x[i] * y[j] - x[j] * y[i];
+	}
+	return a / 2;
+}
+
+
+void accumulate_ring(const std::vector<double> &x, const std::vector<double> &y, bool hole, const SpatScanGrid &grid, double c0, std::vector<double> &a, size_t w, long r0, long nr) {
+	size_t n = x.size();
+	if (n < 3) return;
+	// outer rings add, and holes subtract, whatever the order of their nodes
+	double sign = ring_area(x, y) > 0 ? 1 : -1;
+	if (hole) sign = -sign;
+	for (size_t i=0; i<n; i++) {
+		size_t j = (i+1) % n;
+		double u0 = (x[i] - grid.xmin) / grid.xres - c0;
+		double u1 = (x[j] - grid.xmin) / grid.xres - c0;
+		double v0 = (grid.ymax - y[i]) / grid.yres;
+		double v1 = (grid.ymax - y[j]) / grid.yres;
+		accumulate_edge(u0, v0, u1, v1, sign, a, w, r0, nr);
+	}
+}
+
+
+void scan_coverage(const SpatGeom &g, const SpatScanGrid &grid, std::vector<double> &cells, std::vector<double> &fraction) {
+
+	cells.resize(0);
+	fraction.resize(0);
+	if (g.gtype != polygons) return;
+
+	double xmin = std::numeric_limits<double>::infinity();
+	double xmax = -xmin, ymin = xmin, ymax = -xmin;
+	for (size_t i=0; i<g.parts.size(); i++) {
+		const SpatPart &p = g.parts[i];
+		if (p.x.size() < 3) continue;
+		xmin = std::min(xmin, *std::min_element(p.x.begin(), p.x.end()));
+		xmax = std::max(xmax, *std::max_element(p.x.begin(), p.x.end()));
+		ymin = std::min(ymin, *std::min_element(p.y.begin(), p.y.end()));
+		ymax = std::max(ymax, *std::max_element(p.y.begin(), p.y.end()));
+	}
+	if (xmin > xmax) return;
+
+	// the rows and columns of the grid that the polygon may cover
+	double nc = grid.ncol;
+	long c0 = std::max(0.0, std::floor((xmin - grid.xmin) / grid.xres));
+	long c1 = std::min(nc, std::ceil((xmax - grid.xmin) / grid.xres));
+	long ra = std::max(0.0, std::floor((grid.ymax - ymax) / grid.yres));
+	long rb = std::min((double)grid.nrow, std::ceil((grid.ymax - ymin) / grid.yres));
+	if ((c0 >= c1) || (ra >= rb)) return;
+	size_t w = c1 - c0;
+
+	// rows of cells are done in bands to limit the size of the buffer
+	long bandrows = std::max(1L, (long)(4000000 / (w + 2)));
+	std::vector<double> a;
+	for (long r0=ra; r0<rb; r0+=bandrows) {
+		long nr = std::min(bandrows, rb - r0);
+		a.resize(0);
+		a.resize(nr * (w + 2), 0);
+		for (size_t i=0; i<g.parts.size(); i++) {
+			const SpatPart &p = g.parts[i];
+			accumulate_ring(p.x, p.y, false, grid, c0, a, w, r0, nr);
+			for (size_t h=0; h<p.holes.size(); h++) {
+				accumulate_ring(p.holes[h].x, p.holes[h].y, true, grid, c0, a, w, r0, nr);
+			}
+		}
+		for (long r=0; r<nr; r++) {
+			double acc = 0;
+			const double *ar = &a[r * (w + 2)];
+			for (size_t c=0; c<w; c++) {
+				acc += ar[c];
+				double f = std::min(1.0, std::fabs(acc));
+				if (f > 1e-9) {
+					cells.push_back((r0 + r) * nc + c0 + c);
+					fraction.push_back(f);
+				}
+			}
+		}
+	}
+}
+
+
+SpatRTree scan_index(SpatVector &v) {
+	size_t n = v.size();
+	std::vector<double> xmin(n), xmax(n), ymin(n), ymax(n);
+	for (size_t i=0; i<n; i++) {
+		// does not unpack the geometries
+		SpatExtent e = v.geoms.extent(i);
+		xmin[i] = e.xmin;
+		xmax[i] = e.xmax;
+		ymin[i] = e.ymin;
+		ymax[i] = e.ymax;
+	}
+	return SpatRTree(xmin, xmax, ymin, ymax);
+}
@@ -0,0 +1,561 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <cstdio>
+#include <iomanip>
+#include "spatRaster.h"
+#include "spatScratch.h"
+#include "spatBlock.h"
+#include "spatSIMD.h"
+#include "file_utils.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+SpatScratch::~SpatScratch() {
+#ifndef _WIN32
+	if (data != NULL) {
+		munmap(data, nbytes);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+#endif
+	if (fs.is_open()) {
+		fs.close();
+	}
+	if (filename != "") {
+		remove(filename.c_str());
+		remove(hdrfile.c_str());
+		std::string aux = filename + ".aux.xml";
+		remove(aux.c_str());
+	}
+}
+
+
+bool SpatScratch::create(std::string fname, size_t nr, size_t nc, size_t nl, std::string dtype, std::string &msg) {
+	if (!is_native_datatype(dtype)) {
+		msg = "invalid datatype for a scratch file: " + dtype;
+		return false;
+	}
+	nrow = nr;
+	ncol = nc;
+	nlyr = nl;
+	datatype = dtype;
+	elsize = native_datatype_size(dtype);
+	nbytes = nrow * ncol * nlyr * elsize;
+	if (nbytes == 0) {
+		msg = "cannot create an empty scratch file";
+		return false;
+	}
+	hdrfile = fname.substr(0, fname.find_last_of('.')) + ".hdr";
+
+#ifndef _WIN32
+	fd = open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		msg = "cannot create scratch file";
+		return false;
+	}
+	filename = fname;
+	if (ftruncate(fd, nbytes) != 0) {
+		msg = "insufficient disk space for a scratch file";
+		return false;
+	}
+	void *p = mmap(NULL, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p != MAP_FAILED) {
+		data = (char *) p;
+		return true;
+	}
+	// cannot map (e.g. not enough address space); use the file
+	close(fd);
+	fd = -1;
+#endif
+
+	fs.open(fname, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!fs.is_open()) {
+		msg = "cannot create scratch file";
+		return false;
+	}
+	filename = fname;
+	fs.seekp(nbytes - 1);
+	fs.put(0);
+	if (!fs.good()) {
+		msg = "insufficient disk space for a scratch file";
+		return false;
+	}
+	return true;
+}
+
+
+bool SpatScratch::get(char *dst, size_t offset, size_t n) {
+	if (data != NULL) {
+		std::memcpy(dst, data + offset, n);
+		return true;
+	}
+	std::lock_guard<std::mutex> lock(fsmutex);
+	fs.seekg(offset);
+	fs.read(dst, n);
+	return fs.good();
+}
+
+
+bool SpatScratch::put(const char *src, size_t offset, size_t n) {
+	if (data != NULL) {
+		std::memcpy(data + offset, src, n);
+		return true;
+	}
+	std::lock_guard<std::mutex> lock(fsmutex);
+	fs.seekp(offset);
+	fs.write(src, n);
+	return fs.good();
+}
+
+
+template <typename T>
+bool SpatScratch::write_type(const std::vector<double> &v, size_t row, size_t nrows, size_t col, size_t ncols) {
+	// rows are contiguous in the file if they are complete
+	bool whole = (col == 0) && (ncols == ncol);
+	size_t n = whole ? nrows * ncols : ncols;
+	size_t nchunks = whole ? 1 : nrows;
+	size_t ncell = nrows * ncols;
+	const double mn = SpatType<T>::lowest();
+	const double mx = SpatType<T>::highest();
+	const T na = SpatType<T>::na();
+	std::vector<T> buf(n);
+	for (size_t lyr=0; lyr<nlyr; lyr++) {
+		for (size_t i=0; i<nchunks; i++) {
+			const double *d = v.data() + lyr * ncell + i * n;
+			for (size_t j=0; j<n; j++) {
+				buf[j] = std::isnan(d[j]) ? na : (d[j] < mn ? na : (d[j] > mx ? na : (T) d[j]));
+			}
+			size_t offset = ((lyr * nrow + row + i) * ncol + col) * sizeof(T);
+			if (!put((const char *) buf.data(), offset, n * sizeof(T))) return false;
+		}
+	}
+	return true;
+}
+
+template <>
+bool SpatScratch::write_type<double>(const std::vector<double> &v, size_t row, size_t nrows, size_t col, size_t ncols) {
+	bool whole = (col == 0) && (ncols == ncol);
+	size_t n = whole ? nrows * ncols : ncols;
+	size_t nchunks = whole ? 1 : nrows;
+	size_t ncell = nrows * ncols;
+	for (size_t lyr=0; lyr<nlyr; lyr++) {
+		for (size_t i=0; i<nchunks; i++) {
+			size_t offset = ((lyr * nrow + row + i) * ncol + col) * sizeof(double);
+			if (!put((const char *) (v.data() + lyr * ncell + i * n), offset, n * sizeof(double))) return false;
+		}
+	}
+	return true;
+}
+
+
+bool SpatScratch::write(const std::vector<double> &v, size_t row, size_t nrows, size_t col, size_t ncols) {
+	if ((v.size() != (nrows * ncols * nlyr)) || ((row + nrows) > nrow) || ((col + ncols) > ncol)) {
+		return false;
+	}
+	if (datatype == "FLT8S") {
+		return write_type<double>(v, row, nrows, col, ncols);
+	} else if (datatype == "FLT4S") {
+		return write_type<float>(v, row, nrows, col, ncols);
+	} else if (datatype == "INT4S") {
+		return write_type<int32_t>(v, row, nrows, col, ncols);
+	} else if (datatype == "INT4U") {
+		return write_type<uint32_t>(v, row, nrows, col, ncols);
+	} else if (datatype == "INT2S") {
+		return write_type<int16_t>(v, row, nrows, col, ncols);
+	} else if (datatype == "INT2U") {
+		return write_type<uint16_t>(v, row, nrows, col, ncols);
+	} else if (datatype == "INT1U") {
+		return write_type<uint8_t>(v, row, nrows, col, ncols);
+	}
+	return false;
+}
+
+
+bool SpatScratch::fill(double x) {
+	std::vector<double> v(ncol * nlyr, x);
+	// one row at a time, for all layers
+	for (size_t r=0; r<nrow; r++) {
+		if (!write(v, r, 1, 0, ncol)) return false;
+	}
+	return true;
+}
+
+
+template <typename T>
+bool SpatScratch::read_type(std::vector<T> &out, size_t row, size_t nrows, size_t col, size_t ncols, const std::vector<unsigned> &layers) {
+	bool whole = (col == 0) && (ncols == ncol);
+	size_t n = whole ? nrows * ncols : ncols;
+	size_t nchunks = whole ? 1 : nrows;
+	size_t start = out.size();
+	out.resize(start + nrows * ncols * layers.size());
+	char *dst = (char *) (out.data() + start);
+	for (size_t i=0; i<layers.size(); i++) {
+		for (size_t j=0; j<nchunks; j++) {
+			size_t offset = ((layers[i] * nrow + row + j) * ncol + col) * sizeof(T);
+			if (!get(dst, offset, n * sizeof(T))) return false;
+			dst += n * sizeof(T);
+		}
+	}
+	return true;
+}
+
+
+template <typename T>
+bool scratch_to_double(SpatScratch *s, std::vector<double> &out, size_t row, size_t nrows, size_t col, size_t ncols, const std::vector<unsigned> &layers) {
+	std::vector<T> v;
+	if (!s->read_native(v, row, nrows, col, ncols, layers)) return false;
+	size_t start = out.size();
+	size_t n = v.size();
+	out.resize(start + n);
+	for (size_t i=0; i<n; i++) {
+		out[start+i] = SpatType<T>::isna(v[i]) ? NAN : (double) v[i];
+	}
+	return true;
+}
+
+
+bool SpatScratch::read(std::vector<double> &out, size_t row, size_t nrows, size_t col, size_t ncols, const std::vector<unsigned> &layers) {
+	if (datatype == "FLT8S") {
+		return read_type<double>(out, row, nrows, col, ncols, layers);
+	} else if (datatype == "FLT4S") {
+		return scratch_to_double<float>(this, out, row, nrows, col, ncols, layers);
+	} else if (datatype == "INT4S") {
+		return scratch_to_double<int32_t>(this, out, row, nrows, col, ncols, layers);
+	} else if (datatype == "INT4U") {
+		return scratch_to_double<uint32_t>(this, out, row, nrows, col, ncols, layers);
+	} else if (datatype == "INT2S") {
+		return scratch_to_double<int16_t>(this, out, row, nrows, col, ncols, layers);
+	} else if (datatype == "INT2U") {
+		return scratch_to_double<uint16_t>(this, out, row, nrows, col, ncols, layers);
+	} else if (datatype == "INT1U") {
+		return scratch_to_double<uint8_t>(this, out, row, nrows, col, ncols, layers);
+	}
+	return false;
+}
+
+
+template <typename T>
+bool SpatScratch::read_native(std::vector<T> &out, size_t row, size_t nrows, size_t col, size_t ncols, const std::vector<unsigned> &layers) {
+	if (SpatType<T>::name() == datatype) {
+		return read_type<T>(out, row, nrows, col, ncols, layers);
+	}
+	std::vector<double> d;
+	if (!read(d, row, nrows, col, ncols, layers)) return false;
+	std::vector<T> v;
+	double_to_native(d, v);
+	out.insert(out.end(), v.begin(), v.end());
+	return true;
+}
+
+template bool SpatScratch::read_native(std::vector<uint8_t> &, size_t, size_t, size_t, size_t, const std::vector<unsigned> &);
+template bool SpatScratch::read_native(std::vector<int16_t> &, size_t, size_t, size_t, size_t, const std::vector<unsigned> &);
+template bool SpatScratch::read_native(std::vector<uint16_t> &, size_t, size_t, size_t, size_t, const std::vector<unsigned> &);
+template bool SpatScratch::read_native(std::vector<int32_t> &, size_t, size_t, size_t, size_t, const std::vector<unsigned> &);
+template bool SpatScratch::read_native(std::vector<uint32_t> &, size_t, size_t, size_t, size_t, const std::vector<unsigned> &);
+template bool SpatScratch::read_native(std::vector<float> &, size_t, size_t, size_t, size_t, const std::vector<unsigned> &);
+template bool SpatScratch::read_native(std::vector<double> &, size_t, size_t, size_t, size_t, const std::vector<unsigned> &);
+
+
+template <typename T>
+bool SpatScratch::read_cells_type(const std::vector<long long> &rows, const std::vector<long long> &cols, const std::vector<unsigned> &layers, std::vector<double> &out) {
+	size_t n = rows.size();
+	size_t start = out.size();
+	out.resize(start + n * layers.size(), NAN);
+	long long nr = nrow;
+	long long nc = ncol;
+	T v;
+	for (size_t i=0; i<layers.size(); i++) {
+		size_t off = start + i * n;
+		for (size_t j=0; j<n; j++) {
+			if ((rows[j] < 0) || (rows[j] >= nr) || (cols[j] < 0) || (cols[j] >= nc)) continue;
+			size_t offset = ((layers[i] * nrow + rows[j]) * ncol + cols[j]) * sizeof(T);
+			if (!get((char *) &v, offset, sizeof(T))) return false;
+			if (!SpatType<T>::isna(v)) out[off+j] = v;
+		}
+	}
+	return true;
+}
+
+
+bool SpatScratch::read_cells(const std::vector<long long> &rows, const std::vector<long long> &cols, const std::vector<unsigned> &layers, std::vector<double> &out) {
+	if (rows.size() != cols.size()) return false;
+	if (datatype == "FLT8S") {
+		return read_cells_type<double>(rows, cols, layers, out);
+	} else if (datatype == "FLT4S") {
+		return read_cells_type<float>(rows, cols, layers, out);
+	} else if (datatype == "INT4S") {
+		return read_cells_type<int32_t>(rows, cols, layers, out);
+	} else if (datatype == "INT4U") {
+		return read_cells_type<uint32_t>(rows, cols, layers, out);
+	} else if (datatype == "INT2S") {
+		return read_cells_type<int16_t>(rows, cols, layers, out);
+	} else if (datatype == "INT2U") {
+		return read_cells_type<uint16_t>(rows, cols, layers, out);
+	} else if (datatype == "INT1U") {
+		return read_cells_type<uint8_t>(rows, cols, layers, out);
+	}
+	return false;
+}
+
+
+// ENVI header
+bool SpatScratch::finish(const std::vector<std::string> &names, double xmin, double ymax, double xres, double yres, const std::string &wkt, std::string &msg) {
+
+#ifndef _WIN32
+	if (data != NULL) {
+		msync(data, nbytes, MS_ASYNC);
+	}
+#endif
+	if (fs.is_open()) {
+		std::lock_guard<std::mutex> lock(fsmutex);
+		fs.flush();
+	}
+
+	int envitype = 5;
+	if (datatype == "FLT4S") {
+		envitype = 4;
+	} else if (datatype == "INT4S") {
+		envitype = 3;
+	} else if (datatype == "INT4U") {
+		envitype = 13;
+	} else if (datatype == "INT2S") {
+		envitype = 2;
+	} else if (datatype == "INT2U") {
+		envitype = 12;
+	} else if (datatype == "INT1U") {
+		envitype = 1;
+	}
+	uint16_t one = 1;
+	int byteorder = (*(char *) &one == 1) ? 0 : 1;
+
+	std::ofstream f(hdrfile, std::ios::out | std::ios::trunc);
+	if (!f.is_open()) {
+		msg = "cannot write scratch header";
+		return false;
+	}
+	f << std::setprecision(15);
+	f << "ENVI" << std::endl;
+	f << "description = {terra scratch file}" << std::endl;
+	f << "samples = " << ncol << std::endl;
+	f << "lines = " << nrow << std::endl;
+	f << "bands = " << nlyr << std::endl;
+	f << "header offset = 0" << std::endl;
+	f << "file type = ENVI Standard" << std::endl;
+	f << "data type = " << envitype << std::endl;
+	f << "interleave = bsq" << std::endl;
+	f << "byte order = " << byteorder << std::endl;
+	f << "map info = {Arbitrary, 1, 1, " << xmin << ", " << ymax << ", " << xres << ", " << yres << "}" << std::endl;
+	if (wkt != "") {
+		f << "coordinate system string = {" << wkt << "}" << std::endl;
+	}
+	// also for FLT types, such that GDAL reports NAN as the NA flag
+	if (datatype.substr(0, 3) == "INT") {
+		double na = 0;
+		if (datatype == "INT4S") {
+			na = SpatType<int32_t>::na();
+		} else if (datatype == "INT4U") {
+			na = SpatType<uint32_t>::na();
+		} else if (datatype == "INT2S") {
+			na = SpatType<int16_t>::na();
+		} else if (datatype == "INT2U") {
+			na = SpatType<uint16_t>::na();
+		} else {
+			na = SpatType<uint8_t>::na();
+		}
+		f << "data ignore value = " << na << std::endl;
+	} else {
+		f << "data ignore value = nan" << std::endl;
+	}
+	if (names.size() == nlyr) {
+		f << "band names = {";
+		for (size_t i=0; i<nlyr; i++) {
+			std::string nm = names[i];
+			std::replace(nm.begin(), nm.end(), ',', ' ');
+			std::replace(nm.begin(), nm.end(), '}', ' ');
+			f << nm << ((i+1) < nlyr ? ", " : "}");
+		}
+		f << std::endl;
+	}
+	f.close();
+	if (f.fail()) {
+		msg = "cannot write scratch header";
+		return false;
+	}
+	return true;
+}
+
+
+
+bool SpatRaster::writeStartScratch(SpatOptions &opt, std::string filename) {
+	std::string datatype = opt.get_datatype();
+	if (!is_native_datatype(datatype)) {
+		datatype = "FLT4S";
+	}
+	std::shared_ptr<SpatScratch> s = std::make_shared<SpatScratch>();
+	std::string msg;
+	if (!s->create(filename, nrow(), ncol(), nlyr(), datatype, msg)) {
+		setError(msg);
+		return false;
+	}
+	source[0].resize(nlyr());
+	source[0].nlyrfile = nlyr();
+	source[0].datatype = datatype;
+	for (size_t i =0; i<nlyr(); i++) {
+		source[0].range_min[i] = NAN;
+		source[0].range_max[i] = NAN;
+	}
+	source[0].driver = "scratch";
+	source[0].filename = filename;
+	source[0].memory = false;
+	source[0].scratch = s;
+	return true;
+}
+
+
+bool SpatRaster::writeValuesScratch(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols) {
+	double vmin, vmax;
+	size_t nc = nrows * ncols;
+	size_t nl = nlyr();
+	if (vals.size() != (nc * nl)) {
+		setError("incorrect number of values");
+		return false;
+	}
+	std::string datatype = source[0].datatype;
+	for (size_t i=0; i < nl; i++) {
+		size_t start = nc * i;
+		if (datatype == "INT4S") {
+			simd_minmax(vals.data()+start, nc, vmin, vmax, (double)INT32_MIN, (double)INT32_MAX);
+		} else if (datatype == "INT2S") {
+			simd_minmax(vals.data()+start, nc, vmin, vmax, (double)INT16_MIN, (double)INT16_MAX);
+		} else if (datatype == "INT4U") {
+			simd_minmax(vals.data()+start, nc, vmin, vmax, 0.0, (double)UINT32_MAX);
+		} else if (datatype == "INT2U") {
+			simd_minmax(vals.data()+start, nc, vmin, vmax, 0.0, (double)UINT16_MAX);
+		} else if (datatype == "INT1U") {
+			simd_minmax(vals.data()+start, nc, vmin, vmax, 0.0, 255.0);
+		} else {
+			simd_minmax(vals.data()+start, nc, vmin, vmax);
+		}
+		if (!std::isnan(vmin)) {
+			if (std::isnan(source[0].range_min[i])) {
+				source[0].range_min[i] = vmin;
+				source[0].range_max[i] = vmax;
+			} else {
+				source[0].range_min[i] = std::min(source[0].range_min[i], vmin);
+				source[0].range_max[i] = std::max(source[0].range_max[i], vmax);
+			}
+		}
+	}
+	if (!source[0].scratch->write(vals, startrow, nrows, startcol, ncols)) {
+		setError("cannot write values to scratch file");
+		return false;
+	}
+	return true;
+}
+
+
+bool SpatRaster::writeStopScratch() {
+	std::string msg;
+	SpatExtent e = getExtent();
+	if (!source[0].scratch->finish(getNames(), e.xmin, e.ymax, xres(), yres(), source[0].srs.wkt, msg)) {
+		setError(msg);
+		return false;
+	}
+	source[0].hasRange = std::vector<bool>(nlyr(), true);
+	if (source[0].datatype.substr(0,3) == "INT") {
+		for (size_t i=0; i<nlyr(); i++) {
+			source[0].range_min[i] = trunc(source[0].range_min[i]);
+			source[0].range_max[i] = trunc(source[0].range_max[i]);
+		}
+	}
+	source[0].hasValues = true;
+	return true;
+}
+
+
+template <typename T>
+void SpatRaster::readChunkScratchNative(std::vector<T> &data, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols) {
+	if (source[src].hasWindow) {
+		row = row + source[src].window.off_row;
+		col = col + source[src].window.off_col;
+	}
+	size_t start = data.size();
+	if (!source[src].scratch->read_native(data, row, nrows, col, ncols, source[src].layers)) {
+		setError("cannot read values from scratch file");
+		return;
+	}
+	if (source[src].hasNAflag) {
+		native_set_NA(data, start, data.size(), source[src].NAflag);
+	}
+}
+
+void SpatRaster::readChunkScratch(std::vector<double> &data, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols) {
+	if (source[src].hasWindow) {
+		row = row + source[src].window.off_row;
+		col = col + source[src].window.off_col;
+	}
+	size_t start = data.size();
+	if (!source[src].scratch->read(data, row, nrows, col, ncols, source[src].layers)) {
+		setError("cannot read values from scratch file");
+		return;
+	}
+	// the NA flag is a stored value, before scale and offset
+	if (source[src].hasNAflag) {
+		simd_set_na(data.data() + start, data.size() - start, source[src].NAflag, false);
+	}
+	size_t ncell = nrows * ncols;
+	for (size_t i=0; i<source[src].has_scale_offset.size(); i++) {
+		if (source[src].has_scale_offset[i]) {
+			simd_scale_offset(data.data() + start + i * ncell, ncell, source[src].scale[i], source[src].offset[i]);
+		}
+	}
+}
+
+bool SpatRaster::readRowColScratch(unsigned src, const std::vector<int_64> &rows, const std::vector<int_64> &cols, std::vector<double> &out) {
+	size_t start = out.size();
+	if (!source[src].scratch->read_cells(rows, cols, source[src].layers, out)) {
+		setError("cannot read values from scratch file");
+		return false;
+	}
+	if (source[src].hasNAflag) {
+		simd_set_na(out.data() + start, out.size() - start, source[src].NAflag, false);
+	}
+	size_t n = rows.size();
+	for (size_t i=0; i<source[src].has_scale_offset.size(); i++) {
+		if (source[src].has_scale_offset[i]) {
+			simd_scale_offset(out.data() + start + i * n, n, source[src].scale[i], source[src].offset[i]);
+		}
+	}
+	return true;
+}
+
+
+template void SpatRaster::readChunkScratchNative(std::vector<uint8_t> &, unsigned, size_t, size_t, size_t, size_t);
+template void SpatRaster::readChunkScratchNative(std::vector<int16_t> &, unsigned, size_t, size_t, size_t, size_t);
+template void SpatRaster::readChunkScratchNative(std::vector<uint16_t> &, unsigned, size_t, size_t, size_t, size_t);
+template void SpatRaster::readChunkScratchNative(std::vector<int32_t> &, unsigned, size_t, size_t, size_t, size_t);
+template void SpatRaster::readChunkScratchNative(std::vector<uint32_t> &, unsigned, size_t, size_t, size_t, size_t);
+template void SpatRaster::readChunkScratchNative(std::vector<float> &, unsigned, size_t, size_t, size_t, size_t);
+template void SpatRaster::readChunkScratchNative(std::vector<double> &, unsigned, size_t, size_t, size_t, size_t);
@@ -0,0 +1,427 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatSIMD.h"
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+
+// The AVX2 and AVX-512 kernels are compiled with a "target" attribute, such
+// that the package can be compiled without -mavx2 and still run anywhere.
+// Not on Windows, where gcc does not align the stack for AVX registers.
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(_WIN32) && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 6)))
+#define SPAT_SIMD_X86
+#include <immintrin.h>
+#define SPAT_TARGET(x) __attribute__((target(x)))
+#endif
+
+
+// 0: scalar, 1: AVX2, 2: AVX-512
+static int detect_simd() {
+#ifdef SPAT_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return 2;
+	if (__builtin_cpu_supports("avx2")) return 1;
+#endif
+	return 0;
+}
+
+static int cpu_level() {
+	static const int level = detect_simd();
+	return level;
+}
+
+std::string simd_level() {
+	int level = cpu_level();
+	if (level == 2) return "AVX-512";
+	if (level == 1) return "AVX2";
+	return "scalar";
+}
+
+
+int simd_cmp_code(const std::string &oper) {
+	if (oper == "==") return SIMD_EQ;
+	if (oper == "!=") return SIMD_NE;
+	if (oper == ">") return SIMD_GT;
+	if (oper == "<") return SIMD_LT;
+	if (oper == ">=") return SIMD_GE;
+	if (oper == "<=") return SIMD_LE;
+	return -1;
+}
+
+
+template <int op>
+inline double cmp1(const double &a, const double &b) {
+	if (std::isnan(a) || std::isnan(b)) return NAN;
+	switch (op) {
+		case SIMD_EQ: return a == b;
+		case SIMD_NE: return a != b;
+		case SIMD_GT: return a > b;
+		case SIMD_LT: return a < b;
+		case SIMD_GE: return a >= b;
+		default: return a <= b;
+	}
+}
+
+
+#ifdef SPAT_SIMD_X86
+
+// ordered predicates; unordered (NAN) is dealt with separately
+// (an enum, not a function, such that it is an immediate also without optimization)
+template <int op> struct CmpPred { enum { value = _CMP_LE_OQ }; };
+template <> struct CmpPred<SIMD_EQ> { enum { value = _CMP_EQ_OQ }; };
+template <> struct CmpPred<SIMD_NE> { enum { value = _CMP_NEQ_OQ }; };
+template <> struct CmpPred<SIMD_GT> { enum { value = _CMP_GT_OQ }; };
+template <> struct CmpPred<SIMD_LT> { enum { value = _CMP_LT_OQ }; };
+template <> struct CmpPred<SIMD_GE> { enum { value = _CMP_GE_OQ }; };
+
+// the kernels return the number of cells done; the caller does the rest
+
+template <int op>
+SPAT_TARGET("avx2")
+size_t cmp_avx2(double *a, const double *b, bool vec, size_t n) {
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d na = _mm256_set1_pd(NAN);
+	__m256d y = vec ? _mm256_setzero_pd() : _mm256_set1_pd(*b);
+	size_t i = 0;
+	for (; (i+4) <= n; i+=4) {
+		__m256d x = _mm256_loadu_pd(a+i);
+		if (vec) y = _mm256_loadu_pd(b+i);
+		__m256d r = _mm256_and_pd(_mm256_cmp_pd(x, y, CmpPred<op>::value), one);
+		r = _mm256_blendv_pd(r, na, _mm256_cmp_pd(x, y, _CMP_UNORD_Q));
+		_mm256_storeu_pd(a+i, r);
+	}
+	return i;
+}
+
+template <int op>
+SPAT_TARGET("avx512f")
+size_t cmp_avx512(double *a, const double *b, bool vec, size_t n) {
+	const __m512d one = _mm512_set1_pd(1.0);
+	const __m512d na = _mm512_set1_pd(NAN);
+	__m512d y = vec ? _mm512_setzero_pd() : _mm512_set1_pd(*b);
+	size_t i = 0;
+	for (; (i+8) <= n; i+=8) {
+		__m512d x = _mm512_loadu_pd(a+i);
+		if (vec) y = _mm512_loadu_pd(b+i);
+		__mmask8 m = _mm512_cmp_pd_mask(x, y, CmpPred<op>::value);
+		__mmask8 u = _mm512_cmp_pd_mask(x, y, _CMP_UNORD_Q);
+		__m512d r = _mm512_maskz_mov_pd(m, one);
+		r = _mm512_mask_mov_pd(r, u, na);
+		_mm512_storeu_pd(a+i, r);
+	}
+	return i;
+}
+
+template <bool below>
+SPAT_TARGET("avx2")
+size_t setna_avx2(double *a, size_t n, double flag) {
+	const __m256d f = _mm256_set1_pd(flag);
+	const __m256d na = _mm256_set1_pd(NAN);
+	size_t i = 0;
+	for (; (i+4) <= n; i+=4) {
+		__m256d x = _mm256_loadu_pd(a+i);
+		__m256d m = below ? _mm256_cmp_pd(x, f, _CMP_LT_OQ) : _mm256_cmp_pd(x, f, _CMP_EQ_OQ);
+		_mm256_storeu_pd(a+i, _mm256_blendv_pd(x, na, m));
+	}
+	return i;
+}
+
+template <bool below>
+SPAT_TARGET("avx512f")
+size_t setna_avx512(double *a, size_t n, double flag) {
+	const __m512d f = _mm512_set1_pd(flag);
+	const __m512d na = _mm512_set1_pd(NAN);
+	size_t i = 0;
+	for (; (i+8) <= n; i+=8) {
+		__m512d x = _mm512_loadu_pd(a+i);
+		__mmask8 m = below ? _mm512_cmp_pd_mask(x, f, _CMP_LT_OQ) : _mm512_cmp_pd_mask(x, f, _CMP_EQ_OQ);
+		_mm512_storeu_pd(a+i, _mm512_mask_mov_pd(x, m, na));
+	}
+	return i;
+}
+
+// multiply and add separately (no FMA) to get the same result as the scalar loop
+SPAT_TARGET("avx2")
+size_t scaleoff_avx2(double *a, size_t n, double scale, double offset) {
+	const __m256d s = _mm256_set1_pd(scale);
+	const __m256d o = _mm256_set1_pd(offset);
+	size_t i = 0;
+	for (; (i+4) <= n; i+=4) {
+		__m256d x = _mm256_mul_pd(_mm256_loadu_pd(a+i), s);
+		_mm256_storeu_pd(a+i, _mm256_add_pd(x, o));
+	}
+	return i;
+}
+
+SPAT_TARGET("avx512f")
+size_t scaleoff_avx512(double *a, size_t n, double scale, double offset) {
+	const __m512d s = _mm512_set1_pd(scale);
+	const __m512d o = _mm512_set1_pd(offset);
+	size_t i = 0;
+	for (; (i+8) <= n; i+=8) {
+		__m512d x = _mm512_mul_pd(_mm512_loadu_pd(a+i), s);
+		_mm512_storeu_pd(a+i, _mm512_add_pd(x, o));
+	}
+	return i;
+}
+
+SPAT_TARGET("avx2")
+size_t minmax_avx2(const double *a, size_t n, double lmin, double lmax, double &vmin, double &vmax, bool &found) {
+	const __m256d lo = _mm256_set1_pd(lmin);
+	const __m256d hi = _mm256_set1_pd(lmax);
+	const __m256d pinf = _mm256_set1_pd(INFINITY);
+	const __m256d ninf = _mm256_set1_pd(-INFINITY);
+	__m256d mn = pinf;
+	__m256d mx = ninf;
+	__m256d any = _mm256_setzero_pd();
+	size_t i = 0;
+	for (; (i+4) <= n; i+=4) {
+		__m256d x = _mm256_loadu_pd(a+i);
+		// false for NAN
+		__m256d m = _mm256_and_pd(_mm256_cmp_pd(x, lo, _CMP_GE_OQ), _mm256_cmp_pd(x, hi, _CMP_LE_OQ));
+		mn = _mm256_min_pd(mn, _mm256_blendv_pd(pinf, x, m));
+		mx = _mm256_max_pd(mx, _mm256_blendv_pd(ninf, x, m));
+		any = _mm256_or_pd(any, m);
+	}
+	if (_mm256_movemask_pd(any) != 0) {
+		double tmn[4], tmx[4];
+		_mm256_storeu_pd(tmn, mn);
+		_mm256_storeu_pd(tmx, mx);
+		for (size_t j=0; j<4; j++) {
+			vmin = std::min(vmin, tmn[j]);
+			vmax = std::max(vmax, tmx[j]);
+		}
+		found = true;
+	}
+	return i;
+}
+
+SPAT_TARGET("avx512f")
+size_t minmax_avx512(const double *a, size_t n, double lmin, double lmax, double &vmin, double &vmax, bool &found) {
+	const __m512d lo = _mm512_set1_pd(lmin);
+	const __m512d hi = _mm512_set1_pd(lmax);
+	__m512d mn = _mm512_set1_pd(INFINITY);
+	__m512d mx = _mm512_set1_pd(-INFINITY);
+	__mmask8 any = 0;
+	size_t i = 0;
+	for (; (i+8) <= n; i+=8) {
+		__m512d x = _mm512_loadu_pd(a+i);
+		__mmask8 m = _mm512_cmp_pd_mask(x, lo, _CMP_GE_OQ) & _mm512_cmp_pd_mask(x, hi, _CMP_LE_OQ);
+		mn = _mm512_mask_min_pd(mn, m, mn, x);
+		mx = _mm512_mask_max_pd(mx, m, mx, x);
+		any |= m;
+	}
+	if (any != 0) {
+		double tmn[8], tmx[8];
+		_mm512_storeu_pd(tmn, mn);
+		_mm512_storeu_pd(tmx, mx);
+		for (size_t j=0; j<8; j++) {
+			vmin = std::min(vmin, tmn[j]);
+			vmax = std::max(vmax, tmx[j]);
+		}
+		found = true;
+	}
+	return i;
+}
+
+#endif
+
+
+template <int op>
+void compare_level(double *a, const double *b, bool vec, size_t n, int level) {
+	size_t i = 0;
+#ifdef SPAT_SIMD_X86
+	if (level == 2) {
+		i = cmp_avx512<op>(a, b, vec, n);
+	} else if (level == 1) {
+		i = cmp_avx2<op>(a, b, vec, n);
+	}
+#endif
+	if (vec) {
+		for (; i<n; i++) a[i] = cmp1<op>(a[i], b[i]);
+	} else {
+		const double y = *b;
+		for (; i<n; i++) a[i] = cmp1<op>(a[i], y);
+	}
+}
+
+static void compare_level(double *a, const double *b, bool vec, size_t n, int op, int level) {
+	switch (op) {
+		case SIMD_EQ: compare_level<SIMD_EQ>(a, b, vec, n, level); break;
+		case SIMD_NE: compare_level<SIMD_NE>(a, b, vec, n, level); break;
+		case SIMD_GT: compare_level<SIMD_GT>(a, b, vec, n, level); break;
+		case SIMD_LT: compare_level<SIMD_LT>(a, b, vec, n, level); break;
+		case SIMD_GE: compare_level<SIMD_GE>(a, b, vec, n, level); break;
+		case SIMD_LE: compare_level<SIMD_LE>(a, b, vec, n, level); break;
+		default: break;
+	}
+}
+
+static void set_na_level(double *a, size_t n, double flag, bool below, int level) {
+	size_t i = 0;
+#ifdef SPAT_SIMD_X86
+	if (level == 2) {
+		i = below ? setna_avx512<true>(a, n, flag) : setna_avx512<false>(a, n, flag);
+	} else if (level == 1) {
+		i = below ? setna_avx2<true>(a, n, flag) : setna_avx2<false>(a, n, flag);
+	}
+#endif
+	if (below) {
+		for (; i<n; i++) if (a[i] < flag) a[i] = NAN;
+	} else {
+		for (; i<n; i++) if (a[i] == flag) a[i] = NAN;
+	}
+}
+
+static void scale_offset_level(double *a, size_t n, double scale, double offset, int level) {
+	size_t i = 0;
+#ifdef SPAT_SIMD_X86
+	if (level == 2) {
+		i = scaleoff_avx512(a, n, scale, offset);
+	} else if (level == 1) {
+		i = scaleoff_avx2(a, n, scale, offset);
+	}
+#endif
+	for (; i<n; i++) {
+		double d = a[i] * scale;
+		a[i] = d + offset;
+	}
+}
+
+static bool minmax_level(const double *a, size_t n, double &vmin, double &vmax, double lmin, double lmax, int level) {
+	double mn = INFINITY;
+	double mx = -INFINITY;
+	bool found = false;
+	size_t i = 0;
+#ifdef SPAT_SIMD_X86
+	if (level == 2) {
+		i = minmax_avx512(a, n, lmin, lmax, mn, mx, found);
+	} else if (level == 1) {
+		i = minmax_avx2(a, n, lmin, lmax, mn, mx, found);
+	}
+#endif
+	for (; i<n; i++) {
+		// false for NAN
+		if ((a[i] >= lmin) && (a[i] <= lmax)) {
+			mn = std::min(mn, a[i]);
+			mx = std::max(mx, a[i]);
+			found = true;
+		}
+	}
+	if (!found) {
+		vmin = NAN;
+		vmax = NAN;
+		return false;
+	}
+	vmin = mn;
+	vmax = mx;
+	return true;
+}
+
+
+void simd_compare(double *a, const double *b, size_t n, int op) {
+	compare_level(a, b, true, n, op, cpu_level());
+}
+
+void simd_compare_scalar(double *a, double b, size_t n, int op, bool reverse) {
+	if (reverse) {
+		// b > a[i] is a[i] < b
+		if (op == SIMD_GT) op = SIMD_LT;
+		else if (op == SIMD_LT) op = SIMD_GT;
+		else if (op == SIMD_GE) op = SIMD_LE;
+		else if (op == SIMD_LE) op = SIMD_GE;
+	}
+	compare_level(a, &b, false, n, op, cpu_level());
+}
+
+void simd_set_na(double *a, size_t n, double flag, bool below) {
+	set_na_level(a, n, flag, below, cpu_level());
+}
+
+void simd_scale_offset(double *a, size_t n, double scale, double offset) {
+	scale_offset_level(a, n, scale, offset, cpu_level());
+}
+
+bool simd_minmax(const double *a, size_t n, double &vmin, double &vmax, double lmin, double lmax) {
+	return minmax_level(a, n, vmin, vmax, lmin, lmax, cpu_level());
+}
+
+bool simd_minmax(const double *a, size_t n, double &vmin, double &vmax) {
+	return minmax_level(a, n, vmin, vmax, -INFINITY, INFINITY, cpu_level());
+}
+
+
+void simd_benchmark(size_t n, size_t reps, std::vector<std::string> &kernel, std::vector<double> &scalar, std::vector<double> &simd) {
+
+	n = std::max(n, (size_t)1);
+	reps = std::max(reps, (size_t)1);
+	kernel = {"==", "!=", ">", "<", ">=", "<=", "> scalar", "NA flag", "scale/offset", "minmax"};
+	size_t nk = kernel.size();
+	scalar.resize(nk);
+	simd.resize(nk);
+
+	// integers between 0 and 9; and about 5% NAN
+	std::vector<double> x(n), y(n), w;
+	uint64_t s = 12345;
+	for (size_t i=0; i<n; i++) {
+		s = s * 6364136223846793005ULL + 1442695040888963407ULL;
+		double r = (s >> 11) * (1.0 / 9007199254740992.0);
+		x[i] = r < 0.05 ? NAN : std::floor(r * 10);
+		s = s * 6364136223846793005ULL + 1442695040888963407ULL;
+		r = (s >> 11) * (1.0 / 9007199254740992.0);
+		y[i] = r < 0.05 ? NAN : std::floor(r * 10);
+	}
+
+	double five = 5;
+	double vmin, vmax;
+	volatile double sink = 0;
+	int best = cpu_level();
+	for (size_t k=0; k<nk; k++) {
+		for (size_t j=0; j<2; j++) {
+			int level = j == 0 ? 0 : best;
+			double secs = 0;
+			for (size_t r=0; r<reps; r++) {
+				w = x;
+				std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+				if (k < 6) {
+					compare_level(w.data(), y.data(), true, n, k, level);
+				} else if (k == 6) {
+					compare_level(w.data(), &five, false, n, SIMD_GT, level);
+				} else if (k == 7) {
+					set_na_level(w.data(), n, 3, false, level);
+				} else if (k == 8) {
+					scale_offset_level(w.data(), n, 0.1, 1, level);
+				} else {
+					minmax_level(w.data(), n, vmin, vmax, -INFINITY, INFINITY, level);
+					sink = sink + vmax;
+				}
+				std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+				secs += std::chrono::duration<double>(t1 - t0).count();
+				sink = sink + w[n-1];
+			}
+			double cells = (double)n * reps / std::max(secs, 1e-9);
+			if (j == 0) {
+				scalar[k] = cells;
+			} else {
+				simd[k] = cells;
+			}
+		}
+	}
+}
+
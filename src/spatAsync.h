@@ -0,0 +1,100 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATASYNC_GUARD
+#define SPATASYNC_GUARD
+
+#include <future>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Reading the next block (readBlock) and writing the previous block
+// (writeValues) on a background thread, while the current block is
+// processed. The background threads only touch the GDAL datasets;
+// GDAL messages are collected and reported on the calling thread.
+
+// the window of a GDAL dataset to read for one source
+class SpatAsyncWindow {
+	public:
+#ifdef useGDAL
+		GDALDataset *ds = NULL;
+#endif
+		// empty if the bands are read in order
+		std::vector<int> bands;
+		size_t nl = 0;
+		size_t row = 0;
+		size_t col = 0;
+};
+
+// the values of each source as read from file; NA flags, scale/offset
+// and flipping are applied by prefetchGet
+class SpatAsyncChunk {
+	public:
+		std::vector<std::vector<double>> values;
+		SpatMessages msg;
+};
+
+class SpatAsyncRead {
+	public:
+		bool pending = false;
+		size_t row = 0;
+		size_t nrows = 0;
+		size_t col = 0;
+		size_t ncols = 0;
+		std::future<SpatAsyncChunk> chunk;
+};
+
+// a single writer thread that is started with the first block and
+// runs one task at a time. The thread is joined when this is destroyed
+class SpatAsyncWrite {
+	public:
+		~SpatAsyncWrite();
+		// run task on the writer thread after the previous task is done.
+		// throws std::system_error if the thread cannot be started
+		void submit(std::function<SpatMessages()> task);
+		// wait for the task that was submitted, and get its messages
+		SpatMessages wait();
+		bool pending = false;
+
+	private:
+		std::thread worker;
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::function<SpatMessages()> task;
+		bool has_task = false;
+		bool stop = false;
+		SpatMessages result;
+		void run();
+};
+
+#ifdef useGDAL
+// a GDAL error handler that adds the messages to the SpatMessages that is
+// passed as user data (CPLPushErrorHandlerEx); for use on other threads,
+// where the R error handlers (RcppFunctions.cpp) may not be called
+void __err_collect(CPLErr eErrClass, int err_no, const char *msg);
+
+// the values of a window of a GDAL dataset, as stored in the file
+CPLErr read_window_gdal(const SpatAsyncWindow &w, size_t nrows, size_t ncols, std::vector<double> &out);
+
+SpatMessages writeBlockGDAL(GDALDataset *ds, const std::vector<double> &vals, const std::string &datatype, size_t startrow, size_t nrows, size_t startcol, size_t ncols, size_t nl);
+#endif
+
+#endif
@@ -18,6 +18,7 @@
 #include "spatRaster.h"
 #include "string_utils.h"
 #include "math_utils.h"
+#include <thread>
 
 
 SpatOptions::SpatOptions() {}
@@ -26,6 +27,7 @@ SpatOptions::SpatOptions() {}
 SpatOptions::SpatOptions(const SpatOptions &opt) {
 	tempdir = opt.tempdir;
 	memfrac = opt.memfrac;
+	memmax = opt.memmax;
 	todisk = opt.todisk;
 	def_datatype = opt.def_datatype;
 	def_filetype = opt.def_filetype; 
@@ -33,6 +35,7 @@ SpatOptions::SpatOptions(const SpatOptions &opt) {
 	overwrite = false;
 	progress = opt.progress;
 	ncopies = opt.ncopies;
+	threads = opt.threads;
 	verbose = opt.verbose;
 	statistics = opt.statistics;
 	steps = opt.steps;
@@ -159,16 +162,32 @@ void SpatOptions::set_memfrac(double d) {
 	//setError;
 }
 
+// the maximum amount of RAM to use, in GB. Zero or less means: no limit
+double SpatOptions::get_memmax() { return memmax / 1073741824; }
+void SpatOptions::set_memmax(double d) { 
+	memmax = std::isnan(d) ? 0 : std::max(0.0, d * 1073741824); 
+}
+
 bool SpatOptions::get_todisk() { return todisk; }
 void SpatOptions::set_todisk(bool b) { todisk = b; }
 
 
-void SpatOptions::set_steps(size_t n) { steps = std::max((size_t)1, n); }
+// 0 is the default: the number of blocks depends on the available memory
+void SpatOptions::set_steps(size_t n) { steps = n; }
 size_t SpatOptions::get_steps(){ return steps; }
 
 void SpatOptions::set_ncopies(size_t n) { ncopies = std::max((size_t)1, n); }
 size_t SpatOptions::get_ncopies(){ return ncopies; }
 
+// zero means: use all cores
+void SpatOptions::set_threads(unsigned n) { threads = n; }
+unsigned SpatOptions::get_threads() { 
+	if (threads == 0) {
+		return std::max((unsigned)1, std::thread::hardware_concurrency());
+	}
+	return threads; 
+}
+
 
 bool extent_operator(std::string oper) {
 	std::vector<std::string> f {"==", "!=", ">", "<", ">=", "<="};
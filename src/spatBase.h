@@ -103,10 +103,12 @@ class SpatOptions {
 		std::string tempdir = "";
 		bool todisk = false;
 		double memfrac = 0.6;
+		double memmax = 0;
 
 	public:
 		unsigned ncopies = 4;
 		unsigned minrows = 1;
+		unsigned threads = 1;
 		std::string def_datatype = "FLT4S";
 		std::string def_filetype = "GTiff";
 		//std::string def_bandorder = "BIL";
@@ -138,6 +140,8 @@ class SpatOptions {
 		void set_todisk(bool b);
 		double get_memfrac();
 		void set_memfrac(double d);
+		double get_memmax();
+		void set_memmax(double d);
 		std::string get_tempdir();
 		void set_tempdir(std::string d);
 
@@ -181,6 +185,8 @@ class SpatOptions {
 		size_t get_steps();
 		void set_ncopies(size_t n);
 		size_t get_ncopies();
+		void set_threads(unsigned n);
+		unsigned get_threads();
 
 		SpatMessages msg;
 };
@@ -0,0 +1,238 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATBLOCK_GUARD
+#define SPATBLOCK_GUARD
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+#include <algorithm>
+
+// Cell types for blocks that are read and written in the native type
+// of a file, rather than widened to double. NA is represented by the
+// nodata value that is used by default when writing a file of that type.
+
+template <typename T> struct SpatType {};
+
+template <> struct SpatType<uint8_t> {
+	static std::string name() { return "INT1U"; }
+	static uint8_t na() { return 255; }
+	static bool isna(const uint8_t &v) { return v == 255; }
+	static double lowest() { return 0; }
+	static double highest() { return 254; }
+};
+
+template <> struct SpatType<int16_t> {
+	static std::string name() { return "INT2S"; }
+	static int16_t na() { return INT16_MIN; }
+	static bool isna(const int16_t &v) { return v == INT16_MIN; }
+	static double lowest() { return INT16_MIN + 1; }
+	static double highest() { return INT16_MAX; }
+};
+
+template <> struct SpatType<uint16_t> {
+	static std::string name() { return "INT2U"; }
+	static uint16_t na() { return UINT16_MAX; }
+	static bool isna(const uint16_t &v) { return v == UINT16_MAX; }
+	static double lowest() { return 0; }
+	static double highest() { return UINT16_MAX - 1; }
+};
+
+template <> struct SpatType<int32_t> {
+	static std::string name() { return "INT4S"; }
+	static int32_t na() { return INT32_MIN; }
+	static bool isna(const int32_t &v) { return v == INT32_MIN; }
+	static double lowest() { return INT32_MIN + 1.0; }
+	static double highest() { return INT32_MAX; }
+};
+
+template <> struct SpatType<uint32_t> {
+	static std::string name() { return "INT4U"; }
+	static uint32_t na() { return UINT32_MAX; }
+	static bool isna(const uint32_t &v) { return v == UINT32_MAX; }
+	static double lowest() { return 0; }
+	static double highest() { return UINT32_MAX - 1.0; }
+};
+
+template <> struct SpatType<float> {
+	static std::string name() { return "FLT4S"; }
+	static float na() { return NAN; }
+	static bool isna(const float &v) { return std::isnan(v); }
+	static double lowest() { return std::numeric_limits<float>::lowest(); }
+	static double highest() { return std::numeric_limits<float>::max(); }
+};
+
+template <> struct SpatType<double> {
+	static std::string name() { return "FLT8S"; }
+	static double na() { return NAN; }
+	static bool isna(const double &v) { return std::isnan(v); }
+	static double lowest() { return std::numeric_limits<double>::lowest(); }
+	static double highest() { return std::numeric_limits<double>::max(); }
+};
+
+
+inline bool is_native_datatype(const std::string &datatype) {
+	return ((datatype == "INT1U") || (datatype == "INT2S") || (datatype == "INT2U") || (datatype == "INT4S") || (datatype == "INT4U") || (datatype == "FLT4S") || (datatype == "FLT8S"));
+}
+
+
+// true if a file with this datatype and nodata value can be read in the
+// native type: the nodata value is the NA value of the type, such that
+// no valid value is taken for NA (floating point NA is NAN)
+inline bool native_NA_compatible(const std::string &datatype, const double &flag) {
+	if ((datatype == "FLT4S") || (datatype == "FLT8S")) {
+		return true;
+	} else if (datatype == "INT1U") {
+		return flag == SpatType<uint8_t>::na();
+	} else if (datatype == "INT2S") {
+		return flag == SpatType<int16_t>::na();
+	} else if (datatype == "INT2U") {
+		return flag == SpatType<uint16_t>::na();
+	} else if (datatype == "INT4S") {
+		return flag == SpatType<int32_t>::na();
+	} else if (datatype == "INT4U") {
+		return flag == SpatType<uint32_t>::na();
+	}
+	return false;
+}
+
+
+// bytes per cell value
+inline size_t native_datatype_size(const std::string &datatype) {
+	if (datatype == "INT1U") {
+		return 1;
+	} else if ((datatype == "INT2S") || (datatype == "INT2U")) {
+		return 2;
+	} else if ((datatype == "INT4S") || (datatype == "INT4U") || (datatype == "FLT4S")) {
+		return 4;
+	}
+	return 8;
+}
+
+
+// can value x be stored in a T without loss (NAN becomes NA)
+template <typename T>
+bool native_value(const double &x, T &out) {
+	if (std::isnan(x)) {
+		out = SpatType<T>::na();
+		return true;
+	}
+	if ((x < SpatType<T>::lowest()) || (x > SpatType<T>::highest())) {
+		return false;
+	}
+	if (std::numeric_limits<T>::is_integer && (x != std::trunc(x))) {
+		return false;
+	}
+	out = x;
+	return true;
+}
+
+
+inline bool native_value_fits(const std::string &datatype, const double &x) {
+	if (datatype == "INT1U") {
+		uint8_t v; return native_value(x, v);
+	} else if (datatype == "INT2S") {
+		int16_t v; return native_value(x, v);
+	} else if (datatype == "INT2U") {
+		uint16_t v; return native_value(x, v);
+	} else if (datatype == "INT4S") {
+		int32_t v; return native_value(x, v);
+	} else if (datatype == "INT4U") {
+		uint32_t v; return native_value(x, v);
+	} else if (datatype == "FLT4S") {
+		float v; return native_value(x, v);
+	} else if (datatype == "FLT8S") {
+		return true;
+	}
+	return false;
+}
+
+
+template <typename T>
+void native_to_double(const std::vector<T> &v, std::vector<double> &out) {
+	size_t n = v.size();
+	out.resize(n);
+	for (size_t i=0; i<n; i++) {
+		out[i] = SpatType<T>::isna(v[i]) ? NAN : (double) v[i];
+	}
+}
+
+
+template <typename T>
+void double_to_native(const std::vector<double> &v, std::vector<T> &out) {
+	size_t n = v.size();
+	const double mn = SpatType<T>::lowest();
+	const double mx = SpatType<T>::highest();
+	const T na = SpatType<T>::na();
+	out.resize(n);
+	for (size_t i=0; i<n; i++) {
+		out[i] = std::isnan(v[i]) ? na : (v[i] < mn ? na : (v[i] > mx ? na : (T) v[i]));
+	}
+}
+
+
+// replace the nodata flag of a file with the NA value of T
+template <typename T>
+void native_set_NA(std::vector<T> &v, size_t start, size_t end, const double &flag) {
+	if (std::isnan(flag)) return;
+	T na = SpatType<T>::na();
+	if (!std::numeric_limits<T>::is_integer) {
+		if (flag < -3.4e+37) {
+			// see NAso; float derived flags are not always exactly equal
+			for (size_t i=start; i<end; i++) {
+				if (v[i] < -3.4e+37) v[i] = na;
+			}
+			return;
+		}
+	} else if ((flag < std::numeric_limits<T>::lowest()) || (flag > std::numeric_limits<T>::max()) || (flag != std::trunc(flag))) {
+		return;
+	}
+	T tflag = flag;
+	if (tflag == na) return;
+	std::replace(v.begin()+start, v.begin()+end, tflag, na);
+}
+
+
+template <typename T>
+void native_minmax(const std::vector<T> &v, size_t start, size_t end, double &vmin, double &vmax) {
+	bool none = true;
+	T tmin = 0, tmax = 0;
+	for (size_t i=start; i<end; i++) {
+		if (SpatType<T>::isna(v[i])) continue;
+		if (none) {
+			tmin = v[i];
+			tmax = v[i];
+			none = false;
+		} else if (v[i] < tmin) {
+			tmin = v[i];
+		} else if (v[i] > tmax) {
+			tmax = v[i];
+		}
+	}
+	if (none) {
+		vmin = NAN;
+		vmax = NAN;
+	} else {
+		vmin = tmin;
+		vmax = tmax;
+	}
+}
+
+#endif
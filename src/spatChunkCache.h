@@ -0,0 +1,59 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATCHUNKCACHE_GUARD
+#define SPATCHUNKCACHE_GUARD
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <cstddef>
+
+// reads a hyperslab (start, count; row-major, last dimension varies
+// fastest) of an n-dimensional array into buf
+typedef std::function<bool(const std::vector<size_t> &start, const std::vector<size_t> &count, std::vector<double> &buf)> SpatSlabReader;
+
+
+// Reading hyperslabs of a chunked n-dimensional array (netCDF-4, HDF5,
+// Zarr) one whole chunk at a time, keeping the most recently used
+// (decompressed) chunks in memory. Only the chunks that intersect with a
+// request are read, such that a time series for a few cells does not
+// touch the chunks with other cells.
+
+class SpatChunkCache {
+	public:
+		std::vector<size_t> size;
+		std::vector<size_t> chunk;
+		size_t maxbytes = 0;
+		size_t nread = 0;
+
+		SpatChunkCache(std::vector<size_t> dimsize, std::vector<size_t> chunksize, size_t max_bytes, SpatSlabReader reader);
+
+		// values for start/count are copied to out, with the position of
+		// element (i, j, ...) of the hyperslab at sum(index * stride)
+		bool read(const std::vector<size_t> &start, const std::vector<size_t> &count, const std::vector<size_t> &stride, double *out);
+
+	private:
+		SpatSlabReader reader;
+		std::list<size_t> lru;
+		std::unordered_map<size_t, std::pair<std::list<size_t>::iterator, std::vector<double>>> cache;
+		size_t bytes = 0;
+		std::vector<double>* get(const std::vector<size_t> &cindex);
+};
+
+#endif
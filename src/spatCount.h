@@ -0,0 +1,201 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATCOUNT_GUARD
+#define SPATCOUNT_GUARD
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <numeric>
+#include <stdint.h>
+
+// Counts of values, or of combinations of "width" values (e.g. for crosstab).
+// Small non-negative integers (e.g. from INT1U or INT2U files) are counted
+// in an array ("dense"); other keys in an open addressing hash table.
+// Tables (e.g. of different blocks or threads) are combined with "merge".
+// NAN is a valid key; all NANs are the same, as are 0 and -0.
+
+class SpatCountTable {
+
+	private:
+		size_t nused = 0;
+		std::vector<double> keys;     // capacity * width
+		std::vector<uint64_t> counts; // capacity; zero for an empty slot
+
+		static uint64_t keybits(const double &d) {
+			double x = std::isnan(d) ? NAN : (d + 0.0);
+			uint64_t b;
+			std::memcpy(&b, &x, sizeof(double));
+			return b;
+		}
+
+		size_t hash(const double *key) const {
+			uint64_t h = 0x9E3779B97F4A7C15ULL;
+			for (size_t i=0; i<width; i++) {
+				// splitmix64
+				uint64_t z = h ^ keybits(key[i]);
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+				h = z ^ (z >> 31);
+			}
+			return h;
+		}
+
+		bool same(const double *a, const double *b) const {
+			for (size_t i=0; i<width; i++) {
+				if (keybits(a[i]) != keybits(b[i])) return false;
+			}
+			return true;
+		}
+
+		void grow() {
+			std::vector<double> oldkeys;
+			std::vector<uint64_t> oldcounts;
+			oldkeys.swap(keys);
+			oldcounts.swap(counts);
+			size_t cap = std::max((size_t)64, oldcounts.size() * 2);
+			keys.resize(cap * width);
+			counts.resize(cap, 0);
+			nused = 0;
+			for (size_t i=0; i<oldcounts.size(); i++) {
+				if (oldcounts[i] > 0) {
+					add_hash(&oldkeys[i*width], oldcounts[i]);
+				}
+			}
+		}
+
+		void add_hash(const double *key, uint64_t n) {
+			if ((2 * (nused + 1)) > counts.size()) grow();
+			size_t mask = counts.size() - 1;
+			size_t i = hash(key) & mask;
+			while (counts[i] > 0) {
+				if (same(&keys[i*width], key)) {
+					counts[i] += n;
+					return;
+				}
+				i = (i + 1) & mask;
+			}
+			for (size_t j=0; j<width; j++) {
+				keys[i*width+j] = std::isnan(key[j]) ? NAN : (key[j] + 0.0);
+			}
+			counts[i] = n;
+			nused++;
+		}
+
+	public:
+		size_t width = 1;
+		std::vector<uint64_t> dense;
+
+		// "ndense" is the number of integers (0, 1, ...) that are counted in an array
+		SpatCountTable(size_t w=1, size_t ndense=0) {
+			width = std::max((size_t)1, w);
+			if (width == 1) dense.resize(ndense, 0);
+		}
+
+		void add(const double *key, uint64_t n=1) {
+			if (n == 0) return;
+			if (dense.size() > 0) {
+				double d = key[0];
+				if ((d >= 0) && (d < dense.size()) && (d == std::trunc(d))) {
+					dense[(size_t)d] += n;
+					return;
+				}
+			}
+			add_hash(key, n);
+		}
+
+		void add(const double &key) {
+			add(&key, 1);
+		}
+
+		void merge(const SpatCountTable &x) {
+			if (dense.size() == x.dense.size()) {
+				for (size_t i=0; i<dense.size(); i++) {
+					dense[i] += x.dense[i];
+				}
+			} else {
+				for (size_t i=0; i<x.dense.size(); i++) {
+					double d = i;
+					add(&d, x.dense[i]);
+				}
+			}
+			for (size_t i=0; i<x.counts.size(); i++) {
+				if (x.counts[i] > 0) {
+					add(&x.keys[i*x.width], x.counts[i]);
+				}
+			}
+		}
+
+		// the number of distinct keys
+		size_t size() const {
+			size_t n = nused;
+			for (size_t i=0; i<dense.size(); i++) {
+				n += dense[i] > 0;
+			}
+			return n;
+		}
+
+		// "width" columns with the (sorted) keys, and a column with the counts
+		// NAN is sorted before any number
+		std::vector<std::vector<double>> table() const {
+			std::vector<std::vector<double>> k(width);
+			std::vector<double> cnt;
+			size_t n = size();
+			for (size_t j=0; j<width; j++) k[j].reserve(n);
+			cnt.reserve(n);
+			for (size_t i=0; i<dense.size(); i++) {
+				if (dense[i] > 0) {
+					k[0].push_back(i);
+					cnt.push_back(dense[i]);
+				}
+			}
+			for (size_t i=0; i<counts.size(); i++) {
+				if (counts[i] > 0) {
+					for (size_t j=0; j<width; j++) {
+						k[j].push_back(keys[i*width+j]);
+					}
+					cnt.push_back(counts[i]);
+				}
+			}
+			std::vector<size_t> ord(n);
+			std::iota(ord.begin(), ord.end(), 0);
+			std::sort(ord.begin(), ord.end(), [&k](size_t a, size_t b) {
+				for (size_t j=0; j<k.size(); j++) {
+					double x = k[j][a], y = k[j][b];
+					if (std::isnan(x)) {
+						if (std::isnan(y)) continue;
+						return true;
+					}
+					if (std::isnan(y)) return false;
+					if (x != y) return x < y;
+				}
+				return false;
+			});
+			std::vector<std::vector<double>> out(width+1, std::vector<double>(n));
+			for (size_t i=0; i<n; i++) {
+				for (size_t j=0; j<width; j++) {
+					out[j][i] = k[j][ord[i]];
+				}
+				out[width][i] = cnt[ord[i]];
+			}
+			return out;
+		}
+};
+
+#endif
@@ -0,0 +1,57 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATEXPR_GUARD
+#define SPATEXPR_GUARD
+
+#include <vector>
+#include <string>
+
+// An expression of the layers of a raster, such as (a - b) / (a + b) > 0.3,
+// that is computed for all cells of a block at once, without intermediate
+// rasters. The expression is compiled from postfix code ("layer" 0, "layer" 1,
+// "-", ...) to a program in which each operator has its own kernel.
+
+class SpatExprValue {
+	public:
+		std::vector<double> v;
+		bool scalar = true;
+		double s = 0;
+};
+
+typedef void (*SpatExprKernel)(std::vector<SpatExprValue> &stack, size_t n);
+
+class SpatExprInstr {
+	public:
+		unsigned type = 0; // 0: layer, 1: constant, 2: operator
+		size_t layer = 0;
+		double value = 0;
+		SpatExprKernel kernel = NULL;
+};
+
+class SpatExpr {
+	public:
+		std::vector<SpatExprInstr> code;
+		size_t depth = 0; // maximum size of the stack
+
+		// "ops" has "layer", "const", or an operator; "args" has the layer number (0 based) or constant
+		bool compile(const std::vector<std::string> &ops, const std::vector<double> &args, size_t nlyr, std::string &msg);
+		// "v" has the values of all layers for "ncell" cells
+		void eval(const std::vector<double> &v, size_t ncell, std::vector<double> &out) const;
+};
+
+#endif
@@ -0,0 +1,284 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATINDEX_GUARD
+#define SPATINDEX_GUARD
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+
+// A KD-tree of points with K coordinates, to find the nearest point, or
+// all points within a distance, in O(log n) instead of O(n) time.
+// Each node splits its points at the median of the coordinate with the
+// largest range. Points with a NAN coordinate are ignored.
+
+template <size_t K>
+class SpatKDTree {
+
+	private:
+		class Node {
+			public:
+				size_t lo, hi;         // the points of the node
+				int axis = -1;         // -1 for a leaf
+				double split = 0;
+				size_t left = 0, right = 0;
+		};
+
+		std::vector<Node> nodes;
+		std::vector<double> pts;  // the coordinates, in the order of "ids"
+		std::vector<size_t> ids;  // the index of the points in the input
+		static const size_t leafsize = 8;
+
+		size_t build(std::vector<double> &xyz, size_t lo, size_t hi) {
+			size_t id = nodes.size();
+			nodes.push_back(Node());
+			nodes[id].lo = lo;
+			nodes[id].hi = hi;
+			if ((hi - lo) <= leafsize) return id;
+
+			int axis = 0;
+			double range = -1;
+			for (size_t k=0; k<K; k++) {
+				double mn = std::numeric_limits<double>::max();
+				double mx = std::numeric_limits<double>::lowest();
+				for (size_t i=lo; i<hi; i++) {
+					double v = xyz[ids[i]*K+k];
+					mn = std::min(mn, v);
+					mx = std::max(mx, v);
+				}
+				if ((mx - mn) > range) {
+					range = mx - mn;
+					axis = k;
+				}
+			}
+			size_t mid = (lo + hi) / 2;
+			std::nth_element(ids.begin()+lo, ids.begin()+mid, ids.begin()+hi, [&xyz, axis](size_t a, size_t b) {
+				return xyz[a*K+axis] < xyz[b*K+axis];
+			});
+			double split = xyz[ids[mid]*K+axis];
+			size_t left = build(xyz, lo, mid);
+			size_t right = build(xyz, mid, hi);
+			nodes[id].axis = axis;
+			nodes[id].split = split;
+			nodes[id].left = left;
+			nodes[id].right = right;
+			return id;
+		}
+
+		void nearest(const double *q, size_t node, size_t &best, double &bestd2) const {
+			const Node &nd = nodes[node];
+			if (nd.axis < 0) {
+				for (size_t i=nd.lo; i<nd.hi; i++) {
+					double d2 = 0;
+					for (size_t k=0; k<K; k++) {
+						double dk = pts[i*K+k] - q[k];
+						d2 += dk * dk;
+					}
+					if (d2 < bestd2) {
+						bestd2 = d2;
+						best = ids[i];
+					}
+				}
+				return;
+			}
+			double diff = q[nd.axis] - nd.split;
+			nearest(q, diff <= 0 ? nd.left : nd.right, best, bestd2);
+			if ((diff * diff) < bestd2) {
+				nearest(q, diff <= 0 ? nd.right : nd.left, best, bestd2);
+			}
+		}
+
+		void within(const double *q, double r2, size_t node, std::vector<size_t> &out) const {
+			const Node &nd = nodes[node];
+			if (nd.axis < 0) {
+				for (size_t i=nd.lo; i<nd.hi; i++) {
+					double d2 = 0;
+					for (size_t k=0; k<K; k++) {
+						double dk = pts[i*K+k] - q[k];
+						d2 += dk * dk;
+					}
+					if (d2 <= r2) out.push_back(ids[i]);
+				}
+				return;
+			}
+			double diff = q[nd.axis] - nd.split;
+			if ((diff <= 0) || ((diff * diff) <= r2)) within(q, r2, nd.left, out);
+			if ((diff >= 0) || ((diff * diff) <= r2)) within(q, r2, nd.right, out);
+		}
+
+	public:
+		SpatKDTree() {}
+
+		// "xyz" has the K coordinates of the first point, then of the second point, etc.
+		SpatKDTree(std::vector<double> xyz) {
+			size_t n = xyz.size() / K;
+			ids.reserve(n);
+			for (size_t i=0; i<n; i++) {
+				bool ok = true;
+				for (size_t k=0; k<K; k++) {
+					if (std::isnan(xyz[i*K+k])) ok = false;
+				}
+				if (ok) ids.push_back(i);
+			}
+			if (ids.size() == 0) return;
+			nodes.reserve(2 * ids.size() / leafsize + 2);
+			build(xyz, 0, ids.size());
+			pts.resize(ids.size() * K);
+			for (size_t i=0; i<ids.size(); i++) {
+				for (size_t k=0; k<K; k++) {
+					pts[i*K+k] = xyz[ids[i]*K+k];
+				}
+			}
+		}
+
+		size_t size() const {
+			return ids.size();
+		}
+
+		// the index of the nearest point; "d2" gets the squared distance
+		// returns false if there are no points
+		bool nearest(const double *q, size_t &id, double &d2) const {
+			if (ids.size() == 0) return false;
+			d2 = std::numeric_limits<double>::infinity();
+			nearest(q, 0, id, d2);
+			return true;
+		}
+
+		// the index of all points within distance sqrt(r2)
+		void within(const double *q, double r2, std::vector<size_t> &out) const {
+			out.resize(0);
+			if (ids.size() == 0) return;
+			within(q, r2, 0, out);
+		}
+};
+
+
+// A static R-tree of rectangles, to find the rectangles that intersect a
+// query rectangle. The tree is packed with the Sort-Tile-Recursive algorithm:
+// the rectangles are sorted by x and cut into vertical slices, and each slice
+// is sorted by y and cut into nodes; and so on for the nodes of each level.
+// Rectangles with a NAN coordinate are ignored.
+
+class SpatRTree {
+
+	private:
+		class Node {
+			public:
+				double xmin, xmax, ymin, ymax;
+				size_t first;    // the first child node; or the rectangle (if n == 0)
+				size_t n = 0;    // the number of child nodes
+		};
+
+		std::vector<Node> nodes;
+		size_t root = 0, nroot = 0;
+		size_t nitems = 0;
+		static const size_t nodesize = 16;
+
+		static void str_sort(std::vector<Node> &v) {
+			std::sort(v.begin(), v.end(), [](const Node &a, const Node &b) {
+				return (a.xmin + a.xmax) < (b.xmin + b.xmax);
+			});
+			size_t nleaf = (v.size() + nodesize - 1) / nodesize;
+			size_t nslice = std::ceil(std::sqrt((double)nleaf));
+			size_t slice = nslice * nodesize;
+			for (size_t i=0; i<v.size(); i+=slice) {
+				size_t end = std::min(i + slice, v.size());
+				std::sort(v.begin()+i, v.begin()+end, [](const Node &a, const Node &b) {
+					return (a.ymin + a.ymax) < (b.ymin + b.ymax);
+				});
+			}
+		}
+
+		void query(size_t first, size_t n, double xmin, double xmax, double ymin, double ymax, std::vector<size_t> &out) const {
+			for (size_t i=first; i<(first+n); i++) {
+				const Node &nd = nodes[i];
+				if ((nd.xmin > xmax) || (nd.xmax < xmin) || (nd.ymin > ymax) || (nd.ymax < ymin)) continue;
+				if (nd.n == 0) {
+					out.push_back(nd.first);
+				} else {
+					query(nd.first, nd.n, xmin, xmax, ymin, ymax, out);
+				}
+			}
+		}
+
+	public:
+		SpatRTree() {}
+
+		SpatRTree(const std::vector<double> &xmin, const std::vector<double> &xmax, const std::vector<double> &ymin, const std::vector<double> &ymax) {
+			std::vector<Node> level;
+			level.reserve(xmin.size());
+			for (size_t i=0; i<xmin.size(); i++) {
+				if (std::isnan(xmin[i]) || std::isnan(xmax[i]) || std::isnan(ymin[i]) || std::isnan(ymax[i])) continue;
+				Node nd;
+				nd.xmin = xmin[i];
+				nd.xmax = xmax[i];
+				nd.ymin = ymin[i];
+				nd.ymax = ymax[i];
+				nd.first = i;
+				level.push_back(nd);
+			}
+			nitems = level.size();
+			if (nitems == 0) return;
+			while (true) {
+				str_sort(level);
+				size_t start = nodes.size();
+				nodes.insert(nodes.end(), level.begin(), level.end());
+				if (level.size() <= nodesize) {
+					root = start;
+					nroot = level.size();
+					break;
+				}
+				std::vector<Node> parents;
+				parents.reserve(level.size() / nodesize + 1);
+				for (size_t i=0; i<level.size(); i+=nodesize) {
+					Node p;
+					p.first = start + i;
+					// a copy; std::min takes references, and nodesize has no definition out of the class
+					p.n = std::min((size_t)nodesize, level.size() - i);
+					p.xmin = level[i].xmin;
+					p.xmax = level[i].xmax;
+					p.ymin = level[i].ymin;
+					p.ymax = level[i].ymax;
+					for (size_t j=i+1; j<(i+p.n); j++) {
+						p.xmin = std::min(p.xmin, level[j].xmin);
+						p.xmax = std::max(p.xmax, level[j].xmax);
+						p.ymin = std::min(p.ymin, level[j].ymin);
+						p.ymax = std::max(p.ymax, level[j].ymax);
+					}
+					parents.push_back(p);
+				}
+				level = std::move(parents);
+			}
+		}
+
+		size_t size() const {
+			return nitems;
+		}
+
+		// the (sorted) index of the rectangles that intersect (or touch) the query rectangle
+		void query(double xmin, double xmax, double ymin, double ymax, std::vector<size_t> &out) const {
+			out.resize(0);
+			if (nitems == 0) return;
+			query(root, nroot, xmin, xmax, ymin, ymax, out);
+			std::sort(out.begin(), out.end());
+		}
+};
+
+#endif
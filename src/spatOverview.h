@@ -0,0 +1,88 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATOVERVIEW_GUARD
+#define SPATOVERVIEW_GUARD
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+// Statistics and overviews that are computed from the blocks of values
+// while they are written, such that the file does not need to be read
+// again when it is closed.
+
+// min, max, mean and (population) sd of each layer, combined block by
+// block (Chan et al.). Values outside [lo, hi] are NA for the datatype.
+class SpatStreamStats {
+	public:
+		std::vector<double> n, mean, m2, vmin, vmax;
+		void init(size_t nl);
+		void add(const double *v, size_t ncell, size_t lyr, double lo, double hi, bool isint);
+		double sd(size_t lyr);
+};
+
+
+// overview levels with factors 2, 4, 8, ... that are built from whole
+// rows of the base raster, in order. Each level keeps the sum and count
+// of the base cells of one row of the next level, such that "average"
+// is the mean of all (non-NA) base cells. "nearest" uses the first cell.
+// Completed rows of each level are kept until they are written.
+class SpatOverviewStream {
+	public:
+		bool average = true;
+		size_t nlyr = 0;
+		// for each level; level 0 is the base raster
+		std::vector<size_t> nrow, ncol;
+		// rows that are ready to be written, by level and layer
+		std::vector<std::vector<std::vector<double>>> ready;
+		std::vector<size_t> ready_row, ready_nrows;
+
+		bool init(size_t nr, size_t nc, size_t nl, size_t nlevels, bool avg);
+		size_t nlevels() { return nrow.size() > 0 ? nrow.size() - 1 : 0; }
+		// a block of whole rows of the base raster (layer by layer)
+		bool add(const std::vector<double> &v, size_t startrow, size_t nrows, double lo, double hi);
+		// clear the rows of "level" that have been written
+		void written(size_t level);
+		// all rows of all levels have been computed
+		bool complete();
+
+	private:
+		std::vector<size_t> nextrow;
+		std::vector<std::vector<double>> sum, cnt;
+		void add_row(size_t level, const double *s, const double *c, size_t stride);
+};
+
+
+// the state of a file that is being written (see writeStartGDAL)
+class SpatWriteStream {
+	public:
+		SpatStreamStats stats;
+		SpatOverviewStream ovr;
+		// the overviews are computed from the values that are written
+		bool overviews = false;
+		// the overviews must be computed by GDAL from the file
+		bool regenerate = false;
+		std::string resampling;
+};
+
+
+// the number of overview levels for a COG (the smallest overview fits
+// in one block)
+size_t cog_overview_count(size_t nrow, size_t ncol, size_t blocksize);
+
+#endif
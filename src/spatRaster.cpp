@@ -243,6 +243,9 @@ SpatRaster SpatRaster::geometry(long nlyrs, bool properties, bool time) {
 		}
 	}
 	s.names = nms;
+	// blocks aligned to the tiles of the input are also good for the output
+	s.blockrows = source[0].blockrows;
+	s.blockcols = source[0].blockcols;
 	SpatRaster out(s);
 	if (properties) {
 		out.rgb = rgb;
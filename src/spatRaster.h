@@ -17,6 +17,8 @@
 
 #include <fstream>
 #include <numeric>
+#include <functional>
+#include <memory>
 #include "spatVector.h"
 
 #ifdef useGDAL
@@ -40,6 +42,9 @@ class SpatCategories {
 };
 
 
+class SpatScratch;
+class SpatChunkCache;
+
 class SpatWindow {
 	public:
 		SpatExtent full_extent;
@@ -57,7 +62,7 @@ class SpatRasterSource {
 	public:
 #ifdef useGDAL
 		GDALDataset* gdalconnection;
-#if GDAL_VERSION_MAJOR >= 3 && GDAL_VERSION_MINOR >= 1	
+#if (GDAL_VERSION_MAJOR > 3) || (GDAL_VERSION_MAJOR == 3 && GDAL_VERSION_MINOR >= 1)
 		GDALMDArrayH gdalmdarray;
 #endif
 #endif
@@ -79,6 +84,9 @@ class SpatRasterSource {
 		bool flipped=false;
 		bool hasWindow=false;
 		SpatWindow window;
+		// block (tile or strip) size of the file; zero if unknown
+		size_t blockrows = 0;
+		size_t blockcols = 0;
 	
 
 		bool multidim = false;
@@ -90,6 +98,9 @@ class SpatRasterSource {
 		std::vector<size_t> m_counts;
 		std::vector<size_t> m_order;
 		std::vector<size_t> m_subset;
+		// chunk size of each dimension; zero if not chunked
+		std::vector<size_t> m_chunks;
+		std::shared_ptr<SpatChunkCache> m_cache;
 		bool m_hasNA = false;
 		double m_missing_value;
 
@@ -133,6 +144,13 @@ class SpatRasterSource {
 		std::string filename;
 		std::string driver;
 		std::string datatype; 
+		// for driver "scratch"; shared by the copies of this source, 
+		// the files are removed when the last copy goes
+		std::shared_ptr<SpatScratch> scratch;
+		// the nodata values of the file are the NA values of the datatype
+		// (see native_NA_compatible), or, for FLT types, there are none;
+		// if not, it is not read natively
+		bool native_NA = true;
 		
 		// user set for reading:
 		bool hasNAflag = false;
@@ -165,9 +183,36 @@ class BlockSize {
 	public:
 		std::vector<size_t> row;
 		std::vector<size_t> nrows;
+		std::vector<size_t> col;
+		std::vector<size_t> ncols;
 		unsigned n;
 };
 
+// how the blocks of a method are processed, such that getBlockSize
+// can take the memory that is used into account
+class BlockLayout {
+	public:
+		// the blocks are computed by a pool of threads (writeBlocks)
+		// that keeps up to two blocks per thread in memory
+		bool threaded = false;
+		// blocks may be windows of rows and columns (aligned to file tiles)
+		bool tiles = false;
+		// bytes per cell value in a block (8 for double, less for native types)
+		unsigned elsize = 8;
+};
+
+// processing of blocks with writeBlocks. The reader gets the input values
+// of block i and the worker computes the output values, to be returned in d[0].
+// Workers may run on other threads; they should only use "d" and local data
+typedef std::function<bool(size_t i, std::vector<std::vector<double>> &d)> BlockReader;
+typedef std::function<void(size_t i, std::vector<std::vector<double>> &d)> BlockWorker;
+
+class SpatAsyncRead;
+class SpatAsyncWindow;
+class SpatAsyncWrite;
+class SpatRAMReservation;
+class SpatWriteStream;
+
 class SpatRaster {
 
     private:
@@ -178,6 +223,7 @@ class SpatRaster {
 		bool gdal_stats = false;
 		bool gdal_approx = true;
 		bool gdal_minmax = true;
+		std::shared_ptr<SpatWriteStream> wstream;
 
 	protected:
 		SpatExtent window;
@@ -195,13 +241,23 @@ class SpatRaster {
 		
 		std::vector<SpatRasterSource> source;
 
+		// read-ahead (readBlock) and queued writes (writeValues). See spatAsync.h
+		// declared after "source" such that pending reads finish before it is destroyed
+		std::shared_ptr<SpatAsyncRead> prefetch;
+		std::shared_ptr<SpatAsyncWrite> writeq;
+		// the RAM this raster needs while it is written (writeStart to writeStop,
+		// or to an error). Released when the last copy is destroyed. See ram.h
+		std::shared_ptr<SpatRAMReservation> ramreserved;
+
 		BlockSize bs;
 		//BlockSize getBlockSize(unsigned n, double frac, unsigned steps=0);
-		BlockSize getBlockSize(SpatOptions &opt);
+		BlockSize getBlockSize(SpatOptions &opt, BlockLayout layout=BlockLayout());
 		std::vector<double> mem_needs(SpatOptions &opt);
 
 		SpatMessages msg;
-		void setError(std::string s) { msg.setError(s); }
+		// a raster with an error is not written anymore, so the RAM that was
+		// reserved for it by writeStart is released (also if writeStop is not called)
+		void setError(std::string s) { msg.setError(s); ramreserved.reset(); }
 		void addWarning(std::string s) { msg.addWarning(s); }
 		void setMessage(std::string s) { msg.setMessage(s); }
 		bool hasError() { return msg.has_error; }
@@ -429,23 +485,43 @@ class SpatRaster {
 
 		bool readAll();
 
+		bool prefetchable();
+		void prefetchStart(size_t row, size_t nrows, size_t col, size_t ncols);
+		bool prefetchGet(std::vector<double> &out, size_t row, size_t nrows, size_t col, size_t ncols);
+		void prefetchStop();
+		bool writeQueue(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
+		bool writeWait();
+
+		// reading and writing blocks in the datatype of the file (see spatBlock.h)
+		bool native_datatype(std::string &datatype);
+		bool native_output(std::string &datatype, SpatOptions &opt);
+		template <typename T> bool readValuesNative(std::vector<T> &out, size_t row, size_t nrows, size_t col, size_t ncols);
+		template <typename T> bool writeValuesNative(std::vector<T> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
+		bool copyValuesNative(SpatRaster &out, std::string datatype, size_t row, size_t col);
+
 		bool writeStart(SpatOptions &opt);
+		bool writeStart(SpatOptions &opt, BlockLayout layout);
 		bool writeValues(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
 		bool writeValues2(std::vector<std::vector<double>> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
+		bool writeBlocks(BlockReader reader, BlockWorker worker, SpatOptions &opt);
 		bool writeStop();
 		bool writeHDR(std::string filename);
 		SpatRaster make_vrt(std::vector<std::string> filenames, SpatOptions &opt);
 
 		//bool writeStartGDAL(std::string filename, std::string driver, std::string datatype, bool overwrite, SpatOptions &opt);
-		bool writeStartGDAL(SpatOptions &opt);		
+		bool writeStartGDAL(SpatOptions &opt, const BlockSize &blocks);		
 		bool fillValuesGDAL(double fillvalue);
 		bool writeValuesGDAL(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
 		bool writeStopGDAL();
+		bool writeStream(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
+		bool writeOverviewsGDAL();
 
 
 		bool readStartMulti(unsigned src);
 		bool readStopMulti(unsigned src);
 		bool readValuesMulti(std::vector<double> &data, size_t src, size_t row, size_t nrows, size_t col, size_t ncols);
+		bool readMulti(std::vector<double> &out, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols, const std::vector<unsigned> &lyrs);
+		bool readRowColMulti(unsigned src, const std::vector<int_64> &rows, const std::vector<int_64> &cols, std::vector<double> &out);
 
 
 
@@ -454,6 +530,14 @@ class SpatRaster {
 
 		bool writeValuesMem(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
 
+		// scratch source (temporary, see spatScratch.h)
+		bool writeStartScratch(SpatOptions &opt, std::string filename);
+		bool writeValuesScratch(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
+		bool writeStopScratch();
+		void readChunkScratch(std::vector<double> &data, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols);
+		template <typename T> void readChunkScratchNative(std::vector<T> &data, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols);
+		bool readRowColScratch(unsigned src, const std::vector<int_64> &rows, const std::vector<int_64> &cols, std::vector<double> &out);
+
 		// binary (flat) source
 		//std::vector<double> readValuesBinary(unsigned src, unsigned row, unsigned nrows, unsigned col, unsigned ncols);
 		//std::vector<double> readSampleBinary(unsigned src, unsigned srows, unsigned scols);
@@ -463,11 +547,16 @@ class SpatRaster {
 		std::vector<double> readValuesGDAL(unsigned src, size_t row, size_t nrows, size_t col, size_t ncols, int lyr = -1);
 		std::vector<double> readGDALsample(unsigned src, size_t srows, size_t scols);
 		std::vector<std::vector<double>> readRowColGDAL(unsigned src, std::vector<int_64> &rows, const std::vector<int_64> &cols);
+		bool readRowColBlocksGDAL(unsigned src, const std::vector<int_64> &rows, const std::vector<int_64> &cols, std::vector<double> &out);
 		std::vector<double> readRowColGDALFlat(unsigned src, std::vector<int_64> &rows, const std::vector<int_64> &cols);
 
 		bool readStartGDAL(unsigned src);
 		bool readStopGDAL(unsigned src);
 		void readChunkGDAL(std::vector<double> &data, unsigned src, size_t row, unsigned nrows, size_t col, unsigned ncols);
+		SpatAsyncWindow gdalWindow(unsigned src, size_t row, size_t col);
+		void readChunkGDALFinish(std::vector<double> &out, unsigned src, size_t nrows, size_t ncols);
+		template <typename T> void readChunkGDALNative(std::vector<T> &data, unsigned src, size_t row, unsigned nrows, size_t col, unsigned ncols);
+		template <typename T> bool writeValuesGDALNative(std::vector<T> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
 
 		bool setWindow(SpatExtent x);
 		bool removeWindow();
@@ -482,6 +571,7 @@ class SpatRaster {
 
 		bool canProcessInMemory(SpatOptions &opt);
 		size_t chunkSize(SpatOptions &opt);
+		size_t chunkSize(SpatOptions &opt, unsigned elsize);
 
 		void fill(double x);
 
@@ -509,6 +599,7 @@ class SpatRaster {
 		std::vector<std::vector<double>> area_by_value(SpatOptions &opt);
 
 		SpatRaster arith(SpatRaster x, std::string oper, SpatOptions &opt);
+		SpatRaster expression(std::vector<std::string> ops, std::vector<double> args, SpatOptions &opt);
 		SpatRaster arith(double x, std::string oper, bool reverse, SpatOptions &opt);
 		SpatRaster arith(std::vector<double> x, std::string oper, bool reverse, SpatOptions &opt);
 		SpatRaster apply(std::vector<unsigned> ind, std::string fun, bool narm, std::vector<std::string> nms, SpatOptions &opt);
@@ -536,6 +627,8 @@ class SpatRaster {
 		SpatRaster distance(SpatOptions &opt);
 		SpatRaster distance(SpatVector p, SpatOptions &opt);
 		SpatRaster clumps(int directions, bool zeroAsNA, SpatOptions &opt);
+		// the number of cells and the extent of each patch
+		SpatDataFrame patchStats(int directions, bool zeroAsNA, SpatOptions &opt);
 
 		SpatRaster edges(bool classes, std::string type, unsigned directions, double falseval, SpatOptions &opt);
 		SpatRaster extend(SpatExtent e, SpatOptions &opt);
@@ -647,6 +740,7 @@ class SpatRaster {
 		SpatRaster trig(std::string fun, SpatOptions &opt);
 		SpatRaster trim(double value, unsigned padding, SpatOptions &opt);
 		std::vector<std::vector<double>> unique(bool bylayer, SpatOptions &opt);
+		std::vector<std::vector<double>> crosstab(bool round, int digits, bool narm, SpatOptions &opt);
 		SpatRaster project1(std::string newcrs, std::string method, SpatOptions &opt);
 		SpatRaster project2(SpatRaster &x, std::string method, SpatOptions &opt);
 		void project3(SpatRaster &out, std::string method, SpatOptions &opt);
@@ -655,10 +749,11 @@ class SpatRaster {
 //		void resample2(SpatRaster &out, const std::string &method, SpatOptions &opt);
 
 #ifdef useGDAL
-		bool getDSh(GDALDatasetH &rstDS, SpatRaster out, std::string &filename, std::string &driver, double &naval, std::string &msg, bool update, double background, SpatOptions opt);
 		bool open_gdal(GDALDatasetH &hDS, int src, SpatOptions &opt);
-		bool create_gdalDS(GDALDatasetH &hDS, std::string filename, std::string driver, bool fill, double fillvalue, std::vector<bool> has_so, std::vector<double> scale, std::vector<double> offset, SpatOptions& opt);
-		bool from_gdalMEM(GDALDatasetH hDS, bool set_geometry, bool get_values);
+		// with "inplace" (MEM only), the bands are doubles that point to the values of this raster
+		bool create_gdalDS(GDALDatasetH &hDS, std::string filename, std::string driver, bool fill, double fillvalue, std::vector<bool> has_so, std::vector<double> scale, std::vector<double> offset, SpatOptions& opt, bool inplace=false);
+		// "inplace" must be the same as for create_gdalDS (and cannot be used with set_geometry)
+		bool from_gdalMEM(GDALDatasetH hDS, bool set_geometry, bool get_values, bool inplace=false);
 
 		bool as_gdalvrt(GDALDatasetH &hVRT, SpatOptions &opt);
 		//bool as_gdalmem(GDALDatasetH &hVRT);
@@ -681,7 +776,7 @@ class SpatRaster {
 
 		//SpatRaster warp_gdal(SpatRaster x, const std::string &method, SpatOptions &opt);
 		//SpatRaster warp_gdal_crs(std::string x, const std::string &method, SpatOptions &opt);
-		SpatDataFrame zonal(SpatRaster x, std::string fun, bool narm, SpatOptions &opt);
+		SpatDataFrame zonal(SpatRaster x, std::string fun, bool narm, std::vector<double> probs, bool approx, SpatOptions &opt);
 		SpatRaster rgb2col(size_t r,  size_t g, size_t b, SpatOptions &opt);
 		SpatRaster which(SpatOptions &opt);
 		SpatRaster is_true(SpatOptions &opt);
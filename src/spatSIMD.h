@@ -0,0 +1,59 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATSIMD_GUARD
+#define SPATSIMD_GUARD
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+// Kernels for the cell-by-cell loops that are run for every block:
+// comparisons, NA flags, scale/offset and the range of the values.
+// On x86 they use AVX2 or AVX-512 if the CPU has it (checked at runtime);
+// otherwise (and for the last few cells) a scalar loop. All give the same
+// results. A NAN in any of the operands of a comparison gives NAN.
+
+enum SpatCmp { SIMD_EQ=0, SIMD_NE, SIMD_GT, SIMD_LT, SIMD_GE, SIMD_LE };
+
+// the SpatCmp for "==", "!=", ">", "<", ">=" or "<="; -1 for other operators
+int simd_cmp_code(const std::string &oper);
+
+// a[i] = a[i] OP b[i]
+void simd_compare(double *a, const double *b, size_t n, int op);
+
+// a[i] = a[i] OP b; or b OP a[i] if "reverse"
+void simd_compare_scalar(double *a, double b, size_t n, int op, bool reverse);
+
+// a[i] = NAN if a[i] == flag; or if a[i] < flag if "below"
+void simd_set_na(double *a, size_t n, double flag, bool below);
+
+// a[i] = a[i] * scale + offset
+void simd_scale_offset(double *a, size_t n, double scale, double offset);
+
+// the range of the values between lmin and lmax (NAN is ignored).
+// returns false (and NAN for vmin and vmax) if there are no such values
+bool simd_minmax(const double *a, size_t n, double &vmin, double &vmax, double lmin, double lmax);
+bool simd_minmax(const double *a, size_t n, double &vmin, double &vmax);
+
+// the instruction set that is used: "AVX-512", "AVX2" or "scalar"
+std::string simd_level();
+
+// cells per second for each kernel, without ("scalar") and with SIMD
+void simd_benchmark(size_t n, size_t reps, std::vector<std::string> &kernel, std::vector<double> &scalar, std::vector<double> &simd);
+
+#endif
@@ -0,0 +1,60 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATSCANLINE_GUARD
+#define SPATSCANLINE_GUARD
+
+#include <vector>
+#include <cstddef>
+#include "spatIndex.h"
+
+class SpatGeom;
+class SpatVector;
+
+// Rasterization of geometries on a grid of cells, without GDAL. The cells
+// are returned as (sorted) cell numbers of the grid. Polygons may have
+// holes (the "even-odd" rule is used for the rings of each part).
+
+class SpatScanGrid {
+	public:
+		double xmin, ymax, xres, yres;
+		size_t nrow, ncol;
+		SpatScanGrid(double x, double y, double rx, double ry, size_t nr, size_t nc) :
+			xmin(x), ymax(y), xres(rx), yres(ry), nrow(nr), ncol(nc) {};
+};
+
+// the cells with their center inside the polygon, or, with "touches", also
+// the cells that are touched by its boundary
+void scan_polygon(const SpatGeom &g, const SpatScanGrid &grid, bool touches, std::vector<double> &cells);
+
+// the cells that a line passes through
+void scan_lines(const SpatGeom &g, const SpatScanGrid &grid, std::vector<double> &cells);
+
+// the cells that have a point
+void scan_points(const SpatGeom &g, const SpatScanGrid &grid, std::vector<double> &cells);
+
+// scan_polygon, scan_lines or scan_points, depending on the type of geometry
+void scan_geometry(const SpatGeom &g, const SpatScanGrid &grid, bool touches, std::vector<double> &cells);
+
+// the cells that are covered by a polygon, and the fraction of each cell that is covered
+void scan_coverage(const SpatGeom &g, const SpatScanGrid &grid, std::vector<double> &cells, std::vector<double> &fraction);
+
+// an R-tree of the extents of the geometries, to find the geometries that
+// may cover a block of rows
+SpatRTree scan_index(SpatVector &v);
+
+#endif
@@ -0,0 +1,74 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATSCRATCH_GUARD
+#define SPATSCRATCH_GUARD
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <mutex>
+
+// Scratch files for intermediate results that do not fit in memory.
+// The cell values are stored raw, in the native datatype, band
+// sequential and row major (such that a block of rows of a layer is a
+// single contiguous slice); with an ENVI header such that GDAL can
+// also read them. The file is memory mapped where that is available.
+// The object owns the files; they are removed when the last
+// SpatRasterSource that refers to it is destroyed.
+
+class SpatScratch {
+	public:
+		SpatScratch() {};
+		~SpatScratch();
+		SpatScratch(const SpatScratch&) = delete;
+		SpatScratch& operator=(const SpatScratch&) = delete;
+
+		std::string filename;
+		std::string hdrfile;
+		std::string datatype;
+		size_t nrow = 0;
+		size_t ncol = 0;
+		size_t nlyr = 0;
+		size_t elsize = 8;
+
+		bool create(std::string fname, size_t nr, size_t nc, size_t nl, std::string dtype, std::string &msg);
+		bool write(const std::vector<double> &v, size_t row, size_t nrows, size_t col, size_t ncols);
+		bool fill(double x);
+		bool finish(const std::vector<std::string> &names, double xmin, double ymax, double xres, double yres, const std::string &wkt, std::string &msg);
+
+		// layers are the (zero based) layers in the file
+		bool read(std::vector<double> &out, size_t row, size_t nrows, size_t col, size_t ncols, const std::vector<unsigned> &layers);
+		template <typename T> bool read_native(std::vector<T> &out, size_t row, size_t nrows, size_t col, size_t ncols, const std::vector<unsigned> &layers);
+		// values for cells, layer by layer; NAN for cells outside the raster
+		bool read_cells(const std::vector<long long> &rows, const std::vector<long long> &cols, const std::vector<unsigned> &layers, std::vector<double> &out);
+
+	private:
+		char *data = NULL;
+		size_t nbytes = 0;
+		int fd = -1;
+		std::fstream fs;
+		std::mutex fsmutex;
+
+		bool get(char *dst, size_t offset, size_t n);
+		bool put(const char *src, size_t offset, size_t n);
+		template <typename T> bool write_type(const std::vector<double> &v, size_t row, size_t nrows, size_t col, size_t ncols);
+		template <typename T> bool read_type(std::vector<T> &out, size_t row, size_t nrows, size_t col, size_t ncols, const std::vector<unsigned> &layers);
+		template <typename T> bool read_cells_type(const std::vector<long long> &rows, const std::vector<long long> &cols, const std::vector<unsigned> &layers, std::vector<double> &out);
+};
+
+#endif
@@ -424,7 +424,9 @@ bool SpatRasterSource::combine_sources(const SpatRasterSource &x) {
 	cats.insert(cats.end(), x.cats.begin(), x.cats.end());
 	hasColors.insert(hasColors.end(), x.hasColors.begin(), x.hasColors.end());
 	cols.insert(cols.end(), x.cols.begin(), x.cols.end());
-	datatype.insert(datatype.end(), x.datatype.begin(), x.datatype.end());
+	if (datatype != x.datatype) {
+		datatype = "";
+	}
 	has_scale_offset.insert(has_scale_offset.end(), x.has_scale_offset.begin(), x.has_scale_offset.end());
 	scale.insert(scale.end(), x.scale.begin(), x.scale.end());
 	offset.insert(offset.end(), x.offset.begin(), x.offset.end());
@@ -466,7 +468,9 @@ bool SpatRasterSource::combine(SpatRasterSource &x) {
 	cats.insert(cats.end(), x.cats.begin(), x.cats.end());
 	hasColors.insert(hasColors.end(), x.hasColors.begin(), x.hasColors.end());
 	cols.insert(cols.end(), x.cols.begin(), x.cols.end());
-	datatype.insert(datatype.end(), x.datatype.begin(), x.datatype.end());
+	if (datatype != x.datatype) {
+		datatype = "";
+	}
 	has_scale_offset.insert(has_scale_offset.end(), x.has_scale_offset.begin(), x.has_scale_offset.end());
 	scale.insert(scale.end(), x.scale.begin(), x.scale.end());
 	offset.insert(offset.end(), x.offset.begin(), x.offset.end());
@@ -136,6 +136,204 @@ SpatPart SpatGeom::getPart(unsigned i) {
 	return parts[i];
 }
 
+
+void SpatGeomColumns::clear() {
+	gtype = unknown;
+	n = 0;
+	x.clear(); y.clear();
+	ring.clear(); part.clear(); geom.clear();
+}
+
+void SpatGeomColumns::set_offsets() {
+	if (!single()) return;
+	ring.resize(n+1);
+	std::iota(ring.begin(), ring.end(), 0);
+	part = ring;
+	geom = ring;
+}
+
+bool SpatGeomColumns::add(const SpatGeom &g) {
+	if (g.gtype == unknown) return false;
+	if (n == 0) {
+		gtype = g.gtype;
+	} else if (g.gtype != gtype) {
+		return false;
+	}
+	if (single() && (g.gtype == points) && (g.parts.size() == 1)
+			&& (g.parts[0].x.size() == 1) && (g.parts[0].holes.size() == 0)) {
+		x.push_back(g.parts[0].x[0]);
+		y.push_back(g.parts[0].y[0]);
+		n++;
+		return true;
+	}
+	set_offsets();
+	for (size_t j=0; j<g.parts.size(); j++) {
+		const SpatPart &p = g.parts[j];
+		x.insert(x.end(), p.x.begin(), p.x.end());
+		y.insert(y.end(), p.y.begin(), p.y.end());
+		ring.push_back(x.size());
+		for (size_t k=0; k<p.holes.size(); k++) {
+			x.insert(x.end(), p.holes[k].x.begin(), p.holes[k].x.end());
+			y.insert(y.end(), p.holes[k].y.begin(), p.holes[k].y.end());
+			ring.push_back(x.size());
+		}
+		part.push_back(ring.size()-1);
+	}
+	geom.push_back(part.size()-1);
+	n++;
+	return true;
+}
+
+
+SpatGeom SpatGeomColumns::get(size_t i) const {
+	SpatGeom g(gtype);
+	if (single()) {
+		g.addPart(SpatPart(x[i], y[i]));
+		return g;
+	}
+	for (size_t j=geom[i]; j<geom[i+1]; j++) {
+		size_t r = part[j];
+		SpatPart p;
+		if (ring[r+1] > ring[r]) {
+			p = SpatPart(std::vector<double>(x.begin()+ring[r], x.begin()+ring[r+1]),
+						std::vector<double>(y.begin()+ring[r], y.begin()+ring[r+1]));
+		}
+		for (r=r+1; r<part[j+1]; r++) {
+			p.addHole(std::vector<double>(x.begin()+ring[r], x.begin()+ring[r+1]),
+						std::vector<double>(y.begin()+ring[r], y.begin()+ring[r+1]));
+		}
+		g.addPart(p);
+	}
+	return g;
+}
+
+
+SpatExtent SpatGeomColumns::getExtent() const {
+	SpatExtent e;
+	double xmin = INFINITY, xmax = -INFINITY, ymin = INFINITY, ymax = -INFINITY;
+	for (size_t i=0; i<x.size(); i++) {
+		if (std::isnan(x[i]) || std::isnan(y[i])) continue;
+		xmin = std::min(xmin, x[i]);
+		xmax = std::max(xmax, x[i]);
+		ymin = std::min(ymin, y[i]);
+		ymax = std::max(ymax, y[i]);
+	}
+	if (xmin > xmax) return e;
+	e.xmin = xmin; e.xmax = xmax;
+	e.ymin = ymin; e.ymax = ymax;
+	return e;
+}
+
+
+SpatGeomColumns SpatGeomColumns::subset(const std::vector<unsigned> &r) const {
+	SpatGeomColumns out;
+	out.gtype = gtype;
+	out.n = r.size();
+	if (single()) {
+		out.x.reserve(r.size());
+		out.y.reserve(r.size());
+		for (size_t i=0; i<r.size(); i++) {
+			out.x.push_back(x[r[i]]);
+			out.y.push_back(y[r[i]]);
+		}
+		return out;
+	}
+	out.ring.push_back(0);
+	out.part.push_back(0);
+	out.geom.push_back(0);
+	for (size_t i=0; i<r.size(); i++) {
+		for (size_t j=geom[r[i]]; j<geom[r[i]+1]; j++) {
+			for (size_t k=part[j]; k<part[j+1]; k++) {
+				out.x.insert(out.x.end(), x.begin()+ring[k], x.begin()+ring[k+1]);
+				out.y.insert(out.y.end(), y.begin()+ring[k], y.begin()+ring[k+1]);
+				out.ring.push_back(out.x.size());
+			}
+			out.part.push_back(out.ring.size()-1);
+		}
+		out.geom.push_back(out.part.size()-1);
+	}
+	return out;
+}
+
+
+SpatExtent SpatGeomColumns::getExtent(size_t i) const {
+	SpatExtent e;
+	size_t first = single() ? i : ring[part[geom[i]]];
+	size_t last = single() ? i+1 : ring[part[geom[i+1]]];
+	double xmin = INFINITY, xmax = -INFINITY, ymin = INFINITY, ymax = -INFINITY;
+	for (size_t j=first; j<last; j++) {
+		if (std::isnan(x[j]) || std::isnan(y[j])) continue;
+		xmin = std::min(xmin, x[j]);
+		xmax = std::max(xmax, x[j]);
+		ymin = std::min(ymin, y[j]);
+		ymax = std::max(ymax, y[j]);
+	}
+	if (xmin > xmax) return e;
+	e.xmin = xmin; e.xmax = xmax;
+	e.ymin = ymin; e.ymax = ymax;
+	return e;
+}
+
+size_t SpatGeomColumns::nxy(size_t i) const {
+	if (single()) return 1;
+	return ring[part[geom[i+1]]] - ring[part[geom[i]]];
+}
+
+
+void SpatGeoms::unpack() {
+	if (!ispacked) return;
+	g.clear();
+	g.reserve(c.size());
+	for (size_t i=0; i<c.size(); i++) {
+		g.push_back(c.get(i));
+	}
+	c.clear();
+	ispacked = false;
+}
+
+bool SpatGeoms::pack() {
+	if (ispacked) return true;
+	SpatGeomColumns cc;
+	for (size_t i=0; i<g.size(); i++) {
+		if (!cc.add(g[i])) return false;
+	}
+	c = cc;
+	g.clear();
+	g.shrink_to_fit();
+	ispacked = true;
+	return true;
+}
+
+size_t SpatGeoms::nxy(size_t i) const {
+	if (ispacked) return c.nxy(i);
+	size_t n = 0;
+	for (size_t j=0; j<g[i].parts.size(); j++) {
+		n += g[i].parts[j].x.size();
+		for (size_t k=0; k<g[i].parts[j].holes.size(); k++) {
+			n += g[i].parts[j].holes[k].x.size();
+		}
+	}
+	return n;
+}
+
+SpatGeomType SpatGeoms::gtype() const {
+	if (ispacked) return c.gtype;
+	return g.empty() ? unknown : g[0].gtype;
+}
+
+void SpatGeoms::push_back(const SpatGeom &x) {
+	if (ispacked) {
+		if (c.add(x)) return;
+		unpack();
+	}
+	g.push_back(x);
+}
+
+void SpatGeoms::resize(size_t n) {
+	unpack();
+	g.resize(n);
+}
+
 SpatVector::SpatVector() {
 	
 	srs.proj4 = "+proj=longlat +datum=WGS84";
@@ -167,15 +365,7 @@ SpatVector::SpatVector(std::vector<double> x, std::vector<double> y, SpatGeomTyp
 	if (x.size() == 0) return;
 	
 	if (g == points) {
-		SpatPart p(x[0], y[0]);
-		SpatGeom geom(p);
-		geom.gtype = g;
-		setGeom(geom);
-		for (size_t i=1; i<x.size(); i++) {
-			SpatPart p(x[i], y[i]);
-			geom.setPart(p, 0);
-			addGeom(geom);			
-		}
+		setPointsGeometry(x, y);
 	} else {
 		SpatPart p(x, y);
 		SpatGeom geom(p);
@@ -256,11 +446,13 @@ std::string SpatVector::getPRJ(){
 std::string SpatVector::type(){
 	if (size() == 0) {
 		return "none";
-	} else if (geoms[0].gtype == points) {
+	}
+	SpatGeomType gt = geoms.gtype();
+	if (gt == points) {
 		return "points";
-	} else if (geoms[0].gtype == lines) {
+	} else if (gt == lines) {
 		return "lines";
-	} else if (geoms[0].gtype == polygons) {
+	} else if (gt == polygons) {
 		return "polygons";
 	} else {
 		return("unknown");
@@ -270,7 +462,7 @@ std::string SpatVector::type(){
 
 
 SpatGeom SpatVector::getGeom(unsigned i) {
-	return geoms[i];
+	return geoms.get(i);
 }
 
 bool SpatVector::addGeom(SpatGeom p) {
@@ -292,6 +484,10 @@ bool SpatVector::setGeom(SpatGeom p) {
 
 void SpatVector::computeExtent() {
 	if (geoms.size() == 0) return;
+	if (geoms.packed()) {
+		extent = geoms.columns().getExtent();
+		return;
+	}
 	extent = geoms[0].extent;
 	for (size_t i=1; i<geoms.size(); i++) {
 		extent.unite(geoms[i].extent);
@@ -318,6 +514,16 @@ bool SpatVector::replaceGeom(SpatGeom p, unsigned i) {
 
 unsigned SpatVector::nxy() {
 	unsigned n = 0;
+	if (geoms.packed()) {
+		SpatGeomColumns &c = geoms.columns();
+		n = c.x.size();
+		if (!c.single()) {
+			for (size_t i=0; i<c.size(); i++) {
+				if (c.geom[i] == c.geom[i+1]) n++; // empty
+			}
+		}
+		return n;
+	}
 	for (size_t i=0; i < size(); i++) {
 		SpatGeom g = getGeom(i);
 		if (g.size() == 0) {
@@ -340,6 +546,11 @@ unsigned SpatVector::nxy() {
 
 std::vector<std::vector<double>> SpatVector::coordinates() {
 	std::vector<std::vector<double>> out(2);
+	if (geoms.packed()) {
+		out[0] = geoms.columns().x;
+		out[1] = geoms.columns().y;
+		return out;
+	}
 	for (size_t i=0; i < size(); i++) {
 		SpatGeom g = getGeom(i);
 		for (size_t j=0; j < g.size(); j++) {
@@ -376,6 +587,39 @@ SpatDataFrame SpatVector::getGeometryDF() {
 	out.resize_rows(n);
 
 	size_t idx = 0;
+	if (geoms.packed()) {
+		SpatGeomColumns &c = geoms.columns();
+		for (size_t i=0; i < c.size(); i++) {
+			size_t p1 = c.single() ? 0 : c.geom[i];
+			size_t p2 = c.single() ? 1 : c.geom[i+1];
+			if (p1 == p2) { // empty
+				out.iv[0][idx] = i+1;
+				out.iv[1][idx] = 1;
+				out.dv[0][idx] = NAN;
+				out.dv[1][idx] = NAN;
+				out.iv[2][idx] = 0;
+				idx++;
+			}
+			for (size_t j=p1; j<p2; j++) {
+				size_t r1 = c.single() ? i : c.part[j];
+				size_t r2 = c.single() ? i+1 : c.part[j+1];
+				for (size_t r=r1; r<r2; r++) {
+					size_t q1 = c.single() ? i : c.ring[r];
+					size_t q2 = c.single() ? i+1 : c.ring[r+1];
+					for (size_t q=q1; q<q2; q++) {
+						out.iv[0][idx] = i+1;
+						out.iv[1][idx] = j-p1+1;
+						out.dv[0][idx] = c.x[q];
+						out.dv[1][idx] = c.y[q];
+						out.iv[2][idx] = r-r1;
+						idx++;
+					}
+				}
+			}
+		}
+		return out;
+	}
+
 	for (size_t i=0; i < size(); i++) {
 		SpatGeom g = getGeom(i);
 		if (g.size() == 0) { // empty
@@ -421,9 +665,20 @@ std::vector<std::vector<double>> SpatVector::getGeometry() {
 
 	unsigned n = nxy();
 	std::vector<std::vector<double>> out(5);
-	for (size_t i=0; i>out.size(); i++) {
+	for (size_t i=0; i<out.size(); i++) {
 		out[i].reserve(n);
 	}
+	if (geoms.packed()) {
+		SpatDataFrame d = getGeometryDF();
+		for (size_t i=0; i<d.nrow(); i++) {
+			out[0].push_back(d.iv[0][i]);
+			out[1].push_back(d.iv[1][i]);
+			out[2].push_back(d.dv[0][i]);
+			out[3].push_back(d.dv[1][i]);
+			out[4].push_back(d.iv[2][i]);
+		}
+		return out;
+	}
 	for (size_t i=0; i < size(); i++) {
 		SpatGeom g = getGeom(i);
 		if (g.size() == 0) { // empty
@@ -551,6 +806,7 @@ SpatGeomType SpatVector::getGType(std::string &type) {
 void SpatVector::setGeometry(std::string type, std::vector<unsigned> gid, std::vector<unsigned> part, std::vector<double> x, std::vector<double> y, std::vector<unsigned> hole) {
 
 // it is assumed that values are sorted by gid, part, hole
+	if (size() == 0) geoms.pack();
 	unsigned lastgeom = gid[0];
 	unsigned lastpart = part[0];
 	unsigned lasthole = hole[0];
@@ -626,6 +882,17 @@ void SpatVector::setGeometry(std::string type, std::vector<unsigned> gid, std::v
 
 
 void SpatVector::setPointsGeometry(std::vector<double> x, std::vector<double> y) {
+	if (x.size() == 0) return;
+	if ((size() == 0) || ((geoms.packed()) && (geoms.gtype() == points) && geoms.columns().single())) {
+		geoms.pack();
+		SpatGeomColumns &c = geoms.columns();
+		c.gtype = points;
+		c.x.insert(c.x.end(), x.begin(), x.end());
+		c.y.insert(c.y.end(), y.begin(), y.end());
+		c.n += x.size();
+		computeExtent();
+		return;
+	}
 	SpatGeom g;
 	g.gtype = points;
 	for (size_t i=0; i<x.size(); i++) {
@@ -649,8 +916,13 @@ SpatVector SpatVector::subset_rows(std::vector<int> range) {
 		}
 	}
 
-	for (size_t i=0; i < r.size(); i++) {
-		out.addGeom( geoms[r[i]] );
+	if (geoms.packed()) {
+		out.geoms.setColumns(geoms.columns().subset(r));
+		out.computeExtent();
+	} else {
+		for (size_t i=0; i < r.size(); i++) {
+			out.addGeom( geoms[r[i]] );
+		}
 	}
 	out.srs = srs;
 	out.df = df.subset_rows(r);
@@ -669,8 +941,13 @@ SpatVector SpatVector::subset_rows(std::vector<unsigned> range) {
 		}
 	}
 
-	for (size_t i=0; i < r.size(); i++) {
-		out.addGeom( geoms[r[i]] );
+	if (geoms.packed()) {
+		out.geoms.setColumns(geoms.columns().subset(r));
+		out.computeExtent();
+	} else {
+		for (size_t i=0; i < r.size(); i++) {
+			out.addGeom( geoms[r[i]] );
+		}
 	}
 	out.srs = srs;
 	out.df = df.subset_rows(r);
@@ -793,24 +1070,66 @@ SpatVector SpatVector::cbind(SpatDataFrame d) {
 
 SpatVector SpatVector::as_points(bool multi, bool skiplast) {
 	SpatVector v = *this;
-	if (geoms[0].gtype == points) {
+	if (geoms.gtype() == points) {
 		v.addWarning("returning a copy");
 		return v;
 	}
-	size_t skip = 0;
-	if (geoms[0].gtype == polygons) {
-		v = v.as_lines();
-		if (skiplast) {
-			skip = 1;
+	size_t skip = ((geoms.gtype() == polygons) && skiplast) ? 1 : 0;
+
+	if (geoms.packed()) {
+		SpatGeomColumns &c = geoms.columns();
+		SpatGeomColumns pc;
+		pc.gtype = points;
+		std::vector<unsigned> id;
+		if (multi) {
+			pc.ring.push_back(0);
+			pc.part.push_back(0);
+			pc.geom.push_back(0);
 		}
+		for (size_t i=0; i<c.size(); i++) {
+			// as with as_lines, the outer rings come first, then the holes
+			std::vector<size_t> rings;
+			for (size_t j=c.geom[i]; j<c.geom[i+1]; j++) {
+				rings.push_back(c.part[j]);
+			}
+			for (size_t j=c.geom[i]; j<c.geom[i+1]; j++) {
+				for (size_t r=c.part[j]+1; r<c.part[j+1]; r++) {
+					rings.push_back(r);
+				}
+			}
+			for (size_t r : rings) {
+				size_t q2 = c.ring[r+1];
+				if (q2 > c.ring[r]) q2 -= skip;
+				for (size_t q=c.ring[r]; q<q2; q++) {
+					pc.x.push_back(c.x[q]);
+					pc.y.push_back(c.y[q]);
+					if (multi) {
+						pc.ring.push_back(pc.x.size());
+						pc.part.push_back(pc.ring.size()-1);
+					} else {
+						id.push_back(i);
+					}
+				}
+			}
+			if (multi) pc.geom.push_back(pc.part.size()-1);
+		}
+		pc.n = multi ? c.size() : pc.x.size();
+		v.geoms.setColumns(pc);
+		v.computeExtent();
+		v.df = multi ? df : df.subset_rows(id);
+		return v;
+	}
+
+	if (geoms.gtype() == polygons) {
+		v = v.as_lines();
 	}
 
 
 	for (size_t i=0; i < v.geoms.size(); i++) {
 		SpatGeom g;
 		g.gtype = points;
-		for (size_t j=0; j<geoms[i].parts.size(); j++) {
-			SpatPart p = geoms[i].parts[j];
+		for (size_t j=0; j<v.geoms[i].parts.size(); j++) {
+			SpatPart p = v.geoms[i].parts[j];
 			if (p.size() > 0) {
 				size_t n = p.size() - skip;
 				for (size_t k=0; k<n; k++) {
@@ -19,6 +19,8 @@
 #include "spatDataframe.h"
 //#include "spatMessages.h"
 
+#include <memory>
+
 #ifdef useGDAL
 #include "gdal_priv.h"
 #endif
@@ -84,17 +86,105 @@ class SpatGeom {
 };
 
 
+// The coordinates of geometries of one type in flat vectors, with offsets.
+// The nodes of ring r are x[ring[r]] to x[ring[r+1]-1]; the rings of part p
+// are part[p] to part[p+1]-1 (the first is the outer ring, the others are
+// holes); and the parts of geometry g are geom[g] to geom[g+1]-1.
+// If "geom" is empty, each geometry is a single point, and there are no offsets.
+class SpatGeomColumns {
+	public:
+		SpatGeomType gtype = unknown;
+		std::vector<double> x, y;
+		std::vector<size_t> ring, part, geom;
+		size_t n = 0;
+
+		bool single() const { return geom.empty(); }
+		size_t size() const { return n; }
+		void clear();
+		void set_offsets();
+		// returns false if "g" cannot be added (another type of geometry)
+		bool add(const SpatGeom &g);
+		// a geometry in (ISO or extended) WKB; returns false, and adds
+		// nothing, if it is not valid or of another type (see wkb.cpp)
+		bool add_wkb(const unsigned char *wkb, size_t size, bool &hasZ, bool &hasM);
+		// an empty geometry (for a geometry that is NULL)
+		void add_empty();
+		SpatGeom get(size_t i) const;
+		SpatExtent getExtent() const;
+		// the extent and the number of nodes of geometry i
+		SpatExtent getExtent(size_t i) const;
+		size_t nxy(size_t i) const;
+		SpatGeomColumns subset(const std::vector<unsigned> &r) const;
+};
+
+
+// The geometries of a SpatVector. They are either stored as a vector of
+// SpatGeom, or "packed" in a SpatGeomColumns, which uses much less memory
+// (a point takes 16 bytes instead of three allocations). Methods that access
+// a SpatGeom by reference unpack the geometries, and can therefore not be used
+// on a const SpatGeoms (or from more than one thread); get, extent, nxy, size 
+// and push_back do not unpack.
+class SpatGeoms {
+	private:
+		std::vector<SpatGeom> g;
+		SpatGeomColumns c;
+		bool ispacked = false;
+
+	public:
+		SpatGeoms() {}
+		SpatGeoms(const std::vector<SpatGeom> &x) : g(x) {}
+		SpatGeoms& operator=(const std::vector<SpatGeom> &x) {
+			g = x;
+			c.clear();
+			ispacked = false;
+			return *this;
+		}
+
+		bool packed() const { return ispacked; }
+		// packing fails (and nothing changes) if there are different types of geometries
+		bool pack();
+		void unpack();
+		SpatGeomColumns& columns() { return c; }
+		void setColumns(const SpatGeomColumns &x) {
+			g.clear();
+			c = x;
+			ispacked = true;
+		}
+
+		size_t size() const { return ispacked ? c.size() : g.size(); }
+		bool empty() const { return size() == 0; }
+		SpatGeomType gtype() const;
+		SpatGeom get(size_t i) const { return ispacked ? c.get(i) : g[i]; }
+		SpatExtent extent(size_t i) const { return ispacked ? c.getExtent(i) : g[i].extent; }
+		size_t nxy(size_t i) const;
+
+		SpatGeom& operator[](size_t i) { unpack(); return g[i]; }
+		std::vector<SpatGeom>::iterator begin() { unpack(); return g.begin(); }
+		std::vector<SpatGeom>::iterator end() { unpack(); return g.end(); }
+
+		void push_back(const SpatGeom &x);
+		void reserve(size_t n) { if (!ispacked) g.reserve(n); }
+		void resize(size_t n);
+		void clear() { g.clear(); c.clear(); }
+		std::vector<SpatGeom>::iterator erase(std::vector<SpatGeom>::iterator i) { unpack(); return g.erase(i); }
+};
+
+
 class SpatVectorCollection;
+class SpatGeosCache;
 
 class SpatVector {
 
 	public:
-		std::vector<SpatGeom> geoms;
+		SpatGeoms geoms;
 		SpatExtent extent;
 		SpatDataFrame df;
 		//std::vector<std::string> crs;
 		SpatSRS srs;
 
+		// GEOS (and prepared) geometries kept for repeated queries (see geos_cache)
+		std::shared_ptr<SpatGeosCache> geoscache;
+
 		SpatVector();
 		//SpatVector(const SpatVector &x);
 		SpatVector(SpatGeom g);
@@ -147,6 +237,7 @@ class SpatVector {
 		std::vector<std::vector<double>> coordinates();
 
 		SpatVector project(std::string crs);
+		SpatVector project(std::string crs, SpatOptions &opt);
 
 		SpatVector subset_cols(int i);
 		SpatVector subset_cols(std::vector<int> range);
@@ -173,14 +264,16 @@ class SpatVector {
 		SpatVector get_holes();
 		SpatVector set_holes(SpatVector x, size_t i);
 
-		bool read(std::string fname);
+		// layer (default: the first), an attribute filter (SQL WHERE clause), an
+		// extent (xmin, xmax, ymin, ymax) and the fields to read (default: all)
+		bool read(std::string fname, std::string layer="", std::string where="", std::vector<double> extent=std::vector<double>(), std::vector<std::string> fields=std::vector<std::string>());
 		
 		bool write(std::string filename, std::string lyrname, std::string driver, bool overwrite);
 		
 #ifdef useGDAL
 		GDALDataset* write_ogr(std::string filename, std::string lyrname, std::string driver, bool overwrite);
 		GDALDataset* GDAL_ds();
-		bool read_ogr(GDALDataset *poDS);
+		bool read_ogr(GDALDataset *poDS, std::string layer="", std::string where="", std::vector<double> extent=std::vector<double>(), std::vector<std::string> fields=std::vector<std::string>());
 		SpatVector fromDS(GDALDataset *poDS);
 		bool ogr_geoms(std::vector<OGRGeometryH> &ogrgeoms, std::string &message);		
 #endif
@@ -274,6 +367,8 @@ class SpatVector {
 		std::vector<int> relate(SpatVector v, std::string relation);
 		std::vector<int> relate(std::string relation, bool symmetrical);
 		std::vector<int> relateFirst(SpatVector v, std::string relation);
+		std::vector<std::vector<int>> relatePairs(SpatVector v, std::string relation);
+		void geos_cache(bool keep);
 		std::vector<double> geos_distance(SpatVector v, bool parallel);
 		std::vector<double> geos_distance(bool sequential);
 
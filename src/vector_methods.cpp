@@ -356,6 +356,19 @@ SpatVector SpatVector::shift(double x, double y) {
 
 	SpatVector out = *this;
 
+	if (geoms.packed()) {
+		SpatGeomColumns &c = out.geoms.columns();
+		for (size_t i=0; i < c.x.size(); i++) {
+			c.x[i] += x;
+			c.y[i] += y;
+		}
+		out.extent.xmin += x;
+		out.extent.xmax += x;
+		out.extent.ymin += y;
+		out.extent.ymax += y;
+		return out;
+	}
+
 	for (size_t i=0; i < size(); i++) {
 		for (size_t j=0; j < geoms[i].size(); j++) {
 			for (size_t q=0; q < geoms[i].parts[j].x.size(); q++) {
@@ -0,0 +1,248 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+// Decoding WKB geometries straight into the flat coordinate vectors
+// of a SpatGeomColumns, without creating SpatGeom/SpatPart objects.
+
+#include "spatVector.h"
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+
+class WKBReader {
+	public:
+		const unsigned char *p;
+		const unsigned char *end;
+		bool little = true;
+		bool swap = false;
+		size_t ncoord = 2;
+		bool hasZ = false;
+		bool hasM = false;
+
+		WKBReader(const unsigned char *wkb, size_t size) {
+			p = wkb;
+			end = wkb + size;
+		}
+
+		bool u32(uint32_t &v) {
+			if ((end - p) < 4) return false;
+			unsigned char b[4];
+			std::memcpy(b, p, 4);
+			if (swap) {
+				std::swap(b[0], b[3]);
+				std::swap(b[1], b[2]);
+			}
+			std::memcpy(&v, b, 4);
+			p += 4;
+			return true;
+		}
+
+		bool dbl(double &v) {
+			if ((end - p) < 8) return false;
+			unsigned char b[8];
+			std::memcpy(b, p, 8);
+			if (swap) {
+				for (size_t i=0; i<4; i++) std::swap(b[i], b[7-i]);
+			}
+			std::memcpy(&v, b, 8);
+			p += 8;
+			return true;
+		}
+
+		// byte order and type of a (sub) geometry; "type" is 1 to 7
+		bool header(uint32_t &type) {
+			if (p >= end) return false;
+			if (*p > 1) return false;
+			uint16_t one = 1;
+			bool host_little = *(reinterpret_cast<unsigned char*>(&one)) == 1;
+			swap = (*p == 1) != host_little;
+			p++;
+			uint32_t t;
+			if (!u32(t)) return false;
+			bool z = false, m = false;
+			// extended WKB (PostGIS)
+			if (t & 0x80000000) z = true;
+			if (t & 0x40000000) m = true;
+			if (t & 0x20000000) {
+				uint32_t srid;
+				if (!u32(srid)) return false;
+			}
+			t &= 0x0FFFFFFF;
+			// ISO WKB
+			uint32_t dim = t / 1000;
+			type = t % 1000;
+			if ((dim == 1) || (dim == 3)) z = true;
+			if ((dim == 2) || (dim == 3)) m = true;
+			hasZ = hasZ || z;
+			hasM = hasM || m;
+			ncoord = 2 + z + m;
+			return (type >= 1) && (type <= 7);
+		}
+
+		bool point(double &x, double &y) {
+			if ((size_t)(end - p) < (ncoord * 8)) return false;
+			if (!dbl(x)) return false;
+			if (!dbl(y)) return false;
+			p += (ncoord - 2) * 8;
+			return true;
+		}
+
+		// the points of a linestring or ring
+		bool points(std::vector<double> &x, std::vector<double> &y) {
+			uint32_t np;
+			if (!u32(np)) return false;
+			if (((size_t)(end - p) / (ncoord * 8)) < np) return false;
+			size_t n = x.size();
+			x.resize(n + np);
+			y.resize(n + np);
+			for (size_t i=0; i<np; i++) {
+				dbl(x[n+i]);
+				dbl(y[n+i]);
+				p += (ncoord - 2) * 8;
+			}
+			return true;
+		}
+};
+
+
+// the type of geometry of a WKB type
+SpatGeomType wkb_geomtype(uint32_t type) {
+	if ((type == 1) || (type == 4)) return points;
+	if ((type == 2) || (type == 5)) return lines;
+	if ((type == 3) || (type == 6)) return polygons;
+	return unknown;
+}
+
+
+bool SpatGeomColumns::add_wkb(const unsigned char *wkb, size_t size, bool &hasZ, bool &hasM) {
+
+	WKBReader r(wkb, size);
+	uint32_t type;
+	if (!r.header(type)) return false;
+	SpatGeomType gt = wkb_geomtype(type);
+	if (gt == unknown) return false;
+	if ((n > 0) || (gtype != unknown)) {
+		if (gt != gtype) return false;
+	}
+
+	if (type == 1) {
+		double px, py;
+		if (!r.point(px, py)) return false;
+		gtype = gt;
+		bool empty = std::isnan(px) && std::isnan(py);
+		if (single() && !empty) {
+			x.push_back(px);
+			y.push_back(py);
+			n++;
+		} else {
+			set_offsets();
+			if (!empty) {
+				x.push_back(px);
+				y.push_back(py);
+				ring.push_back(x.size());
+				part.push_back(ring.size()-1);
+			}
+			geom.push_back(part.size()-1);
+			n++;
+		}
+		hasZ = hasZ || r.hasZ;
+		hasM = hasM || r.hasM;
+		return true;
+	}
+
+	// undo a partially added geometry if the WKB is not valid
+	size_t nx = x.size();
+	bool wassingle = single();
+	set_offsets();
+	size_t nr = ring.size();
+	size_t np = part.size();
+	bool ok = true;
+
+	if (type == 2) {
+		ok = r.points(x, y);
+		ring.push_back(x.size());
+		part.push_back(ring.size()-1);
+	} else if (type == 3) {
+		uint32_t nrings;
+		ok = r.u32(nrings);
+		for (size_t i=0; ok && (i<nrings); i++) {
+			ok = r.points(x, y);
+			ring.push_back(x.size());
+		}
+		if (ok && (nrings > 0)) part.push_back(ring.size()-1);
+	} else {
+		uint32_t ng;
+		ok = r.u32(ng);
+		for (size_t i=0; ok && (i<ng); i++) {
+			uint32_t stype;
+			ok = r.header(stype) && (stype == (type - 3));
+			if (!ok) break;
+			if (stype == 1) {
+				// all points of a multipoint are one part
+				double px, py;
+				ok = r.point(px, py);
+				x.push_back(px);
+				y.push_back(py);
+			} else if (stype == 2) {
+				ok = r.points(x, y);
+				ring.push_back(x.size());
+				part.push_back(ring.size()-1);
+			} else {
+				uint32_t nrings;
+				ok = r.u32(nrings);
+				for (size_t j=0; ok && (j<nrings); j++) {
+					ok = r.points(x, y);
+					ring.push_back(x.size());
+				}
+				if (ok && (nrings > 0)) part.push_back(ring.size()-1);
+			}
+		}
+		if (ok && (type == 4)) {
+			ring.push_back(x.size());
+			part.push_back(ring.size()-1);
+		}
+	}
+
+	if (!ok) {
+		x.resize(nx);
+		y.resize(nx);
+		ring.resize(nr);
+		part.resize(np);
+		if (wassingle) {
+			ring.clear(); part.clear(); geom.clear();
+		}
+		return false;
+	}
+	gtype = gt;
+	geom.push_back(part.size()-1);
+	n++;
+	hasZ = hasZ || r.hasZ;
+	hasM = hasM || r.hasM;
+	return true;
+}
+
+
+void SpatGeomColumns::add_empty() {
+	set_offsets();
+	if (gtype != polygons) {
+		ring.push_back(x.size());
+		part.push_back(ring.size()-1);
+	}
+	geom.push_back(part.size()-1);
+	n++;
+}
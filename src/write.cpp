@@ -19,6 +19,10 @@
 #include "file_utils.h"
 #include "string_utils.h"
 #include "math_utils.h"
+#include "spatBlock.h"
+#include "ram.h"
+#include "spatSIMD.h"
+#include "spatScratch.h"
 
 
 
@@ -67,6 +71,8 @@ void SpatRaster::fill(double x) {
 		#ifdef useGDAL
 		fillValuesGDAL(x);
 		#endif
+	} else if (source[0].driver == "scratch") {
+		source[0].scratch->fill(x);
 	} else {
 		source[0].values.resize(size(), x);
 	}
@@ -175,10 +181,21 @@ SpatRaster SpatRaster::writeRaster(SpatOptions &opt) {
 		return(out);
 	}
 
-	if (!out.writeStart(opt)) { 
+	std::string datatype;
+	bool native = native_output(datatype, opt);
+	BlockLayout layout;
+	if (native) {
+		layout.elsize = native_datatype_size(datatype);
+	}
+	if (!out.writeStart(opt, layout)) { 
 		readStop();
 		return out; 
 	}
+	if (native) {
+		copyValuesNative(out, datatype, 0, 0);
+		readStop();
+		return out;
+	}
 	for (size_t i=0; i<out.bs.n; i++) {
 		std::vector<double> v = readBlock(out.bs, i);
 		if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, ncol())) {
@@ -199,6 +216,11 @@ SpatRaster SpatRaster::writeRaster(SpatOptions &opt) {
 
 
 bool SpatRaster::writeStart(SpatOptions &opt) {
+	return writeStart(opt, BlockLayout());
+}
+
+
+bool SpatRaster::writeStart(SpatOptions &opt, BlockLayout layout) {
 
 	if (opt.names.size() == nlyr()) {
 		setNames(opt.names);
@@ -209,19 +231,27 @@ bool SpatRaster::writeStart(SpatOptions &opt) {
 		addWarning("only the first filename supplied is used");
 	}
 	std::string filename = fnames[0];
+	bool scratch = false;
 	if (filename == "") {
 		if (!canProcessInMemory(opt)) {
-			std::string extension = ".tif";
-			filename = tempFile(opt.get_tempdir(), extension);
-			opt.set_filenames({filename});
-			opt.gdal_options = {"COMPRESS=NONE"};
+			// raw scratch file, removed when no longer used
+			filename = tempFile(opt.get_tempdir(), ".bin");
+			scratch = true;
 		}
 	}
 
-	if (filename != "") {
+	// before the file is created, such that it can be tiled like the blocks
+	bs = getBlockSize(opt, layout);
+
+	source[0].scratch.reset();
+	if (scratch) {
+		if (!writeStartScratch(opt, filename)) {
+			return false;
+		}
+	} else if (filename != "") {
 		// open GDAL filestream
 		#ifdef useGDAL
-		if (! writeStartGDAL(opt) ) {
+		if (! writeStartGDAL(opt, bs) ) {
 			return false;
 		}
 		#else
@@ -234,15 +264,14 @@ bool SpatRaster::writeStart(SpatOptions &opt) {
 	}
 	source[0].open_write = true;
 	source[0].filename = filename;
-	bs = getBlockSize(opt);
     #ifdef useRcpp
 	if (opt.verbose) {
 		std::vector<double> mems = mem_needs(opt); 
-		double gb = 1073741824 / 8; 
+		double gb = 1073741824; 
 		//{memneed, memavail, frac, csize, inmem} ;
 		// << "max vect size : " << roundn(mems.max_size() / gb, 2) << " GB" << std::endl;
 		Rcpp::Rcout<< "memory avail. : " << roundn(mems[1] / gb, 2) << " GB" << std::endl;
-		Rcpp::Rcout<< "memory allow. : " << roundn(mems[2] * mems[1] / gb, 2) << " GB" << std::endl;
+		Rcpp::Rcout<< "memory allow. : " << roundn(mems[5] / gb, 2) << " GB" << std::endl;
 		Rcpp::Rcout<< "memory needed : " << roundn(mems[0] / gb, 3) << " GB" << "  (" << opt.ncopies << " copies)" << std::endl;
 		std::string inmem = mems[4] < 0.5 ? "false" : "true";
 		Rcpp::Rcout<< "in memory     : " << inmem << std::endl;
@@ -261,6 +290,18 @@ bool SpatRaster::writeStart(SpatOptions &opt) {
 		progressbar = false;
 	}
 	#endif
+
+	// reserve the working set, such that rasters that are written at
+	// the same time (e.g. by another method) use smaller blocks
+	size_t maxcells = 0;
+	for (size_t i=0; i<bs.n; i++) {
+		maxcells = std::max(maxcells, bs.nrows[i] * bs.ncols[i]);
+	}
+	double workingset = (double)maxcells * nlyr() * opt.ncopies * layout.elsize;
+	if (filename == "") {
+		workingset += size() * sizeof(double);
+	}
+	ramreserved = std::make_shared<SpatRAMReservation>(workingset);
 	return true;
 }
 
@@ -286,6 +327,8 @@ bool SpatRaster::writeValues(std::vector<double> &vals, size_t startrow, size_t
 		setError("GDAL is not available");
 		return false;
 		#endif
+	} else if (source[0].driver == "scratch") {
+		success = writeValuesScratch(vals, startrow, nrows, startcol, ncols);
 	} else {
 		success = writeValuesMem(vals, startrow, nrows, startcol, ncols);
 	}
@@ -306,6 +349,98 @@ bool SpatRaster::writeValues(std::vector<double> &vals, size_t startrow, size_t
 
 
 
+template <typename T>
+bool SpatRaster::writeValuesNative(std::vector<T> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols) {
+
+	if ((source[0].driver != "gdal") || (source[0].datatype != SpatType<T>::name())) {
+		std::vector<double> v;
+		native_to_double(vals, v);
+		return writeValues(v, startrow, nrows, startcol, ncols);
+	}
+
+	if (!source[0].open_write) {
+		setError("cannot write (no open file)");
+		return false;
+	}
+	if ((startrow + nrows) > nrow()) {
+		setError("incorrect start and/or nrows value");
+		return false;
+	}
+
+	#ifdef useGDAL
+	bool success = writeValuesGDALNative(vals, startrow, nrows, startcol, ncols);
+	#else
+	setError("GDAL is not available");
+	bool success = false;
+	#endif
+
+#ifdef useRcpp
+	if (progressbar) {
+		if (Progress::check_abort()) {
+			pbar->cleanup();
+			setError("aborted");
+			return(false);
+		}
+		pbar->increment();
+	}
+#endif
+	return success;
+}
+
+template bool SpatRaster::writeValuesNative(std::vector<uint8_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::writeValuesNative(std::vector<int16_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::writeValuesNative(std::vector<uint16_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::writeValuesNative(std::vector<int32_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::writeValuesNative(std::vector<uint32_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::writeValuesNative(std::vector<float> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::writeValuesNative(std::vector<double> &, size_t, size_t, size_t, size_t);
+
+
+template <typename T>
+bool copy_native(SpatRaster &x, SpatRaster &out, size_t row, size_t col) {
+	std::vector<T> v;
+	size_t nc = out.ncol();
+	for (size_t i=0; i<out.bs.n; i++) {
+		if (!x.readValuesNative(v, row+out.bs.row[i], out.bs.nrows[i], col, nc)) {
+			out.setError(x.getError());
+			return false;
+		}
+		if (!out.writeValuesNative(v, out.bs.row[i], out.bs.nrows[i], 0, nc)) return false;
+	}
+	return true;
+}
+
+
+// copy the cell values (starting at row, col) to "out" (opened for writing)
+// in their native datatype; "out" is closed on return
+bool SpatRaster::copyValuesNative(SpatRaster &out, std::string datatype, size_t row, size_t col) {
+	bool success;
+	if (datatype == "INT1U") {
+		success = copy_native<uint8_t>(*this, out, row, col);
+	} else if (datatype == "INT2S") {
+		success = copy_native<int16_t>(*this, out, row, col);
+	} else if (datatype == "INT2U") {
+		success = copy_native<uint16_t>(*this, out, row, col);
+	} else if (datatype == "INT4S") {
+		success = copy_native<int32_t>(*this, out, row, col);
+	} else if (datatype == "INT4U") {
+		success = copy_native<uint32_t>(*this, out, row, col);
+	} else if (datatype == "FLT4S") {
+		success = copy_native<float>(*this, out, row, col);
+	} else if (datatype == "FLT8S") {
+		success = copy_native<double>(*this, out, row, col);
+	} else {
+		out.setError("unknown datatype: " + datatype);
+		success = false;
+	}
+	if (success) {
+		return out.writeStop();
+	}
+	return false;
+}
+
+
+
 template <typename T>
 std::vector<T> flatten(const std::vector<std::vector<T>>& v) {
     std::size_t total_size = 0;
@@ -330,6 +465,7 @@ bool SpatRaster::writeStop(){
 		return false;
 	}
 	source[0].open_write = false;
+	ramreserved.reset();
 	bool success = true;
 	source[0].memory = false;
 	if (source[0].driver=="gdal") {
@@ -340,6 +476,8 @@ bool SpatRaster::writeStop(){
 		setError("GDAL is not available");
 		return false;
 		#endif
+	} else if (source[0].driver == "scratch") {
+		success = writeStopScratch();
 	} else {
    		source[0].setRange();
 		//source[0].driver = "memory";
@@ -425,7 +563,7 @@ void SpatRasterSource::setRange() {
 	if (values.size() == nc * nlyr) {
 		for (size_t i=0; i<nlyr; i++) {
 			start = nc * i;
-			minmax(values.begin()+start, values.begin()+start+nc, vmin, vmax);
+			simd_minmax(values.data()+start, nc, vmin, vmax);
 			range_min[i] = vmin;
 			range_max[i] = vmax;
 			hasRange[i] = true;
@@ -31,6 +31,10 @@
 #include "gdal_rat.h"
 
 #include "gdalio.h"
+#include "spatBlock.h"
+#include "spatAsync.h"
+#include "spatSIMD.h"
+#include "spatOverview.h"
 
 
 bool setCats(GDALRasterBand *poBand, std::vector<std::string> &labels) {
@@ -179,7 +183,44 @@ void stat_options(int sstat, bool &compute_stats, bool &gdal_stats, bool &gdal_m
 
 
 
-bool SpatRaster::writeStartGDAL(SpatOptions &opt) {
+// the value of a gdal option (e.g. "BLOCKSIZE=512"); "" if not set
+std::string gdal_option(const std::vector<std::string> &gdal_options, std::string name) {
+	name = name + "=";
+	for (size_t i=0; i<gdal_options.size(); i++) {
+		std::string s = gdal_options[i];
+		if (s.size() < name.size()) continue;
+		std::string nm = s.substr(0, name.size());
+		lowercase(nm);
+		std::string lname = name;
+		lowercase(lname);
+		if (nm == lname) {
+			return s.substr(name.size());
+		}
+	}
+	return "";
+}
+
+
+// the values that can be stored in a datatype (others are written as NA)
+void datatype_limits(const std::string &datatype, double &lo, double &hi) {
+	if (datatype == "INT4S") {
+		lo = INT32_MIN; hi = INT32_MAX;
+	} else if (datatype == "INT2S") {
+		lo = INT16_MIN; hi = INT16_MAX;
+	} else if (datatype == "INT4U") {
+		lo = 0; hi = UINT32_MAX;
+	} else if (datatype == "INT2U") {
+		lo = 0; hi = UINT16_MAX;
+	} else if (datatype == "INT1U") {
+		lo = 0; hi = 255;
+	} else {
+		lo = -std::numeric_limits<double>::infinity();
+		hi = std::numeric_limits<double>::infinity();
+	}
+}
+
+
+bool SpatRaster::writeStartGDAL(SpatOptions &opt, const BlockSize &blocks) {
 
 
 	std::string filename = opt.get_filename();
@@ -260,6 +301,34 @@ bool SpatRaster::writeStartGDAL(SpatOptions &opt) {
 
 	char **papszOptions = set_GDAL_options(driver, diskNeeded, writeRGB, opt.gdal_options);
 
+	// blocks that are windows of rows and columns are written to tiles,
+	// because writing part of a (compressed) strip rewrites the strip
+	if ((driver == "GTiff") && (gdal_option(opt.gdal_options, "TILED") == "")) {
+		bool windows = false;
+		for (size_t i=0; i<blocks.n; i++) {
+			if (blocks.ncols[i] < ncol()) {
+				windows = true;
+				break;
+			}
+		}
+		if (windows) {
+			// the blocks are aligned with tiles of this size (see getBlockSize)
+			size_t tw = source[0].blockcols;
+			size_t th = source[0].blockrows;
+			if (((tw % 16) != 0) || ((th % 16) != 0) || (tw == 0) || (th == 0)) {
+				tw = 256;
+				th = 256;
+			}
+			papszOptions = CSLSetNameValue(papszOptions, "TILED", "YES");
+			if (gdal_option(opt.gdal_options, "BLOCKXSIZE") == "") {
+				papszOptions = CSLSetNameValue(papszOptions, "BLOCKXSIZE", std::to_string(tw).c_str());
+			}
+			if (gdal_option(opt.gdal_options, "BLOCKYSIZE") == "") {
+				papszOptions = CSLSetNameValue(papszOptions, "BLOCKYSIZE", std::to_string(th).c_str());
+			}
+		}
+	}
+
 /*	if (driver == "GTiff") {
 		GDAL_tiff_options(diskNeeded > 4194304000, writeRGB, opt);
 	}
@@ -289,9 +358,22 @@ bool SpatRaster::writeStartGDAL(SpatOptions &opt) {
 	} else if (CSLFetchBoolean( papszMetadata, GDAL_DCAP_CREATECOPY, FALSE)) {
 		copy_driver = driver;
 		gdal_options = opt.gdal_options;
+		if (driver == "COG") {
+			// the intermediate file is not compressed (that is done once, 
+			// with multiple threads, when it is copied) and is tiled like 
+			// the COG, with overviews that are filled while writing
+			std::string bsize = gdal_option(opt.gdal_options, "BLOCKSIZE");
+			if (bsize == "") bsize = "512";
+			CSLDestroy( papszOptions );
+			papszOptions = NULL;
+			papszOptions = CSLSetNameValue(papszOptions, "TILED", "YES");
+			papszOptions = CSLSetNameValue(papszOptions, "BLOCKXSIZE", bsize.c_str());
+			papszOptions = CSLSetNameValue(papszOptions, "BLOCKYSIZE", bsize.c_str());
+			papszOptions = CSLSetNameValue(papszOptions, "BIGTIFF", "IF_SAFER");
+		}
 		if (canProcessInMemory(opt)) {
 			poDriver = GetGDALDriverManager()->GetDriverByName("MEM");
-			poDS = poDriver->Create("", ncol(), nrow(), nlyr(), gdt, papszOptions);
+			poDS = poDriver->Create("", ncol(), nrow(), nlyr(), gdt, NULL);
 		} else {
 			std::string f = tempFile(opt.get_tempdir(), ".tif");
 			copy_filename = f;
@@ -456,6 +538,51 @@ bool SpatRaster::writeStartGDAL(SpatOptions &opt) {
 	source[0].driver = "gdal" ;
 	source[0].filename = filename;
 	source[0].memory = false;
+	if (source[0].blockrows == 0) {
+		int bcols, brows;
+		poDS->GetRasterBand(1)->GetBlockSize(&bcols, &brows);
+		source[0].blockrows = brows;
+		source[0].blockcols = bcols;
+	}
+	writeq = std::make_shared<SpatAsyncWrite>();
+
+	wstream.reset();
+	if (driver == "COG") {
+		wstream = std::make_shared<SpatWriteStream>();
+		wstream->stats.init(nlyr());
+		std::string ovr = gdal_option(opt.gdal_options, "OVERVIEWS");
+		lowercase(ovr);
+		std::string resample = gdal_option(opt.gdal_options, "RESAMPLING");
+		if (resample == "") resample = gdal_option(opt.gdal_options, "OVERVIEW_RESAMPLING");
+		lowercase(resample);
+		if (resample == "") {
+			resample = (hasCT[0] || hasCats[0]) ? "nearest" : "average";
+		}
+		if ((ovr != "none") && ((resample == "average") || (resample == "nearest"))) {
+			std::string bsize = gdal_option(opt.gdal_options, "BLOCKSIZE");
+			size_t blocksize = bsize == "" ? 512 : std::max(16, atoi(bsize.c_str()));
+			size_t nlevels = cog_overview_count(nrow(), ncol(), blocksize);
+			std::string ocount = gdal_option(opt.gdal_options, "OVERVIEW_COUNT");
+			if (ocount != "") {
+				nlevels = std::max(0, atoi(ocount.c_str()));
+			}
+			if (nlevels > 0) {
+				std::vector<int> levels(nlevels);
+				for (size_t i=0; i<nlevels; i++) {
+					levels[i] = 1 << (i+1);
+				}
+				// empty overviews, to be filled by writeValues
+				CPLErr err = GDALBuildOverviews((GDALDatasetH) poDS, "NONE", nlevels, &levels[0], 0, NULL, NULL, NULL);
+				if ((err == CE_None) && (poDS->GetRasterBand(1)->GetOverviewCount() == (int)nlevels)) {
+					wstream->overviews = wstream->ovr.init(nrow(), ncol(), nlyr(), nlevels, resample == "average");
+					wstream->resampling = resample;
+				}
+			}
+		}
+	} else if (compute_stats && gdal_stats) {
+		wstream = std::make_shared<SpatWriteStream>();
+		wstream->stats.init(nlyr());
+	}
 
 	return true;
 }
@@ -481,27 +608,30 @@ void tmp_min_max_na(std::vector<T> &out, const std::vector<double> &v, const dou
 
 bool SpatRaster::writeValuesGDAL(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols){
 
-	CPLErr err = CE_None;
 	double vmin, vmax;
 	size_t nc = nrows * ncols;
 	size_t nl = nlyr();
 	std::string datatype = source[0].datatype;
 
-	if ((compute_stats) && (!gdal_stats)) {
+	if (wstream) {
+		if (!writeStream(vals, startrow, nrows, startcol, ncols)) {
+			return false;
+		}
+	} else if ((compute_stats) && (!gdal_stats)) {
 		for (size_t i=0; i < nl; i++) {
 			size_t start = nc * i;
 			if (datatype == "INT4S") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, (double)INT32_MIN, (double)INT32_MAX);
+				simd_minmax(vals.data()+start, nc, vmin, vmax, (double)INT32_MIN, (double)INT32_MAX);
 			} else if (datatype == "INT2S") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, (double)INT16_MIN, (double)INT16_MAX);
+				simd_minmax(vals.data()+start, nc, vmin, vmax, (double)INT16_MIN, (double)INT16_MAX);
 			} else if (datatype == "INT4U") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, 0.0, (double)UINT32_MAX);
+				simd_minmax(vals.data()+start, nc, vmin, vmax, 0.0, (double)UINT32_MAX);
 			} else if (datatype == "INT2U") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, 0.0, (double)UINT16_MAX);
+				simd_minmax(vals.data()+start, nc, vmin, vmax, 0.0, (double)UINT16_MAX);
 			} else if (datatype == "INT1U") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, 0.0, 255.0);
+				simd_minmax(vals.data()+start, nc, vmin, vmax, 0.0, 255.0);
 			} else {
-				minmax(vals.begin()+start, vals.begin()+start+nc, vmin, vmax);
+				simd_minmax(vals.data()+start, nc, vmin, vmax);
 			}
 			if (!std::isnan(vmin)) {
 				if (std::isnan(source[0].range_min[i])) {
@@ -515,11 +645,82 @@ bool SpatRaster::writeValuesGDAL(std::vector<double> &vals, size_t startrow, siz
 		}
 	}
 
+	return writeQueue(vals, startrow, nrows, startcol, ncols);
+}
+
+
+// statistics and overviews of the values that are written 
+bool SpatRaster::writeStream(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols) {
+	double lo, hi;
+	datatype_limits(source[0].datatype, lo, hi);
+	bool isint = source[0].datatype.substr(0,3) == "INT";
+	size_t nc = nrows * ncols;
+	for (size_t i=0; i<nlyr(); i++) {
+		wstream->stats.add(vals.data() + i * nc, nc, i, lo, hi, isint);
+	}
+	if (!wstream->overviews) {
+		return true;
+	}
+	if ((startcol != 0) || (ncols != ncol()) || (!wstream->ovr.add(vals, startrow, nrows, lo, hi))) {
+		// not whole rows in order; computed by GDAL when the file is closed
+		wstream->overviews = false;
+		wstream->regenerate = true;
+		return true;
+	}
+	return writeOverviewsGDAL();
+}
+
+
+// write the overview rows that are ready
+bool SpatRaster::writeOverviewsGDAL() {
+	SpatOverviewStream &ovr = wstream->ovr;
+	bool ready = false;
+	for (size_t lev=1; lev<=ovr.nlevels(); lev++) {
+		if (ovr.ready_nrows[lev] > 0) {
+			ready = true;
+			break;
+		}
+	}
+	if (!ready) return true;
+	// the queued block write must be done before the overviews are written
+	if (!writeWait()) return false;
+	bool isint = source[0].datatype.substr(0,3) == "INT";
+	for (size_t lev=1; lev<=ovr.nlevels(); lev++) {
+		size_t nr = ovr.ready_nrows[lev];
+		if (nr == 0) continue;
+		for (size_t i=0; i<nlyr(); i++) {
+			GDALRasterBand *poBand = source[0].gdalconnection->GetRasterBand(i+1);
+			std::vector<double> &v = ovr.ready[lev][i];
+			if (isint) {
+				int hasNA=0;
+				double na = poBand->GetNoDataValue(&hasNA);
+				if (hasNA) {
+					std::replace_if(v.begin(), v.end(), [](const double &d) { return std::isnan(d); }, na);
+				}
+			}
+			GDALRasterBand *poOvr = poBand->GetOverview(lev-1);
+			if ((poOvr == NULL) || (poOvr->RasterIO(GF_Write, 0, ovr.ready_row[lev], ovr.ncol[lev], nr, &v[0], ovr.ncol[lev], nr, GDT_Float64, 0, 0, NULL) != CE_None)) {
+				wstream->overviews = false;
+				wstream->regenerate = true;
+				return true;
+			}
+		}
+		ovr.written(lev);
+	}
+	return true;
+}
+
+
+// this is also called on a background thread (see async.cpp)
+SpatMessages writeBlockGDAL(GDALDataset *ds, const std::vector<double> &vals, const std::string &datatype, size_t startrow, size_t nrows, size_t startcol, size_t ncols, size_t nl) {
+
+	SpatMessages msg;
+	CPLErr err = CE_None;
 	if ((datatype == "FLT8S") || (datatype == "FLT4S")) {
-		err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vals[0], ncols, nrows, GDT_Float64, nl, NULL, 0, 0, 0, NULL );
+		err = ds->RasterIO(GF_Write, startcol, startrow, ncols, nrows, const_cast<double*>(&vals[0]), ncols, nrows, GDT_Float64, nl, NULL, 0, 0, 0, NULL );
 	} else {
 		int hasNA=0;
-		double na = source[0].gdalconnection->GetRasterBand(1)->GetNoDataValue(&hasNA);
+		double na = ds->GetRasterBand(1)->GetNoDataValue(&hasNA);
 		if (!hasNA) {
 			na = NAN;
 		}
@@ -528,36 +729,102 @@ bool SpatRaster::writeValuesGDAL(std::vector<double> &vals, size_t startrow, siz
 			//std::vector<int32_t> vv(vals.begin(), vals.end());
 			std::vector<int32_t> vv;
 			tmp_min_max_na(vv, vals, na, (double)INT32_MIN, (double)INT32_MAX);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Int32, nl, NULL, 0, 0, 0, NULL );
+			err = ds->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Int32, nl, NULL, 0, 0, 0, NULL );
 		} else if (datatype == "INT2S") {				
 			//min_max_na(vals, na, (double)INT16_MIN, (double)INT16_MAX); 
 			//std::vector<int16_t> vv(vals.begin(), vals.end());
 			std::vector<int16_t> vv;
 			tmp_min_max_na(vv, vals, na, (double)INT16_MIN, (double)INT16_MAX);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Int16, nl, NULL, 0, 0, 0, NULL );
+			err = ds->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Int16, nl, NULL, 0, 0, 0, NULL );
 		} else if (datatype == "INT4U") {
 			//min_max_na(vals, na, 0, (double)INT32_MAX * 2 - 1);
 			//std::vector<uint32_t> vv(vals.begin(), vals.end());
 			std::vector<uint32_t> vv;
 			tmp_min_max_na(vv, vals, na, 0, (double)UINT32_MAX);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_UInt32, nl, NULL, 0, 0, 0, NULL );
+			err = ds->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_UInt32, nl, NULL, 0, 0, 0, NULL );
 		} else if (datatype == "INT2U") {
 			//min_max_na(vals, na, 0, (double)INT16_MAX * 2 - 1); 
 			//std::vector<uint16_t> vv(vals.begin(), vals.end());
 			std::vector<uint16_t> vv;
 			tmp_min_max_na(vv, vals, na, 0, (double)UINT16_MAX); 
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_UInt16, nl, NULL, 0, 0, 0, NULL );
+			err = ds->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_UInt16, nl, NULL, 0, 0, 0, NULL );
 		} else if (datatype == "INT1U") {
 			//min_max_na(vals, na, 0, 255);
 			//std::vector<int8_t> vv(vals.begin(), vals.end());
 			std::vector<int8_t> vv;
 			tmp_min_max_na(vv, vals, na, 0, 255);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Byte, nl, NULL, 0, 0, 0, NULL );
+			err = ds->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Byte, nl, NULL, 0, 0, 0, NULL );
 		} else {
-			setError("bad datatype");
-			GDALClose( source[0].gdalconnection );
+			msg.setError("bad datatype");
+			return msg;
+		}
+	}
+
+	if (err != CE_None ) {
+		msg.setError("cannot write values (err: " + std::to_string(err) +")");
+	}
+	return msg;
+}
+
+
+template <typename T>
+bool SpatRaster::writeValuesGDALNative(std::vector<T> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols){
+
+	if (!writeWait()) return false;
+	double vmin, vmax;
+	size_t nc = nrows * ncols;
+	size_t nl = nlyr();
+
+	if (wstream) {
+		std::vector<double> d;
+		native_to_double(vals, d);
+		if (!writeStream(d, startrow, nrows, startcol, ncols)) {
 			return false;
 		}
+	} else if ((compute_stats) && (!gdal_stats)) {
+		for (size_t i=0; i < nl; i++) {
+			size_t start = nc * i;
+			native_minmax(vals, start, start+nc, vmin, vmax);
+			if (!std::isnan(vmin)) {
+				if (std::isnan(source[0].range_min[i])) {
+					source[0].range_min[i] = vmin;
+					source[0].range_max[i] = vmax;		
+				} else {
+					source[0].range_min[i] = std::min(source[0].range_min[i], vmin);
+					source[0].range_max[i] = std::max(source[0].range_max[i], vmax);
+				}
+			}
+		}
+	}
+
+	GDALDataType gdt;
+	getGDALDataType(source[0].datatype, gdt);
+
+	// a user supplied NAflag, for each band
+	std::vector<T> flags(nl, SpatType<T>::na());
+	bool sentinel = true;
+	for (size_t i=0; i<nl; i++) {
+		int hasNA=0;
+		double na = source[0].gdalconnection->GetRasterBand(i+1)->GetNoDataValue(&hasNA);
+		if (hasNA && (!std::isnan(na)) && (na >= std::numeric_limits<T>::lowest()) && (na <= std::numeric_limits<T>::max())) {
+			flags[i] = na;
+			sentinel = sentinel && SpatType<T>::isna(flags[i]);
+		}
+	}
+
+	CPLErr err = CE_None;
+	if (sentinel) {
+		err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vals[0], ncols, nrows, gdt, nl, NULL, 0, 0, 0, NULL );
+	} else {
+		std::vector<T> vv = vals;
+		for (size_t i=0; i<nl; i++) {
+			if (SpatType<T>::isna(flags[i])) continue;
+			size_t start = nc * i;
+			for (size_t j=start; j<(start+nc); j++) {
+				if (SpatType<T>::isna(vv[j])) vv[j] = flags[i];
+			}
+		}
+		err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, gdt, nl, NULL, 0, 0, 0, NULL );
 	}
 
 	if (err != CE_None ) {
@@ -565,21 +832,64 @@ bool SpatRaster::writeValuesGDAL(std::vector<double> &vals, size_t startrow, siz
 		GDALClose( source[0].gdalconnection );
 		return false;
 	}
-
 	return true;
 }
 
+template bool SpatRaster::writeValuesGDALNative(std::vector<uint8_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::writeValuesGDALNative(std::vector<int16_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::writeValuesGDALNative(std::vector<uint16_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::writeValuesGDALNative(std::vector<int32_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::writeValuesGDALNative(std::vector<uint32_t> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::writeValuesGDALNative(std::vector<float> &, size_t, size_t, size_t, size_t);
+template bool SpatRaster::writeValuesGDALNative(std::vector<double> &, size_t, size_t, size_t, size_t);
+
+
 
 bool SpatRaster::writeStopGDAL() {
 
+	bool queued = writeWait();
+	writeq.reset();
+	if (!queued) return false;
+
 	GDALRasterBand *poBand;
 	source[0].hasRange.resize(nlyr());
 	std::string datatype = source[0].datatype;
 
+	bool streamed_ovr = false;
+	if (wstream) {
+		if (wstream->overviews) {
+			if (!writeOverviewsGDAL()) return false;
+			streamed_ovr = wstream->overviews && wstream->ovr.complete();
+			wstream->regenerate = !streamed_ovr;
+		}
+		if (wstream->regenerate) {
+			int n = source[0].gdalconnection->GetRasterBand(1)->GetOverviewCount();
+			std::vector<int> levels;
+			for (int i=0; i<n; i++) levels.push_back(1 << (i+1));
+			if ((n > 0) && (GDALBuildOverviews((GDALDatasetH) source[0].gdalconnection, wstream->resampling.c_str(), n, &levels[0], 0, NULL, NULL, NULL) == CE_None)) {
+				streamed_ovr = true;
+			}
+		}
+	}
+
 	for (size_t i=0; i < nlyr(); i++) {
 		poBand = source[0].gdalconnection->GetRasterBand(i+1);
 
-		if (compute_stats) {
+		if (wstream && (compute_stats || (copy_driver == "COG"))) {
+			// from the values that were written, the file is not read again
+			double mn = wstream->stats.vmin[i];
+			double mx = wstream->stats.vmax[i];
+			if (!std::isnan(mn)) {
+				source[0].range_min[i] = mn;
+				source[0].range_max[i] = mx;
+				if (gdal_minmax && !(copy_driver == "COG")) {
+					poBand->SetStatistics(mn, mx, -9999., -9999.);
+				} else {
+					poBand->SetStatistics(mn, mx, wstream->stats.mean[i], wstream->stats.sd(i));
+				}
+			}
+			source[0].hasRange[i] = true;
+		} else if (compute_stats) {
 			if (gdal_stats) {
 				double mn, mx, av=-9999, sd=-9999;
 				//int approx = gdal_approx;
@@ -608,6 +918,15 @@ bool SpatRaster::writeStopGDAL() {
 		GDALDataset *newDS;
 		GDALDriver *poDriver;
 		char **papszOptions = set_GDAL_options(copy_driver, 0.0, false, gdal_options);
+		if (copy_driver == "COG") {
+			if (streamed_ovr) {
+				papszOptions = CSLSetNameValue(papszOptions, "OVERVIEWS", "FORCE_USE_EXISTING");
+			}
+			if (gdal_option(gdal_options, "NUM_THREADS") == "") {
+				papszOptions = CSLSetNameValue(papszOptions, "NUM_THREADS", "ALL_CPUS");
+			}
+		}
+		wstream.reset();
 		poDriver = GetGDALDriverManager()->GetDriverByName(copy_driver.c_str());
 		if (copy_filename == "") {
 			newDS = poDriver->CreateCopy(source[0].filename.c_str(),
@@ -645,13 +964,17 @@ bool SpatRaster::writeStopGDAL() {
 				return false;	
 			}
 			copy_driver = "";
-			copy_filename = "";
 			GDALClose( (GDALDatasetH) oldDS );
 			GDALClose( (GDALDatasetH) newDS );
+			remove(copy_filename.c_str());
+			std::string aux = copy_filename + ".aux.xml";
+			remove(aux.c_str());
+			copy_filename = "";
 		}
 	} else {
 		GDALClose( (GDALDatasetH) source[0].gdalconnection );
 	}
+	wstream.reset();
 	source[0].hasValues = true;
 	return true;
 }
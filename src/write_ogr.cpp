@@ -37,7 +37,7 @@ bool SpatVector::ogr_geoms(std::vector<OGRGeometryH> &ogrgeoms, std::string &	me
 //    char **papszMetadata;
 
 	OGRwkbGeometryType wkb;
-	SpatGeomType geomtype = geoms[0].gtype;
+	SpatGeomType geomtype = geoms.gtype();
 	if (geomtype == points) {
 		wkb = wkbPoint;
 	} else if (geomtype == lines) {
@@ -211,7 +211,7 @@ GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, st
     }
 
 	OGRwkbGeometryType wkb;
-	SpatGeomType geomtype = geoms[0].gtype;
+	SpatGeomType geomtype = geoms.gtype();
 	if (geomtype == points) {
 		wkb = wkbPoint;
 	} else if (geomtype == lines) {